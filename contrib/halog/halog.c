@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <time.h>
+#include <stddef.h>
+#include <arpa/inet.h>
 
 #include <eb32tree.h>
 #include <eb64tree.h>
@@ -73,6 +75,63 @@ struct url_stat {
 	unsigned int nb_err, nb_req;
 };
 
+/* Binary access log records, as emitted by haproxy with "option binlog" : a
+ * magic byte, a type byte, the body length as a varint, the body and a
+ * trailer byte. Name records announce the proxy and server names, access
+ * records only reference them by their IDs.
+ */
+#define BINLOG_MAGIC      0xFE
+#define BINLOG_TRAILER    0xFF
+#define BINLOG_T_ACCESS   'R'
+#define BINLOG_T_NAME     'N'
+
+#define BINLOG_F_HTTP     0x01
+#define BINLOG_F_IPV4     0x02
+#define BINLOG_F_IPV6     0x04
+#define BINLOG_F_APPLET   0x08
+#define BINLOG_F_REDISP   0x10
+#define BINLOG_F_ASAP     0x20
+
+#define BINLOG_N_PROXY    1
+#define BINLOG_N_SERVER   2
+
+#define BINLOG_MAX_BODY   65536
+#define BINLOG_BUFSIZE    (1 << 20)
+
+struct binlog_rec {
+	unsigned int flags;
+	unsigned int date, ms;            /* accept date */
+	unsigned int fe, be, srv;         /* frontend, backend and server IDs */
+	int status;
+	char tsc[4];                      /* termination state and cookie codes */
+	unsigned char addr[16];           /* client address and port */
+	unsigned int port;
+	const char *applet;               /* applet name when BINLOG_F_APPLET */
+	int applet_len;
+	int th, ti;                       /* handshake and idle times */
+	int t[5];                         /* TR/Tw/Tc/Tr/Ta, like in text logs */
+	unsigned long long bytes_out, bytes_in;
+	unsigned int ac, fc, bc, sc, rc, sq, bq;
+	const char *req;                  /* request line */
+	int req_len;
+};
+
+/* proxy or server name, indexed by (proxy ID << 32) + server ID */
+struct binlog_name {
+	struct eb64_node node;
+	char name[0];
+};
+
+/* per-server stats of binary logs, indexed like the names since those may
+ * only be known later. Applets are indexed by a hash of their name instead
+ * of a server ID.
+ */
+struct binlog_srv {
+	struct eb64_node node;
+	struct srv_st *srv;
+	char applet[65];
+};
+
 #define FILT_COUNT_ONLY		0x01
 #define FILT_INVERT		0x02
 #define FILT_QUIET		0x04
@@ -118,6 +177,7 @@ struct url_stat {
 #define FILT_COUNT_IP_COUNT   0x80000000
 
 #define FILT2_TIMESTAMP	0x01
+#define FILT2_BINARY	0x02
 
 unsigned int filter = 0;
 unsigned int filter2 = 0;
@@ -140,6 +200,13 @@ void filter_graphs(const char *accept_field, const char *time_field, struct time
 void filter_output_line(const char *accept_field, const char *time_field, struct timer **tptr);
 void filter_accept_holes(const char *accept_field, const char *time_field, struct timer **tptr);
 
+void binlog_read(void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr),
+		 const char *filter_term_code_name, int filter_time_resp,
+		 int filt_http_status_low, int filt_http_status_high,
+		 unsigned int filt2_timestamp_low, unsigned int filt2_timestamp_high,
+		 struct timer **tptr);
+void binlog_resolve_servers();
+
 void usage(FILE *output, const char *msg)
 {
 	fprintf(output,
@@ -148,7 +215,8 @@ void usage(FILE *output, const char *msg)
 		"       halog [-q] [-c] [-m <lines>]\n"
 		"       {-cc|-gt|-pct|-st|-tc|-srv|-u|-uc|-ue|-ua|-ut|-uao|-uto|-uba|-ubt|-ic}\n"
 		"       [-s <skip>] [-e|-E] [-H] [-rt|-RT <time>] [-ad <delay>] [-ac <count>]\n"
-		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ] [ -time [min][:[max]] ] < log\n"
+		"       [-v] [-Q|-QS] [-tcn|-TCN <termcode>] [ -hs|-HS [min][:[max]] ] [ -time [min][:[max]] ]\n"
+		"       [-b] < log\n"
 		"\n",
 		msg ? msg : ""
 		);
@@ -182,6 +250,7 @@ void help()
 	       " -m <lines>              limit output to the first <lines> lines\n"
                " -s <skip_n_fields>      skip n fields from the beginning of a line (default %d)\n"
                "                         you can also use -n to start from earlier then field %d\n"
+	       " -b                      read binary records (\"option binlog\") instead of text\n"
                "\n"
 	       "Output filters - only one may be used at a time\n"
 	       " -c    only report the number of lines that would have been printed\n"
@@ -413,6 +482,127 @@ struct timer *insert_value(struct eb_root *r, struct timer **alloc, int v)
 	return container_of(n, struct timer, node);
 }
 
+/* Accounts one request to key <key> (URL or source address) in timers[0],
+ * with error count <err>, times <ttot> and <tok> (OK requests only), and
+ * <bytes> bytes sent. The key is duplicated when it is not yet in the tree.
+ */
+void count_url_key(char *key, int err, int ttot, int tok, long long bytes)
+{
+	static struct url_stat *ustat;
+	struct ebpt_node *ebpt_old;
+
+	if (unlikely(!ustat))
+		ustat = calloc(1, sizeof(*ustat));
+
+	ustat->nb_err = err;
+	ustat->nb_req = 1;
+	ustat->total_time = ttot;
+	ustat->total_time_ok = tok;
+	ustat->total_bytes_sent = bytes;
+
+	/* now instead of copying the key for a simple lookup, we'll link
+	 * to it from the node we're trying to insert. If it returns a
+	 * different value, it was already there. Otherwise we just have
+	 * to dynamically realloc an entry using strdup().
+	 */
+	ustat->node.url.key = key;
+	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
+
+	if (ebpt_old != &ustat->node.url) {
+		struct url_stat *ustat_old;
+		/* node was already there, let's update previous one */
+		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
+		ustat_old->nb_req ++;
+		ustat_old->nb_err += ustat->nb_err;
+		ustat_old->total_time += ustat->total_time;
+		ustat_old->total_time_ok += ustat->total_time_ok;
+		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
+	} else {
+		ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
+		ustat = NULL; /* node was used */
+	}
+}
+
+/* Accounts the connect and response times found in the 5 timers of <array>
+ * (<err> being set if any of them is negative) and the HTTP status class <st>
+ * (1 to 5, or 0 for invalid ones) to server <srv>.
+ */
+void count_srv_st(struct srv_st *srv, const int *array, int err, int st)
+{
+	if (!err)
+		srv->nb_ok++;
+
+	if (array[2] >= 0) {
+		srv->cum_ct += array[2];
+		srv->nb_ct++;
+	}
+
+	if (array[3] >= 0) {
+		srv->cum_rt += array[3];
+		srv->nb_rt++;
+	}
+
+	srv->st_cnt[st]++;
+}
+
+/* Inserts the 5 timers of <array> into the timer trees for -gt and -pct,
+ * <err> being set if any of them is negative.
+ */
+void count_timers(int *array, int err, struct timer **tptr)
+{
+	struct timer *t2;
+
+	/* if we find at least one negative time, we count one error
+	 * with a time equal to the total session time. This will
+	 * emphasize quantum timing effects associated to known
+	 * timeouts. Note that on some buggy machines, it is possible
+	 * that the total time is negative, hence the reason to reset
+	 * it.
+	 */
+
+	if (filter & FILT_GRAPH_TIMERS) {
+		if (err) {
+			if (array[4] < 0)
+				array[4] = -1;
+			t2 = insert_timer(&timers[0], tptr, array[4]);  // total time
+			t2->count++;
+		} else {
+			int v;
+
+			t2 = insert_timer(&timers[1], tptr, array[0]); t2->count++;  // req
+			t2 = insert_timer(&timers[2], tptr, array[2]); t2->count++;  // conn
+			t2 = insert_timer(&timers[3], tptr, array[3]); t2->count++;  // resp
+
+			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
+			if (v < 0 && !(filter & FILT_QUIET))
+				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
+					line, array[0], array[1], array[2], array[3], array[4], v);
+			t2 = insert_timer(&timers[4], tptr, v); t2->count++;
+			lines_out++;
+		}
+	} else { /* percentile */
+		if (err) {
+			if (array[4] < 0)
+				array[4] = -1;
+			t2 = insert_value(&timers[0], tptr, array[4]);  // total time
+			t2->count++;
+		} else {
+			int v;
+
+			t2 = insert_value(&timers[1], tptr, array[0]); t2->count++;  // req
+			t2 = insert_value(&timers[2], tptr, array[2]); t2->count++;  // conn
+			t2 = insert_value(&timers[3], tptr, array[3]); t2->count++;  // resp
+
+			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
+			if (v < 0 && !(filter & FILT_QUIET))
+				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
+					line, array[0], array[1], array[2], array[3], array[4], v);
+			t2 = insert_value(&timers[4], tptr, v); t2->count++;
+			lines_out++;
+		}
+	}
+}
+
 int str2ic(const char *s)
 {
 	int i = 0;
@@ -833,6 +1023,8 @@ int main(int argc, char **argv)
 			filter |= FILT_COUNT_URL_BTOT;
 		else if (strcmp(argv[0], "-ic") == 0)
 			filter |= FILT_COUNT_IP_COUNT;
+		else if (strcmp(argv[0], "-b") == 0)
+			filter2 |= FILT2_BINARY;
 		else if (strcmp(argv[0], "-o") == 0) {
 			if (output_file)
 				die("Fatal: output file name already specified.\n");
@@ -884,6 +1076,14 @@ int main(int argc, char **argv)
 	posix_fadvise(0, 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
+	if (filter2 & FILT2_BINARY) {
+		/* binary records are decoded and filtered on their own */
+		binlog_read(line_filter, filter_term_code_name, filter_time_resp,
+			    filt_http_status_low, filt_http_status_high,
+			    filt2_timestamp_low, filt2_timestamp_high, &t);
+		goto skip_filters;
+	}
+
 	if (!line_filter && /* FILT_COUNT_ONLY ( see above), and no input filter (see below) */
 	    !(filter & (FILT_HTTP_ONLY|FILT_TIME_RESP|FILT_ERRORS_ONLY|FILT_HTTP_STATUS|FILT_QUEUE_ONLY|FILT_QUEUE_SRV_ONLY|FILT_TERM_CODE_NAME)) &&
 		!(filter2 & (FILT2_TIMESTAMP))) {
@@ -1203,6 +1403,9 @@ int main(int argc, char **argv)
 		struct ebmb_node *srv_node;
 		struct srv_st *srv;
 
+		if (filter2 & FILT2_BINARY)
+			binlog_resolve_servers();
+
 		printf("#srv_name 1xx 2xx 3xx 4xx 5xx other tot_req req_ok pct_ok avg_ct avg_rt\n");
 
 		srv_node = ebmb_first(&timers[0]);
@@ -1466,20 +1669,6 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 		return;
 	}
 
-	/* OK we have our timers in array[2,3] */
-	if (!err)
-		srv->nb_ok++;
-
-	if (array[2] >= 0) {
-		srv->cum_ct += array[2];
-		srv->nb_ct++;
-	}
-
-	if (array[3] >= 0) {
-		srv->cum_rt += array[3];
-		srv->nb_rt++;
-	}
-
 	/* we're interested in the 5 HTTP status classes (1xx ... 5xx), and
 	 * the invalid ones which will be reported as 0.
 	 */
@@ -1493,13 +1682,12 @@ void filter_count_srv_status(const char *accept_field, const char *time_field, s
 	if (*b >= '1' && *b <= '5')
 		val = *b - '0';
 
-	srv->st_cnt[val]++;
+	/* OK we have our timers in array[2,3] */
+	count_srv_st(srv, array, err, val);
 }
 
 void filter_count_url(const char *accept_field, const char *time_field, struct timer **tptr)
 {
-	struct url_stat *ustat = NULL;
-	struct ebpt_node *ebpt_old;
 	const char *b, *e;
 	int f, err, array[5];
 	int val;
@@ -1534,21 +1722,10 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 
 	/* OK we have our timers in array[3], and err is >0 if at
 	 * least one -1 was seen. <e> points to the first char of
-	 * the last timer. Let's prepare a new node with that.
+	 * the last timer.
 	 */
-	if (unlikely(!ustat))
-		ustat = calloc(1, sizeof(*ustat));
-
-	ustat->nb_err = err;
-	ustat->nb_req = 1;
-
-	/* use array[4] = total time in case of error */
-	ustat->total_time = (array[3] >= 0) ? array[3] : array[4];
-	ustat->total_time_ok = (array[3] >= 0) ? array[3] : 0;
-
 	e = field_start(e, BYTES_SENT_FIELD - TIME_FIELD + 1);
 	val = str2ic(e);
-	ustat->total_bytes_sent = val;
 
 	/* the line may be truncated because of a bad request or anything like this,
 	 * without a method. Also, if it does not begin with an quote, let's skip to
@@ -1565,7 +1742,6 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 
 	if (unlikely(!*e)) {
 		truncated_line(linenum, line);
-		free(ustat);
 		return;
 	}
 
@@ -1583,33 +1759,13 @@ void filter_count_url(const char *accept_field, const char *time_field, struct t
 		e++;
 	} while (*e);
 
-	/* now instead of copying the URL for a simple lookup, we'll link
-	 * to it from the node we're trying to insert. If it returns a
-	 * different value, it was already there. Otherwise we just have
-	 * to dynamically realloc an entry using strdup().
-	 */
-	ustat->node.url.key = (char *)b;
-	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
-
-	if (ebpt_old != &ustat->node.url) {
-		struct url_stat *ustat_old;
-		/* node was already there, let's update previous one */
-		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
-		ustat_old->nb_req ++;
-		ustat_old->nb_err += ustat->nb_err;
-		ustat_old->total_time += ustat->total_time;
-		ustat_old->total_time_ok += ustat->total_time_ok;
-		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
-	} else {
-		ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
-		ustat = NULL; /* node was used */
-	}
+	/* use array[4] = total time in case of error */
+	count_url_key((char *)b, err, (array[3] >= 0) ? array[3] : array[4],
+		      (array[3] >= 0) ? array[3] : 0, val);
 }
 
 void filter_count_ip(const char *source_field, const char *accept_field, const char *time_field, struct timer **tptr)
 {
-	struct url_stat *ustat = NULL;
-	struct ebpt_node *ebpt_old;
 	const char *b, *e;
 	int f, err, array[5];
 	int val;
@@ -1646,21 +1802,10 @@ void filter_count_ip(const char *source_field, const char *accept_field, const c
 
 	/* OK we have our timers in array[0], and err is >0 if at
 	 * least one -1 was seen. <e> points to the first char of
-	 * the last timer. Let's prepare a new node with that.
+	 * the last timer.
 	 */
-	if (unlikely(!ustat))
-		ustat = calloc(1, sizeof(*ustat));
-
-	ustat->nb_err = err;
-	ustat->nb_req = 1;
-
-	/* use array[4] = total time in case of error */
-	ustat->total_time = (array[0] >= 0) ? array[0] : array[4];
-	ustat->total_time_ok = (array[0] >= 0) ? array[0] : 0;
-
 	e = field_start(e, BYTES_SENT_FIELD - TIME_FIELD + 1);
 	val = str2ic(e);
-	ustat->total_bytes_sent = val;
 
 	/* the source might be IPv4 or IPv6, so we always strip the port by
 	 * removing the last colon.
@@ -1671,33 +1816,15 @@ void filter_count_ip(const char *source_field, const char *accept_field, const c
 		e--;
 	*(char *)(e - 1) = '\0';
 
-	/* now instead of copying the src for a simple lookup, we'll link
-	 * to it from the node we're trying to insert. If it returns a
-	 * different value, it was already there. Otherwise we just have
-	 * to dynamically realloc an entry using strdup(). We're using the
+	/* use array[4] = total time in case of error. We're using the
 	 * <url> field of the node to store the source address.
 	 */
-	ustat->node.url.key = (char *)b;
-	ebpt_old = ebis_insert(&timers[0], &ustat->node.url);
-
-	if (ebpt_old != &ustat->node.url) {
-		struct url_stat *ustat_old;
-		/* node was already there, let's update previous one */
-		ustat_old = container_of(ebpt_old, struct url_stat, node.url);
-		ustat_old->nb_req ++;
-		ustat_old->nb_err += ustat->nb_err;
-		ustat_old->total_time += ustat->total_time;
-		ustat_old->total_time_ok += ustat->total_time_ok;
-		ustat_old->total_bytes_sent += ustat->total_bytes_sent;
-	} else {
-		ustat->url = ustat->node.url.key = strdup(ustat->node.url.key);
-		ustat = NULL; /* node was used */
-	}
+	count_url_key((char *)b, err, (array[0] >= 0) ? array[0] : array[4],
+		      (array[0] >= 0) ? array[0] : 0, val);
 }
 
 void filter_graphs(const char *accept_field, const char *time_field, struct timer **tptr)
 {
-	struct timer *t2;
 	const char *p;
 	int f, err, array[5];
 
@@ -1731,57 +1858,624 @@ void filter_graphs(const char *accept_field, const char *time_field, struct time
 		return;
 	}
 
-	/* if we find at least one negative time, we count one error
-	 * with a time equal to the total session time. This will
-	 * emphasize quantum timing effects associated to known
-	 * timeouts. Note that on some buggy machines, it is possible
-	 * that the total time is negative, hence the reason to reset
-	 * it.
+	count_timers(array, err, tptr);
+}
+
+/* Binary records ("option binlog") are read by blocks and decoded in place.
+ * Names are collected as they are announced and only resolved when printing,
+ * so that records appearing before their names are still accounted for.
+ */
+static unsigned char *binlog_buf;
+static size_t binlog_len, binlog_pos;
+static int binlog_eof;
+static struct eb_root binlog_names = EB_ROOT_UNIQUE;
+static struct eb_root binlog_srvs = EB_ROOT_UNIQUE;
+
+static const char binlog_months[12][4] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static inline unsigned int binlog_read16(const unsigned char *p)
+{
+	return p[0] + (p[1] << 8);
+}
+
+static inline unsigned int binlog_read32(const unsigned char *p)
+{
+	return p[0] + (p[1] << 8) + (p[2] << 16) + ((unsigned int)p[3] << 24);
+}
+
+/* Decodes a varint encoded like haproxy's encode_varint() from <*p> into <v>
+ * without reading past <end>. Returns 0 if it is truncated.
+ */
+static inline int binlog_varint(const unsigned char **p, const unsigned char *end,
+				unsigned long long *v)
+{
+	const unsigned char *q = *p;
+	int r;
+
+	if (q >= end)
+		return 0;
+
+	*v = *q++;
+	if (*v >= 240) {
+		r = 4;
+		do {
+			if (q >= end)
+				return 0;
+			*v += (unsigned long long)*q << r;
+			r += 7;
+		} while (*q++ >= 128);
+	}
+	*p = q;
+	return 1;
+}
+
+/* Returns the type of the next valid record from stdin and sets <*body> and
+ * <*len> to its body, or returns 0 at the end of the input. Anything between
+ * records (line feeds, syslog headers) is skipped, as well as the invalid
+ * records which are reported as parsing errors.
+ */
+static int binlog_next(const unsigned char **body, size_t *len)
+{
+	const unsigned char *p, *b, *end;
+	unsigned long long l;
+	ssize_t ret;
+
+	if (unlikely(!binlog_buf)) {
+		binlog_buf = malloc(BINLOG_BUFSIZE);
+		if (!binlog_buf) {
+			fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+			exit(1);
+		}
+	}
+
+	while (1) {
+		/* always keep enough room for the largest record */
+		if (binlog_len - binlog_pos < BINLOG_MAX_BODY + 16 && !binlog_eof) {
+			memmove(binlog_buf, binlog_buf + binlog_pos, binlog_len - binlog_pos);
+			binlog_len -= binlog_pos;
+			binlog_pos = 0;
+			while (binlog_len < BINLOG_BUFSIZE && !binlog_eof) {
+				ret = read(0, binlog_buf + binlog_len, BINLOG_BUFSIZE - binlog_len);
+				if (ret > 0)
+					binlog_len += ret;
+				else if (ret == 0 || errno != EINTR)
+					binlog_eof = 1;
+			}
+		}
+
+		/* records are usually contiguous or separated by a line feed */
+		end = binlog_buf + binlog_len;
+		p = binlog_buf + binlog_pos;
+		if (p < end && *p == '\n')
+			p++;
+		if (p >= end || *p != BINLOG_MAGIC)
+			p = memchr(p, BINLOG_MAGIC, end - p);
+		if (!p) {
+			binlog_pos = binlog_len;
+			if (binlog_eof)
+				return 0;
+			continue;
+		}
+
+		binlog_pos = p - binlog_buf;
+		b = p + 2;
+		if (end - p < 4 || (p[1] != BINLOG_T_ACCESS && p[1] != BINLOG_T_NAME) ||
+		    !binlog_varint(&b, end, &l) || l > BINLOG_MAX_BODY ||
+		    l >= end - b || b[l] != BINLOG_TRAILER) {
+			/* not a record or a truncated one */
+			parse_err++;
+			binlog_pos++;
+			continue;
+		}
+
+		binlog_pos = b + l + 1 - binlog_buf;
+		*body = b;
+		*len = l;
+		return p[1];
+	}
+}
+
+/* Records the proxy or server name announced in name record <p> of <len>
+ * bytes. A name announced again for the same IDs replaces the previous one.
+ */
+static void binlog_add_name(const unsigned char *p, size_t len)
+{
+	struct binlog_name *name;
+	struct eb64_node *node;
+	unsigned long long key;
+
+	if (len < 9 || (p[0] != BINLOG_N_PROXY && p[0] != BINLOG_N_SERVER)) {
+		parse_err++;
+		return;
+	}
+
+	key = ((unsigned long long)binlog_read32(p + 1) << 32) + binlog_read32(p + 5);
+	len -= 9;
+
+	node = eb64_lookup(&binlog_names, key);
+	if (node) {
+		name = container_of(node, struct binlog_name, node);
+		if (strlen(name->name) == len && memcmp(name->name, p + 9, len) == 0)
+			return;
+		eb64_delete(node);
+		free(name);
+	}
+
+	name = malloc(sizeof(*name) + len + 1);
+	if (!name) {
+		fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+		exit(1);
+	}
+	memcpy(name->name, p + 9, len);
+	name->name[len] = 0;
+	name->node.key = key;
+	eb64_insert(&binlog_names, &name->node);
+}
+
+/* Returns the name of proxy <px>, or of its server <srv> if not zero, or
+ * "#<id>" if it was not announced. The result may be overwritten by the
+ * fourth next call.
+ */
+static const char *binlog_get_name(unsigned int px, unsigned int srv)
+{
+	static char buf[4][16];
+	static int idx;
+	struct eb64_node *node;
+
+	node = eb64_lookup(&binlog_names, ((unsigned long long)px << 32) + srv);
+	if (node)
+		return container_of(node, struct binlog_name, node)->name;
+
+	idx = (idx + 1) & 3;
+	snprintf(buf[idx], sizeof(buf[idx]), "#%u", srv ? srv : px);
+	return buf[idx];
+}
+
+/* Decodes access record <p> ending at <end> into <rec>. Returns 0 if it is
+ * invalid. Fields added after the request line by future versions are
+ * ignored.
+ */
+static int binlog_parse_access(const unsigned char *p, const unsigned char *end,
+			       struct binlog_rec *rec)
+{
+	unsigned long long v[17];
+	int i;
+
+	if (end - p < 25)
+		return 0;
+
+	rec->flags  = p[0];
+	rec->date   = binlog_read32(p + 1);
+	rec->ms     = binlog_read16(p + 5);
+	rec->fe     = binlog_read32(p + 7);
+	rec->be     = binlog_read32(p + 11);
+	rec->srv    = binlog_read32(p + 15);
+	rec->status = (short)binlog_read16(p + 19);
+	memcpy(rec->tsc, p + 21, 4);
+	p += 25;
+
+	if (rec->flags & BINLOG_F_IPV4) {
+		if (end - p < 6)
+			return 0;
+		memcpy(rec->addr, p, 4);
+		rec->port = binlog_read16(p + 4);
+		p += 6;
+	}
+	else if (rec->flags & BINLOG_F_IPV6) {
+		if (end - p < 18)
+			return 0;
+		memcpy(rec->addr, p, 16);
+		rec->port = binlog_read16(p + 16);
+		p += 18;
+	}
+
+	rec->applet_len = 0;
+	if (rec->flags & BINLOG_F_APPLET) {
+		if (!binlog_varint(&p, end, &v[0]) || v[0] > end - p || v[0] > 64)
+			return 0;
+		rec->applet = (const char *)p;
+		rec->applet_len = v[0];
+		p += v[0];
+	}
+
+	/* Th, Ti, TR, Tw, Tc, Tr, Ta, bytes out and in, ac, fc, bc, sc, rc,
+	 * sq, bq and the length of the request line.
 	 */
+	for (i = 0; i < 17; i++)
+		if (!binlog_varint(&p, end, &v[i]))
+			return 0;
+
+	rec->th = (int)v[0] - 1;
+	rec->ti = (int)v[1] - 1;
+	for (i = 0; i < 5; i++)
+		rec->t[i] = (int)v[i + 2] - 1;
+	rec->bytes_out = v[7];
+	rec->bytes_in  = v[8];
+	rec->ac = v[9];
+	rec->fc = v[10];
+	rec->bc = v[11];
+	rec->sc = v[12];
+	rec->rc = v[13];
+	rec->sq = v[14];
+	rec->bq = v[15];
+
+	if (v[16] > end - p)
+		return 0;
+	rec->req = (const char *)p;
+	rec->req_len = v[16];
+	return 1;
+}
 
-	if (filter & FILT_GRAPH_TIMERS) {
-		if (err) {
-			if (array[4] < 0)
-				array[4] = -1;
-			t2 = insert_timer(&timers[0], tptr, array[4]);  // total time
-			t2->count++;
-		} else {
-			int v;
+/* returns the broken down local time of date <date>, cached per second */
+static const struct tm *binlog_localtime(unsigned int date)
+{
+	static struct tm tm;
+	static time_t last = -1;
+	time_t t = date;
 
-			t2 = insert_timer(&timers[1], tptr, array[0]); t2->count++;  // req
-			t2 = insert_timer(&timers[2], tptr, array[2]); t2->count++;  // conn
-			t2 = insert_timer(&timers[3], tptr, array[3]); t2->count++;  // resp
+	if (t != last) {
+		localtime_r(&t, &tm);
+		last = t;
+	}
+	return &tm;
+}
 
-			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
-			if (v < 0 && !(filter & FILT_QUIET))
-				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
-					line, array[0], array[1], array[2], array[3], array[4], v);
-			t2 = insert_timer(&timers[4], tptr, v); t2->count++;
-			lines_out++;
+/* Writes the <len> bytes of request line <req> to <out>, encoding the same
+ * characters as haproxy does in text logs as "#XX".
+ */
+static void binlog_put_req(FILE *out, const char *req, int len)
+{
+	const char *p = req, *end = req + len;
+	unsigned char c;
+
+	for (; p < end; p++) {
+		c = *p;
+		if (c < 32 || c >= 127 || c == '"' || c == '#') {
+			fwrite(req, 1, p - req, out);
+			fprintf(out, "#%02X", c);
+			req = p + 1;
 		}
-	} else { /* percentile */
-		if (err) {
-			if (array[4] < 0)
-				array[4] = -1;
-			t2 = insert_value(&timers[0], tptr, array[4]);  // total time
-			t2->count++;
-		} else {
-			int v;
+	}
+	fwrite(req, 1, p - req, out);
+}
 
-			t2 = insert_value(&timers[1], tptr, array[0]); t2->count++;  // req
-			t2 = insert_value(&timers[2], tptr, array[2]); t2->count++;  // conn
-			t2 = insert_value(&timers[3], tptr, array[3]); t2->count++;  // resp
+/* Prints record <rec> like the default HTTP or TCP log formats, without the
+ * syslog header nor the captures.
+ */
+static void binlog_output_line(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	const struct tm *tm = binlog_localtime(rec->date);
+	const char *asap = (rec->flags & BINLOG_F_ASAP) ? "+" : "";
+	char addr[INET6_ADDRSTRLEN];
+	char srv[80];
+	int tt;
+
+	if (rec->flags & BINLOG_F_IPV4)
+		printf("%s:%u", inet_ntop(AF_INET, rec->addr, addr, sizeof(addr)), rec->port);
+	else if (rec->flags & BINLOG_F_IPV6)
+		printf("%s:%u", inet_ntop(AF_INET6, rec->addr, addr, sizeof(addr)), rec->port);
+	else
+		printf("unix:-");
 
-			v = array[4] - array[0] - array[1] - array[2] - array[3]; // data time
-			if (v < 0 && !(filter & FILT_QUIET))
-				fprintf(stderr, "ERR: %s (%d %d %d %d %d => %d)\n",
-					line, array[0], array[1], array[2], array[3], array[4], v);
-			t2 = insert_value(&timers[4], tptr, v); t2->count++;
-			lines_out++;
+	if (rec->flags & BINLOG_F_APPLET)
+		snprintf(srv, sizeof(srv), "%.*s", rec->applet_len, rec->applet);
+	else
+		snprintf(srv, sizeof(srv), "%s", rec->srv ? binlog_get_name(rec->be, rec->srv) : "<NOSRV>");
+
+	printf(" [%02d/%s/%04d:%02d:%02d:%02d.%03u] %s %s/%s ",
+	       tm->tm_mday, binlog_months[tm->tm_mon], tm->tm_year + 1900,
+	       tm->tm_hour, tm->tm_min, tm->tm_sec, rec->ms,
+	       binlog_get_name(rec->fe, 0), binlog_get_name(rec->be, 0), srv);
+
+	if (rec->flags & BINLOG_F_HTTP) {
+		printf("%d/%d/%d/%d/%s%d %d %s%llu - - %.4s %u/%u/%u/%u/%s%u %u/%u \"",
+		       rec->t[0], rec->t[1], rec->t[2], rec->t[3], asap, rec->t[4],
+		       rec->status, asap, rec->bytes_out, rec->tsc,
+		       rec->ac, rec->fc, rec->bc, rec->sc,
+		       (rec->flags & BINLOG_F_REDISP) ? "+" : "", rec->rc, rec->sq, rec->bq);
+		binlog_put_req(stdout, rec->req, rec->req_len);
+		printf("\"\n");
+	}
+	else {
+		tt = rec->t[4] + (rec->ti >= 0 ? rec->ti + rec->th : 0);
+		printf("%d/%d/%s%d %s%llu %.2s %u/%u/%u/%u/%s%u %u/%u\n",
+		       rec->t[1], rec->t[2], asap, tt, asap, rec->bytes_out, rec->tsc,
+		       rec->ac, rec->fc, rec->bc, rec->sc,
+		       (rec->flags & BINLOG_F_REDISP) ? "+" : "", rec->rc, rec->sq, rec->bq);
+	}
+	lines_out++;
+}
+
+static void binlog_accept_holes(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	const struct tm *tm = binlog_localtime(rec->date);
+	struct timer *t2;
+
+	t2 = insert_value(&timers[0], tptr, ((tm->tm_hour * 60 + tm->tm_min) * 60 + tm->tm_sec) * 1000 + rec->ms);
+	t2->count++;
+}
+
+static void binlog_count_status(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	struct timer *t2;
+
+	t2 = insert_value(&timers[0], tptr, rec->status);
+	t2->count++;
+}
+
+static void binlog_count_cook_codes(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	struct timer *t2;
+
+	t2 = insert_value(&timers[0], tptr, 256 * rec->tsc[2] + rec->tsc[3]);
+	t2->count++;
+}
+
+static void binlog_count_term_codes(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	struct timer *t2;
+
+	t2 = insert_value(&timers[0], tptr, 256 * rec->tsc[0] + rec->tsc[1]);
+	t2->count++;
+}
+
+static void binlog_count_srv_status(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	struct binlog_srv *bsrv;
+	struct eb64_node *node;
+	unsigned long long key;
+	unsigned int hash = 0;
+	int i;
+
+	key = (unsigned long long)rec->be << 32;
+	if (rec->flags & BINLOG_F_APPLET) {
+		for (i = 0; i < rec->applet_len; i++)
+			hash = hash * 31 + (unsigned char)rec->applet[i];
+		key += 0x80000000U | hash;
+	}
+	else
+		key += rec->srv;
+
+	node = eb64_lookup(&binlog_srvs, key);
+	if (node)
+		bsrv = container_of(node, struct binlog_srv, node);
+	else {
+		bsrv = calloc(1, sizeof(*bsrv));
+		if (bsrv)
+			bsrv->srv = calloc(1, sizeof(*bsrv->srv));
+		if (!bsrv || !bsrv->srv) {
+			fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+			exit(1);
+		}
+		if (rec->flags & BINLOG_F_APPLET)
+			memcpy(bsrv->applet, rec->applet, rec->applet_len);
+		bsrv->node.key = key;
+		eb64_insert(&binlog_srvs, &bsrv->node);
+	}
+
+	count_srv_st(bsrv->srv, array, err,
+		     (rec->status >= 100 && rec->status < 600) ? rec->status / 100 : 0);
+}
+
+/* Moves the per-server stats of binary logs to the tree of server names used
+ * by the text logs, now that all names are known. Stats of servers found
+ * under several IDs are merged.
+ */
+void binlog_resolve_servers()
+{
+	struct eb64_node *node;
+	struct ebmb_node *old;
+	struct binlog_srv *bsrv;
+	struct srv_st *srv, *prev;
+	char name[512];
+	int len, f;
+
+	for (node = eb64_first(&binlog_srvs); node; node = eb64_next(node)) {
+		bsrv = container_of(node, struct binlog_srv, node);
+		len = snprintf(name, sizeof(name), "%s/%s",
+			       binlog_get_name(node->key >> 32, 0),
+			       *bsrv->applet ? bsrv->applet :
+			       (node->key & 0xFFFFFFFFU) ? binlog_get_name(node->key >> 32, node->key) :
+			       "<NOSRV>");
+		if (len >= sizeof(name))
+			len = sizeof(name) - 1;
+
+		srv = malloc(sizeof(*srv) + len + 1);
+		if (!srv) {
+			fprintf(stderr, "%s: not enough memory\n", __FUNCTION__);
+			exit(1);
+		}
+		memcpy(srv, bsrv->srv, offsetof(struct srv_st, node));
+		memcpy(srv->node.key, name, len + 1);
+
+		old = ebst_insert(&timers[0], &srv->node);
+		if (old != &srv->node) {
+			prev = container_of(old, struct srv_st, node);
+			for (f = 0; f <= 5; f++)
+				prev->st_cnt[f] += srv->st_cnt[f];
+			prev->nb_ct += srv->nb_ct;
+			prev->nb_rt += srv->nb_rt;
+			prev->nb_ok += srv->nb_ok;
+			prev->cum_ct += srv->cum_ct;
+			prev->cum_rt += srv->cum_rt;
+			free(srv);
 		}
 	}
 }
 
+static void binlog_count_url(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	const char *b = rec->req, *e = rec->req + rec->req_len, *p;
+	char url[MAXLINE];
+	int len = 0;
+	unsigned char c;
+
+	/* the URL is the second word of the request line, or the first one if
+	 * there is no other.
+	 */
+	p = memchr(b, ' ', e - b);
+	if (p) {
+		while (p < e && *p == ' ')
+			p++;
+		if (p < e)
+			b = p;
+	}
+
+	/* stop at end of word or first ';' or '?', and encode the characters
+	 * like in text logs.
+	 */
+	for (; b < e && len < sizeof(url) - 4; b++) {
+		c = *b;
+		if (c == ' ' || c == '?' || c == ';')
+			break;
+		if (c < 32 || c >= 127 || c == '"' || c == '#')
+			len += sprintf(url + len, "#%02X", c);
+		else
+			url[len++] = c;
+	}
+	url[len] = 0;
+
+	/* use array[4] = total time in case of error */
+	count_url_key(url, err, (array[3] >= 0) ? array[3] : array[4],
+		      (array[3] >= 0) ? array[3] : 0, rec->bytes_out);
+}
+
+static void binlog_count_ip(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	if (rec->flags & BINLOG_F_IPV4)
+		inet_ntop(AF_INET, rec->addr, addr, sizeof(addr));
+	else if (rec->flags & BINLOG_F_IPV6)
+		inet_ntop(AF_INET6, rec->addr, addr, sizeof(addr));
+	else
+		strcpy(addr, "unix");
+
+	/* only the first and last timers are checked for errors here */
+	err = array[0] < 0 || array[4] < 0;
+
+	/* use array[4] = total time in case of error */
+	count_url_key(addr, err, (array[0] >= 0) ? array[0] : array[4],
+		      (array[0] >= 0) ? array[0] : 0, rec->bytes_out);
+}
+
+static void binlog_graphs(const struct binlog_rec *rec, int *array, int err, struct timer **tptr)
+{
+	count_timers(array, err, tptr);
+}
+
+/* Reads binary records from stdin and applies the same input filters as for
+ * text lines, then the equivalent of <line_filter> to matching records.
+ */
+void binlog_read(void (*line_filter)(const char *accept_field, const char *time_field, struct timer **tptr),
+		 const char *filter_term_code_name, int filter_time_resp,
+		 int filt_http_status_low, int filt_http_status_high,
+		 unsigned int filt2_timestamp_low, unsigned int filt2_timestamp_high,
+		 struct timer **tptr)
+{
+	void (*rec_filter)(const struct binlog_rec *rec, int *array, int err, struct timer **tptr) = NULL;
+	const unsigned char *body;
+	struct binlog_rec rec;
+	int need_timers = 0;
+	int array[5];
+	int f, err, test, type;
+	size_t len;
+
+	/* for the error messages */
+	line = "(binary record)";
+
+	if (filter & FILT_COUNT_IP_COUNT)
+		rec_filter = binlog_count_ip;
+	else if (line_filter == filter_accept_holes)
+		rec_filter = binlog_accept_holes;
+	else if (line_filter == filter_graphs)
+		rec_filter = binlog_graphs;
+	else if (line_filter == filter_count_status)
+		rec_filter = binlog_count_status;
+	else if (line_filter == filter_count_cook_codes)
+		rec_filter = binlog_count_cook_codes;
+	else if (line_filter == filter_count_term_codes)
+		rec_filter = binlog_count_term_codes;
+	else if (line_filter == filter_count_srv_status)
+		rec_filter = binlog_count_srv_status;
+	else if (line_filter == filter_count_url)
+		rec_filter = binlog_count_url;
+	else if (line_filter == filter_output_line)
+		rec_filter = binlog_output_line;
+
+	/* the timers of TCP logs cannot be parsed from text logs */
+	if (rec_filter == binlog_count_ip || rec_filter == binlog_graphs ||
+	    rec_filter == binlog_count_srv_status || rec_filter == binlog_count_url ||
+	    (filter & FILT_TIME_RESP))
+		need_timers = 1;
+
+	while ((type = binlog_next(&body, &len))) {
+		if (type == BINLOG_T_NAME) {
+			binlog_add_name(body, len);
+			continue;
+		}
+
+		linenum++;
+		if (unlikely(!binlog_parse_access(body, body + len, &rec))) {
+			parse_err++;
+			continue;
+		}
+
+		if (need_timers && !(rec.flags & BINLOG_F_HTTP)) {
+			parse_err++;
+			continue;
+		}
+
+		err = 0;
+		for (f = 0; f < 5; f++) {
+			array[f] = rec.t[f];
+			if (array[f] < 0) {
+				array[f] = -1;
+				err = 1;
+			}
+		}
+
+		test = 1;
+
+		if (filter2 & FILT2_TIMESTAMP)
+			test &= (rec.date >= filt2_timestamp_low && rec.date <= filt2_timestamp_high);
+
+		if (filter & FILT_HTTP_ONLY)
+			test &= !!(rec.flags & BINLOG_F_HTTP);
+
+		if (filter & FILT_TIME_RESP)
+			test &= (array[3] >= filter_time_resp) ^ !!(filter & FILT_INVERT_TIME_RESP);
+
+		if (filter & FILT_ERRORS_ONLY)
+			test &= (rec.status < 0 || (rec.status >= 500 && rec.status <= 599)) ^ !!(filter & FILT_INVERT_ERRORS);
+
+		if (filter & FILT_HTTP_STATUS)
+			test &= (rec.status >= filt_http_status_low && rec.status <= filt_http_status_high) ^ !!(filter & FILT_INVERT_HTTP_STATUS);
+
+		if (filter & FILT_QUEUE_SRV_ONLY)
+			test &= rec.sq > 0;
+		else if (filter & FILT_QUEUE_ONLY)
+			test &= rec.sq > 0 || rec.bq > 0;
+
+		if (filter & FILT_TERM_CODE_NAME)
+			test &= (rec.tsc[0] == filter_term_code_name[0] && rec.tsc[1] == filter_term_code_name[1]) ^ !!(filter & FILT_INVERT_TERM_CODE_NAME);
+
+		test ^= filter_invert;
+		if (!test)
+			continue;
+
+		if (rec_filter)
+			rec_filter(&rec, array, err, tptr);
+		else
+			lines_out++; /* FILT_COUNT_ONLY was used, so we're just counting lines */
+		if (lines_max >= 0 && lines_out >= lines_max)
+			break;
+	}
+}
+
 
 /*
  * Local variables:
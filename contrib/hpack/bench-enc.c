@@ -0,0 +1,216 @@
+/*
+ * HPACK encoder benchmark. It encodes a series of typical response header
+ * lists as a single connection would, checks that each header block decodes
+ * back to the original list, and reports the average encoded size and the
+ * encoding time per header field. The table size defaults to 4096, 0 disables
+ * the dynamic table. The policy is "all" or "repeated" (default).
+ *
+ *   usage: bench-enc [table-size [policy [responses]]]
+ *
+ * Build like this :
+ *    gcc -I../../include -I../../ebtree -O2 -g -fno-strict-aliasing -fwrapv \
+ *        -o bench-enc bench-enc.c
+ */
+
+#define HPACK_STANDALONE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <common/chunk.h>
+#include <common/hpack-dec.h>
+#include <common/hpack-enc.h>
+
+#include "../../src/hpack-huff.c"
+#include "../../src/hpack-tbl.c"
+#include "../../src/hpack-dec.c"
+#include "../../src/hpack-enc.c"
+
+#define MAX_HDR_NUM 64
+#define RESP_PER_CONN 100
+
+char trash_buf[65536];
+char tmp_buf[65536];
+char out_buf[65536];
+
+struct buffer trash = { .area = trash_buf, .data = 0, .size = sizeof(trash_buf) };
+struct buffer tmp   = { .area = tmp_buf,   .data = 0, .size = sizeof(tmp_buf)   };
+
+/* static parts of a few typical responses, the dynamic ones are appended */
+static const char *responses[][12] = {
+	{ "content-type", "text/html; charset=utf-8",
+	  "cache-control", "private, max-age=0",
+	  "server", "nginx/1.18.0",
+	  "strict-transport-security", "max-age=31536000; includeSubDomains",
+	  "x-frame-options", "SAMEORIGIN",
+	  NULL },
+	{ "content-type", "application/javascript",
+	  "cache-control", "public, max-age=31536000, immutable",
+	  "server", "nginx/1.18.0",
+	  "vary", "Accept-Encoding",
+	  "content-encoding", "gzip",
+	  NULL },
+	{ "content-type", "image/png",
+	  "cache-control", "public, max-age=86400",
+	  "server", "nginx/1.18.0",
+	  "accept-ranges", "bytes",
+	  "access-control-allow-origin", "*",
+	  NULL },
+	{ "content-type", "application/json",
+	  "cache-control", "no-store",
+	  "server", "nginx/1.18.0",
+	  "x-content-type-options", "nosniff",
+	  "content-security-policy", "default-src 'self'; img-src * data:; script-src 'self' https://cdn.example.com",
+	  NULL },
+};
+
+#define NB_RESP (sizeof(responses) / sizeof(responses[0]))
+
+/* display the message and exit with the code */
+__attribute__((noreturn)) void die(int code, const char *format, ...)
+{
+	va_list args;
+
+	if (format) {
+		va_start(args, format);
+		vfprintf(stderr, format, args);
+		va_end(args);
+	}
+	exit(code);
+}
+
+/* builds the header list of response <num> into <list> using <store> for the
+ * dynamic values, and returns the number of headers.
+ */
+static int build_resp(int num, struct http_hdr *list, char *store)
+{
+	const char **r = responses[num % NB_RESP];
+	int hdr = 0;
+
+	for (; *r; r += 2, hdr++) {
+		list[hdr].n = ist(r[0]);
+		list[hdr].v = ist(r[1]);
+	}
+
+	/* the date changes every 10 responses */
+	list[hdr].n = ist("date");
+	list[hdr++].v = ist2(store, sprintf(store, "Tue, 19 May 2020 09:%02d:%02d GMT", num / 600 % 60, num / 10 % 60));
+	store += 64;
+
+	list[hdr].n = ist("content-length");
+	list[hdr++].v = ist2(store, sprintf(store, "%d", (num * 7919) % 100000));
+	store += 64;
+
+	list[hdr].n = ist("etag");
+	list[hdr++].v = ist2(store, sprintf(store, "\"%08x-%04x\"", num * 2654435761U, (unsigned int)(num % NB_RESP)));
+	store += 64;
+
+	list[hdr].n = ist("x-request-id");
+	list[hdr++].v = ist2(store, sprintf(store, "%016llx", num * 0x9E3779B97F4A7C15ULL));
+	return hdr;
+}
+
+/* encodes the header list <list> of <hdr> entries into <out> */
+static int encode_resp(void *enc, struct buffer *out, const struct http_hdr *list, int hdr)
+{
+	int i;
+
+	out->data = 0;
+#ifdef HPACK_ENC_HASH_SIZE
+	if (!hpack_enc_begin(enc, out))
+		return 0;
+#endif
+	if (!hpack_encode_int_status(out, 200))
+		return 0;
+	for (i = 0; i < hdr; i++) {
+#ifdef HPACK_ENC_HASH_SIZE
+		if (!hpack_enc_header(enc, out, list[i].n, list[i].v))
+			return 0;
+#else
+		if (!hpack_encode_header(out, list[i].n, list[i].v))
+			return 0;
+#endif
+	}
+#ifdef HPACK_ENC_HASH_SIZE
+	hpack_enc_commit(enc);
+#endif
+	return 1;
+}
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	struct pool_head tbl_pool, enc_pool;
+	struct http_hdr list[MAX_HDR_NUM], dec[MAX_HDR_NUM];
+	struct hpack_dht *dht;
+	struct buffer out = { .area = out_buf, .data = 0, .size = sizeof(out_buf) };
+	char store[256];
+	unsigned long long start, enc_ns = 0, bytes = 0, fields = 0, raw = 0;
+	int size = 4096, policy = 1, count = 100000;
+	void *enc = NULL;
+	int num, hdr, i, ret;
+
+	if (argc > 1)
+		size = atoi(argv[1]);
+	if (argc > 2)
+		policy = strcmp(argv[2], "all") != 0;
+	if (argc > 3)
+		count = atoi(argv[3]);
+
+	tbl_pool.size = size > 4096 ? size : 4096;
+	pool_head_hpack_tbl = &tbl_pool;
+	enc_pool.size = 0;
+#ifdef HPACK_ENC_HASH_SIZE
+	enc_pool.size = sizeof(struct hpack_enc);
+	pool_head_hpack_enc = &enc_pool;
+#endif
+	dht = NULL;
+
+	for (num = 0; num < count; num++) {
+		if (num % RESP_PER_CONN == 0) {
+			/* new connection */
+			hpack_dht_free(dht);
+			dht = hpack_dht_alloc();
+#ifdef HPACK_ENC_HASH_SIZE
+			hpack_enc_free(enc);
+			enc = hpack_enc_alloc(size, policy ? HPACK_ENC_POL_REPEATED : HPACK_ENC_POL_ALL);
+#endif
+			if (!dht || (enc_pool.size && !enc))
+				die(1, "cannot allocate tables\n");
+		}
+
+		hdr = build_resp(num, list, store);
+
+		start = now_ns();
+		if (!encode_resp(enc, &out, list, hdr))
+			die(1, "response %d: encoding failed\n", num);
+		enc_ns += now_ns() - start;
+
+		bytes += out.data;
+		fields += hdr + 1;
+		for (i = 0; i < hdr; i++)
+			raw += list[i].n.len + list[i].v.len + 4;
+
+		/* decode it back and compare */
+		ret = hpack_decode_frame(dht, (const uint8_t *)out.area, out.data, dec, MAX_HDR_NUM, &tmp);
+		if (ret != hdr + 2)
+			die(1, "response %d: decoding failed: %d\n", num, ret);
+		for (i = 0; i < hdr; i++) {
+			if (!isteq(dec[i + 1].n, list[i].n) || !isteq(dec[i + 1].v, list[i].v))
+				die(1, "response %d: header %d mismatch\n", num, i);
+		}
+	}
+
+	printf("%d responses, %llu fields: %.2f bytes/field (%.1f%% of HTTP/1), %.1f ns/field\n",
+	       count, fields, (double)bytes / fields, 100.0 * bytes / raw, (double)enc_ns / fields);
+	return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Hash-based load balancing test tool. It builds a backend with the real
+ * map-based, consistent and Maglev hashing code, then reports for each of
+ * them the load variance across servers, the fraction of keys which move when
+ * a server is removed or added, and the lookup time. Optionally keys may be
+ * skewed and the hash-balance-factor applied, each lookup then being counted
+ * as an outstanding request on the selected server.
+ *
+ *   usage: lb-hash [-n servers] [-k keys] [-w] [-z] [-b factor]
+ *     -n : number of servers (default 20)
+ *     -k : number of keys (default 1000000)
+ *     -w : use random weights from 1 to 4 instead of 1
+ *     -z : skew keys (log-uniform distribution) instead of unique keys
+ *     -b : apply a hash-balance-factor (eg: 125)
+ *
+ * Build like this :
+ *    gcc -I../../include -I../../ebtree -O2 -g -fno-strict-aliasing -fwrapv \
+ *        -o lb-hash lb-hash.c ../../ebtree/ebtree.c ../../ebtree/eb32tree.c
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../src/lb_chash.c"
+#include "../../src/lb_map.c"
+#include "../../src/lb_maglev.c"
+
+/* the following ones are normally provided by standard.c, backend.c and
+ * queue.c, the last two are copies of the originals.
+ */
+unsigned int full_hash(unsigned int a)
+{
+	return __full_hash(a);
+}
+
+unsigned int srv_dynamic_maxconn(const struct server *s)
+{
+	return s->maxconn;
+}
+
+void recount_servers(struct proxy *px)
+{
+	struct server *srv;
+
+	px->srv_act = px->srv_bck = 0;
+	px->lbprm.tot_wact = px->lbprm.tot_wbck = 0;
+	px->lbprm.fbck = NULL;
+	for (srv = px->srv; srv != NULL; srv = srv->next) {
+		if (!srv_willbe_usable(srv))
+			continue;
+
+		if (srv->flags & SRV_F_BACKUP) {
+			if (!px->srv_bck &&
+			    !(px->options & PR_O_USE_ALL_BK))
+				px->lbprm.fbck = srv;
+			px->srv_bck++;
+			srv->cumulative_weight = px->lbprm.tot_wbck;
+			px->lbprm.tot_wbck += srv->next_eweight;
+		} else {
+			px->srv_act++;
+			srv->cumulative_weight = px->lbprm.tot_wact;
+			px->lbprm.tot_wact += srv->next_eweight;
+		}
+	}
+}
+
+void update_backend_weight(struct proxy *px)
+{
+	if (px->srv_act) {
+		px->lbprm.tot_weight = px->lbprm.tot_wact;
+		px->lbprm.tot_used   = px->srv_act;
+	}
+	else if (px->lbprm.fbck) {
+		px->lbprm.tot_weight = px->lbprm.fbck->uweight * px->lbprm.wdiv;
+		px->lbprm.tot_used   = 1;
+	}
+	else {
+		px->lbprm.tot_weight = px->lbprm.tot_wbck;
+		px->lbprm.tot_used   = px->srv_bck;
+	}
+}
+
+static const char *algos[] = { "map-based", "consistent", "maglev" };
+
+static int nbsrv = 20, nbkeys = 1000000, weights, skew, factor;
+
+/* returns the hash of the <i>th key */
+static unsigned int key_hash(int i)
+{
+	if (skew)
+		i = (int)pow(nbkeys, (double)full_hash(i) / 4294967296.0);
+	return full_hash(i);
+}
+
+static struct server *lookup(struct proxy *px, int algo, unsigned int hash)
+{
+	struct server *srv;
+
+	if (algo == 0)
+		srv = map_get_server_hash(px, hash);
+	else if (algo == 1)
+		srv = chash_get_server_hash(px, hash, NULL);
+	else
+		srv = maglev_get_server_hash(px, hash, NULL);
+
+	if (srv && factor) {
+		/* the request remains outstanding */
+		srv->served++;
+		px->served++;
+	}
+	return srv;
+}
+
+/* maps all keys to <res> and returns the number of ns per lookup */
+static double map_keys(struct proxy *px, int algo, struct server **res)
+{
+	struct timespec start, stop;
+	struct server *srv;
+	int i;
+
+	for (srv = px->srv; srv; srv = srv->next)
+		srv->served = 0;
+	px->served = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nbkeys; i++)
+		res[i] = lookup(px, algo, key_hash(i));
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	return ((stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec)) / nbkeys;
+}
+
+/* changes the state of server <srv> and lets the LB algo know */
+static void set_srv_state(struct server *srv, int up)
+{
+	srv->next_state = up ? SRV_ST_RUNNING : SRV_ST_STOPPED;
+	if (up)
+		srv->proxy->lbprm.set_server_status_up(srv);
+	else
+		srv->proxy->lbprm.set_server_status_down(srv);
+}
+
+/* returns the fraction of keys which are mapped differently in <a> and <b> */
+static double moved(struct server **a, struct server **b)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nbkeys; i++)
+		n += a[i] != b[i];
+	return (double)n / nbkeys;
+}
+
+int main(int argc, char **argv)
+{
+	struct server **ref, **res, *srv;
+	struct proxy *px;
+	double ns, sum, sum2, dev, max;
+	int algo, opt, i;
+
+	while ((opt = getopt(argc, argv, "n:k:wzb:")) != -1) {
+		switch (opt) {
+		case 'n': nbsrv = atoi(optarg); break;
+		case 'k': nbkeys = atoi(optarg); break;
+		case 'w': weights = 1; break;
+		case 'z': skew = 1; break;
+		case 'b': factor = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n servers] [-k keys] [-w] [-z] [-b factor]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (nbsrv < 2 || nbkeys < 1) {
+		fprintf(stderr, "at least 2 servers and 1 key are needed\n");
+		exit(1);
+	}
+
+	ref = calloc(nbkeys, sizeof(*ref));
+	res = calloc(nbkeys, sizeof(*res));
+	if (!ref || !res)
+		exit(1);
+
+	printf("%d servers, %d %s keys, %s weights, hash-balance-factor %d\n",
+	       nbsrv, nbkeys, skew ? "skewed" : "unique", weights ? "random" : "equal", factor);
+	printf("%-11s %9s %9s %9s %9s %9s %9s %8s\n",
+	       "algo", "load-dev%", "max/avg", "moved-del", "ideal", "moved-add", "ideal", "ns/key");
+
+	for (algo = 0; algo < 3; algo++) {
+		/* the last server is only added once the others were measured */
+		px = calloc(1, sizeof(*px));
+		px->id = "test";
+		px->lbprm.wmult = 1;
+		px->lbprm.wdiv = 1;
+		px->lbprm.hash_balance_factor = factor;
+		srand(1);
+		for (i = nbsrv; i >= 0; i--) {
+			srv = calloc(1, sizeof(*srv));
+			srv->proxy = px;
+			srv->puid = i + 1;
+			srv->uweight = srv->iweight = weights ? 1 + rand() % 4 : 1;
+			srv->cur_state = srv->next_state = (i < nbsrv) ? SRV_ST_RUNNING : SRV_ST_STOPPED;
+			srv->next = px->srv;
+			px->srv = srv;
+		}
+
+		if (algo == 0)
+			init_server_map(px);
+		else if (algo == 1)
+			chash_init_server_tree(px);
+		else if (maglev_init_server_table(px) < 0)
+			exit(1);
+
+		ns = map_keys(px, algo, ref);
+
+		/* load relative to the weight, in percent of the average */
+		sum = sum2 = max = 0;
+		for (srv = px->srv; srv; srv = srv->next) {
+			double load = 0;
+
+			if (srv->next_state != SRV_ST_RUNNING)
+				continue;
+			for (i = 0; i < nbkeys; i++)
+				load += ref[i] == srv;
+			load = load * px->lbprm.tot_weight / srv->cur_eweight / nbkeys;
+			sum += load;
+			sum2 += load * load;
+			if (load > max)
+				max = load;
+		}
+		sum /= nbsrv;
+		dev = sqrt(sum2 / nbsrv - sum * sum) / sum;
+
+		/* remove a server in the middle then put it back */
+		srv = px->srv;
+		for (i = 0; i < nbsrv / 2; i++)
+			srv = srv->next;
+		set_srv_state(srv, 0);
+		map_keys(px, algo, res);
+		printf("%-11s %9.2f %9.3f %9.4f %9.4f ", algos[algo], dev * 100.0, max / sum,
+		       moved(ref, res), (double)srv->cur_eweight / (px->lbprm.tot_weight + srv->cur_eweight));
+		set_srv_state(srv, 1);
+
+		/* add the last server */
+		for (srv = px->srv; srv->next; srv = srv->next)
+			;
+		set_srv_state(srv, 1);
+		map_keys(px, algo, res);
+		printf("%9.4f %9.4f %8.1f\n", moved(ref, res),
+		       (double)srv->cur_eweight / px->lbprm.tot_weight, ns);
+	}
+	return 0;
+}
@@ -131,8 +131,17 @@ enum {
 	PEER_MSG_CTRL_RESYNCFINISHED,
 	PEER_MSG_CTRL_RESYNCPARTIAL,
 	PEER_MSG_CTRL_RESYNCCONFIRM,
+	PEER_MSG_CTRL_HEARTBEAT,
+	PEER_MSG_CTRL_CAPABILITIES = 0x80,
 };
 
+/* Capabilities */
+#define PEER_CAP_BATCH        0x01
+#define PEER_CAP_INFLATE      0x02
+
+/* Batch message flags */
+#define PEER_BATCH_F_DEFLATE  0x01
+
 /* Error messages */
 enum {
 	PEER_MSG_ERR_PROTOCOL = 0,
@@ -148,6 +157,7 @@ enum {
 	PEER_MSG_STKT_ACK,
 	PEER_MSG_STKT_UPDATE_TIMED,
 	PEER_MSG_STKT_INCUPDATE_TIMED,
+	PEER_MSG_STKT_BATCH,
 };
 
 /* This is the different key types of the stick tables.
@@ -263,6 +273,10 @@ static int hf_happp_stkt_updt_data_bytes_out_rate_curr_ctr = -1;
 static int hf_happp_stkt_updt_data_bytes_out_rate_prev_ctr = -1;
 static int hf_happp_stkt_updt_ack_table_id = -1;
 static int hf_happp_stkt_updt_ack_update_id = -1;
+static int hf_happp_caps = -1;
+static int hf_happp_caps_max_batch_len = -1;
+static int hf_happp_stkt_batch_flags = -1;
+static int hf_happp_stkt_batch_raw_len = -1;
 
 struct happp_cv_data_t {
 	/* Same thing for the type of the the stick table keys */
@@ -517,6 +531,10 @@ static const char *control_msg_type_str_from_byte(guint8 c)
 		return "resync. partial";
 	case PEER_MSG_CTRL_RESYNCCONFIRM:
 		return "resync. confirm";
+	case PEER_MSG_CTRL_HEARTBEAT:
+		return "heartbeat";
+	case PEER_MSG_CTRL_CAPABILITIES:
+		return "capabilities";
 	default:
 		return "Unknown";
 	}
@@ -539,6 +557,8 @@ static const char *stkt_msg_type_str_from_byte(guint8 c)
 		return "update (with expiration)";
 	case PEER_MSG_STKT_INCUPDATE_TIMED:
 		return "inc. update (with expiration)";
+	case PEER_MSG_STKT_BATCH:
+		return "batch";
 	default:
 		return "Unknown";
 	}
@@ -914,6 +934,60 @@ static void dissect_happp_stkt_ack_msg(tvbuff_t *tvb, packet_info *pinfo _U_,
 		return;
 }
 
+static void dissect_happp_stkt_batch_msg(tvbuff_t *tvb, packet_info *pinfo _U_,
+                                         proto_tree *tree, guint offset, guint total)
+{
+	uint64_t flags, raw_len, len;
+
+	if (add_enc_field_to_happp_tree(hf_happp_stkt_batch_flags, tree, tvb,
+	                                &offset, total, &flags) < 0)
+		return;
+
+	if (flags & PEER_BATCH_F_DEFLATE) {
+		if (add_enc_field_to_happp_tree(hf_happp_stkt_batch_raw_len, tree, tvb,
+		                                &offset, total, &raw_len) < 0)
+			return;
+
+		/* continue with the inflated updates */
+		tvb = tvb_child_uncompress(tvb, tvb, offset, total - offset);
+		if (!tvb || tvb_reported_length(tvb) != raw_len)
+			return;
+
+		add_new_data_source(pinfo, tvb, "Inflated batch");
+		offset = 0;
+		total = raw_len;
+	}
+
+	/* Sequence of <type><encoded length><update> */
+	while (offset < total) {
+		guint8 msg_type_byte;
+
+		msg_type_byte = tvb_get_guint8(tvb, offset);
+		proto_tree_add_uint_format_value(tree, hf_happp_msg_type,
+		                                 tvb, offset++, 1, msg_type_byte,
+		                                 "%u    (%s)", msg_type_byte,
+		                                 stkt_msg_type_str_from_byte(msg_type_byte));
+		if (add_enc_field_to_happp_tree(hf_happp_msg_len, tree, tvb,
+		                                &offset, total, &len) < 0 ||
+		    len > total - offset)
+			return;
+
+		dissect_happp_stkt_update_msg(tvb, pinfo, tree, offset, offset + len, msg_type_byte);
+		offset += len;
+	}
+}
+
+static void dissect_happp_caps_msg(tvbuff_t *tvb, packet_info *pinfo _U_,
+                                   proto_tree *tree, guint offset, guint total)
+{
+	if (add_enc_field_to_happp_tree(hf_happp_caps, tree, tvb,
+	                                &offset, total, NULL) < 0)
+		return;
+
+	add_enc_field_to_happp_tree(hf_happp_caps_max_batch_len, tree, tvb,
+	                            &offset, total, NULL);
+}
+
 static void dissect_happp_stk_msg(tvbuff_t *tvb, packet_info *pinfo _U_,
                                   proto_tree *tree, guint8 msg_type_byte,
                                   guint offset, guint total)
@@ -931,6 +1005,9 @@ static void dissect_happp_stk_msg(tvbuff_t *tvb, packet_info *pinfo _U_,
 	case PEER_MSG_STKT_ACK:
 		dissect_happp_stkt_ack_msg(tvb, pinfo, tree, offset, total);
 		break;
+	case PEER_MSG_STKT_BATCH:
+		dissect_happp_stkt_batch_msg(tvb, pinfo, tree, offset, total);
+		break;
 	};
 
 }
@@ -961,8 +1038,12 @@ dissect_happp_msg(tvbuff_t *tvb, packet_info *pinfo _U_, proto_tree *tree,
 	*offset += dec_val_len;
 
 	switch (msg_class_byte) {
+	case PEER_MSG_CLASS_CONTROL:
+		if (msg_type_byte == PEER_MSG_CTRL_CAPABILITIES)
+			dissect_happp_caps_msg(tvb, pinfo, tree, *offset, *offset + dec_msg_len);
+		break;
 	case PEER_MSG_CLASS_STICKTABLE:
-		dissect_happp_stk_msg(tvb, pinfo, tree, msg_type_byte, *offset, total);
+		dissect_happp_stk_msg(tvb, pinfo, tree, msg_type_byte, *offset, *offset + dec_msg_len);
 		break;
 	}
 
@@ -1055,7 +1136,8 @@ dissect_happp_pdu(tvbuff_t *tvb, packet_info *pinfo, proto_tree *tree, void *dat
 			col_append_str(pinfo->cinfo, COL_INFO, "NON IMPLEMENTED");
 			break;
 		}
-		if (msg_class_byte >= PEER_MSG_CLASS_STICKTABLE)
+		/* Messages with a type >= 128 carry data */
+		if (msg_class_byte != PEER_MSG_CLASS_RESERVED && (msg_type_byte & 0x80))
 			dissect_happp_msg(tvb, pinfo, happp_tree,
 			                  msg_class_byte, msg_type_byte, &offset, total);
 
@@ -1099,11 +1181,14 @@ get_happp_msg_len(packet_info *pinfo _U_, tvbuff_t *tvb, int offset, void *data
 
 	saved_offset = offset;
 	first_byte = (gchar)tvb_get_guint8(tvb, offset);
-	if (first_byte == PEER_MSG_CLASS_CONTROL ||
-	    first_byte == PEER_MSG_CLASS_ERROR   ||
-	    first_byte == PEER_MSG_CLASS_RESERVED) {
+	if (first_byte == PEER_MSG_CLASS_RESERVED ||
+	    ((first_byte == PEER_MSG_CLASS_CONTROL ||
+	      first_byte == PEER_MSG_CLASS_ERROR) &&
+	     !(tvb_get_guint8(tvb, offset + 1) & 0x80))) {
 		ret = HAPPP_MSG_MIN_LEN;
-	} else if (first_byte == PEER_MSG_CLASS_STICKTABLE) {
+	} else if (first_byte == PEER_MSG_CLASS_CONTROL ||
+	           first_byte == PEER_MSG_CLASS_ERROR   ||
+	           first_byte == PEER_MSG_CLASS_STICKTABLE) {
 		int soff;
 
 		left -= HAPPP_MSG_MIN_LEN;
@@ -1581,6 +1666,34 @@ proto_register_happp(void)
 				FT_INT32, BASE_DEC, NULL, 0, NULL, HFILL
 			}
 		},
+		{
+			&hf_happp_caps,
+			{
+				"    capabilities", "happp.msg.caps",
+				FT_UINT64, BASE_HEX, NULL, 0, NULL, HFILL
+			}
+		},
+		{
+			&hf_happp_caps_max_batch_len,
+			{
+				"    max batch length", "happp.msg.caps.max_batch_len",
+				FT_UINT64, BASE_DEC, NULL, 0, NULL, HFILL
+			}
+		},
+		{
+			&hf_happp_stkt_batch_flags,
+			{
+				"    flags", "happp.msg.stkt.batch.flags",
+				FT_UINT64, BASE_HEX, NULL, 0, NULL, HFILL
+			}
+		},
+		{
+			&hf_happp_stkt_batch_raw_len,
+			{
+				"    raw length", "happp.msg.stkt.batch.raw_len",
+				FT_UINT64, BASE_DEC, NULL, 0, NULL, HFILL
+			}
+		},
 	};
 
 	/* Setup protocol subtree array */
@@ -207,6 +207,12 @@ typedef struct { } empty_t;
 #define HA_HAVE_CRYPT_R
 #endif
 
+/* sendmmsg() appeared in glibc 2.14 and FreeBSD 11.0 (1100000). */
+#if (defined(__linux__) && defined(__GNU_LIBRARY__) && (__GLIBC__ > 2 || __GLIBC__ == 2 && __GLIBC_MINOR__ >= 14)) \
+ || (defined(__FreeBSD__) && __FreeBSD_version >= 1100000)
+#define HA_HAVE_SENDMMSG
+#endif
+
 /* some backtrace() implementations are broken or incomplete, in this case we
  * can replace them. We must not do it all the time as some are more accurate
  * than ours.
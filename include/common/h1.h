@@ -140,6 +140,21 @@ union h1_sl {                          /* useful start line pointers, relative t
 	} st;                          /* status line : field, length */
 };
 
+/* Vector instruction sets the HTTP/1 parser may use to skip over the header
+ * names, values and URIs. The best one supported by the CPU is selected at
+ * boot, and H1_SIMD_NONE only relies on the portable 4/8-byte scanners.
+ */
+enum h1_simd {
+	H1_SIMD_NONE = 0,
+	H1_SIMD_SSE2,
+	H1_SIMD_AVX2,
+};
+
+extern enum h1_simd h1_simd_level;
+
+enum h1_simd h1_set_simd_level(enum h1_simd level);
+const char *h1_simd_name(enum h1_simd level);
+
 int h1_headers_to_hdr_list(char *start, const char *stop,
                            struct http_hdr *hdr, unsigned int hdr_num,
                            struct h1m *h1m, union h1_sl *slp);
@@ -611,6 +611,7 @@ enum lock_label {
 	CKCH_LOCK,
 	SNI_LOCK,
 	SFT_LOCK, /* sink forward target */
+	CACHE_LOCK,
 	OTHER_LOCK,
 	LOCK_LABELS
 };
@@ -729,6 +730,7 @@ static inline const char *lock_label(enum lock_label label)
 	case CKCH_LOCK:            return "CKCH";
 	case SNI_LOCK:             return "SNI";
 	case SFT_LOCK:             return "SFT";
+	case CACHE_LOCK:           return "CACHE";
 	case OTHER_LOCK:           return "OTHER";
 	case LOCK_LABELS:          break; /* keep compiler happy */
 	};
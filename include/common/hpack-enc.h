@@ -33,10 +33,75 @@
 #include <common/buf.h>
 #include <common/config.h>
 #include <common/http.h>
+#include <common/hpack-tbl.h>
 #include <common/ist.h>
 
+/* number of slots of each hash index of the encoder, must be a power of 2 */
+#define HPACK_ENC_HASH_SIZE   128
+
+/* max number of fields inserted into the dynamic table by a header block */
+#define HPACK_ENC_MAX_PEND    16
+
+/* number of slots of the table of fields already seen (power of 2) */
+#define HPACK_ENC_SEEN_SIZE   256
+
+/* no pending dynamic table size update */
+#define HPACK_ENC_NO_UPDATE   (~0U)
+
+/* policies deciding which header fields are inserted into the dynamic table */
+enum hpack_enc_policy {
+	HPACK_ENC_POL_ALL = 0,     /* all fields which may be indexed */
+	HPACK_ENC_POL_REPEATED,    /* only fields already seen on the connection */
+};
+
+/* latest entry of the dynamic table matching a hash */
+struct hpack_enc_slot {
+	uint32_t seq;   /* sequence number of the entry, 0 if none */
+	uint32_t cum;   /* bytes inserted in the table before this entry */
+};
+
+/* a field inserted by the header block being encoded */
+struct hpack_enc_pend {
+	struct ist n, v;
+	uint32_t hn, hnv; /* name and name+value hashes */
+};
+
+/* HPACK encoder. The dynamic table <dht> mirrors the peer's decoding table.
+ * It may only lose its oldest entries compared to the peer's one, so that the
+ * indexes of the remaining ones are always the same on both sides. Entries
+ * are looked up through two lossy hash indexes keeping the latest entry for a
+ * name and for a name+value pair. Insertions are only applied to the table
+ * once the whole header block is committed, so that a block which could not
+ * be emitted (eg: buffer full) may simply be encoded again later. A NULL
+ * <dht> disables the dynamic table.
+ */
+struct hpack_enc {
+	struct hpack_dht *dht;     /* mirror of the peer's table, or NULL */
+	uint32_t max_size;         /* configured size limit of the table */
+	uint32_t seq;              /* sequence number of the newest entry */
+	uint32_t cum;              /* bytes ever inserted, 32-byte overhead included */
+	uint32_t upd_size;         /* pending table size update or HPACK_ENC_NO_UPDATE */
+	uint32_t upd_min;          /* smallest size since the last update */
+	uint32_t pend_bytes;       /* bytes inserted by the current block */
+	uint16_t pend_cnt;         /* fields inserted by the current block */
+	enum hpack_enc_policy policy;
+	struct hpack_enc_pend pend[HPACK_ENC_MAX_PEND];
+	struct hpack_enc_slot nv_idx[HPACK_ENC_HASH_SIZE];
+	struct hpack_enc_slot n_idx[HPACK_ENC_HASH_SIZE];
+	uint16_t seen[HPACK_ENC_SEEN_SIZE]; /* tags of the fields seen last */
+};
+
+extern struct pool_head *pool_head_hpack_enc;
+
 int hpack_encode_header(struct buffer *out, const struct ist n,
 			const struct ist v);
+int hpack_enc_header(struct hpack_enc *enc, struct buffer *out,
+		     const struct ist n, const struct ist v);
+struct hpack_enc *hpack_enc_alloc(unsigned int size, enum hpack_enc_policy policy);
+void hpack_enc_free(struct hpack_enc *enc);
+void hpack_enc_set_size(struct hpack_enc *enc, unsigned int size);
+int hpack_enc_begin(struct hpack_enc *enc, struct buffer *out);
+void hpack_enc_commit(struct hpack_enc *enc);
 
 /* Returns the number of bytes required to encode the string length <len>. The
  * number of usable bits is an integral multiple of 7 plus 6 for the last byte.
@@ -80,19 +145,40 @@ static inline int hpack_encode_len(char *out, int pos, int len)
 	return pos;
 }
 
+/* Encodes integer <val> with a <bits>-bit prefix (RFC7541#5.1) into <out>+<pos>
+ * after the flags <flags> of the first byte, and returns the new position. The
+ * caller is responsible for checking for available room, at most 5 bytes.
+ */
+static inline int hpack_encode_int(char *out, int pos, uint8_t flags, int bits, uint32_t val)
+{
+	uint32_t max = (1U << bits) - 1;
+
+	if (val < max) {
+		out[pos++] = flags | val;
+		return pos;
+	}
+
+	out[pos++] = flags | max;
+	for (val -= max; val >= 128; val >>= 7)
+		out[pos++] = val | 128;
+	out[pos++] = val;
+	return pos;
+}
+
 /* Tries to encode header field index <idx> with short value <val> into the
  * aligned buffer <out>. Returns non-zero on success, 0 on failure (buffer
  * full). The caller is responsible for ensuring that the length of <val> is
- * strictly lower than 127, and that <idx> is lower than 64 (static list only),
- * and that the buffer is aligned (head==0).
+ * strictly lower than 127, and that <idx> is lower than 15 (static list only),
+ * and that the buffer is aligned (head==0). The field is never indexed since
+ * the peer's dynamic table is managed by the encoder.
  */
 static inline int hpack_encode_short_idx(struct buffer *out, int idx, struct ist val)
 {
 	if (out->data + 2 + val.len > out->size)
 		return 0;
 
-	/* literal header field with incremental indexing */
-	out->area[out->data++] = idx | 0x40;
+	/* literal header field without indexing */
+	out->area[out->data++] = idx;
 	out->area[out->data++] = val.len;
 	ist2bin(&out->area[out->data], val);
 	out->data += val.len;
@@ -101,7 +187,7 @@ static inline int hpack_encode_short_idx(struct buffer *out, int idx, struct ist
 
 /* Tries to encode header field index <idx> with long value <val> into the
  * aligned buffer <out>. Returns non-zero on success, 0 on failure (buffer
- * full). The caller is responsible for ensuring <idx> is lower than 64 (static
+ * full). The caller is responsible for ensuring <idx> is lower than 15 (static
  * list only), and that the buffer is aligned (head==0).
  */
 static inline int hpack_encode_long_idx(struct buffer *out, int idx, struct ist val)
@@ -112,10 +198,10 @@ static inline int hpack_encode_long_idx(struct buffer *out, int idx, struct ist
 	    1 + len + hpack_len_to_bytes(val.len) + val.len > out->size)
 		return 0;
 
-	/* emit literal with indexing (7541#6.2.1) :
-	 * [ 0 | 1 | Index (6+) ]
+	/* emit literal without indexing (7541#6.2.2) :
+	 * [ 0 | 0 | 0 | 0 | Index (4+) ]
 	 */
-	out->area[len++] = idx | 0x40;
+	out->area[len++] = idx;
 	len = hpack_encode_len(out->area, len, val.len);
 	memcpy(out->area + len, val.ptr, val.len);
 	len += val.len;
@@ -165,7 +251,7 @@ static inline int hpack_encode_int_status(struct buffer *out, unsigned int statu
 		goto fail;
 
 	/* basic encoding of the status code */
-	out->area[len - 5] = 0x48; // indexed name -- name=":status" (idx 8)
+	out->area[len - 5] = 0x08; // indexed name -- name=":status" (idx 8)
 	out->area[len - 4] = 0x03; // 3 bytes status
 	out->area[len - 3] = '0' + status / 100;
 	out->area[len - 2] = '0' + status / 10 % 10;
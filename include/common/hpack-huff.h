@@ -29,7 +29,7 @@
 
 #include <inttypes.h>
 
-int huff_enc(const char *s, char *out);
+int huff_enc(const char *s, int len, char *out, int max);
 int huff_dec(const uint8_t *huff, int hlen, char *out, int olen);
 
 #endif
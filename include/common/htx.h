@@ -217,8 +217,7 @@ struct htx {
 
 	uint64_t extra;  /* known bytes amount remaining to receive */
 	uint32_t flags;  /* HTX_FL_* */
-
-	/* XXX 4 bytes unused */
+	uint64_t hdr_gen; /* generation of the header index, 0 if none (see http_htx.c) */
 
 	/* Blocks representing the HTTP message itself */
 	char blocks[0] __attribute__((aligned(8)));
@@ -686,6 +685,15 @@ static inline int htx_almost_full(const struct htx *htx)
 	return 0;
 }
 
+/* Drops the header index of the HTX message <htx>, if any. It must be called
+ * each time a block is added or moved and each time a header name changes.
+ * Removed blocks don't need it since they keep their position.
+ */
+static inline void htx_drop_hdr_index(struct htx *htx)
+{
+	htx->hdr_gen = 0;
+}
+
 /* Resets an HTX message */
 static inline void htx_reset(struct htx *htx)
 {
@@ -694,6 +702,7 @@ static inline void htx_reset(struct htx *htx)
 	htx->tail_addr = htx->head_addr = htx->end_addr = 0;
 	htx->extra = 0;
 	htx->flags = HTX_FL_NONE;
+	htx_drop_hdr_index(htx);
 }
 
 /* Returns the available room for raw data in buffer <buf> once HTX overhead is
@@ -0,0 +1,127 @@
+/*
+ * include/common/regset.h
+ * Matching of a set of regular expressions at once.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _COMMON_REGSET_H
+#define _COMMON_REGSET_H
+
+#include <common/config.h>
+#include <common/hathreads.h>
+
+/* A regset compiles many regular expressions into a single Thompson NFA,
+ * which is searched through a lazily built DFA: each subject is read once
+ * whatever the number of expressions, and the lowest id among the matching
+ * expressions is reported. Only the part of the regex syntax which has the
+ * same meaning for the POSIX and the PCRE libraries is supported (literals,
+ * ".", bracket expressions, \w \s, anchors, groups, alternations and
+ * quantifiers); regset_add() refuses the other expressions so that the
+ * caller keeps executing them with the regex library.
+ */
+
+#define REGSET_MAX_NSTATES   (1 << 20)         /* NFA states in a set */
+#define REGSET_MAX_REPEAT    255               /* max bound in "{n,m}" */
+#define REGSET_HASH_BITS     12
+
+/* Memory the DFA states of a set may use. Once reached, the subjects which
+ * need a new state are finished by simulating the NFA.
+ */
+#ifndef REGSET_MAX_DFA_MEM
+#define REGSET_MAX_DFA_MEM   (16 * 1024 * 1024)
+#endif
+
+/* NFA state types */
+enum {
+	REGSET_N_CHAR = 0,   /* consumes one byte from char set <arg> */
+	REGSET_N_SPLIT,      /* goes to both <out> and <out1> */
+	REGSET_N_EMPTY,      /* goes to <out> */
+	REGSET_N_BOL,        /* goes to <out> at the beginning of the subject */
+	REGSET_N_EOL,        /* goes to <out> at the end of the subject */
+	REGSET_N_MATCH,      /* expression <id> matches */
+};
+
+struct regset_nstate {
+	unsigned char type;  /* REGSET_N_* */
+	int out, out1;       /* next states, -1 if none */
+	unsigned int arg;    /* char set index for REGSET_N_CHAR */
+	unsigned int id;     /* id of the expression this state belongs to */
+};
+
+/* A DFA state is the set of NFA states reached after some input, excluding
+ * those of the restart set (the states reached without reading anything,
+ * which are implicitly part of all the DFA states). The transitions are
+ * indexed by byte class and are filled on demand.
+ */
+struct regset_dstate {
+	struct regset_dstate *hnext;    /* next state in the same hash bucket */
+	unsigned int hash;
+	unsigned int match;             /* lowest id matched here, ~0 if none */
+	unsigned int eol_match;         /* lowest id matched if the subject ends here */
+	unsigned int minlive;           /* lowest id which may still match from here */
+	unsigned int bol;               /* 1 for the initial state only */
+	unsigned int nb;                /* number of NFA states */
+	unsigned int *nfa;              /* sorted NFA states */
+	struct regset_dstate *next[0];  /* transitions, one per byte class */
+};
+
+struct regset {
+	int icase;                      /* case insensitive matching */
+	struct regset_nstate *nstates;
+	unsigned int nb_nstates, alloc_nstates;
+	unsigned long (*csets)[256 / (8 * sizeof(long))]; /* char sets as bit fields */
+	unsigned int nb_csets, alloc_csets;
+	int single_cset[256];           /* char set index of single bytes, -1 if none */
+	int *starts;                    /* initial state of each expression */
+	unsigned int nb_starts, alloc_starts;
+
+	/* filled by regset_compile() */
+	unsigned char bclass[256];      /* byte class of each byte */
+	unsigned char brep[256];        /* one byte of each class */
+	unsigned int nb_classes;
+	unsigned char *in_base;         /* states of the restart set */
+	unsigned int *base;             /* restart set, listed states only */
+	unsigned int nb_base;
+	unsigned int base_match, base_eol_match, base_minlive;
+	struct regset_dstate *start;    /* initial DFA state */
+	struct regset_dstate *htable[1 << REGSET_HASH_BITS];
+	size_t dfa_mem;                 /* memory used by the DFA states */
+	int dfa_full;                   /* no more DFA states may be created */
+	__decl_hathreads(HA_SPINLOCK_T lock); /* protects the DFA construction */
+
+	/* statistics */
+	unsigned int nb_patterns;       /* expressions in the set */
+	unsigned int nb_dstates;        /* DFA states built so far */
+	unsigned int build_time;        /* compilation time in microseconds */
+	unsigned long long execs;       /* subjects searched */
+	unsigned long long dfa_misses;  /* DFA transitions computed */
+	unsigned long long nfa_execs;   /* subjects finished without the DFA */
+};
+
+struct regset *regset_new(int icase);
+int regset_add(struct regset *set, const char *str, unsigned int id);
+int regset_compile(struct regset *set, char **err);
+int regset_exec(struct regset *set, const char *subject, int length, unsigned int *id);
+void regset_free(struct regset *set);
+
+#endif /* _COMMON_REGSET_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -49,6 +49,7 @@ int be_downtime(struct proxy *px);
 void recount_servers(struct proxy *px);
 void update_backend_weight(struct proxy *px);
 int be_lastsession(const struct proxy *be);
+void lb_ewma_update(struct server *srv, unsigned int sample);
 
 /* Returns number of usable servers in backend */
 static inline int be_usable_srv(struct proxy *be)
@@ -25,10 +25,15 @@
 
 #include <types/compression.h>
 
+struct htx;
+struct stream;
+
 extern unsigned int compress_min_idle;
+extern const struct comp_algo comp_algos[];
 
 int comp_append_type(struct comp *comp, const char *type);
 int comp_append_algo(struct comp *comp, const char *algo);
+int comp_select_encoding(struct stream *s, struct htx *htx);
 
 #ifdef USE_ZLIB
 extern long zlib_used_memory;
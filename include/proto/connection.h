@@ -329,6 +329,8 @@ static inline void conn_init(struct connection *conn)
 	conn->dst = NULL;
 	conn->proxy_authority = NULL;
 	conn->proxy_unique_id = IST_NULL;
+	conn->hash_node.node.leaf_p = NULL;
+	conn->hash_node.key = 0;
 }
 
 /* sets <owner> as the connection's owner */
@@ -444,6 +446,19 @@ static inline void conn_force_unsubscribe(struct connection *conn)
 	conn->subs = NULL;
 }
 
+/* Removes and returns the oldest connection of the idle list <list>, whatever
+ * its hash, after removing it from the matching idle tree, or NULL if the list
+ * is empty. The toremove_lock of the thread owning the list must be held.
+ */
+static inline struct connection *conn_take_oldest_idle(struct mt_list *list)
+{
+	struct connection *conn = MT_LIST_POP(list, struct connection *, list);
+
+	if (conn)
+		eb64_delete(&conn->hash_node);
+	return conn;
+}
+
 /* Releases a connection previously allocated by conn_new() */
 static inline void conn_free(struct connection *conn)
 {
@@ -492,6 +507,7 @@ static inline void conn_free(struct connection *conn)
 	conn_force_unsubscribe(conn);
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 	MT_LIST_DEL((struct mt_list *)&conn->list);
+	eb64_delete(&conn->hash_node);
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 	pool_free(pool_head_connection, conn);
 }
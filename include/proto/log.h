@@ -79,6 +79,11 @@ static inline int build_logline(struct stream *s, char *dst, size_t maxsize, str
 	return sess_build_logline(strm_sess(s), s, dst, maxsize, list_format);
 }
 
+/*
+ * Builds a binary access log record ("option binlog").
+ */
+int sess_build_binlog(struct session *sess, struct stream *s, char *dst, size_t maxsize);
+
 
 /*
  * send a log for the stream when we have enough info about it.
@@ -103,6 +108,9 @@ int add_to_logformat_list(char *start, char *end, int type, struct list *list_fo
  */
 int parse_logformat_string(const char *str, struct proxy *curproxy, struct list *list_format, int options, int cap, char **err);
 
+/* Prepares the complete list <list_format> for sess_build_logline() */
+int compile_logformat_list(struct list *list_format, char **err);
+
 /* Parse "log" keyword and update the linked list. */
 int parse_logsrv(char **args, struct list *logsrvs, int do_del, char **err);
 
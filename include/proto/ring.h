@@ -23,9 +23,19 @@
 #define _PROTO_RING_H
 
 #include <stdlib.h>
+#include <common/hathreads.h>
 #include <common/ist.h>
 #include <types/ring.h>
 
+/* Returns the number of bytes of published blocks in ring <ring>, starting
+ * at the buffer's head. The caller must hold the ring's lock so that the head
+ * cannot move. Blocks still being written past this point must not be read.
+ */
+static inline size_t ring_data(struct ring *ring)
+{
+	return HA_ATOMIC_LOAD(&ring->committed) - ring->ofs;
+}
+
 struct ring *ring_new(size_t size);
 struct ring *ring_resize(struct ring *ring, size_t size);
 void ring_free(struct ring *ring);
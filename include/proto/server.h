@@ -42,6 +42,7 @@ extern struct eb_root idle_conn_srv;
 extern struct task *idle_conn_task;
 extern struct task *idle_conn_cleanup[MAX_THREADS];
 extern struct mt_list toremove_connections[MAX_THREADS];
+__decl_hathreads(extern HA_SPINLOCK_T toremove_lock[MAX_THREADS]);
 
 int srv_downtime(const struct server *s);
 int srv_lastsession(const struct server *s);
@@ -242,6 +243,24 @@ static inline enum srv_initaddr srv_get_next_initaddr(unsigned int *list)
 	return ret;
 }
 
+/* Inserts connection <conn> into the current thread's tree of server <srv>
+ * designated by <list>, which is either CO_FL_SAFE_LIST or CO_FL_IDLE_LIST.
+ * The connection is indexed by its hash so that it may only be picked by
+ * requests with the same connection parameters, and is appended to the
+ * matching list so that the oldest connections are purged first. The thread's
+ * toremove_lock is used.
+ */
+static inline void srv_add_to_idle_tree(struct server *srv, struct connection *conn, int list)
+{
+	struct eb_root *root = (list == CO_FL_SAFE_LIST) ? srv->safe_conns_tree : srv->idle_conns_tree;
+	struct mt_list *lru = (list == CO_FL_SAFE_LIST) ? srv->safe_conns : srv->idle_conns;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+	eb64_insert(&root[tid], &conn->hash_node);
+	MT_LIST_ADDQ(&lru[tid], &conn->list);
+	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+}
+
 /* This adds an idle connection to the server's list if the connection is
  * reusable, not held by any owner anymore, but still has available streams.
  */
@@ -266,11 +285,11 @@ static inline int srv_add_to_idle_list(struct server *srv, struct connection *co
 		conn->idle_time = now_ms;
 		if (is_safe) {
 			conn->flags = (conn->flags & ~CO_FL_LIST_MASK) | CO_FL_SAFE_LIST;
-			MT_LIST_ADDQ(&srv->safe_conns[tid], (struct mt_list *)&conn->list);
+			srv_add_to_idle_tree(srv, conn, CO_FL_SAFE_LIST);
 			_HA_ATOMIC_ADD(&srv->curr_safe_nb, 1);
 		} else {
 			conn->flags = (conn->flags & ~CO_FL_LIST_MASK) | CO_FL_IDLE_LIST;
-			MT_LIST_ADDQ(&srv->idle_conns[tid], (struct mt_list *)&conn->list);
+			srv_add_to_idle_tree(srv, conn, CO_FL_IDLE_LIST);
 			_HA_ATOMIC_ADD(&srv->curr_idle_nb, 1);
 		}
 		_HA_ATOMIC_ADD(&srv->curr_idle_thr[tid], 1);
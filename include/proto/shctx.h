@@ -34,6 +34,9 @@
 int shctx_init(struct shared_context **orig_shctx,
                int maxblocks, int blocksize, unsigned int maxobjsz,
                int extra, int shared);
+int shctx_init_seg(struct shared_context **orig_shctx,
+                   int maxblocks, int blocksize, unsigned int maxobjsz,
+                   int extra, int shared, unsigned int nbseg);
 struct shared_block *shctx_row_reserve_hot(struct shared_context *shctx,
                                            struct shared_block *last, int data_len);
 void shctx_row_inc_hot(struct shared_context *shctx, struct shared_block *first);
@@ -184,6 +187,39 @@ static inline void _shctx_unlock(struct shared_context *shctx)
 
 #endif
 
+/* Segments */
+
+/*
+ * Returns the segment number <idx> (modulo the number of segments) of <shctx>,
+ * or <shctx> itself if it is not segmented. Rows must be reserved, used and
+ * released in a segment, under the lock of this segment.
+ */
+static inline struct shared_context *shctx_seg(struct shared_context *shctx, unsigned int idx)
+{
+	if (!shctx->nbseg)
+		return shctx;
+	return &shctx->segs[idx % shctx->nbseg];
+}
+
+/*
+ * Returns the segment of <shctx> the block <block> belongs to, or <shctx>
+ * itself if it is not segmented.
+ */
+static inline struct shared_context *shctx_block_seg(struct shared_context *shctx,
+                                                     struct shared_block *block)
+{
+	unsigned int idx;
+
+	if (!shctx->nbseg)
+		return shctx;
+
+	idx = ((unsigned char *)block - (unsigned char *)shctx->blocks) /
+		(sizeof(struct shared_block) + shctx->block_size) / shctx->seg_blocks;
+	if (idx >= shctx->nbseg)
+		idx = shctx->nbseg - 1;
+	return &shctx->segs[idx];
+}
+
 /* List Macros */
 
 /*
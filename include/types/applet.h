@@ -117,6 +117,16 @@ struct appctx {
 			unsigned int rem_data;      /* Remaining bytes for the last data block (HTX only, 0 means process next block) */
 			struct shared_block *next;  /* The next block of data to be sent for this cache entry. */
 		} cache;
+		struct {
+			struct cache_entry *entry;  /* Stale entry being revalidated. */
+			struct cache *cache;        /* Cache the entry belongs to. */
+			struct buffer req;          /* HTX conditional request to send to the server. */
+			int status;                 /* Status of the response, 0 while unknown. */
+			int maxage;                 /* Freshness of the response (seconds), -1 if not set. */
+			int swr;                    /* stale-while-revalidate of the response, -1 if not set. */
+			int sie;                    /* stale-if-error of the response, -1 if not set. */
+			unsigned int age;           /* Age header of the response. */
+		} cache_reval;
 		/* all entries below are used by various CLI commands, please
 		 * keep the grouped together and avoid adding new ones.
 		 */
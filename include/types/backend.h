@@ -29,6 +29,7 @@
 #include <types/lb_fas.h>
 #include <types/lb_fwlc.h>
 #include <types/lb_fwrr.h>
+#include <types/lb_maglev.h>
 #include <types/lb_map.h>
 #include <types/server.h>
 
@@ -54,6 +55,7 @@
 #define BE_LB_RR_DYN    0x00000  /* dynamic round robin (default) */
 #define BE_LB_RR_STATIC 0x00001  /* static round robin */
 #define BE_LB_RR_RANDOM 0x00002  /* random round robin */
+#define BE_LB_RR_EWMA   0x00003  /* random draws weighted by peak-EWMA latency */
 
 /* BE_LB_CB_* is used with BE_LB_KIND_CB */
 #define BE_LB_CB_LC     0x00000  /* least-connections */
@@ -82,6 +84,7 @@
 #define BE_LB_ALGO_NONE (BE_LB_KIND_NONE | BE_LB_NEED_NONE)    /* not defined */
 #define BE_LB_ALGO_RR   (BE_LB_KIND_RR | BE_LB_NEED_NONE)      /* round robin */
 #define BE_LB_ALGO_RND  (BE_LB_KIND_RR | BE_LB_NEED_NONE | BE_LB_RR_RANDOM) /* random value */
+#define BE_LB_ALGO_EWMA (BE_LB_KIND_RR | BE_LB_NEED_NONE | BE_LB_RR_EWMA)   /* peak-EWMA latency */
 #define BE_LB_ALGO_LC   (BE_LB_KIND_CB | BE_LB_NEED_NONE | BE_LB_CB_LC)    /* least connections */
 #define BE_LB_ALGO_FAS  (BE_LB_KIND_CB | BE_LB_NEED_NONE | BE_LB_CB_FAS)   /* first available server */
 #define BE_LB_ALGO_SRR  (BE_LB_KIND_RR | BE_LB_NEED_NONE | BE_LB_RR_STATIC) /* static round robin */
@@ -102,6 +105,7 @@
 #define BE_LB_LKUP_LCTREE 0x30000  /* FWLC tree lookup */
 #define BE_LB_LKUP_CHTREE 0x40000  /* consistent hash  */
 #define BE_LB_LKUP_FSTREE 0x50000  /* FAS tree lookup */
+#define BE_LB_LKUP_MGTABLE 0x60000 /* Maglev table lookup */
 #define BE_LB_LKUP        0x70000  /* mask to get just the LKUP value */
 
 /* additional properties */
@@ -110,7 +114,8 @@
 /* hash types */
 #define BE_LB_HASH_MAP    0x000000 /* map-based hash (default) */
 #define BE_LB_HASH_CONS   0x100000 /* consistent hashbit to indicate a dynamic algorithm */
-#define BE_LB_HASH_TYPE   0x100000 /* get/clear hash types */
+#define BE_LB_HASH_MAGLEV 0x1000000 /* Maglev hash */
+#define BE_LB_HASH_TYPE   0x1100000 /* get/clear hash types */
 
 /* additional modifier on top of the hash function (only avalanche right now) */
 #define BE_LB_HMOD_AVAL   0x200000  /* avalanche modifier */
@@ -136,6 +141,18 @@
  */
 #define BE_WEIGHT_SCALE 16
 
+/* The "ewma" algorithm keeps a per-server peak-EWMA of the response time in
+ * milliseconds, stored as a fixed-point value with LB_EWMA_SCALE fractional
+ * bits. A sample higher than the average replaces it, a lower one only moves
+ * it by 1/2^LB_EWMA_WEIGHT of the difference. Without any new sample the value
+ * is halved every LB_EWMA_HALFLIFE milliseconds, so that a server which was
+ * avoided after a slow period gets a chance to be measured again.
+ */
+#define LB_EWMA_SCALE    4
+#define LB_EWMA_WEIGHT   3
+#define LB_EWMA_HALFLIFE 1000
+#define LB_EWMA_MAX      (1U << 28)  /* ~4.6 hours, keeps the cost within 64 bits */
+
 /* LB parameters for all algorithms */
 struct lbprm {
 	union { /* LB parameters depending on the algo type */
@@ -144,6 +161,7 @@ struct lbprm {
 		struct lb_fwlc fwlc;
 		struct lb_chash chash;
 		struct lb_fas fas;
+		struct lb_maglev maglev;
 	};
 	int algo;			/* load balancing algorithm and variants: BE_LB_* */
 	int tot_wact, tot_wbck;		/* total effective weights of active and backup servers */
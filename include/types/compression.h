@@ -32,12 +32,21 @@
 #include <zlib.h>
 #endif
 
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
 #include <common/buffer.h>
 
 struct comp {
 	struct comp_algo *algos;
 	struct comp_type *types;
 	unsigned int offload;
+	unsigned int async;     /* compress in the compression threads */
 };
 
 struct comp_ctx {
@@ -53,6 +62,13 @@ struct comp_ctx {
 	void *zlib_prev;
 	void *zlib_pending_buf;
 	void *zlib_head;
+#endif
+#ifdef USE_ZSTD
+	ZSTD_CCtx *zstd;              /* zstd stream, taken from the thread's cache */
+	int zstd_hdr;                 /* the "dcz" header is still to be emitted */
+#endif
+#ifdef USE_BROTLI
+	BrotliEncoderState *brotli;   /* brotli stream */
 #endif
 	int cur_lvl;
 };
@@ -75,6 +91,7 @@ struct comp_algo {
 	int (*flush)(struct comp_ctx *comp_ctx, struct buffer *out);
 	int (*finish)(struct comp_ctx *comp_ctx, struct buffer *out);
 	int (*end)(struct comp_ctx **comp_ctx);
+	const char *dict_id;  /* Available-Dictionary the client must send, or NULL */
 	struct comp_algo *next;
 };
 
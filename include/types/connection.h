@@ -28,6 +28,8 @@
 #include <common/config.h>
 #include <common/ist.h>
 
+#include <eb64tree.h>
+
 #include <types/listener.h>
 #include <types/obj_type.h>
 #include <types/port_range.h>
@@ -477,6 +479,18 @@ struct connection {
 	unsigned int idle_time;                 /* Time the connection was added to the idle list, or 0 if not in the idle list */
 	uint8_t proxy_authority_len;  /* Length of authority TLV received via PROXYv2 */
 	struct ist proxy_unique_id;  /* Value of the unique ID TLV received via PROXYv2 */
+	struct eb64_node hash_node;   /* node in the server's idle trees, the key is the hash of the connection parameters */
+};
+
+/* Parameters making a backend connection differ from the server's default
+ * ones. They are mixed into the connection hash so that idle connections are
+ * only reused by requests which would have established the same connection.
+ */
+enum conn_hash_param {
+	CONN_HASH_PARAM_SNI = 1,      /* TLS SNI value */
+	CONN_HASH_PARAM_SRC,          /* client-dependent source address ("usesrc") */
+	CONN_HASH_PARAM_PROXY,        /* PROXY protocol header, including its TLVs */
+	CONN_HASH_PARAM_NETNS,        /* network namespace */
 };
 
 /* PROTO token registration */
@@ -88,6 +88,8 @@ struct be_counters {
 
 	long long connect;                      /* number of connection establishment attempts */
 	long long reuse;                        /* number of connection reuses */
+	long long idle_hits;                    /* idle pool lookups which found a connection with matching parameters */
+	long long idle_miss;                    /* idle pool lookups which found none */
 	long long failed_conns;                 /* failed connect() attempts (BE only) */
 	long long failed_resp;                  /* failed responses (BE only) */
 	long long cli_aborts;                   /* aborted responses during DATA phase caused by the client */
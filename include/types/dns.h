@@ -24,6 +24,7 @@
 
 #include <eb32tree.h>
 
+#include <common/buf.h>
 #include <common/mini-clist.h>
 #include <common/hathreads.h>
 
@@ -45,6 +46,16 @@ extern struct pool_head *dns_requester_pool;
 #define DNS_MAX_LABEL_SIZE   63
 #define DNS_MAX_NAME_SIZE    255
 #define DNS_MAX_UDP_MESSAGE  8192
+#define DNS_MAX_TCP_MESSAGE  65535
+
+/* room for the queries pipelined on a nameserver's TCP connection */
+#define DNS_TCP_BUFSIZE      16384
+
+/* delay before using again the TCP transport of a nameserver after an error */
+#define DNS_TCP_RETRY_DELAY  10000
+
+/* delay after which an idle TCP connection to a nameserver is closed */
+#define DNS_TCP_IDLE_TIMEOUT 30000
 
 /* DNS minimum record size: 1 char + 1 NULL + type + class */
 #define DNS_MIN_RECORD_SIZE  (1 + 1 + 2 + 2)
@@ -152,6 +163,7 @@ struct dns_answer_item {
 	char            target[DNS_MAX_NAME_SIZE+1]; /* Response data: SRV or CNAME type target */
 	time_t          last_seen;                   /* When was the answer was last seen */
 	struct dns_answer_item *ar_item;             /* pointer to a RRset from the additional section, if exists */
+	struct eb32_node link;                       /* place in the response's answer or AR tree, see dns_answer_key() */
 	struct list     list;
 };
 
@@ -160,6 +172,9 @@ struct dns_response_packet {
 	struct list       query_list;
 	struct list       answer_list;
 	struct list       ar_list;         /* additional records */
+	struct eb_root    answer_tree;     /* answer_list indexed by address or target */
+	struct eb_root    ar_tree;         /* ar_list indexed by name */
+	unsigned int      min_ttl;         /* smallest TTL (in seconds) of the last response's answers */
 	/* authority ignored for now */
 };
 
@@ -193,6 +208,7 @@ struct dns_resolvers {
 	struct {
 		struct list wait;           /* resolutions managed to this resolvers section */
 		struct list curr;           /* current running resolutions */
+		struct eb_root names;       /* all resolutions, indexed by hostname and query type */
 	} resolutions;
 	struct eb_root query_ids;           /* tree to quickly lookup/retrieve query ids currently in use
                                              * used by each nameserver, but stored in resolvers since there must
@@ -201,6 +217,27 @@ struct dns_resolvers {
 	struct list list;                   /* resolvers list */
 };
 
+/* TCP transport of a name server (RFC 7766). A single connection is kept
+ * open and all the queries are pipelined on it, each message being preceded
+ * by its length on 2 bytes. The responses are matched by their query id like
+ * over UDP. The connection and its buffers are only allocated when used.
+ * The connection and the responses must make progress within "timeout retry",
+ * and an idle connection is closed after DNS_TCP_IDLE_TIMEOUT.
+ */
+struct dns_stream {
+	int          fd;                /* -1 when not connected */
+	int          connected;         /* the connection is established */
+	struct buffer obuf;             /* queries waiting to be sent */
+	struct buffer ibuf;             /* response(s) being received, always starting at the beginning */
+	unsigned int retry_exp;         /* after an error, date before which it must not be used */
+	unsigned int exp;               /* connect, response or idle timeout, checked by the resolvers task */
+	int          pending;           /* number of queries queued or sent and not answered yet */
+	long        *qids;              /* bitmap of the ids of these queries */
+};
+
+/* name server flags */
+#define DNS_NS_F_TCP            0x00000001  /* only use TCP ("tcp@" address) */
+
 /* Structure describing a name server used during name resolution.
  * A name server belongs to a resolvers section.
  */
@@ -213,7 +250,9 @@ struct dns_nameserver {
 
 	struct dns_resolvers   *resolvers;
 	struct dgram_conn      *dgram;  /* transport layer */
+	struct dns_stream      *stream; /* TCP transport, for "tcp@" and truncated responses */
 	struct sockaddr_storage addr;   /* IP address */
+	unsigned int            flags;  /* DNS_NS_F_* */
 
 	struct {                        /* numbers relted to this name server: */
 		long long sent;         /* - queries sent */
@@ -231,6 +270,7 @@ struct dns_nameserver {
 		long long too_big;      /* - too big response */
 		long long outdated;     /* - outdated response (server slower than the other ones) */
 		long long truncated;    /* - truncated response */
+		long long tcp;          /* - queries sent over TCP */
 	} counters;
 	struct list list;               /* nameserver chained list */
 };
@@ -270,6 +310,7 @@ struct dns_resolution {
 	unsigned int          last_valid;          /* time of the last valid response */
 	int                   query_id;            /* DNS query ID dedicated for this resolution */
 	struct eb32_node      qid;                 /* ebtree query id */
+	struct eb32_node      name;                /* place in the resolvers' names tree */
 	int                   prefered_query_type; /* preferred query type */
 	int                   query_type;          /* current query type  */
 	int                   status;              /* status of the resolution being processed RSLV_STATUS_* */
@@ -155,6 +155,7 @@ struct global {
 		int requri_len;    /* max len of request URI, use REQURI_LEN if zero */
 		int cookie_len;    /* max length of cookie captures */
 		int pattern_cache; /* max number of entries in the pattern cache. */
+		int pattern_regset; /* min number of "-m reg" patterns compiled as a set, 0 = never */
 		int sslcachesize;  /* SSL cache size in session, defaults to 20000 */
 		int comp_maxlevel;    /* max HTTP compression level */
 		int pool_low_ratio;   /* max ratio of FDs used before we stop using new idle connections */
@@ -279,6 +280,7 @@ void hap_register_build_opts(const char *str, int must_free);
 void hap_register_post_check(int (*fct)());
 void hap_register_post_proxy_check(int (*fct)(struct proxy *));
 void hap_register_post_server_check(int (*fct)(struct server *));
+void hap_register_pre_deinit(void (*fct)());
 void hap_register_post_deinit(void (*fct)());
 void hap_register_proxy_deinit(void (*fct)(struct proxy *));
 void hap_register_server_deinit(void (*fct)(struct server *));
@@ -307,6 +309,10 @@ void mworker_reload();
 #define REGISTER_POST_SERVER_CHECK(fct) \
 	INITCALL1(STG_REGISTER, hap_register_post_server_check, (fct))
 
+/* simplified way to declare a pre-deinit callback in a file */
+#define REGISTER_PRE_DEINIT(fct) \
+	INITCALL1(STG_REGISTER, hap_register_pre_deinit, (fct))
+
 /* simplified way to declare a post-deinit callback in a file */
 #define REGISTER_POST_DEINIT(fct) \
 	INITCALL1(STG_REGISTER, hap_register_post_deinit, (fct))
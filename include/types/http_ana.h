@@ -73,6 +73,14 @@
 /* used only for keep-alive purposes, to indicate we're on a second transaction */
 #define TX_NOT_FIRST	0x00040000	/* the transaction is not the first one */
 
+#define TX_CACHE_HAS_SEC_KEY 0x00080000	/* the cache secondary key was computed for this request */
+
+/* Length of the cache secondary key: one 32-bit hash per request header which
+ * may be named in a response's Vary header, followed by the negotiated
+ * content-coding (see src/cache.c).
+ */
+#define HTTP_CACHE_SEC_KEY_LEN (6 * sizeof(uint32_t))
+
 /*
  * HTTP message status flags (msg->flags)
  */
@@ -178,6 +186,7 @@ struct http_txn {
 	struct http_reply *http_reply;  /* The HTTP reply to use as reply */
 
 	char cache_hash[20];               /* Store the cache hash  */
+	char cache_secondary_hash[HTTP_CACHE_SEC_KEY_LEN]; /* Store the cache secondary key (Vary) */
 	char *uri;                      /* first line if log needed, NULL otherwise */
 	char *cli_cookie;               /* cookie presented by the client, in capture mode */
 	char *srv_cookie;               /* cookie presented by the server, in capture mode */
@@ -0,0 +1,46 @@
+/*
+ * include/types/lb_maglev.h
+ * Types for Maglev hashing load-balancing
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TYPES_LB_MAGLEV_H
+#define _TYPES_LB_MAGLEV_H
+
+#include <common/config.h>
+#include <types/server.h>
+
+/* minimum number of lookup table entries per server */
+#define MAGLEV_ENTRIES_PER_SRV 100
+
+struct lb_maglev {
+	struct server **table;	/* lookup table of <size> entries */
+	unsigned int size;	/* number of entries, a prime number */
+	unsigned int rr_idx;	/* next entry to be elected in round robin mode */
+	int nbsrv;		/* number of servers of the backend */
+	unsigned int *pos;	/* per-server position in its permutation (build only) */
+	unsigned int *skip;	/* per-server permutation step (build only) */
+	int *credit;		/* per-server weight credit (build only) */
+};
+
+#endif /* _TYPES_LB_MAGLEV_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -154,6 +154,12 @@ struct logformat_node {
 	int options;   // LOG_OPT_*
 	char *arg;     // text for LOG_FMT_TEXT, arg for others
 	void *expr;    // for use with LOG_FMT_EXPR
+	/* the fields below are set by compile_logformat_list() */
+	struct logformat_node *next; // next node to emit, NULL after the last one
+	int arg_len;   // length of the node's own text in <arg> for LOG_FMT_TEXT
+	int lit_len;   // if not zero, length of the literal run placed in <arg>
+	int lit_tail;  // offset of the run's last part, for truncation
+	int lit_space; // whether the run ends with a space
 };
 
 #define LOG_OPT_HEXA		0x00000001
@@ -184,6 +190,34 @@ struct logformat_node {
 #define LW_FRTIP 	8192	/* frontend IP */
 #define LW_XPRT		16384	/* transport layer information (eg: SSL) */
 
+/* Binary access log records, emitted instead of the log-format line when
+ * "option binlog" is set. A record is made of a magic byte, a type byte, the
+ * length of the body encoded as a varint, the body and a trailer byte. All
+ * fixed-size integers are little endian. The proxy and server names are not
+ * in the access records. Each frontend sends the names of all proxies and
+ * servers in name records to all its loggers before its first access record,
+ * then once per BINLOG_NAMES_PERIOD seconds.
+ * See doc/configuration.txt for the layout of the bodies.
+ */
+#define BINLOG_MAGIC            0xFE
+#define BINLOG_TRAILER          0xFF
+#define BINLOG_T_ACCESS         'R'
+#define BINLOG_T_NAME           'N'
+
+#define BINLOG_NAMES_PERIOD     60
+
+/* flags of the access records */
+#define BINLOG_F_HTTP           0x01    /* HTTP transaction, status and request are valid */
+#define BINLOG_F_IPV4           0x02    /* the client address is IPv4 */
+#define BINLOG_F_IPV6           0x04    /* the client address is IPv6 */
+#define BINLOG_F_APPLET         0x08    /* the server is an applet, its name is in the record */
+#define BINLOG_F_REDISP         0x10    /* the stream was redispatched */
+#define BINLOG_F_ASAP           0x20    /* logged before the end ("option logasap") */
+
+/* kinds of name records */
+#define BINLOG_N_PROXY          1
+#define BINLOG_N_SERVER         2
+
 /* Range of indexes for log sampling. */
 struct smp_log_range {
 	unsigned int low;        /* Low limit of the indexes of this range. */
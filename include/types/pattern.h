@@ -26,6 +26,7 @@
 #include <common/config.h>
 #include <common/mini-clist.h>
 #include <common/regex.h>
+#include <common/regset.h>
 
 #include <types/sample.h>
 
@@ -174,6 +175,18 @@ struct pattern_list {
 	struct pattern pat;
 };
 
+/* The "-m reg" patterns of an expression compiled into a single regset. The
+ * patterns the regset refused are still executed one at a time, and only
+ * when they come before the first pattern the regset matched.
+ */
+struct pat_regset {
+	struct regset *set;               /* ids are positions in the list */
+	struct pattern **pats;            /* patterns by position in the list */
+	unsigned int *fallback;           /* positions of the patterns not in <set> */
+	unsigned int nb_pats, nb_fallback;
+	unsigned long long fallback_execs; /* patterns executed by the regex library */
+};
+
 /* Description of a pattern expression.
  * It contains pointers to the parse and match functions, and a list or tree of
  * patterns to test against. The structure is organized so that the hot parts
@@ -193,6 +206,9 @@ struct pattern_expr {
 	struct eb_root pattern_tree_2;  /* may be used for different types */
 	int mflags;                     /* flags relative to the parsing or matching method. */
 	__decl_hathreads(HA_RWLOCK_T lock);               /* lock used to protect patterns */
+	struct pat_regset *regset;      /* "-m reg" patterns compiled together, or NULL */
+	unsigned long long regset_rev;  /* revision <regset> was last built for */
+	__decl_hathreads(HA_SPINLOCK_T regset_lock);      /* serializes the regset builds */
 };
 
 /* This is a list of expression. A struct pattern_expr can be used by
@@ -71,6 +71,8 @@ struct peer {
 	uint32_t no_hbt;              /* no received heartbeat counter */
 	uint32_t new_conn;            /* new connection after reconnection timeout expiration counter */
 	uint32_t proto_err;           /* protocol errors counter */
+	unsigned int batch_size;      /* largest batch of updates accepted by the remote peer */
+	unsigned int thr;             /* thread running the outgoing sessions to this peer */
 	struct appctx *appctx;        /* the appctx running it */
 	struct shared_table *remote_table;
 	struct shared_table *last_local_table;
@@ -99,6 +101,7 @@ struct peers {
 	unsigned int flags;             /* current peers section resync state */
 	unsigned int resync_timeout;    /* resync timeout timer */
 	int count;                      /* total of peers */
+	int compress;                   /* deflate batched updates if the remote peer supports it */
 };
 
 /* LRU cache for dictionaies */
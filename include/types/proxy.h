@@ -156,7 +156,8 @@ enum PR_SRV_STATE_FILE {
 #define PR_O2_SRC_ADDR	0x00100000	/* get the source ip and port for logs */
 
 #define PR_O2_FAKE_KA   0x00200000      /* pretend we do keep-alive with server eventhough we close */
-/* unused : 0x00400000..0x80000000 */
+#define PR_O2_BINLOG    0x00400000      /* emit binary access log records instead of text lines */
+/* unused : 0x00800000..0x80000000 */
 
 /* server health checks */
 #define PR_O2_CHK_NONE  0x00000000      /* no L7 health checks configured (TCP by default) */
@@ -377,6 +378,7 @@ struct proxy {
 	unsigned down_trans;			/* up-down transitions */
 	unsigned down_time;			/* total time the proxy was down */
 	unsigned int log_count;			/* number of logs produced by the frontend */
+	unsigned int binlog_date;		/* last date the names were sent to the binary loggers (seconds) */
 	time_t last_change;			/* last time, when the state was changed */
 	int (*accept)(struct stream *s);       /* application layer's accept() */
 	struct conn_src conn_src;               /* connection source settings */
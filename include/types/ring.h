@@ -53,6 +53,17 @@
  * cannot fit due to insufficient room, the message is lost and the drop
  * counted must be incremented.
  *
+ * Multiple writers may run in parallel. Each of them only holds the write lock
+ * while reserving its block: it deletes old records if needed, then writes the
+ * size and the next readers count, and advances the tail past them. It then
+ * copies its payload without the lock, and sets the readers count, which was
+ * RING_BUSY until then, to zero to mark the block ready. The <committed>
+ * absolute offset is advanced past the ready blocks which follow it by any
+ * writer, up to the <reserved> absolute offset, so that a block is published
+ * as soon as all the blocks reserved before it are ready. Readers never look
+ * beyond <committed>, and writers never delete a block which is not published
+ * yet. They release the lock while waiting for it to be published.
+ *
  * Like any buffer, this buffer naturally wraps at the end and continues at the
  * beginning. The creation process consists in immediately adding a null
  * readers count byte into the buffer. The write process consists in always
@@ -93,9 +104,14 @@
  *                 removed
  */
 
+/* value of the read counter which follows a message being written */
+#define RING_BUSY 0xff
+
 struct ring {
 	struct buffer buf;   // storage area
 	size_t ofs;          // absolute offset in history of the buffer's head
+	size_t committed;    // absolute offset of the end of published blocks
+	size_t reserved;     // absolute offset of the end of reserved blocks
 	struct list waiters; // list of waiters, for now, CLI "show event"
 	__decl_hathreads(HA_RWLOCK_T lock);
 	int readers_count;
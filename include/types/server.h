@@ -228,8 +228,10 @@ struct server {
 
 	struct eb_root pendconns;		/* pending connections */
 	struct list actconns;			/* active connections */
-	struct mt_list *idle_conns;		/* shareable idle connections*/
-	struct mt_list *safe_conns;		/* safe idle connections */
+	struct eb_root *idle_conns_tree;	/* shareable idle connections, per thread, indexed by connection hash */
+	struct eb_root *safe_conns_tree;	/* safe idle connections, per thread, indexed by connection hash */
+	struct mt_list *idle_conns;		/* same connections as idle_conns_tree, per thread, oldest first */
+	struct mt_list *safe_conns;		/* same connections as safe_conns_tree, per thread, oldest first */
 	struct list *available_conns;           /* Connection in used, but with still new streams available */
 	unsigned int pool_purge_delay;          /* Delay before starting to purge the idle conns pool */
 	unsigned int max_idle_conns;            /* Max number of connection allowed in the orphan connections list */
@@ -270,6 +272,8 @@ struct server {
 	unsigned lb_nodes_tot;                  /* number of allocated lb_nodes (C-HASH) */
 	unsigned lb_nodes_now;                  /* number of lb_nodes placed in the tree (C-HASH) */
 	struct tree_occ *lb_nodes;              /* lb_nodes_tot * struct tree_occ */
+	unsigned int lb_ewma;                   /* peak-EWMA of the response time for "ewma" (ms << LB_EWMA_SCALE) */
+	unsigned int lb_ewma_date;              /* date of the last <lb_ewma> update (now_ms) */
 
 	const struct netns_entry *netns;        /* contains network namespace name or NULL. Network namespace comes from configuration */
 	/* warning, these structs are huge, keep them at the bottom */
@@ -335,6 +339,7 @@ struct server {
 	struct eb_root cids;
 #endif
 	struct dns_srvrq *srvrq;		/* Pointer representing the DNS SRV requeest, if any */
+	struct eb32_node srvrq_node;		/* place in the SRV request's index while applying a response */
 	__decl_hathreads(HA_SPINLOCK_T lock);   /* may enclose the proxy's lock, must not be taken under */
 	struct {
 		const char *file;		/* file where the section appears */
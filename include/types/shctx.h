@@ -43,6 +43,10 @@ struct shared_context {
 	unsigned int max_obj_size;   /* maximum object size (in bytes). */
 	void (*free_block)(struct shared_block *first, struct shared_block *block);
 	short int block_size;
+	unsigned int nbseg;           /* number of segments, 0 if not segmented */
+	unsigned int seg_blocks;      /* blocks per segment, the last one also gets the remainder */
+	struct shared_context *segs;  /* segments, each with its own lock and lists */
+	struct shared_block *blocks;  /* first block */
 	unsigned char data[0];
 };
 
@@ -435,6 +435,8 @@ enum stat_field {
 	ST_F_RT_MAX,
 	ST_F_TT_MAX,
 	ST_F_EINT,
+	ST_F_IDLE_HITS,
+	ST_F_IDLE_MISS,
 
 	/* must always be the last one */
 	ST_F_TOTAL_FIELDS
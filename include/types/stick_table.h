@@ -131,6 +131,38 @@ struct stktable_type {
 
 extern struct stktable_type stktable_types[];
 
+/* Stick-table snapshot context. A snapshot is dumped incrementally into a
+ * memory-mapped temporary file which is atomically renamed once complete, so
+ * that the last complete snapshot is always the one found on disk.
+ */
+struct stktable_snapshot {
+	char *file;               /* snapshot file name, NULL if disabled */
+	unsigned int period;      /* delay between two snapshots, in ms */
+	int proc;                 /* relative process number in charge of the snapshots, 0 once the last one is saved */
+	int final;                /* set once the last snapshot before stopping is being dumped */
+	struct task *task;        /* periodic snapshot task */
+	char *tmpfile;            /* temporary file name, NULL if no snapshot in progress */
+	int fd;                   /* temporary file being written, -1 if none */
+	unsigned long long date;  /* wall clock date of the snapshot start, in ms */
+	char *area;               /* mapped area of the temporary file */
+	size_t size;              /* size of the mapped area */
+	size_t data;              /* number of bytes already written in <area> */
+	unsigned long long entries; /* number of entries already dumped */
+	struct stksess *cursor;   /* next entry to dump (referenced), NULL if none */
+};
+
+/* count-min sketch used to keep approximate counters for the keys which are
+ * not present in the table anymore. Each cell holds a complete data area laid
+ * out exactly like the one preceding an stksess, so that the same data offsets
+ * apply.
+ */
+struct stktable_sketch {
+	unsigned int width;       /* number of cells per row, 0 if no sketch */
+	unsigned int depth;       /* number of rows (independent hashes) */
+	unsigned int stride;      /* size of a cell in bytes */
+	char *cells;              /* <depth> rows of <width> cells */
+};
+
 /* Sticky session.
  * Any additional data related to the stuck session is installed *before*
  * stksess (with negative offsets). This allows us to run variable-sized
@@ -192,6 +224,8 @@ struct stktable {
 	} data_arg[STKTABLE_DATA_TYPES]; /* optional argument of each data type */
 	struct proxy *proxy;      /* The proxy this stick-table is attached to, if any.*/
 	struct proxy *proxies_list; /* The list of proxies which reference this stick-table. */
+	struct stktable_snapshot snapshot; /* on-disk snapshot of the entries */
+	struct stktable_sketch sketch; /* approximate counters of evicted entries */
 };
 
 extern struct stktable_data_type stktable_data_types[STKTABLE_DATA_TYPES];
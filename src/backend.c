@@ -30,6 +30,8 @@
 #include <common/time.h>
 #include <common/namespace.h>
 
+#include <import/xxhash.h>
+
 #include <types/global.h>
 
 #include <proto/acl.h>
@@ -43,6 +45,7 @@
 #include <proto/lb_fas.h>
 #include <proto/lb_fwlc.h>
 #include <proto/lb_fwrr.h>
+#include <proto/lb_maglev.h>
 #include <proto/lb_map.h>
 #include <proto/log.h>
 #include <proto/mux_pt.h>
@@ -189,6 +192,8 @@ static struct server *get_server_sh(struct proxy *px, const char *addr, int len,
  hash_done:
 	if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 		return chash_get_server_hash(px, h, avoid);
+	else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+		return maglev_get_server_hash(px, h, avoid);
 	else
 		return map_get_server_hash(px, h);
 }
@@ -244,6 +249,8 @@ static struct server *get_server_uh(struct proxy *px, char *uri, int uri_len, co
  hash_done:
 	if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 		return chash_get_server_hash(px, hash, avoid);
+	else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+		return maglev_get_server_hash(px, hash, avoid);
 	else
 		return map_get_server_hash(px, hash);
 }
@@ -301,6 +308,8 @@ static struct server *get_server_ph(struct proxy *px, const char *uri, int uri_l
 
 				if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 					return chash_get_server_hash(px, hash, avoid);
+				else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+					return maglev_get_server_hash(px, hash, avoid);
 				else
 					return map_get_server_hash(px, hash);
 			}
@@ -381,6 +390,8 @@ static struct server *get_server_ph_post(struct stream *s, const struct server *
 
 				if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 					return chash_get_server_hash(px, hash, avoid);
+				else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+					return maglev_get_server_hash(px, hash, avoid);
 				else
 					return map_get_server_hash(px, hash);
 			}
@@ -476,6 +487,8 @@ static struct server *get_server_hh(struct stream *s, const struct server *avoid
  hash_done:
 	if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 		return chash_get_server_hash(px, hash, avoid);
+	else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+		return maglev_get_server_hash(px, hash, avoid);
 	else
 		return map_get_server_hash(px, hash);
 }
@@ -521,11 +534,50 @@ static struct server *get_server_rch(struct stream *s, const struct server *avoi
  hash_done:
 	if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 		return chash_get_server_hash(px, hash, avoid);
+	else if ((px->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+		return maglev_get_server_hash(px, hash, avoid);
 	else
 		return map_get_server_hash(px, hash);
 }
 
-/* random value  */
+/* Returns the peak-EWMA <ewma> of a server's response time, halved for each
+ * LB_EWMA_HALFLIFE period elapsed since its last update at <date>.
+ */
+static inline unsigned int lb_ewma_get(unsigned int ewma, unsigned int date)
+{
+	unsigned int elapsed = now_ms - date;
+
+	if (elapsed >= 32 * LB_EWMA_HALFLIFE)
+		return 0;
+	return ewma >> (elapsed / LB_EWMA_HALFLIFE);
+}
+
+/* Feeds the response time <sample> in milliseconds of a request processed by
+ * server <srv> into its peak-EWMA used by the "ewma" algorithm. It is lock-free
+ * and may be called concurrently from any thread.
+ */
+void lb_ewma_update(struct server *srv, unsigned int sample)
+{
+	unsigned int old, new;
+
+	if (sample >= LB_EWMA_MAX >> LB_EWMA_SCALE)
+		sample = (LB_EWMA_MAX >> LB_EWMA_SCALE) - 1;
+	sample <<= LB_EWMA_SCALE;
+
+	old = srv->lb_ewma;
+	do {
+		new = lb_ewma_get(old, srv->lb_ewma_date);
+		if (sample >= new)
+			new = sample;
+		else
+			new -= (new - sample) >> LB_EWMA_WEIGHT;
+	} while (!_HA_ATOMIC_CAS(&srv->lb_ewma, &old, new));
+	srv->lb_ewma_date = now_ms;
+}
+
+/* random value. With the "ewma" algorithm, the server with the lowest product
+ * of its response time and outstanding requests is picked among the draws.
+ */
 static struct server *get_server_rnd(struct stream *s, const struct server *avoid)
 {
 	unsigned int hash = 0;
@@ -545,11 +597,28 @@ static struct server *get_server_rnd(struct stream *s, const struct server *avoi
 		if (!curr)
 			break;
 
+		if (!prev || prev == curr)
+			continue;
+
+		if ((px->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA) {
+			/* the cost is the response time multiplied by the
+			 * number of outstanding requests, which degrades to
+			 * the latter when no time was measured.
+			 */
+			uint64_t ccost, pcost;
+
+			ccost = lb_ewma_get(curr->lb_ewma, curr->lb_ewma_date) + (1 << LB_EWMA_SCALE);
+			ccost *= curr->served + curr->nbpend + 1;
+			pcost = lb_ewma_get(prev->lb_ewma, prev->lb_ewma_date) + (1 << LB_EWMA_SCALE);
+			pcost *= prev->served + prev->nbpend + 1;
+
+			if (ccost * prev->cur_eweight > pcost * curr->cur_eweight)
+				curr = prev;
+		}
 		/* compare the new server to the previous best choice and pick
 		 * the one with the least currently served requests.
 		 */
-		if (prev && prev != curr &&
-		    curr->served * prev->cur_eweight > prev->served * curr->cur_eweight)
+		else if (curr->served * prev->cur_eweight > prev->served * curr->cur_eweight)
 			curr = prev;
 	} while (--draws > 0);
 
@@ -660,9 +729,11 @@ int assign_server(struct stream *s)
 			break;
 
 		case BE_LB_LKUP_CHTREE:
+		case BE_LB_LKUP_MGTABLE:
 		case BE_LB_LKUP_MAP:
 			if ((s->be->lbprm.algo & BE_LB_KIND) == BE_LB_KIND_RR) {
-				if ((s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM)
+				if ((s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM ||
+				    (s->be->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA)
 					srv = get_server_rnd(s, prev_srv);
 				else if ((s->be->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 					srv = chash_get_next_server(s->be, prev_srv);
@@ -742,6 +813,8 @@ int assign_server(struct stream *s)
 			if (!srv) {
 				if ((s->be->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_CHTREE)
 					srv = chash_get_next_server(s->be, prev_srv);
+				else if ((s->be->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+					srv = maglev_get_next_server(s->be, prev_srv);
 				else
 					srv = map_get_server_rr(s->be, prev_srv);
 			}
@@ -1014,73 +1087,153 @@ int assign_server_and_queue(struct stream *s)
  * assigned to the stream's pending connection. This function assumes that an
  * outgoing connection has already been assigned to s->si[1].end.
  */
-static void assign_tproxy_address(struct stream *s)
+/* Fills <addr> with the source address the connection of stream <s> must be
+ * bound to when a "usesrc" setting applies. Returns the CO_SRC_TPROXY_* mode
+ * in use, or 0 if the source address is left to the system.
+ */
+static int get_tproxy_address(struct stream *s, struct sockaddr_storage *addr)
 {
 #if defined(CONFIG_HAP_TRANSPARENT)
 	struct server *srv = objt_server(s->target);
 	struct conn_src *src;
 	struct connection *cli_conn;
-	struct connection *srv_conn;
-
-	if (objt_cs(s->si[1].end))
-		srv_conn = cs_conn(__objt_cs(s->si[1].end));
-	else
-		srv_conn = objt_conn(s->si[1].end);
 
 	if (srv && srv->conn_src.opts & CO_SRC_BIND)
 		src = &srv->conn_src;
 	else if (s->be->conn_src.opts & CO_SRC_BIND)
 		src = &s->be->conn_src;
 	else
-		return;
-
-	if (!sockaddr_alloc(&srv_conn->src))
-		return;
+		return 0;
 
 	switch (src->opts & CO_SRC_TPROXY_MASK) {
 	case CO_SRC_TPROXY_ADDR:
-		*srv_conn->src = src->tproxy_addr;
+		*addr = src->tproxy_addr;
 		break;
 	case CO_SRC_TPROXY_CLI:
 	case CO_SRC_TPROXY_CIP:
 		/* FIXME: what can we do if the client connects in IPv6 or unix socket ? */
 		cli_conn = objt_conn(strm_orig(s));
 		if (cli_conn && conn_get_src(cli_conn))
-			*srv_conn->src = *cli_conn->src;
-		else {
-			sockaddr_free(&srv_conn->src);
-		}
+			*addr = *cli_conn->src;
+		else
+			return 0;
 		break;
 	case CO_SRC_TPROXY_DYN:
-		if (src->bind_hdr_occ && IS_HTX_STRM(s)) {
+		if (!src->bind_hdr_occ || !IS_HTX_STRM(s))
+			return 0;
+		else {
 			char *vptr;
 			size_t vlen;
 
 			/* bind to the IP in a header */
-			((struct sockaddr_in *)srv_conn->src)->sin_family = AF_INET;
-			((struct sockaddr_in *)srv_conn->src)->sin_port = 0;
-			((struct sockaddr_in *)srv_conn->src)->sin_addr.s_addr = 0;
+			memset(addr, 0, sizeof(*addr));
+			((struct sockaddr_in *)addr)->sin_family = AF_INET;
 			if (http_get_htx_hdr(htxbuf(&s->req.buf),
 					     ist2(src->bind_hdr_name, src->bind_hdr_len),
 					     src->bind_hdr_occ, NULL, &vptr, &vlen)) {
-				((struct sockaddr_in *)srv_conn->src)->sin_addr.s_addr =
+				((struct sockaddr_in *)addr)->sin_addr.s_addr =
 					htonl(inetaddr_host_lim(vptr, vptr + vlen));
 			}
 		}
 		break;
 	default:
-		sockaddr_free(&srv_conn->src);
+		return 0;
 	}
+	return src->opts & CO_SRC_TPROXY_MASK;
+#else
+	return 0;
 #endif
 }
 
-/* Attempt to get a backend connection from the specified mt_list array
- * (safe or idle connections).
+/* Sets the source address of the connection of stream <s> to the transparent
+ * proxy address designated by the "usesrc" setting, if any.
+ */
+static void assign_tproxy_address(struct stream *s)
+{
+	struct connection *srv_conn;
+	struct sockaddr_storage addr;
+
+	if (objt_cs(s->si[1].end))
+		srv_conn = cs_conn(__objt_cs(s->si[1].end));
+	else
+		srv_conn = objt_conn(s->si[1].end);
+
+	if (!get_tproxy_address(s, &addr))
+		return;
+
+	if (!sockaddr_alloc(&srv_conn->src))
+		return;
+
+	*srv_conn->src = addr;
+}
+
+/* Mixes parameter <param> whose value is made of the <len> bytes at <data>
+ * into the connection hash <hash> and returns the new hash.
+ */
+static inline uint64_t conn_hash_update(uint64_t hash, enum conn_hash_param param, const void *data, size_t len)
+{
+	return XXH64(data, len, hash ^ ((uint64_t)param << 56));
+}
+
+/* Computes the hash of the parameters of the connection stream <s> would
+ * establish to server <srv>, <cli_conn> being the client connection if any:
+ * the SNI <sni> already evaluated by the caller if any, the client-dependent
+ * source address, the PROXY protocol header and the network namespace learned
+ * from the client. Two streams only get the same hash if they would establish
+ * identical connections, so that they may share them. Connections with the
+ * server's default parameters all hash to 0. Since the PROXY protocol header
+ * holds the client's port, connections sending it remain private, and the
+ * header only distinguishes them within the session (e.g. unique-id TLVs).
  */
-static struct connection *conn_backend_get(struct server *srv, int is_safe)
+static uint64_t conn_calculate_hash(struct stream *s, struct server *srv, struct connection *cli_conn,
+                                    const struct buffer *sni)
 {
-	struct mt_list *mt_list = is_safe ? srv->safe_conns : srv->idle_conns;
-	struct connection *conn;
+	struct sockaddr_storage addr;
+	uint64_t hash = 0;
+
+	if (sni)
+		hash = conn_hash_update(hash, CONN_HASH_PARAM_SNI, sni->area, sni->data);
+
+	switch (get_tproxy_address(s, &addr)) {
+	case CO_SRC_TPROXY_CIP:
+		/* only the address is bound */
+		set_host_port(&addr, 0);
+		/* fall through */
+	case CO_SRC_TPROXY_CLI:
+	case CO_SRC_TPROXY_DYN:
+		hash = conn_hash_update(hash, CONN_HASH_PARAM_SRC, &addr, get_addr_len(&addr));
+		break;
+	}
+
+	if (srv && srv->pp_opts) {
+		struct buffer *chk = get_trash_chunk();
+		int len;
+
+		if (cli_conn) {
+			conn_get_src(cli_conn);
+			conn_get_dst(cli_conn);
+		}
+		len = make_proxy_line(chk->area, chk->size, srv, cli_conn, s);
+		if (len > 0)
+			hash = conn_hash_update(hash, CONN_HASH_PARAM_PROXY, chk->area, len);
+	}
+
+#ifdef USE_NS
+	if (srv && (srv->flags & SRV_F_USE_NS_FROM_PP) && cli_conn && cli_conn->proxy_netns)
+		hash = conn_hash_update(hash, CONN_HASH_PARAM_NETNS,
+					&cli_conn->proxy_netns, sizeof(cli_conn->proxy_netns));
+#endif
+	return hash;
+}
+
+/* Attempt to get a backend connection whose parameters hash to <hash> from
+ * the specified tree array (safe or idle connections).
+ */
+static struct connection *conn_backend_get(struct server *srv, int is_safe, uint64_t hash)
+{
+	struct eb_root *tree = is_safe ? srv->safe_conns_tree : srv->idle_conns_tree;
+	struct eb64_node *node;
+	struct connection *conn = NULL;
 	int i;
 	int found = 0;
 
@@ -1089,7 +1242,12 @@ static struct connection *conn_backend_get(struct server *srv, int is_safe)
 	 * to end up with two threads using the same connection.
 	 */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
-	conn = MT_LIST_POP(&mt_list[tid], struct connection *, list);
+	node = eb64_lookup(&tree[tid], hash);
+	if (node) {
+		eb64_delete(node);
+		conn = eb64_entry(node, struct connection, hash_node);
+		MT_LIST_DEL(&conn->list);
+	}
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
 	/* If we found a connection in our own list, and we don't have to
@@ -1102,12 +1260,12 @@ static struct connection *conn_backend_get(struct server *srv, int is_safe)
 
 	/* Lookup all other threads for an idle connection, starting from tid + 1 */
 	for (i = tid; !found && (i = ((i + 1 == global.nbthread) ? 0 : i + 1)) != tid;) {
-		struct mt_list *elt1, elt2;
-
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
-		mt_list_for_each_entry_safe(conn, &mt_list[i], list, elt1, elt2) {
+		for (node = eb64_lookup(&tree[i], hash); node && node->key == hash; node = eb64_next(node)) {
+			conn = eb64_entry(node, struct connection, hash_node);
 			if (conn->mux->takeover && conn->mux->takeover(conn) == 0) {
-				MT_LIST_DEL_SAFE(elt1);
+				eb64_delete(node);
+				MT_LIST_DEL(&conn->list);
 				found = 1;
 				break;
 			}
@@ -1151,9 +1309,11 @@ int connect_server(struct stream *s)
 	struct conn_stream *srv_cs = NULL;
 	struct sess_srv_list *srv_list;
 	struct server *srv;
+	struct buffer *sni = NULL;
 	int reuse = 0;
 	int reuse_orphan = 0;
 	int init_mux = 0;
+	uint64_t hash;
 	int err;
 
 
@@ -1162,11 +1322,33 @@ int connect_server(struct stream *s)
 	 */
 	si_release_endpoint(&s->si[1]);
 
+	srv = objt_server(s->target);
+
+#ifdef USE_OPENSSL
+	/* the SNI is evaluated once for both the hash and the new connection */
+	if (srv && srv->ssl_ctx.sni) {
+		struct sample *smp;
+
+		smp = sample_fetch_as_type(s->be, s->sess, s, SMP_OPT_DIR_REQ | SMP_OPT_FINAL,
+					   srv->ssl_ctx.sni, SMP_T_STR);
+		if (smp_make_safe(smp)) {
+			sni = alloc_trash_chunk();
+			if (!sni)
+				return SF_ERR_RESOURCE;
+			chunk_memcpy(sni, smp->data.u.str.area, smp->data.u.str.data);
+			sni->area[sni->data] = 0;
+		}
+	}
+#endif
+
+	/* only connections established with the same parameters may be reused */
+	hash = conn_calculate_hash(s, srv, cli_conn, sni);
+
 	/* first, search for a matching connection in the session's idle conns */
 	list_for_each_entry(srv_list, &s->sess->srv_list, srv_list) {
 		if (srv_list->target == s->target) {
 			list_for_each_entry(srv_conn, &srv_list->conn_list, session_list) {
-				if (conn_xprt_ready(srv_conn) &&
+				if (conn_xprt_ready(srv_conn) && srv_conn->hash_node.key == hash &&
 				    srv_conn->mux && (srv_conn->mux->avail_streams(srv_conn) > 0)) {
 					reuse = 1;
 					break;
@@ -1179,8 +1361,6 @@ int connect_server(struct stream *s)
 	if (!reuse)
 		srv_conn = NULL;
 
-	srv = objt_server(s->target);
-
 	if (srv && !reuse) {
 		srv_conn = NULL;
 
@@ -1204,27 +1384,52 @@ int connect_server(struct stream *s)
 		 */
 		if (srv->available_conns && !LIST_ISEMPTY(&srv->available_conns[tid]) &&
 		    ((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR)) {
-			    srv_conn = LIST_ELEM(srv->available_conns[tid].n, struct connection *, list);
-			    reuse = 1;
+			struct list *elt;
+
+			for (elt = srv->available_conns[tid].n; elt != &srv->available_conns[tid]; elt = elt->n) {
+				srv_conn = LIST_ELEM(elt, struct connection *, list);
+				if (srv_conn->hash_node.key == hash) {
+					reuse = 1;
+					break;
+				}
+			}
+			if (!reuse)
+				srv_conn = NULL;
 		}
-		else if (!srv_conn && srv->curr_idle_conns > 0) {
-			if (srv->idle_conns &&
+
+		if (!srv_conn && srv->curr_idle_conns > 0) {
+			int looked_up = 0;
+			int idle_looked_up = 0;
+
+			/* since only connections with the same hash may be
+			 * picked, a miss in one tree falls back to the next one.
+			 */
+			if (srv->idle_conns_tree &&
 			    ((s->be->options & PR_O_REUSE_MASK) != PR_O_REUSE_NEVR &&
 			     s->txn && (s->txn->flags & TX_NOT_FIRST)) &&
 			    srv->curr_idle_nb > 0) {
-				srv_conn = conn_backend_get(srv, 0);
+				srv_conn = conn_backend_get(srv, 0, hash);
+				looked_up = idle_looked_up = 1;
 			}
-			else if (srv->safe_conns &&
-			         ((s->txn && (s->txn->flags & TX_NOT_FIRST)) ||
-				  (s->be->options & PR_O_REUSE_MASK) >= PR_O_REUSE_AGGR) &&
-				 srv->curr_safe_nb > 0) {
-				srv_conn = conn_backend_get(srv, 1);
+			if (!srv_conn && srv->safe_conns_tree &&
+			    ((s->txn && (s->txn->flags & TX_NOT_FIRST)) ||
+			     (s->be->options & PR_O_REUSE_MASK) >= PR_O_REUSE_AGGR) &&
+			    srv->curr_safe_nb > 0) {
+				srv_conn = conn_backend_get(srv, 1, hash);
+				looked_up = 1;
 			}
-			else if (srv->idle_conns &&
-			         ((s->be->options & PR_O_REUSE_MASK) == PR_O_REUSE_ALWS) &&
-				 srv->curr_idle_nb > 0) {
-				srv_conn = conn_backend_get(srv, 0);
+			if (!srv_conn && !idle_looked_up && srv->idle_conns_tree &&
+			    ((s->be->options & PR_O_REUSE_MASK) == PR_O_REUSE_ALWS) &&
+			    srv->curr_idle_nb > 0) {
+				srv_conn = conn_backend_get(srv, 0, hash);
+				looked_up = 1;
+			}
+
+			if (looked_up) {
+				_HA_ATOMIC_ADD(srv_conn ? &srv->counters.idle_hits : &srv->counters.idle_miss, 1);
+				_HA_ATOMIC_ADD(srv_conn ? &s->be->be_counters.idle_hits : &s->be->be_counters.idle_miss, 1);
 			}
+
 			/* If we've picked a connection from the pool, we now have to
 			 * detach it. We may have to get rid of the previous idle
 			 * connection we had, so for this we try to swap it with the
@@ -1239,35 +1444,16 @@ int connect_server(struct stream *s)
 		}
 	}
 
-
-	/* here reuse might have been set above, indicating srv_conn finally
-	 * is OK.
-	 */
-	if (reuse) {
-		/* Disable connection reuse if a dynamic source is used.
-		 * As long as we don't share connections between servers,
-		 * we don't need to disable connection reuse on no-idempotent
-		 * requests nor when PROXY protocol is used.
-		 */
-		if (srv && srv->conn_src.opts & CO_SRC_BIND) {
-			if ((srv->conn_src.opts & CO_SRC_TPROXY_MASK) == CO_SRC_TPROXY_DYN)
-				reuse = 0;
-		}
-		else if (s->be->conn_src.opts & CO_SRC_BIND) {
-			if ((s->be->conn_src.opts & CO_SRC_TPROXY_MASK) == CO_SRC_TPROXY_DYN)
-				reuse = 0;
-		}
-	}
-
-	if (ha_used_fds > global.tune.pool_high_count && srv && srv->idle_conns) {
+	if (ha_used_fds > global.tune.pool_high_count && srv && srv->idle_conns_tree) {
 		struct connection *tokill_conn;
 
 		/* We can't reuse a connection, and e have more FDs than deemd
 		 * acceptable, attempt to kill an idling connection
 		 */
 		/* First, try from our own idle list */
-		tokill_conn = MT_LIST_POP(&srv->idle_conns[tid],
-		    struct connection *, list);
+		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
+		tokill_conn = conn_take_oldest_idle(&srv->idle_conns[tid]);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 		if (tokill_conn)
 			tokill_conn->mux->destroy(tokill_conn->ctx);
 		/* If not, iterate over other thread's idling pool, and try to grab one */
@@ -1284,22 +1470,20 @@ int connect_server(struct stream *s)
 				// see it possibly larger.
 				ALREADY_CHECKED(i);
 
-				HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
-				tokill_conn = MT_LIST_POP(&srv->idle_conns[i],
-				    struct connection *, list);
+				HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
+				tokill_conn = conn_take_oldest_idle(&srv->idle_conns[i]);
 				if (!tokill_conn)
-					tokill_conn = MT_LIST_POP(&srv->safe_conns[i],
-					    struct connection *, list);
+					tokill_conn = conn_take_oldest_idle(&srv->safe_conns[i]);
 				if (tokill_conn) {
 					/* We got one, put it into the concerned thread's to kill list, and wake it's kill task */
 
 					MT_LIST_ADDQ(&toremove_connections[i],
 					    (struct mt_list *)&tokill_conn->list);
 					task_wakeup(idle_conn_cleanup[i], TASK_WOKEN_OTHER);
-					HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+					HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
 					break;
 				}
-				HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
+				HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[i]);
 			}
 		}
 
@@ -1345,8 +1529,10 @@ int connect_server(struct stream *s)
 	/* no reuse or failed to reuse the connection above, pick a new one */
 	if (!srv_conn) {
 		srv_conn = conn_new();
-		if (srv_conn)
+		if (srv_conn) {
 			srv_conn->target = s->target;
+			srv_conn->hash_node.key = hash;
+		}
 		srv_cs = NULL;
 	}
 
@@ -1361,14 +1547,16 @@ int connect_server(struct stream *s)
 	if (!srv_conn || !sockaddr_alloc(&srv_conn->dst)) {
 		if (srv_conn)
 			conn_free(srv_conn);
-		return SF_ERR_RESOURCE;
+		err = SF_ERR_RESOURCE;
+		goto out;
 	}
 
 	if (!(s->flags & SF_ADDR_SET)) {
 		err = assign_server_address(s);
 		if (err != SRV_STATUS_OK) {
 			conn_free(srv_conn);
-			return SF_ERR_INTERNAL;
+			err = SF_ERR_INTERNAL;
+			goto out;
 		}
 	}
 
@@ -1387,18 +1575,21 @@ int connect_server(struct stream *s)
 			conn_prepare(srv_conn, protocol_by_family(srv_conn->dst->ss_family), xprt_get(XPRT_RAW));
 			if (!(srv_conn->ctrl)) {
 				conn_free(srv_conn);
-				return SF_ERR_INTERNAL;
+				err = SF_ERR_INTERNAL;
+				goto out;
 			}
 		}
 		else {
 			conn_free(srv_conn);
-			return SF_ERR_INTERNAL;  /* how did we get there ? */
+			err = SF_ERR_INTERNAL; /* how did we get there ? */
+			goto out;
 		}
 
 		srv_cs = si_alloc_cs(&s->si[1], srv_conn);
 		if (!srv_cs) {
 			conn_free(srv_conn);
-			return SF_ERR_RESOURCE;
+			err = SF_ERR_RESOURCE;
+			goto out;
 		}
 		srv_conn->ctx = srv_cs;
 #if defined(USE_OPENSSL) && defined(TLSEXT_TYPE_application_layer_protocol_negotiation)
@@ -1461,7 +1652,7 @@ int connect_server(struct stream *s)
 
 	err = si_connect(&s->si[1], srv_conn);
 	if (err != SF_ERR_NONE)
-		return err;
+		goto out;
 
 	/* We have to defer the mux initialization until after si_connect()
 	 * has been called, as we need the xprt to have been properly
@@ -1471,7 +1662,8 @@ int connect_server(struct stream *s)
 	if (init_mux) {
 		if (conn_install_mux_be(srv_conn, srv_cs, s->sess) < 0) {
 			conn_full_close(srv_conn);
-			return SF_ERR_INTERNAL;
+			err = SF_ERR_INTERNAL;
+			goto out;
 		}
 		/* If we're doing http-reuse always, and the connection
 		 * is an http2 connection, add it to the available list,
@@ -1487,7 +1679,8 @@ int connect_server(struct stream *s)
 	if ((srv_conn->flags & CO_FL_HANDSHAKE)) {
 		if (xprt_add_hs(srv_conn) < 0) {
 			conn_full_close(srv_conn);
-			return SF_ERR_INTERNAL;
+			err = SF_ERR_INTERNAL;
+			goto out;
 		}
 	}
 
@@ -1522,17 +1715,8 @@ int connect_server(struct stream *s)
 			s->be->lbprm.server_take_conn(srv);
 
 #ifdef USE_OPENSSL
-		if (srv->ssl_ctx.sni) {
-			struct sample *smp;
-
-			smp = sample_fetch_as_type(s->be, s->sess, s, SMP_OPT_DIR_REQ | SMP_OPT_FINAL,
-						   srv->ssl_ctx.sni, SMP_T_STR);
-			if (smp_make_safe(smp)) {
-				ssl_sock_set_servername(srv_conn,
-							smp->data.u.str.area);
-				srv_conn->flags |= CO_FL_PRIVATE;
-			}
-		}
+		if (sni)
+			ssl_sock_set_servername(srv_conn, sni->area);
 #endif /* USE_OPENSSL */
 
 	}
@@ -1571,7 +1755,10 @@ int connect_server(struct stream *s)
 	if ((srv_cs->flags & CS_FL_EOI) && !(si_ic(&s->si[1])->flags & CF_EOI))
 		si_ic(&s->si[1])->flags |= (CF_EOI|CF_READ_PARTIAL);
 
-	return SF_ERR_NONE;  /* connection is OK */
+	err = SF_ERR_NONE;  /* connection is OK */
+ out:
+	free_trash_chunk(sni);
+	return err;
 }
 
 
@@ -2283,6 +2470,10 @@ const char *backend_lb_algo_str(int algo) {
 		return "hdr";
 	else if (algo == BE_LB_ALGO_RCH)
 		return "rdp-cookie";
+	else if (algo == BE_LB_ALGO_RND)
+		return "random";
+	else if (algo == BE_LB_ALGO_EWMA)
+		return "ewma";
 	else if (algo == BE_LB_ALGO_NONE)
 		return "none";
 	else
@@ -2347,6 +2538,32 @@ int backend_parse_balance(const char **args, char **err, struct proxy *curproxy)
 			}
 		}
 	}
+	else if (!strncmp(args[0], "ewma", 4)) {
+		curproxy->lbprm.algo &= ~BE_LB_ALGO;
+		curproxy->lbprm.algo |= BE_LB_ALGO_EWMA;
+		curproxy->lbprm.arg_opt1 = 2;
+
+		if (*(args[0] + 4) == '(' && *(args[0] + 5) != ')') { /* number of draws */
+			const char *beg;
+			char *end;
+
+			beg = args[0] + 5;
+			curproxy->lbprm.arg_opt1 = strtol(beg, &end, 0);
+
+			if (*end != ')') {
+				if (!*end)
+					memprintf(err, "ewma : missing closing parenthesis.");
+				else
+					memprintf(err, "ewma : unexpected character '%c' after argument.", *end);
+				return -1;
+			}
+
+			if (curproxy->lbprm.arg_opt1 < 1) {
+				memprintf(err, "ewma : number of draws must be at least 1.");
+				return -1;
+			}
+		}
+	}
 	else if (!strcmp(args[0], "source")) {
 		curproxy->lbprm.algo &= ~BE_LB_ALGO;
 		curproxy->lbprm.algo |= BE_LB_ALGO_SH;
@@ -10,6 +10,13 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <eb32tree.h>
 #include <import/sha1.h>
 
@@ -19,41 +26,80 @@
 #include <types/proxy.h>
 #include <types/shctx.h>
 
+#include <proto/applet.h>
+#include <proto/backend.h>
 #include <proto/channel.h>
 #include <proto/cli.h>
+#include <proto/compression.h>
 #include <proto/proxy.h>
 #include <proto/http_htx.h>
 #include <proto/filters.h>
 #include <proto/http_rules.h>
 #include <proto/http_ana.h>
 #include <proto/log.h>
+#include <proto/session.h>
 #include <proto/stream.h>
 #include <proto/stream_interface.h>
 #include <proto/shctx.h>
 
 
 #include <common/cfgparse.h>
+#include <common/h1.h>
 #include <common/hash.h>
 #include <common/htx.h>
 #include <common/initcall.h>
 #include <common/net_helper.h>
+#include <common/time.h>
 
 #define CACHE_FLT_F_IMPLICIT_DECL  0x00000001 /* The cache filtre was implicitly declared (ie without
 					       * the filter keyword) */
+#define CACHE_FLT_F_COMPRESSED     0x00000002 /* The compression filter precedes the cache, which
+					       * stores one variant per content-coding */
 
 const char *cache_store_flt_id = "cache store filter";
 
 extern struct applet http_cache_applet;
+extern struct applet cache_reval_applet;
+
+/* internal proxy used by the streams revalidating stale objects */
+static struct proxy cache_reval_px;
 
 struct flt_ops cache_ops;
 
+/* Optional second tier of a cache, stored in a memory-mapped file. Objects
+ * evicted from the memory are copied there as records written one after the
+ * other, the file being used as a ring where the oldest records are dropped to
+ * make room for the new ones. An object found there is moved back to the
+ * memory. Records are indexed by <entries>, whose nodes are in the mapping so
+ * that all processes share them like the memory tier.
+ */
+struct cache_disk {
+	char *path;                     /* backing file, NULL if there is no disk tier */
+	unsigned long long size;        /* size of the file in bytes */
+	char *area;                     /* mapping of the file */
+	unsigned long long head;        /* offset of the next record to write */
+	unsigned long long tail;        /* offset of the oldest record */
+	unsigned int records;           /* number of records between <tail> and <head> */
+	struct eb_root entries;         /* index of the objects of the disk tier */
+	struct cache_disk_rec *pin;     /* record which must not be overwritten */
+	unsigned long long demotions;   /* objects copied from the memory */
+	unsigned long long promotions;  /* objects moved back to the memory */
+};
+
 struct cache {
 	struct list list;        /* cache linked list */
-	struct eb_root entries;  /* head of cache entries based on keys */
+	struct eb_root *entries; /* heads of cache entries based on keys, one per segment */
+	unsigned int nbseg;      /* number of shctx segments */
 	unsigned int maxage;     /* max-age */
 	unsigned int maxblocks;
 	unsigned int maxobjsz;   /* max-object-size (in bytes) */
+	unsigned int max_secondary_entries;  /* maximum number of variants of a same primary key */
+	int vary_processing;     /* store responses carrying a Vary header */
+	int request_collapsing;  /* make concurrent misses wait for the first one */
+	unsigned int collapse_timeout; /* max time a miss waits for another one to fill the cache (ms) */
+	struct cache_disk disk;  /* optional disk tier */
 	char id[33];             /* cache name */
+	/* followed by the <nbseg> heads of <entries> */
 };
 
 /* cache config for filters */
@@ -70,50 +116,368 @@ struct cache_flt_conf {
  */
 struct cache_st {
 	struct shared_block *first_block;
+	int hdrs_pending;                 /* headers to be stored once compressed */
+	struct stream *s;                 /* stream owning this context */
+	struct cache_pending *pending;    /* fill announced by this stream, if any */
+	struct list wait;                 /* element of a pending fill's waiters while waiting for it */
+	int wait_exp;                     /* expiration date of the wait, or TICK_ETERNITY */
+};
+
+/* A cache miss being forwarded to the server by the stream <filler>. Other
+ * streams missing on the same key wait for it to complete instead of reaching
+ * the server too (request collapsing). These are per-process and indexed in
+ * <cache_pending_tree> by the first 32 bits of the hash.
+ */
+struct cache_pending {
+	struct eb32_node node;    /* node in cache_pending_tree */
+	struct cache *cache;      /* cache the object will be stored in */
+	char hash[20];            /* primary key of the object */
+	struct list waiters;      /* list of cache_st waiting for the fill */
 };
 
 struct cache_entry {
 	unsigned int latest_validation;     /* latest validation date */
 	unsigned int expire;      /* expiration date */
 	unsigned int age;         /* Origin server "Age" header value */
+	unsigned int stale_while_revalidate; /* seconds after <expire> during which it may be served stale */
+	unsigned int stale_if_error;         /* seconds after <expire> during which it may be served on error */
+	unsigned int next_revalidation;      /* date before which no new revalidation may start */
+	unsigned int flags;                  /* CACHE_ENTRY_F_* */
+	struct server *srv;                  /* server the object was fetched from, used for revalidations */
 
 	struct eb32_node eb;     /* ebtree node used to hold the cache object */
 	char hash[20];
+
+	unsigned int secondary_key_signature;  /* VARY_* bits of the headers named in Vary, 0 if none */
+	char secondary_key[HTTP_CACHE_SEC_KEY_LEN];  /* request headers hashes, only those in the signature are set */
 	unsigned char data[0];
 };
 
+/* A record of the disk tier: a copy of the entry of an evicted object followed
+ * by its headers and payload. A null <len> marks the end of the records before
+ * the end of the file.
+ */
+struct cache_disk_rec {
+	unsigned int len;         /* total length of the record, including this header */
+	unsigned int data_len;    /* length of the data following the entry */
+	struct cache_entry entry; /* indexed in the disk tier's tree */
+};
+
 #define CACHE_BLOCKSIZE 1024
 #define CACHE_ENTRY_MAX_AGE 2147483648U
+#define CACHE_DEF_MAX_SECONDARY_ENTRIES 10
+#define CACHE_DEF_COLLAPSE_TIMEOUT 2000 /* ms */
+
+#define CACHE_ENTRY_F_REVALIDATING 0x00000001 /* a background revalidation is in progress */
+#define CACHE_ENTRY_F_REVAL_FAILED 0x00000002 /* the server failed to revalidate it, stale-if-error applies */
+
+#define CACHE_REVAL_TIMEOUT 10000 /* ms, connect and response timeout of background revalidations */
+
+#define CACHE_DISK_REC_ALIGN 8 /* records are aligned for their entry */
+
+/* Request headers which may be named in the Vary header of a cacheable
+ * response. Each of them owns a bit in the entries' secondary key signature
+ * and a 32-bit slot in the secondary key.
+ */
+enum vary_header_bit {
+	VARY_ACCEPT_ENCODING = (1 << 0),
+	VARY_ACCEPT          = (1 << 1),
+	VARY_ACCEPT_LANGUAGE = (1 << 2),
+	VARY_REFERER         = (1 << 3),
+	VARY_ORIGIN          = (1 << 4),
+	VARY_ENCODING        = (1 << 5),  /* not a header, see below */
+};
+
+struct vary_hashing_information {
+	struct ist hdr_name;          /* header name */
+	enum vary_header_bit value;   /* bit in the secondary key signature */
+	unsigned int (*norm_fn)(const struct htx *htx, struct ist hdr_name); /* normalizing hash function */
+};
+
+static unsigned int vary_unordered_list_hash(const struct htx *htx, struct ist hdr_name);
+static unsigned int vary_ordered_list_hash(const struct htx *htx, struct ist hdr_name);
+static unsigned int vary_value_hash(const struct htx *htx, struct ist hdr_name);
+
+static const struct vary_hashing_information vary_information[] = {
+	{ IST("accept-encoding"), VARY_ACCEPT_ENCODING, vary_unordered_list_hash },
+	{ IST("accept"),          VARY_ACCEPT,          vary_unordered_list_hash },
+	{ IST("accept-language"), VARY_ACCEPT_LANGUAGE, vary_ordered_list_hash },
+	{ IST("referer"),         VARY_REFERER,         vary_value_hash },
+	{ IST("origin"),          VARY_ORIGIN,          vary_value_hash },
+};
+
+#define VARY_HDR_COUNT (sizeof(vary_information) / sizeof(*vary_information))
+
+/* When the compression filter precedes the cache, the objects are stored once
+ * compressed and the content-coding negotiated by the request, as returned by
+ * comp_select_encoding(), is an additional part of the secondary key, stored
+ * after the headers' ones. It is always part of the signature of such objects.
+ */
+#define VARY_ENCODING_OFS (VARY_HDR_COUNT * sizeof(uint32_t))
 
 static struct list caches = LIST_HEAD_INIT(caches);
 static struct list caches_config = LIST_HEAD_INIT(caches_config); /* cache config to init */
 static struct cache *tmp_cache_config = NULL;
 
 DECLARE_STATIC_POOL(pool_head_cache_st, "cache_st", sizeof(struct cache_st));
+DECLARE_STATIC_POOL(pool_head_cache_pending, "cache_pending", sizeof(struct cache_pending));
+
+static struct eb_root cache_pending_tree = EB_ROOT;
+__decl_spinlock(cache_pending_lock);
 
-struct cache_entry *entry_exist(struct cache *cache, char *hash)
+/* Returns the pending fill of the object <hash> in <cache>, or NULL if there is
+ * none. Must be called with cache_pending_lock held.
+ */
+static struct cache_pending *cache_pending_lookup(struct cache *cache, const char *hash)
 {
 	struct eb32_node *node;
-	struct cache_entry *entry;
+	struct cache_pending *pending;
 
-	node = eb32_lookup(&cache->entries, read_u32(hash));
-	if (!node)
-		return NULL;
+	for (node = eb32_lookup(&cache_pending_tree, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		pending = eb32_entry(node, struct cache_pending, node);
+		if (pending->cache == cache && memcmp(pending->hash, hash, sizeof(pending->hash)) == 0)
+			return pending;
+	}
+	return NULL;
+}
 
-	entry = eb32_entry(node, struct cache_entry, eb);
+/* Releases the collapsing state of the cache context <st>: if it announced a
+ * fill, all the streams waiting for it are woken up, and if it was waiting for
+ * another stream, it leaves its waiters list. It must be called when the fill
+ * is over, either because the object was stored or because it will not be.
+ */
+static void cache_collapse_release(struct cache_st *st)
+{
+	struct cache_pending *pending;
+	struct cache_st *waiter, *back;
+
+	if (!st->pending && !LIST_ADDED(&st->wait))
+		return;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache_pending_lock);
+	pending = st->pending;
+	if (pending) {
+		eb32_delete(&pending->node);
+		list_for_each_entry_safe(waiter, back, &pending->waiters, wait) {
+			LIST_DEL_INIT(&waiter->wait);
+			task_wakeup(waiter->s->task, TASK_WOKEN_MSG);
+		}
+		st->pending = NULL;
+	}
+	if (LIST_ADDED(&st->wait))
+		LIST_DEL_INIT(&st->wait);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache_pending_lock);
 
-	/* if that's not the right node */
-	if (memcmp(entry->hash, hash, sizeof(entry->hash)))
-		return NULL;
+	pool_free(pool_head_cache_pending, pending);
+}
 
-	if (entry->expire > now.tv_sec) {
-		return entry;
-	} else {
-		eb32_delete(node);
-		entry->eb.key = 0;
+/* Called on a miss of the stream <s> when request collapsing is enabled on
+ * <cache>. If no other stream is already fetching the object, <s> announces
+ * that it will fill the cache and ACT_RET_CONT is returned. Otherwise <s> is
+ * queued to be woken up once the fill is over and ACT_RET_YIELD is returned,
+ * unless it was already waiting and the fill is over or the wait timed out, in
+ * which case the request goes to the server. <final> is non-zero when the
+ * action cannot yield anymore.
+ */
+static enum act_return cache_collapse_miss(struct stream *s, struct cache *cache,
+                                           struct cache_st *st, int final)
+{
+	struct http_txn *txn = s->txn;
+	struct cache_pending *pending;
+
+	if (tick_isset(st->wait_exp)) {
+		/* woken up while waiting for another stream */
+		HA_SPIN_LOCK(CACHE_LOCK, &cache_pending_lock);
+		if (LIST_ADDED(&st->wait) && !final && !tick_is_expired(st->wait_exp, now_ms)) {
+			HA_SPIN_UNLOCK(CACHE_LOCK, &cache_pending_lock);
+			s->req.analyse_exp = st->wait_exp;
+			return ACT_RET_YIELD;
+		}
+		if (LIST_ADDED(&st->wait))
+			LIST_DEL_INIT(&st->wait);
+		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_pending_lock);
+		st->wait_exp = TICK_ETERNITY;
+		s->req.analyse_exp = TICK_ETERNITY;
+		return ACT_RET_CONT;
 	}
-	return NULL;
 
+	if (final)
+		return ACT_RET_CONT;
+
+	HA_SPIN_LOCK(CACHE_LOCK, &cache_pending_lock);
+	pending = cache_pending_lookup(cache, txn->cache_hash);
+	if (pending) {
+		LIST_ADDQ(&pending->waiters, &st->wait);
+		HA_SPIN_UNLOCK(CACHE_LOCK, &cache_pending_lock);
+		st->wait_exp = tick_add(now_ms, cache->collapse_timeout);
+		s->req.analyse_exp = st->wait_exp;
+		return ACT_RET_YIELD;
+	}
+
+	/* only GET responses are stored, so only they may be waited for */
+	if (txn->meth == HTTP_METH_GET && !st->pending) {
+		pending = pool_alloc(pool_head_cache_pending);
+		if (pending) {
+			pending->node.key = read_u32(txn->cache_hash);
+			pending->cache = cache;
+			memcpy(pending->hash, txn->cache_hash, sizeof(pending->hash));
+			LIST_INIT(&pending->waiters);
+			eb32_insert(&cache_pending_tree, &pending->node);
+			st->pending = pending;
+		}
+	}
+	HA_SPIN_UNLOCK(CACHE_LOCK, &cache_pending_lock);
+	return ACT_RET_CONT;
+}
+
+/* Returns non-zero if the request secondary key <sec_key> (NULL if it was not
+ * computed) selects the variant stored in <entry>. Only the headers named in
+ * the entry's Vary signature are compared, and an entry stored without any
+ * Vary header matches all requests.
+ */
+static inline int secondary_key_match(const struct cache_entry *entry, const char *sec_key)
+{
+	int i;
+
+	if (!entry->secondary_key_signature)
+		return 1;
+
+	if (!sec_key)
+		return 0;
+
+	for (i = 0; i < VARY_HDR_COUNT; i++) {
+		if (!(entry->secondary_key_signature & vary_information[i].value))
+			continue;
+		if (memcmp(entry->secondary_key + i * sizeof(uint32_t),
+		           sec_key + i * sizeof(uint32_t), sizeof(uint32_t)) != 0)
+			return 0;
+	}
+	if ((entry->secondary_key_signature & VARY_ENCODING) &&
+	    memcmp(entry->secondary_key + VARY_ENCODING_OFS, sec_key + VARY_ENCODING_OFS, sizeof(uint32_t)) != 0)
+		return 0;
+	return 1;
+}
+
+/* Returns the date until which <entry> may still be delivered, stale or not */
+static inline unsigned int entry_stale_limit(const struct cache_entry *entry)
+{
+	return entry->expire + MAX(entry->stale_while_revalidate, entry->stale_if_error);
+}
+
+/* Returns non-zero if the expired <entry> may be delivered stale, which is the
+ * case during its stale-while-revalidate period, or during its stale-if-error
+ * one once the server failed to revalidate it or is known to be down.
+ */
+static inline int entry_may_serve_stale(const struct cache_entry *entry)
+{
+	if (now.tv_sec < entry->expire + entry->stale_while_revalidate)
+		return 1;
+	if (now.tv_sec >= entry->expire + entry->stale_if_error)
+		return 0;
+	return (entry->flags & CACHE_ENTRY_F_REVAL_FAILED) ||
+		(entry->srv && !srv_currently_usable(entry->srv));
+}
+
+/* Looks up in the tree <root> the entry matching the primary key <hash> and the
+ * request secondary key <sec_key> (which may be NULL). The tree accepts
+ * duplicates, which are either variants of a same object or primary keys
+ * sharing their first 32 bits. Entries past their stale periods met on the way
+ * are unlinked. A fresh entry is preferred, but an expired one still within
+ * its stale periods is returned otherwise, so the caller must check its
+ * expiration date. Must be called with the shctx lock held.
+ */
+static struct cache_entry *__entry_exist(struct eb_root *root, char *hash, char *sec_key)
+{
+	struct eb32_node *node, *next;
+	struct cache_entry *entry, *stale = NULL;
+
+	node = eb32_lookup(root, read_u32(hash));
+	while (node) {
+		next = eb32_next_dup(node);
+		entry = eb32_entry(node, struct cache_entry, eb);
+
+		if (entry_stale_limit(entry) <= now.tv_sec) {
+			eb32_delete(node);
+			entry->eb.key = 0;
+		}
+		else if (memcmp(entry->hash, hash, sizeof(entry->hash)) == 0 &&
+		         secondary_key_match(entry, sec_key)) {
+			if (entry->expire > now.tv_sec)
+				return entry;
+			if (!stale)
+				stale = entry;
+		}
+
+		node = next;
+	}
+	return stale;
+}
+
+/* Returns the tree of the memory tier of <cache> indexing the key <key> */
+static inline struct eb_root *cache_entries(struct cache *cache, unsigned int key)
+{
+	return &cache->entries[key % cache->nbseg];
+}
+
+/* Looks up the entry of the memory tier of <cache>, see __entry_exist() */
+struct cache_entry *entry_exist(struct cache *cache, char *hash, char *sec_key)
+{
+	return __entry_exist(cache_entries(cache, read_u32(hash)), hash, sec_key);
+}
+
+/* Returns non-zero if <a> and <b> are the same variant of a same object */
+static inline int entry_same_variant(const struct cache_entry *a, const struct cache_entry *b)
+{
+	return a->secondary_key_signature == b->secondary_key_signature &&
+		memcmp(a->hash, b->hash, sizeof(a->hash)) == 0 &&
+		memcmp(a->secondary_key, b->secondary_key, sizeof(a->secondary_key)) == 0;
+}
+
+/* Returns non-zero if a valid entry with the same primary key, Vary signature
+ * and secondary key as <object> is already indexed. Must be called with the
+ * shctx lock held.
+ */
+static int variant_exist(struct cache *cache, struct cache_entry *object)
+{
+	struct eb32_node *node;
+	struct cache_entry *entry;
+
+	for (node = eb32_lookup(cache_entries(cache, object->eb.key), object->eb.key); node; node = eb32_next_dup(node)) {
+		entry = eb32_entry(node, struct cache_entry, eb);
+		if (entry->expire > now.tv_sec && entry_same_variant(entry, object))
+			return 1;
+	}
+	return 0;
+}
+
+/* Makes room for a new variant of the primary key <hash> by unlinking the
+ * oldest ones as long as there are <max> or more of them. Must be called with
+ * the shctx lock held.
+ */
+static void cache_limit_variants(struct cache *cache, char *hash, unsigned int max)
+{
+	struct eb32_node *node;
+	struct cache_entry *entry, *oldest;
+	unsigned int count;
+
+	while (1) {
+		count = 0;
+		oldest = NULL;
+		for (node = eb32_lookup(cache_entries(cache, read_u32(hash)), read_u32(hash)); node; node = eb32_next_dup(node)) {
+			entry = eb32_entry(node, struct cache_entry, eb);
+			if (memcmp(entry->hash, hash, sizeof(entry->hash)) != 0)
+				continue;
+			count++;
+			if (!oldest || entry->latest_validation < oldest->latest_validation)
+				oldest = entry;
+		}
+
+		if (count < max)
+			break;
+
+		eb32_delete(&oldest->eb);
+		oldest->eb.key = 0;
+	}
 }
 
 static inline struct shared_context *shctx_ptr(struct cache *cache)
@@ -126,6 +490,208 @@ static inline struct shared_block *block_ptr(struct cache_entry *entry)
 	return (struct shared_block *)((unsigned char *)entry - ((struct shared_block *)NULL)->data);
 }
 
+/* Returns the shctx segment of <cache> storing the objects of key <key>. Rows
+ * are reserved, used and released under the lock of their segment, which also
+ * protects the tree of the same index in <entries>. The lock of the shctx
+ * itself only protects the disk tier, and may be taken while holding the one
+ * of a segment, but not the other way around.
+ */
+static inline struct shared_context *cache_shctx(struct cache *cache, unsigned int key)
+{
+	return shctx_seg(shctx_ptr(cache), key);
+}
+
+/* Returns the shctx segment holding the row of <entry> */
+static inline struct shared_context *entry_shctx(struct cache *cache, struct cache_entry *entry)
+{
+	return shctx_block_seg(shctx_ptr(cache), block_ptr(entry));
+}
+
+/* cache whose memory tier is being allocated from by the current thread, used
+ * to demote the objects evicted by shctx_row_reserve_hot().
+ */
+static THREAD_LOCAL struct cache *cache_reserving = NULL;
+
+/* set when the current thread already holds the lock of the disk tier */
+static THREAD_LOCAL int cache_disk_locked = 0;
+
+/* Reserves room for <data_len> bytes in the row <first> (or a new row if NULL)
+ * of the segment <shctx> of <cache>, see shctx_row_reserve_hot(). Must be
+ * called with the lock of the segment held.
+ */
+static struct shared_block *cache_row_reserve(struct cache *cache, struct shared_context *shctx,
+                                              struct shared_block *first, int data_len)
+{
+	struct shared_block *ret;
+
+	cache_reserving = cache;
+	ret = shctx_row_reserve_hot(shctx, first, data_len);
+	cache_reserving = NULL;
+	return ret;
+}
+
+static inline struct cache_disk_rec *cache_disk_rec(struct cache_disk *disk, unsigned long long ofs)
+{
+	return (struct cache_disk_rec *)(disk->area + ofs);
+}
+
+/* Drops the oldest record of the disk tier <disk>, which must not be empty.
+ * Returns 0 if it is pinned.
+ */
+static int cache_disk_evict(struct cache_disk *disk)
+{
+	struct cache_disk_rec *rec = cache_disk_rec(disk, disk->tail);
+
+	if (rec == disk->pin)
+		return 0;
+
+	eb32_delete(&rec->entry.eb);
+	disk->tail += rec->len;
+	disk->records--;
+
+	/* the next record is at the beginning of the file if there is no
+	 * room or an end marker there.
+	 */
+	if (disk->records &&
+	    (disk->tail + sizeof(*rec) > disk->size || !cache_disk_rec(disk, disk->tail)->len))
+		disk->tail = 0;
+	return 1;
+}
+
+/* Allocates a record of <len> bytes at the head of the disk tier <disk>,
+ * dropping the oldest records it overlaps. Returns NULL if this would drop the
+ * pinned record or if <len> is too large. Must be called with the shctx lock
+ * held.
+ */
+static struct cache_disk_rec *cache_disk_alloc(struct cache_disk *disk, unsigned long long len)
+{
+	struct cache_disk_rec *rec;
+
+	len = (len + CACHE_DISK_REC_ALIGN - 1) & ~(unsigned long long)(CACHE_DISK_REC_ALIGN - 1);
+	if (len > disk->size / 2)
+		return NULL;
+
+	if (!disk->records)
+		disk->head = disk->tail = 0;
+
+	if (disk->head + len > disk->size) {
+		/* not enough room before the end of the file: drop the
+		 * records located after the head and restart from the
+		 * beginning.
+		 */
+		while (disk->records && disk->tail >= disk->head) {
+			if (!cache_disk_evict(disk))
+				return NULL;
+		}
+		if (disk->head + sizeof(*rec) <= disk->size)
+			cache_disk_rec(disk, disk->head)->len = 0;
+		disk->head = 0;
+	}
+
+	while (disk->records && disk->tail >= disk->head && disk->tail < disk->head + len) {
+		if (!cache_disk_evict(disk))
+			return NULL;
+	}
+
+	rec = cache_disk_rec(disk, disk->head);
+	rec->len = len;
+	disk->head += len;
+	disk->records++;
+	return rec;
+}
+
+/* Unlinks from the disk tier of <cache> the copies of the variant <object>.
+ * Must be called with the disk tier lock held.
+ */
+static void cache_disk_drop(struct cache *cache, struct cache_entry *object)
+{
+	struct eb32_node *node, *next;
+	struct cache_entry *entry;
+
+	node = eb32_lookup(&cache->disk.entries, read_u32(object->hash));
+	while (node) {
+		next = eb32_next_dup(node);
+		entry = eb32_entry(node, struct cache_entry, eb);
+		if (entry_same_variant(entry, object))
+			eb32_delete(node);
+		node = next;
+	}
+}
+
+/* Copies the object of the row <first>, which is being evicted from the memory
+ * of <cache>, to its disk tier. Must be called with the lock of the segment of
+ * <first> held.
+ */
+static void cache_disk_demote(struct cache *cache, struct shared_block *first)
+{
+	struct cache_entry *object = (struct cache_entry *)first->data;
+	struct cache_disk_rec *rec;
+	unsigned int data_len = first->len - sizeof(*object);
+
+	if (entry_stale_limit(object) <= now.tv_sec)
+		return;
+
+	if (!cache_disk_locked)
+		shctx_lock(shctx_ptr(cache));
+	cache_disk_drop(cache, object);
+	rec = cache_disk_alloc(&cache->disk, sizeof(*rec) + data_len);
+	if (rec) {
+		rec->data_len = data_len;
+		memcpy(&rec->entry, object, sizeof(*object));
+		rec->entry.flags &= ~CACHE_ENTRY_F_REVALIDATING;
+		shctx_row_data_get(shctx_block_seg(shctx_ptr(cache), first), first,
+		                   rec->entry.data, sizeof(*object), data_len);
+		eb32_insert(&cache->disk.entries, &rec->entry.eb);
+		cache->disk.demotions++;
+	}
+	if (!cache_disk_locked)
+		shctx_unlock(shctx_ptr(cache));
+}
+
+/* Looks up the disk tier of <cache> like entry_exist() and moves the object
+ * found, if any, back to the memory tier. Returns its new entry, or NULL if
+ * it was not found or if there is no room in memory. Must be called with the
+ * lock of the segment of <hash> held.
+ */
+static struct cache_entry *cache_disk_promote(struct cache *cache, char *hash, char *sec_key)
+{
+	struct shared_context *shctx = cache_shctx(cache, read_u32(hash));
+	struct cache_entry *disk_entry, *object = NULL;
+	struct cache_disk_rec *rec;
+	struct shared_block *first;
+
+	shctx_lock(shctx_ptr(cache));
+	disk_entry = __entry_exist(&cache->disk.entries, hash, sec_key);
+	if (!disk_entry)
+		goto out;
+	rec = container_of(disk_entry, struct cache_disk_rec, entry);
+
+	/* the objects evicted to make room are demoted, which must not
+	 * overwrite this record.
+	 */
+	cache->disk.pin = rec;
+	cache_disk_locked = 1;
+	first = cache_row_reserve(cache, shctx, NULL, sizeof(*object) + rec->data_len);
+	cache_disk_locked = 0;
+	cache->disk.pin = NULL;
+	if (!first)
+		goto out;
+
+	object = (struct cache_entry *)first->data;
+	memcpy(object, disk_entry, sizeof(*object));
+	first->len = sizeof(*object);
+	first->last_append = NULL;
+	shctx_row_data_append(shctx, first, NULL, disk_entry->data, rec->data_len);
+
+	eb32_delete(&disk_entry->eb);
+	eb32_insert(cache_entries(cache, object->eb.key), &object->eb);
+	shctx_row_dec_hot(shctx, first);
+	cache->disk.promotions++;
+  out:
+	shctx_unlock(shctx_ptr(cache));
+	return object;
+}
+
 
 
 static int
@@ -170,17 +736,13 @@ cache_store_check(struct proxy *px, struct flt_conf *fconf)
 	 * points on the cache filter configuration. */
 
 	/* Check all filters for proxy <px> to know if the compression is
-	 * enabled and if it is after the cache. When the compression is before
-	 * the cache, an error is returned. Also check if the cache filter must
-	 * be explicitly declaired or not. */
+	 * enabled and if it is before the cache, in which case the cache stores
+	 * the compressed responses, one variant per content-coding. Also check
+	 * if the cache filter must be explicitly declaired or not. */
 	list_for_each_entry(f, &px->filter_configs, list) {
 		if (f == fconf) {
-			/* The compression filter must be evaluated after the cache. */
-			if (comp) {
-				ha_alert("config: %s '%s': unable to enable the compression filter before "
-					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-				return 1;
-			}
+			if (comp)
+				cconf->flags |= CACHE_FLT_F_COMPRESSED;
 		}
 		else if (f->id == http_comp_flt_id)
 			comp = 1;
@@ -209,6 +771,11 @@ cache_store_strm_init(struct stream *s, struct filter *filter)
 		return -1;
 
 	st->first_block = NULL;
+	st->hdrs_pending = 0;
+	st->s           = s;
+	st->pending     = NULL;
+	LIST_INIT(&st->wait);
+	st->wait_exp    = TICK_ETERNITY;
 	filter->ctx     = st;
 
 	/* Register post-analyzer on AN_RES_WAIT_HTTP */
@@ -222,16 +789,18 @@ cache_store_strm_deinit(struct stream *s, struct filter *filter)
 	struct cache_st *st = filter->ctx;
 	struct cache_flt_conf *cconf = FLT_CONF(filter);
 	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
+	struct shared_context *shctx;
 
 	/* Everything should be released in the http_end filter, but we need to do it
 	 * there too, in case of errors */
 	if (st && st->first_block) {
+		shctx = shctx_block_seg(shctx_ptr(cache), st->first_block);
 		shctx_lock(shctx);
 		shctx_row_dec_hot(shctx, st->first_block);
 		shctx_unlock(shctx);
 	}
 	if (st) {
+		cache_collapse_release(st);
 		pool_free(pool_head_cache_st, st);
 		filter->ctx = NULL;
 	}
@@ -243,6 +812,7 @@ cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel
 {
 	struct http_txn *txn = s->txn;
 	struct http_msg *msg = &txn->rsp;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
 	struct cache_st *st = filter->ctx;
 
 	if (an_bit != AN_RES_WAIT_HTTP)
@@ -252,9 +822,12 @@ cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel
 	 * filter. This is only possible when the compression is configured in
 	 * the frontend while the cache filter is configured on the
 	 * backend. This case cannot be detected during HAProxy startup. So in
-	 * such cases, the cache is disabled.
+	 * such cases, the cache is disabled. When both are declared in the same
+	 * proxy, the cache stores the compressed response.
 	 */
-	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
+	if (st && (msg->flags & HTTP_MSGF_COMPRESSING) &&
+	    !(cconf->flags & CACHE_FLT_F_COMPRESSED)) {
+		cache_collapse_release(st);
 		pool_free(pool_head_cache_st, st);
 		filter->ctx = NULL;
 	}
@@ -263,19 +836,6 @@ cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel
 	return 1;
 }
 
-static int
-cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
-{
-	struct cache_st *st = filter->ctx;
-
-	if (!(msg->chn->flags & CF_ISRESP) || !st)
-		return 1;
-
-	if (st->first_block)
-		register_data_filter(s, msg->chn, filter);
-	return 1;
-}
-
 static inline void disable_cache_entry(struct cache_st *st,
                                        struct filter *filter, struct shared_context *shctx)
 {
@@ -287,15 +847,83 @@ static inline void disable_cache_entry(struct cache_st *st,
 	shctx_row_dec_hot(shctx, st->first_block);
 	object->eb.key = 0;
 	shctx_unlock(shctx);
+	cache_collapse_release(st);
 	pool_free(pool_head_cache_st, st);
 }
 
+/* Serializes the headers of the message <htx>, up to the end-of-headers block,
+ * into the trash chunk. Returns 0 if they are too big to be cached.
+ */
+static int cache_dump_headers(struct htx *htx)
+{
+	size_t hdrs_len = 0;
+	int32_t pos;
+
+	chunk_reset(&trash);
+	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		struct htx_blk *blk = htx_get_blk(htx, pos);
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t sz = htx_get_blksz(blk);
+
+		hdrs_len += sizeof(*blk) + sz;
+		chunk_memcat(&trash, (char *)&blk->info, sizeof(blk->info));
+		chunk_memcat(&trash, htx_get_blk_ptr(htx, blk), sz);
+		if (type == HTX_BLK_EOH)
+			break;
+	}
+
+	/* Do not cache objects if the headers are too big. */
+	return hdrs_len <= htx->size - global.tune.maxrewrite;
+}
+
+static int
+cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
+{
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct cache_st *st = filter->ctx;
+	struct shared_context *shctx;
+
+	if (!(msg->chn->flags & CF_ISRESP) || !st)
+		return 1;
+
+	if (!st->first_block)
+		return 1;
+
+	/* the headers of a compressed object are only final once the
+	 * compression filter has processed them.
+	 */
+	if (st->hdrs_pending) {
+		st->hdrs_pending = 0;
+		shctx = shctx_block_seg(shctx_ptr(cconf->c.cache), st->first_block);
+		if (!cache_dump_headers(htxbuf(&msg->chn->buf)))
+			goto no_cache;
+
+		shctx_lock(shctx);
+		if (!cache_row_reserve(cconf->c.cache, shctx, st->first_block, trash.data)) {
+			shctx_unlock(shctx);
+			goto no_cache;
+		}
+		shctx_unlock(shctx);
+
+		if (shctx_row_data_append(shctx, st->first_block, st->first_block->last_append,
+		                          (unsigned char *)trash.area, trash.data) < 0)
+			goto no_cache;
+	}
+
+	register_data_filter(s, msg->chn, filter);
+	return 1;
+
+  no_cache:
+	disable_cache_entry(st, filter, shctx);
+	return 1;
+}
+
 static int
 cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 			 unsigned int offset, unsigned int len)
 {
 	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_context *shctx;
 	struct cache_st *st = filter->ctx;
 	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct htx_blk *blk;
@@ -312,6 +940,7 @@ cache_store_http_payload(struct stream *s, struct filter *filter, struct http_ms
 		return len;
 	}
 
+	shctx = shctx_block_seg(shctx_ptr(cconf->c.cache), st->first_block);
 	chunk_reset(&trash);
 	orig_len = len;
 	to_forward = 0;
@@ -362,7 +991,7 @@ cache_store_http_payload(struct stream *s, struct filter *filter, struct http_ms
 
   end:
 	shctx_lock(shctx);
-	fb = shctx_row_reserve_hot(shctx, st->first_block, trash.data);
+	fb = cache_row_reserve(cconf->c.cache, shctx, st->first_block, trash.data);
 	if (!fb) {
 		shctx_unlock(shctx);
 		goto no_cache;
@@ -389,7 +1018,7 @@ cache_store_http_end(struct stream *s, struct filter *filter,
 	struct cache_st *st = filter->ctx;
 	struct cache_flt_conf *cconf = FLT_CONF(filter);
 	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
+	struct shared_context *shctx;
 	struct cache_entry *object;
 
 	if (!(msg->chn->flags & CF_ISRESP))
@@ -398,20 +1027,27 @@ cache_store_http_end(struct stream *s, struct filter *filter,
 	if (st && st->first_block) {
 
 		object = (struct cache_entry *)st->first_block->data;
+		shctx = shctx_block_seg(shctx_ptr(cache), st->first_block);
 
 		/* does not need to test if the insertion worked, if it
 		 * doesn't, the blocks will be reused anyway */
 
 		shctx_lock(shctx);
-		if (eb32_insert(&cache->entries, &object->eb) != &object->eb) {
+		/* the same variant may have been stored meanwhile by another
+		 * stream, in which case we keep the one already indexed.
+		 */
+		if (variant_exist(cache, object))
 			object->eb.key = 0;
-		}
+		else
+			eb32_insert(cache_entries(cache, object->eb.key), &object->eb);
 		/* remove from the hotlist */
 		shctx_row_dec_hot(shctx, st->first_block);
 		shctx_unlock(shctx);
 
 	}
 	if (st) {
+		/* the object is now indexed, wake up the streams waiting for it */
+		cache_collapse_release(st);
 		pool_free(pool_head_cache_st, st);
 		filter->ctx = NULL;
 	}
@@ -509,13 +1145,100 @@ int http_calc_maxage(struct stream *s, struct cache *cache)
 
 }
 
+/*
+ * Return the value in seconds of the Cache-Control directive <word> of length
+ * <wlen> if <v> is this directive, otherwise -1.
+ */
+static int cache_directive_int(struct ist v, const char *word, int wlen)
+{
+	char *value;
+	long long ret;
+
+	value = directive_value(v.ptr, v.len, word, wlen);
+	if (!value || strl2llrc(value, v.ptr + v.len - value, &ret) != 0 || ret < 0)
+		return -1;
+	return MIN(ret, CACHE_ENTRY_MAX_AGE);
+}
+
+/*
+ * Set the stale-while-revalidate and stale-if-error periods of <object> from
+ * the Cache-Control header of the response. Both are disabled by the
+ * must-revalidate and proxy-revalidate directives.
+ */
+static void http_calc_stale(struct stream *s, struct cache_entry *object)
+{
+	struct htx *htx = htxbuf(&s->res.buf);
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	int swr = 0, sie = 0, val;
+
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		if (isteqi(ctx.value, ist("must-revalidate")) ||
+		    isteqi(ctx.value, ist("proxy-revalidate"))) {
+			swr = sie = 0;
+			break;
+		}
+		if ((val = cache_directive_int(ctx.value, "stale-while-revalidate", 22)) >= 0)
+			swr = val;
+		else if ((val = cache_directive_int(ctx.value, "stale-if-error", 14)) >= 0)
+			sie = val;
+	}
+	object->stale_while_revalidate = swr;
+	object->stale_if_error = sie;
+}
+
+/*
+ * Flag the expired entry of the object requested by <txn>, if any, as failed
+ * to revalidate so that it is delivered during its stale-if-error period.
+ */
+static void cache_entry_set_failed(struct cache *cache, struct http_txn *txn)
+{
+	struct shared_context *shctx = cache_shctx(cache, read_u32(txn->cache_hash));
+	struct cache_entry *entry;
+
+	shctx_lock(shctx);
+	entry = entry_exist(cache, txn->cache_hash,
+	                    (txn->flags & TX_CACHE_HAS_SEC_KEY) ? txn->cache_secondary_hash : NULL);
+	if (entry && entry->expire <= now.tv_sec)
+		entry->flags |= CACHE_ENTRY_F_REVAL_FAILED;
+	shctx_unlock(shctx);
+}
+
+/*
+ * Return the signature of the request headers named in the Vary header(s) of
+ * the response in <htx>, 0 if there is none, or -1 if the response varies on
+ * "*" or on a header which is not part of <vary_information>.
+ */
+static int http_get_vary_signature(const struct htx *htx)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	int signature = 0;
+	int i;
+
+	while (http_find_header(htx, ist("Vary"), &ctx, 0)) {
+		if (!ctx.value.len)
+			continue;
+
+		for (i = 0; i < VARY_HDR_COUNT; i++) {
+			if (isteqi(ctx.value, vary_information[i].hdr_name))
+				break;
+		}
+		if (i == VARY_HDR_COUNT)
+			return -1;
+		signature |= vary_information[i].value;
+	}
+	return signature;
+}
 
 static void cache_free_blocks(struct shared_block *first, struct shared_block *block)
 {
 	struct cache_entry *object = (struct cache_entry *)block->data;
 
-	if (first == block && object->eb.key)
+	if (first == block && object->eb.key) {
+		/* complete objects are indexed, and may move to the disk */
+		if (object->eb.node.leaf_p && cache_reserving && cache_reserving->disk.path)
+			cache_disk_demote(cache_reserving, first);
 		eb32_delete(&object->eb);
+	}
 	object->eb.key = 0;
 }
 
@@ -533,14 +1256,14 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	struct filter *filter;
 	struct shared_block *first = NULL;
 	struct cache_flt_conf *cconf = rule->arg.act.p[0];
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	unsigned int key = read_u32(txn->cache_hash);
+	struct shared_context *shctx = cache_shctx(cconf->c.cache, key);
 	struct cache_st *cache_ctx = NULL;
 	struct cache_entry *object, *old;
-	unsigned int key = read_u32(txn->cache_hash);
 	struct htx *htx;
 	struct http_hdr_ctx ctx;
-	size_t hdrs_len = 0;
-	int32_t pos;
+	int vary_signature;
+	int i;
 
 	/* Don't cache if the response came from a cache */
 	if ((obj_type(s->target) == OBJ_TYPE_APPLET) &&
@@ -560,6 +1283,12 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	if (!key)
 		goto out;
 
+	/* a server error lets the stale copy deal with the next requests */
+	if (txn->status >= 500) {
+		cache_entry_set_failed(cconf->c.cache, txn);
+		goto out;
+	}
+
 	/* cache only 200 status code */
 	if (txn->status != 200)
 		goto out;
@@ -583,11 +1312,24 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	    htx->data + htx->extra > shctx->max_obj_size)
 		goto out;
 
-	/* Does not manage Vary at the moment. We will need a secondary key later for that */
-	ctx.blk = NULL;
-	if (http_find_header(htx, ist("Vary"), &ctx, 0))
+	/* Responses varying on headers we cannot normalize are not cached,
+	 * and the other ones only if the cache processes Vary and the
+	 * request's secondary key was computed.
+	 */
+	vary_signature = http_get_vary_signature(htx);
+	if (vary_signature < 0)
+		goto out;
+	if (vary_signature &&
+	    (!cconf->c.cache->vary_processing || !(txn->flags & TX_CACHE_HAS_SEC_KEY)))
 		goto out;
 
+	/* compressed objects are stored as a variant of their content-coding */
+	if (cconf->flags & CACHE_FLT_F_COMPRESSED) {
+		if (!(txn->flags & TX_CACHE_HAS_SEC_KEY))
+			goto out;
+		vary_signature |= VARY_ENCODING;
+	}
+
 	http_check_response_for_cacheability(s, &s->res);
 
 	if (!(txn->flags & TX_CACHEABLE) || !(txn->flags & TX_CACHE_COOK))
@@ -604,25 +1346,16 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 		http_remove_header(htx, &ctx);
 	}
 
-	chunk_reset(&trash);
-	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
-		struct htx_blk *blk = htx_get_blk(htx, pos);
-		enum htx_blk_type type = htx_get_blk_type(blk);
-		uint32_t sz = htx_get_blksz(blk);
-
-		hdrs_len += sizeof(*blk) + sz;
-		chunk_memcat(&trash, (char *)&blk->info, sizeof(blk->info));
-		chunk_memcat(&trash, htx_get_blk_ptr(htx, blk), sz);
-		if (type == HTX_BLK_EOH)
-			break;
-	}
-
-	/* Do not cache objects if the headers are too big. */
-	if (hdrs_len > htx->size - global.tune.maxrewrite)
+	/* The headers of compressed objects are copied by the filter once the
+	 * compression filter has updated them.
+	 */
+	if (cconf->flags & CACHE_FLT_F_COMPRESSED)
+		chunk_reset(&trash);
+	else if (!cache_dump_headers(htx))
 		goto out;
 
 	shctx_lock(shctx);
-	first = shctx_row_reserve_hot(shctx, NULL, sizeof(struct cache_entry) + trash.data);
+	first = cache_row_reserve(cconf->c.cache, shctx, NULL, sizeof(struct cache_entry) + trash.data);
 	if (!first) {
 		shctx_unlock(shctx);
 		goto out;
@@ -636,6 +1369,16 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	object->eb.node.leaf_p = NULL;
 	object->eb.key = 0;
 	object->age = age;
+	object->secondary_key_signature = vary_signature;
+	memset(object->secondary_key, 0, sizeof(object->secondary_key));
+	for (i = 0; i < VARY_HDR_COUNT; i++) {
+		if (vary_signature & vary_information[i].value)
+			memcpy(object->secondary_key + i * sizeof(uint32_t),
+			       txn->cache_secondary_hash + i * sizeof(uint32_t), sizeof(uint32_t));
+	}
+	if (vary_signature & VARY_ENCODING)
+		memcpy(object->secondary_key + VARY_ENCODING_OFS,
+		       txn->cache_secondary_hash + VARY_ENCODING_OFS, sizeof(uint32_t));
 
 	/* reserve space for the cache_entry structure */
 	first->len = sizeof(struct cache_entry);
@@ -648,12 +1391,14 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 
 	/* does not need to be locked because it's in the "hot" list,
 	 * copy the headers */
-	if (shctx_row_data_append(shctx, first, NULL, (unsigned char *)trash.area, trash.data) < 0)
+	if (trash.data &&
+	    shctx_row_data_append(shctx, first, NULL, (unsigned char *)trash.area, trash.data) < 0)
 		goto out;
 
 	/* register the buffer in the filter ctx for filling it with data*/
 	if (cache_ctx) {
 		cache_ctx->first_block = first;
+		cache_ctx->hdrs_pending = !!(cconf->flags & CACHE_FLT_F_COMPRESSED);
 
 		object->eb.key = key;
 
@@ -662,16 +1407,30 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 
 		shctx_lock(shctx);
 
-		old = entry_exist(cconf->c.cache, txn->cache_hash);
+		old = entry_exist(cconf->c.cache, txn->cache_hash,
+		                  (txn->flags & TX_CACHE_HAS_SEC_KEY) ? txn->cache_secondary_hash : NULL);
 		if (old) {
 			eb32_delete(&old->eb);
 			old->eb.key = 0;
 		}
+		if (cconf->c.cache->disk.path) {
+			shctx_lock(shctx_ptr(cconf->c.cache));
+			cache_disk_drop(cconf->c.cache, object);
+			shctx_unlock(shctx_ptr(cconf->c.cache));
+		}
+		if (vary_signature)
+			cache_limit_variants(cconf->c.cache, txn->cache_hash,
+			                     cconf->c.cache->max_secondary_entries);
 		shctx_unlock(shctx);
 
 		/* store latest value and expiration time */
 		object->latest_validation = now.tv_sec;
 		object->expire = now.tv_sec + http_calc_maxage(s, cconf->c.cache);
+		http_calc_stale(s, object);
+		object->next_revalidation = 0;
+		object->flags = 0;
+		/* the server stale copies are revalidated against */
+		object->srv = objt_server(s->target);
 		return ACT_RET_CONT;
 	}
 
@@ -685,6 +1444,10 @@ out:
 		shctx_unlock(shctx);
 	}
 
+	/* streams waiting for this response must now go to the server */
+	if (cache_ctx)
+		cache_collapse_release(cache_ctx);
+
 	return ACT_RET_CONT;
 }
 
@@ -700,10 +1463,11 @@ static void http_cache_applet_release(struct appctx *appctx)
 	struct cache_entry *cache_ptr = appctx->ctx.cache.entry;
 	struct cache *cache = cconf->c.cache;
 	struct shared_block *first = block_ptr(cache_ptr);
+	struct shared_context *shctx = entry_shctx(cache, cache_ptr);
 
-	shctx_lock(shctx_ptr(cache));
-	shctx_row_dec_hot(shctx_ptr(cache), first);
-	shctx_unlock(shctx_ptr(cache));
+	shctx_lock(shctx);
+	shctx_row_dec_hot(shctx, first);
+	shctx_unlock(shctx);
 }
 
 
@@ -920,59 +1684,363 @@ static void http_cache_io_handler(struct appctx *appctx)
 			appctx->st0 = HTX_CACHE_DATA;
 	}
 
-	if (appctx->st0 == HTX_CACHE_DATA) {
-		len = first->len - sizeof(*cache_ptr) - appctx->ctx.cache.sent;
-		if (len) {
-			ret = htx_cache_dump_msg(appctx, res_htx, len, HTX_BLK_EOM);
-			if (ret < len) {
-				si_rx_room_blk(si);
-				goto out;
-			}
+	if (appctx->st0 == HTX_CACHE_DATA) {
+		len = first->len - sizeof(*cache_ptr) - appctx->ctx.cache.sent;
+		if (len) {
+			ret = htx_cache_dump_msg(appctx, res_htx, len, HTX_BLK_EOM);
+			if (ret < len) {
+				si_rx_room_blk(si);
+				goto out;
+			}
+		}
+		appctx->st0 = HTX_CACHE_END;
+	}
+
+	if (appctx->st0 == HTX_CACHE_EOM) {
+		if (!htx_add_endof(res_htx, HTX_BLK_EOM)) {
+			si_rx_room_blk(si);
+			goto out;
+		}
+		appctx->st0 = HTX_CACHE_END;
+	}
+
+  end:
+	if (!(res->flags & CF_SHUTR) && appctx->st0 == HTX_CACHE_END) {
+		res->flags |= CF_READ_NULL;
+		si_shutr(si);
+	}
+
+  out:
+	total = res_htx->data - total;
+	if (total)
+		channel_add_input(res, total);
+	htx_to_buf(res_htx, &res->buf);
+
+	/* eat the whole request */
+	if (co_data(req)) {
+		req_htx = htx_from_buf(&req->buf);
+		co_htx_skip(req, req_htx, co_data(req));
+		htx_to_buf(req_htx, &req->buf);
+	}
+	return;
+
+  error:
+	/* Sent and HTTP error 500 */
+	b_reset(&res->buf);
+	errmsg = &http_err_chunks[HTTP_ERR_500];
+	res->buf.data = b_data(errmsg);
+	memcpy(res->buf.area, b_head(errmsg), b_data(errmsg));
+	res_htx = htx_from_buf(&res->buf);
+
+	total = 0;
+	appctx->st0 = HTX_CACHE_END;
+	goto end;
+}
+
+
+#define CACHE_REVAL_ST_SEND 0 /* Sending the conditional request */
+#define CACHE_REVAL_ST_RECV 1 /* Waiting for the response headers */
+#define CACHE_REVAL_ST_END  2 /* Revalidation over */
+
+/* Sends the conditional request of a revalidation and parses the headers of
+ * the response. Only the status and the freshness information are retained,
+ * the rest of the response is dropped.
+ */
+static void cache_reval_io_handler(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct channel *req = si_ic(si);
+	struct channel *res = si_oc(si);
+	struct htx *req_htx, *res_htx, *src;
+	struct http_hdr_ctx ctx;
+	struct htx_sl *sl;
+	size_t total;
+	long long age;
+	int32_t pos;
+	int val;
+
+	if (unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO))
+		return;
+
+	if (appctx->st0 == CACHE_REVAL_ST_SEND) {
+		if (!b_size(&req->buf)) {
+			si_rx_room_blk(si);
+			return;
+		}
+		src = htxbuf(&appctx->ctx.cache_reval.req);
+		req_htx = htx_from_buf(&req->buf);
+		total = req_htx->data;
+		htx_xfer_blks(req_htx, src, htx_used_space(src), HTX_BLK_UNUSED);
+		channel_add_input(req, req_htx->data - total);
+		htx_to_buf(req_htx, &req->buf);
+		htx_to_buf(src, &appctx->ctx.cache_reval.req);
+		if (!htx_is_empty(src)) {
+			si_rx_room_blk(si);
+			return;
+		}
+		appctx->st0 = CACHE_REVAL_ST_RECV;
+	}
+
+	if (appctx->st0 == CACHE_REVAL_ST_RECV) {
+		res_htx = htxbuf(&res->buf);
+		for (pos = htx_get_first(res_htx); pos != -1; pos = htx_get_next(res_htx, pos)) {
+			if (htx_get_blk_type(htx_get_blk(res_htx, pos)) == HTX_BLK_EOH)
+				break;
+		}
+
+		if (pos != -1) {
+			sl = http_get_stline(res_htx);
+			appctx->ctx.cache_reval.status = sl->info.res.status;
+
+			ctx.blk = NULL;
+			while (http_find_header(res_htx, ist("cache-control"), &ctx, 0)) {
+				if ((val = cache_directive_int(ctx.value, "s-maxage", 8)) >= 0)
+					appctx->ctx.cache_reval.maxage = val;
+				else if ((val = cache_directive_int(ctx.value, "max-age", 7)) >= 0) {
+					if (appctx->ctx.cache_reval.maxage < 0)
+						appctx->ctx.cache_reval.maxage = val;
+				}
+				else if ((val = cache_directive_int(ctx.value, "stale-while-revalidate", 22)) >= 0)
+					appctx->ctx.cache_reval.swr = val;
+				else if ((val = cache_directive_int(ctx.value, "stale-if-error", 14)) >= 0)
+					appctx->ctx.cache_reval.sie = val;
+			}
+
+			ctx.blk = NULL;
+			if (http_find_header(res_htx, ist("age"), &ctx, 0) &&
+			    !strl2llrc(ctx.value.ptr, ctx.value.len, &age) && age > 0)
+				appctx->ctx.cache_reval.age = MIN(age, CACHE_ENTRY_MAX_AGE);
+
+			appctx->st0 = CACHE_REVAL_ST_END;
+		}
+		else if (res->flags & (CF_SHUTR|CF_SHUTW)) {
+			/* the server closed before sending complete headers */
+			appctx->st0 = CACHE_REVAL_ST_END;
+		}
+	}
+
+	if (appctx->st0 == CACHE_REVAL_ST_END) {
+		if (co_data(res)) {
+			res_htx = htxbuf(&res->buf);
+			co_htx_skip(res, res_htx, co_data(res));
+			htx_to_buf(res_htx, &res->buf);
+		}
+		si_shutw(si);
+		si_shutr(si);
+		req->flags |= CF_READ_NULL;
+	}
+}
+
+/* Updates the revalidated entry according to the response: a 304 refreshes it
+ * in place, another non-error status means that it changed and unlinks it so
+ * that the next request fetches it again, and an error or no response at all
+ * lets it be delivered during its stale-if-error period.
+ */
+static void cache_reval_release(struct appctx *appctx)
+{
+	struct cache_entry *entry = appctx->ctx.cache_reval.entry;
+	struct cache *cache = appctx->ctx.cache_reval.cache;
+	int status = appctx->ctx.cache_reval.status;
+	struct shared_context *shctx = entry_shctx(cache, entry);
+	unsigned int maxage;
+
+	shctx_lock(shctx);
+	if (status == 304) {
+		/* keep the previous freshness lifetime if none is provided */
+		maxage = entry->expire - entry->latest_validation;
+		if (appctx->ctx.cache_reval.maxage >= 0)
+			maxage = MIN(appctx->ctx.cache_reval.maxage, cache->maxage);
+		if (appctx->ctx.cache_reval.swr >= 0)
+			entry->stale_while_revalidate = appctx->ctx.cache_reval.swr;
+		if (appctx->ctx.cache_reval.sie >= 0)
+			entry->stale_if_error = appctx->ctx.cache_reval.sie;
+		entry->age = appctx->ctx.cache_reval.age;
+		entry->latest_validation = now.tv_sec;
+		entry->expire = now.tv_sec + maxage;
+		entry->flags &= ~CACHE_ENTRY_F_REVAL_FAILED;
+	}
+	else if (status >= 200 && status < 500) {
+		eb32_delete(&entry->eb);
+		entry->eb.key = 0;
+	}
+	else {
+		entry->flags |= CACHE_ENTRY_F_REVAL_FAILED;
+		entry->next_revalidation = now.tv_sec + 1;
+	}
+	entry->flags &= ~CACHE_ENTRY_F_REVALIDATING;
+	shctx_row_dec_hot(shctx, block_ptr(entry));
+	shctx_unlock(shctx);
+
+	b_free(&appctx->ctx.cache_reval.req);
+}
+
+/* Adds to <htx> the conditional header <cond> built from the value of the
+ * header <name> stored in the headers of <entry>, if any. Returns 0 on error.
+ */
+static int cache_reval_add_cond(struct cache *cache, struct cache_entry *entry,
+                                struct htx *htx, struct ist name, struct ist cond)
+{
+	struct shared_block *first = block_ptr(entry);
+	struct buffer *buf = get_trash_chunk();
+	struct htx_blk blk;
+	uint32_t nlen, vlen;
+	int offset = sizeof(*entry);
+
+	while (offset + sizeof(blk.info) <= first->len) {
+		shctx_row_data_get(entry_shctx(cache, entry), first, (unsigned char *)&blk.info, offset, sizeof(blk.info));
+		offset += sizeof(blk.info);
+		if (htx_get_blk_type(&blk) == HTX_BLK_EOH)
+			break;
+		if (htx_get_blk_type(&blk) != HTX_BLK_HDR) {
+			offset += htx_get_blksz(&blk);
+			continue;
 		}
-		appctx->st0 = HTX_CACHE_END;
-	}
 
-	if (appctx->st0 == HTX_CACHE_EOM) {
-		if (!htx_add_endof(res_htx, HTX_BLK_EOM)) {
-			si_rx_room_blk(si);
-			goto out;
+		nlen = blk.info & 0xff;
+		vlen = (blk.info >> 8) & 0xfffff;
+		if (nlen == name.len && nlen + vlen <= b_size(buf)) {
+			shctx_row_data_get(entry_shctx(cache, entry), first, (unsigned char *)b_orig(buf), offset, nlen + vlen);
+			if (strncasecmp(b_orig(buf), name.ptr, nlen) == 0)
+				return !!htx_add_header(htx, cond, ist2(b_orig(buf) + nlen, vlen));
 		}
-		appctx->st0 = HTX_CACHE_END;
+		offset += nlen + vlen;
 	}
+	return 1;
+}
 
-  end:
-	if (!(res->flags & CF_SHUTR) && appctx->st0 == HTX_CACHE_END) {
-		res->flags |= CF_READ_NULL;
-		si_shutr(si);
-	}
+/* Starts the background revalidation of the stale <entry> of <cache> which is
+ * being delivered to the stream <s>. A conditional request built from the one
+ * of <s> is sent by a dedicated stream to the server the object came from. The
+ * caller must have flagged the entry and taken a reference on its row, which
+ * are released with the revalidation. Returns 0 if the revalidation could not
+ * be started.
+ */
+static int cache_reval_start(struct stream *s, struct cache *cache, struct cache_entry *entry)
+{
+	struct htx *htx = htxbuf(&s->req.buf);
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer req = BUF_NULL;
+	struct appctx *appctx;
+	struct session *sess;
+	struct stream *rs;
+	struct htx_sl *sl;
+	struct htx *req_htx;
+	struct ist uri, path, host;
+	int i;
 
-  out:
-	total = res_htx->data - total;
-	if (total)
-		channel_add_input(res, total);
-	htx_to_buf(res_htx, &res->buf);
+	sl = http_get_stline(htx);
+	if (!sl)
+		return 0;
+	uri = htx_sl_req_uri(sl);
+	path = http_get_path(uri);
+	if (!isttest(path))
+		return 0;
+	if (http_find_header(htx, ist("host"), &ctx, 1))
+		host = ctx.value;
+	else
+		host = http_get_authority(uri, 1);
+	if (!host.len)
+		return 0;
 
-	/* eat the whole request */
-	if (co_data(req)) {
-		req_htx = htx_from_buf(&req->buf);
-		co_htx_skip(req, req_htx, co_data(req));
-		htx_to_buf(req_htx, &req->buf);
+	if (!b_alloc(&req))
+		return 0;
+	req_htx = htx_from_buf(&req);
+
+	sl = htx_add_stline(req_htx, HTX_BLK_REQ_SL, HTX_SL_F_VER_11|HTX_SL_F_XFER_LEN|HTX_SL_F_BODYLESS,
+	                    ist("GET"), path, ist("HTTP/1.1"));
+	if (!sl)
+		goto out_free_req;
+	sl->info.req.meth = HTTP_METH_GET;
+	if (!htx_add_header(req_htx, ist("host"), host))
+		goto out_free_req;
+
+	/* the server needs the headers selecting the variant */
+	for (i = 0; i < VARY_HDR_COUNT; i++) {
+		if (!(entry->secondary_key_signature & vary_information[i].value))
+			continue;
+		ctx.blk = NULL;
+		while (http_find_header(htx, vary_information[i].hdr_name, &ctx, 1)) {
+			if (!htx_add_header(req_htx, vary_information[i].hdr_name, ctx.value))
+				goto out_free_req;
+		}
 	}
-	return;
 
-  error:
-	/* Sent and HTTP error 500 */
-	b_reset(&res->buf);
-	errmsg = &http_err_chunks[HTTP_ERR_500];
-	res->buf.data = b_data(errmsg);
-	memcpy(res->buf.area, b_head(errmsg), b_data(errmsg));
-	res_htx = htx_from_buf(&res->buf);
+	if (!cache_reval_add_cond(cache, entry, req_htx, ist("etag"), ist("if-none-match")) ||
+	    !cache_reval_add_cond(cache, entry, req_htx, ist("last-modified"), ist("if-modified-since")) ||
+	    !htx_add_header(req_htx, ist("connection"), ist("close")) ||
+	    !htx_add_endof(req_htx, HTX_BLK_EOH) ||
+	    !htx_add_endof(req_htx, HTX_BLK_EOM))
+		goto out_free_req;
+	htx_to_buf(req_htx, &req);
+
+	appctx = appctx_new(&cache_reval_applet, tid_bit);
+	if (!appctx)
+		goto out_free_req;
+
+	appctx->st0 = CACHE_REVAL_ST_SEND;
+	appctx->ctx.cache_reval.entry = entry;
+	appctx->ctx.cache_reval.cache = cache;
+	appctx->ctx.cache_reval.req = req;
+	appctx->ctx.cache_reval.status = 0;
+	appctx->ctx.cache_reval.maxage = -1;
+	appctx->ctx.cache_reval.swr = -1;
+	appctx->ctx.cache_reval.sie = -1;
+	appctx->ctx.cache_reval.age = 0;
+
+	sess = session_new(&cache_reval_px, NULL, &appctx->obj_type);
+	if (!sess)
+		goto out_free_appctx;
+
+	if ((rs = stream_new(sess, &appctx->obj_type)) == NULL)
+		goto out_free_sess;
+
+	/* applet is waiting for data */
+	si_cant_get(&rs->si[0]);
+
+	/* the server's mux exchanges HTX messages, and its address is
+	 * assigned as for a direct access.
+	 */
+	rs->flags |= SF_HTX|SF_ASSIGNED|SF_DIRECT;
+	rs->target = &entry->srv->obj_type;
+	rs->si[1].flags |= SI_FL_NOLINGER;
 
-	total = 0;
-	appctx->st0 = HTX_CACHE_END;
-	goto end;
+	rs->do_log = NULL;
+	rs->uniq_id = 0;
+
+	rs->res.flags |= CF_READ_DONTWAIT;
+
+	appctx_wakeup(appctx);
+	task_wakeup(rs->task, TASK_WOKEN_INIT);
+	return 1;
+
+ out_free_sess:
+	session_free(sess);
+ out_free_appctx:
+	/* appctx_free() does not call the release callback, the caller
+	 * restores the entry.
+	 */
+	appctx_free(appctx);
+ out_free_req:
+	b_free(&req);
+	return 0;
 }
 
+/* Initializes the internal proxy used by the revalidation streams */
+static void cache_reval_init_proxy()
+{
+	init_new_proxy(&cache_reval_px);
+	cache_reval_px.parent = NULL;
+	cache_reval_px.last_change = now.tv_sec;
+	cache_reval_px.id = "CACHE-REVALIDATION";
+	cache_reval_px.cap = PR_CAP_FE | PR_CAP_BE;
+	cache_reval_px.maxconn = 0;
+	cache_reval_px.accept = NULL;
+	cache_reval_px.options2 |= PR_O2_INDEPSTR;
+	cache_reval_px.conn_retries = CONN_RETRIES;
+	cache_reval_px.timeout.connect = MS_TO_TICKS(CACHE_REVAL_TIMEOUT);
+	cache_reval_px.timeout.server = MS_TO_TICKS(CACHE_REVAL_TIMEOUT);
+	cache_reval_px.timeout.client = MS_TO_TICKS(CACHE_REVAL_TIMEOUT);
+}
 
 static int parse_cache_rule(struct proxy *proxy, const char *name, struct act_rule *rule, char **err)
 {
@@ -1100,6 +2168,116 @@ int sha1_hosturi(struct stream *s)
 	return 1;
 }
 
+/* Copies the list element <v> into <out> (of size <size>) in lower case and
+ * without any blank, and returns its length. Elements with a null "q"
+ * parameter are refused and 0 is returned, as for empty ones.
+ */
+static size_t vary_normalize_elt(struct ist v, char *out, size_t size)
+{
+	size_t len = 0;
+	char *q;
+	int i;
+
+	for (i = 0; i < v.len && len < size; i++) {
+		if (HTTP_IS_LWS(v.ptr[i]))
+			continue;
+		out[len++] = tolower((unsigned char)v.ptr[i]);
+	}
+
+	q = (char *)my_memmem(out, len, ";q=", 3);
+	if (q) {
+		for (q += 3; q < out + len && (*q == '0' || *q == '.'); q++)
+			;
+		if (q == out + len)
+			return 0;
+	}
+	return len;
+}
+
+/* Hashes the comma-separated elements of all <hdr_name> headers of <htx>
+ * regardless of their order, so that "gzip, br" and "br,gzip" select the same
+ * variant. Returns 0 if the header is absent.
+ */
+static unsigned int vary_unordered_list_hash(const struct htx *htx, struct ist hdr_name)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *trash = get_trash_chunk();
+	unsigned int hash = 0;
+	int found = 0;
+	size_t len;
+
+	while (http_find_header(htx, hdr_name, &ctx, 0)) {
+		found = 1;
+		len = vary_normalize_elt(ctx.value, trash->area, trash->size);
+		if (len)
+			hash += hash_crc32(trash->area, len) * 0x9E3779B1U;
+	}
+	return (found && !hash) ? 1 : hash;
+}
+
+/* Hashes the comma-separated elements of all <hdr_name> headers of <htx> in
+ * their order of appearance. Returns 0 if the header is absent.
+ */
+static unsigned int vary_ordered_list_hash(const struct htx *htx, struct ist hdr_name)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *trash = get_trash_chunk();
+	int found = 0;
+	size_t len;
+
+	trash->data = 0;
+	while (http_find_header(htx, hdr_name, &ctx, 0)) {
+		found = 1;
+		len = vary_normalize_elt(ctx.value, trash->area + trash->data, b_room(trash));
+		if (len) {
+			trash->data += len;
+			chunk_memcat(trash, ",", 1);
+		}
+	}
+	if (!found)
+		return 0;
+	return hash_crc32(trash->area, trash->data) | 1;
+}
+
+/* Hashes the full values of all <hdr_name> headers of <htx> as they are.
+ * Returns 0 if the header is absent.
+ */
+static unsigned int vary_value_hash(const struct htx *htx, struct ist hdr_name)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *trash = get_trash_chunk();
+	int found = 0;
+
+	while (http_find_header(htx, hdr_name, &ctx, 1)) {
+		found = 1;
+		chunk_istcat(trash, ctx.value);
+		chunk_memcat(trash, "\n", 1);
+	}
+	if (!found)
+		return 0;
+	return hash_crc32(trash->area, trash->data) | 1;
+}
+
+/* Computes the secondary key of the request, made of the normalized hashes of
+ * all the headers a response may vary on, and stores it in the transaction.
+ * The Vary header of the response later selects the parts which matter. The
+ * content-coding the response will be compressed with is added when the cache
+ * filter <cconf> stores compressed objects.
+ */
+static void http_request_build_secondary_key(struct stream *s, struct cache_flt_conf *cconf)
+{
+	struct http_txn *txn = s->txn;
+	struct htx *htx = htxbuf(&s->req.buf);
+	int i;
+
+	for (i = 0; i < VARY_HDR_COUNT; i++)
+		write_u32(txn->cache_secondary_hash + i * sizeof(uint32_t),
+		          vary_information[i].norm_fn(htx, vary_information[i].hdr_name));
+	write_u32(txn->cache_secondary_hash + VARY_ENCODING_OFS,
+	          (cconf->flags & CACHE_FLT_F_COMPRESSED) ? comp_select_encoding(s, htx) : 0);
+	txn->flags |= TX_CACHE_HAS_SEC_KEY;
+}
+
 enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *px,
                                          struct session *sess, struct stream *s, int flags)
 {
@@ -1108,6 +2286,25 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	struct cache_entry *res;
 	struct cache_flt_conf *cconf = rule->arg.act.p[0];
 	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx;
+	struct cache_st *st = NULL;
+	struct filter *filter;
+	int reval = 0;
+
+	if (cache->request_collapsing) {
+		list_for_each_entry(filter, &s->strm_flt.filters, list) {
+			if (FLT_ID(filter) == cache_store_flt_id && FLT_CONF(filter) == cconf) {
+				st = filter->ctx;
+				break;
+			}
+		}
+
+		/* woken up while waiting for another stream to fill the
+		 * cache, the lookup was already accounted for.
+		 */
+		if (st && tick_isset(st->wait_exp))
+			goto lookup;
+	}
 
 	/* Ignore cache for HTTP/1.0 requests and for requests other than GET
 	 * and HEAD */
@@ -1126,17 +2323,53 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	if (s->txn->flags & TX_CACHE_IGNORE)
 		return ACT_RET_CONT;
 
+	if (cache->vary_processing || (cconf->flags & CACHE_FLT_F_COMPRESSED))
+		http_request_build_secondary_key(s, cconf);
+
 	if (px == strm_fe(s))
 		_HA_ATOMIC_ADD(&px->fe_counters.p.http.cache_lookups, 1);
 	else
 		_HA_ATOMIC_ADD(&px->be_counters.p.http.cache_lookups, 1);
 
-	shctx_lock(shctx_ptr(cache));
-	res = entry_exist(cache, s->txn->cache_hash);
+  lookup:
+	shctx = cache_shctx(cache, read_u32(s->txn->cache_hash));
+	shctx_lock(shctx);
+	res = entry_exist(cache, s->txn->cache_hash,
+	                  (s->txn->flags & TX_CACHE_HAS_SEC_KEY) ? s->txn->cache_secondary_hash : NULL);
+	if (!res && cache->disk.path)
+		res = cache_disk_promote(cache, s->txn->cache_hash,
+		                         (s->txn->flags & TX_CACHE_HAS_SEC_KEY) ? s->txn->cache_secondary_hash : NULL);
+	if (res && res->expire <= now.tv_sec) {
+		/* a stale entry is delivered while it is revalidated in the
+		 * background, or while the server fails to revalidate it.
+		 */
+		if (!entry_may_serve_stale(res))
+			res = NULL;
+		else if (!(res->flags & CACHE_ENTRY_F_REVALIDATING) &&
+		         res->srv && srv_currently_usable(res->srv) &&
+		         res->next_revalidation <= now.tv_sec) {
+			res->flags |= CACHE_ENTRY_F_REVALIDATING;
+			shctx_row_inc_hot(shctx, block_ptr(res));
+			reval = 1;
+		}
+	}
 	if (res) {
 		struct appctx *appctx;
-		shctx_row_inc_hot(shctx_ptr(cache), block_ptr(res));
-		shctx_unlock(shctx_ptr(cache));
+		shctx_row_inc_hot(shctx, block_ptr(res));
+		shctx_unlock(shctx);
+
+		if (reval && !cache_reval_start(s, cache, res)) {
+			shctx_lock(shctx);
+			res->flags &= ~CACHE_ENTRY_F_REVALIDATING;
+			res->next_revalidation = now.tv_sec + 1;
+			shctx_row_dec_hot(shctx, block_ptr(res));
+			shctx_unlock(shctx);
+		}
+		if (st && tick_isset(st->wait_exp)) {
+			cache_collapse_release(st);
+			st->wait_exp = TICK_ETERNITY;
+			s->req.analyse_exp = TICK_ETERNITY;
+		}
 		s->target = &http_cache_applet.obj_type;
 		if ((appctx = si_register_handler(&s->si[1], objt_applet(s->target)))) {
 			appctx->st0 = HTX_CACHE_INIT;
@@ -1151,13 +2384,16 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 				_HA_ATOMIC_ADD(&px->be_counters.p.http.cache_hits, 1);
 			return ACT_RET_CONT;
 		} else {
-			shctx_lock(shctx_ptr(cache));
-			shctx_row_dec_hot(shctx_ptr(cache), block_ptr(res));
-			shctx_unlock(shctx_ptr(cache));
+			shctx_lock(shctx);
+			shctx_row_dec_hot(shctx, block_ptr(res));
+			shctx_unlock(shctx);
 			return ACT_RET_YIELD;
 		}
 	}
-	shctx_unlock(shctx_ptr(cache));
+	shctx_unlock(shctx);
+
+	if (st)
+		return cache_collapse_miss(s, cache, st, flags & ACT_OPT_FINAL);
 	return ACT_RET_CONT;
 }
 
@@ -1210,6 +2446,13 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			tmp_cache_config->maxage = 60;
 			tmp_cache_config->maxblocks = 0;
 			tmp_cache_config->maxobjsz = 0;
+			tmp_cache_config->max_secondary_entries = CACHE_DEF_MAX_SECONDARY_ENTRIES;
+			tmp_cache_config->vary_processing = 0;
+			tmp_cache_config->request_collapsing = 0;
+			tmp_cache_config->collapse_timeout = CACHE_DEF_COLLAPSE_TIMEOUT;
+			tmp_cache_config->disk.path = NULL;
+			tmp_cache_config->disk.size = 0;
+			tmp_cache_config->nbseg = 0;
 		}
 	} else if (strcmp(args[0], "total-max-size") == 0) {
 		unsigned long int maxsize;
@@ -1274,6 +2517,135 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 		tmp_cache_config->maxobjsz = maxobjsz;
+	} else if (strcmp(args[0], "process-vary") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->vary_processing = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->vary_processing = 0;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"on\" or \"off\".\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "max-secondary-entries") == 0) {
+		unsigned int max_sec_entries;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		max_sec_entries = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !max_sec_entries) {
+			ha_alert("parsing [%s:%d]: max-secondary-entries wrong value '%s'\n",
+			         file, linenum, args[1]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->max_secondary_entries = max_sec_entries;
+	} else if (strcmp(args[0], "request-collapsing") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->request_collapsing = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->request_collapsing = 0;
+		else {
+			ha_alert("parsing [%s:%d]: '%s' expects \"on\" or \"off\".\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "collapse-timeout") == 0) {
+		unsigned int timeout;
+		const char *res;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a timeout value.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &timeout, TIME_UNIT_MS);
+		if (res || !timeout) {
+			ha_alert("parsing [%s:%d]: invalid value '%s' for '%s'.\n",
+			         file, linenum, args[1], args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->collapse_timeout = timeout;
+	} else if (strcmp(args[0], "segments") == 0) {
+		unsigned long int nbseg;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		nbseg = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !nbseg || nbseg > MAX_THREADS * 4) {
+			ha_alert("parsing [%s:%d]: '%s' expects a number of segments between 1 and %d.\n",
+			         file, linenum, args[0], MAX_THREADS * 4);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->nbseg = nbseg;
+	} else if (strcmp(args[0], "disk-file") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a file path.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		free(tmp_cache_config->disk.path);
+		tmp_cache_config->disk.path = strdup(args[1]);
+		if (!tmp_cache_config->disk.path) {
+			ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+	} else if (strcmp(args[0], "disk-max-size") == 0) {
+		unsigned long int maxsize;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		maxsize = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !maxsize) {
+			ha_alert("parsing [%s:%d]: disk-max-size wrong value '%s'\n",
+			         file, linenum, args[1]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		/* size in megabytes */
+		tmp_cache_config->disk.size = (unsigned long long)maxsize * 1024 * 1024;
 	}
 	else if (*args[0] != 0) {
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in 'cache' section\n", file, linenum, args[0]);
@@ -1309,6 +2681,17 @@ int cfg_post_parse_section_cache()
 			goto out;
 		}
 
+		if (tmp_cache_config->disk.path && !tmp_cache_config->disk.size) {
+			ha_alert("\"disk-file\" requires \"disk-max-size\" for cache '%s'\n", tmp_cache_config->id);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
+		else if (!tmp_cache_config->disk.path && tmp_cache_config->disk.size) {
+			ha_warning("\"disk-max-size\" ignored without \"disk-file\" for cache '%s'\n", tmp_cache_config->id);
+			tmp_cache_config->disk.size = 0;
+			err_code |= ERR_WARN;
+		}
+
 		/* add to the list of cache to init and reinit tmp_cache_config
 		 * for next cache section, if any.
 		 */
@@ -1317,12 +2700,52 @@ int cfg_post_parse_section_cache()
 		return err_code;
 	}
 out:
+	if (tmp_cache_config)
+		free(tmp_cache_config->disk.path);
 	free(tmp_cache_config);
 	tmp_cache_config = NULL;
 	return err_code;
 
 }
 
+/* Creates the file of the disk tier <disk> and maps it in memory. Returns 0 on
+ * success, otherwise emits an alert and returns -1.
+ */
+static int cache_disk_init(struct cache_disk *disk)
+{
+	void *area;
+	int fd;
+
+	fd = open(disk->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		ha_alert("Unable to create cache disk file '%s' : %s.\n", disk->path, strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(fd, disk->size) < 0) {
+		ha_alert("Unable to resize cache disk file '%s' : %s.\n", disk->path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	area = mmap(NULL, disk->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED) {
+		ha_alert("Unable to map cache disk file '%s' : %s.\n", disk->path, strerror(errno));
+		return -1;
+	}
+
+	/* records are accessed in no particular order */
+	madvise(area, disk->size, MADV_RANDOM);
+	disk->area = area;
+	disk->head = disk->tail = 0;
+	disk->records = 0;
+	disk->entries = EB_ROOT;
+	disk->pin = NULL;
+	disk->demotions = disk->promotions = 0;
+	return 0;
+}
+
 int post_check_cache()
 {
 	struct proxy *px;
@@ -1330,11 +2753,29 @@ int post_check_cache()
 	struct shared_context *shctx;
 	int ret_shctx;
 	int err_code = 0;
+	int i;
 
 	list_for_each_entry_safe(cache_config, back, &caches_config, list) {
+		unsigned int maxseg;
+
+		/* each segment must be able to hold two of the largest objects */
+		maxseg = cache_config->maxblocks / (2 * ((cache_config->maxobjsz + CACHE_BLOCKSIZE - 1) / CACHE_BLOCKSIZE));
+		if (!maxseg)
+			maxseg = 1;
+
+		if (!cache_config->nbseg)
+			cache_config->nbseg = MIN(global.nbthread, maxseg);
+		else if (cache_config->nbseg > maxseg) {
+			ha_alert("Cache '%s': \"segments\" is limited to %u with this \"total-max-size\" and \"max-object-size\".\n",
+			         cache_config->id, maxseg);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
 
-		ret_shctx = shctx_init(&shctx, cache_config->maxblocks, CACHE_BLOCKSIZE,
-		                       cache_config->maxobjsz, sizeof(struct cache), 1);
+		ret_shctx = shctx_init_seg(&shctx, cache_config->maxblocks, CACHE_BLOCKSIZE,
+		                           cache_config->maxobjsz,
+		                           sizeof(struct cache) + cache_config->nbseg * sizeof(struct eb_root),
+		                           1, cache_config->nbseg);
 
 		if (ret_shctx <= 0) {
 			if (ret_shctx == SHCTX_E_INIT_LOCK)
@@ -1345,13 +2786,22 @@ int post_check_cache()
 			err_code |= ERR_FATAL | ERR_ALERT;
 			goto out;
 		}
-		shctx->free_block = cache_free_blocks;
+		for (i = 0; i < cache_config->nbseg; i++)
+			shctx_seg(shctx, i)->free_block = cache_free_blocks;
 		/* the cache structure is stored in the shctx and added to the
 		 * caches list, we can remove the entry from the caches_config
 		 * list */
 		memcpy(shctx->data, cache_config, sizeof(struct cache));
 		cache = (struct cache *)shctx->data;
-		cache->entries = EB_ROOT_UNIQUE;
+		cache->entries = (struct eb_root *)(cache + 1);
+		for (i = 0; i < cache->nbseg; i++)
+			cache->entries[i] = EB_ROOT;
+		if (cache->disk.path && cache_disk_init(&cache->disk) < 0) {
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
+		if (!cache_reval_px.id)
+			cache_reval_init_proxy();
 		LIST_ADDQ(&caches, &cache->list);
 		LIST_DEL(&cache_config->list);
 		free(cache_config);
@@ -1491,13 +2941,27 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 	}
 
 	list_for_each_entry_from(cache, &caches, list) {
+		struct shared_context *shctx;
 		struct eb32_node *node = NULL;
-		unsigned int next_key;
+		unsigned int next_key, nbav;
 		struct cache_entry *entry;
+		int dup, i;
 
 		next_key = appctx->ctx.cli.i0;
-		if (!next_key) {
-			chunk_printf(&trash, "%p: %s (shctx:%p, available blocks:%d)\n", cache, cache->id, shctx_ptr(cache), shctx_ptr(cache)->nbav);
+		if (!next_key && !appctx->ctx.cli.o0) {
+			for (i = nbav = 0; i < cache->nbseg; i++)
+				nbav += shctx_seg(shctx_ptr(cache), i)->nbav;
+			chunk_printf(&trash, "%p: %s (shctx:%p, available blocks:%u, segments:%u)\n", cache, cache->id, shctx_ptr(cache), nbav, cache->nbseg);
+			if (cache->disk.path) {
+				shctx_lock(shctx_ptr(cache));
+				chunk_appendf(&trash, "  disk:%s size:%llu used:%llu records:%u demotions:%llu promotions:%llu\n",
+				              cache->disk.path, cache->disk.size,
+				              !cache->disk.records ? 0 :
+				              cache->disk.head > cache->disk.tail ? cache->disk.head - cache->disk.tail :
+				              cache->disk.size - cache->disk.tail + cache->disk.head,
+				              cache->disk.records, cache->disk.demotions, cache->disk.promotions);
+				shctx_unlock(shctx_ptr(cache));
+			}
 			if (ci_putchk(si_ic(si), &trash) == -1) {
 				si_rx_room_blk(si);
 				return 0;
@@ -1506,23 +2970,65 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 
 		appctx->ctx.cli.p0 = cache;
 
+		/* dump the segments one at a time, the current one being <o0> */
 		while (1) {
+			if (appctx->ctx.cli.o0 >= cache->nbseg) {
+				appctx->ctx.cli.o0 = 0;
+				break;
+			}
+
+			shctx = shctx_seg(shctx_ptr(cache), appctx->ctx.cli.o0);
+			shctx_lock(shctx);
+			node = eb32_lookup_ge(&cache->entries[appctx->ctx.cli.o0], next_key);
+
+			/* skip the duplicates of this key already dumped (i1) */
+			dup = 0;
+			if (node && node->key == next_key) {
+				for (dup = 0; node && dup < appctx->ctx.cli.i1; dup++)
+					node = eb32_next_dup(node);
+				if (!node && next_key + 1)
+					node = eb32_lookup_ge(&cache->entries[appctx->ctx.cli.o0], next_key + 1);
+				if (!node || node->key != next_key)
+					dup = 0;
+			}
 
-			shctx_lock(shctx_ptr(cache));
-			node = eb32_lookup_ge(&cache->entries, next_key);
 			if (!node) {
-				shctx_unlock(shctx_ptr(cache));
-				appctx->ctx.cli.i0 = 0;
-				break;
+				shctx_unlock(shctx);
+				appctx->ctx.cli.i0 = next_key = 0;
+				appctx->ctx.cli.i1 = 0;
+				appctx->ctx.cli.o0++;
+				continue;
 			}
 
 			entry = container_of(node, struct cache_entry, eb);
-			chunk_printf(&trash, "%p hash:%u size:%u (%u blocks), refcount:%u, expire:%d\n", entry, read_u32(entry->hash), block_ptr(entry)->len, block_ptr(entry)->block_count, block_ptr(entry)->refcount, entry->expire - (int)now.tv_sec);
+			chunk_printf(&trash, "%p hash:%u size:%u (%u blocks), refcount:%u, expire:%d", entry, read_u32(entry->hash), block_ptr(entry)->len, block_ptr(entry)->block_count, block_ptr(entry)->refcount, entry->expire - (int)now.tv_sec);
+			if (entry->secondary_key_signature & ~VARY_ENCODING) {
+				chunk_appendf(&trash, ", vary:");
+				for (i = 0; i < VARY_HDR_COUNT; i++) {
+					if (entry->secondary_key_signature & vary_information[i].value)
+						chunk_appendf(&trash, "%s%.*s=%08x", (entry->secondary_key_signature & (vary_information[i].value - 1)) ? "," : "",
+						              (int)vary_information[i].hdr_name.len, vary_information[i].hdr_name.ptr,
+						              read_u32(entry->secondary_key + i * sizeof(uint32_t)));
+				}
+			}
+			if (entry->secondary_key_signature & VARY_ENCODING) {
+				i = read_u32(entry->secondary_key + VARY_ENCODING_OFS);
+				chunk_appendf(&trash, ", encoding:%s", i ? comp_algos[i - 1].ua_name : "identity");
+			}
+			chunk_appendf(&trash, "\n");
 
-			next_key = node->key + 1;
+			/* resume on the next duplicate if any, otherwise on the next key */
+			if (eb32_next_dup(node)) {
+				next_key = node->key;
+				appctx->ctx.cli.i1 = dup + 1;
+			}
+			else {
+				next_key = node->key + 1;
+				appctx->ctx.cli.i1 = 0;
+			}
 			appctx->ctx.cli.i0 = next_key;
 
-			shctx_unlock(shctx_ptr(cache));
+			shctx_unlock(shctx);
 
 			if (ci_putchk(si_ic(si), &trash) == -1) {
 				si_rx_room_blk(si);
@@ -1577,6 +3083,13 @@ struct applet http_cache_applet = {
 	.release = http_cache_applet_release,
 };
 
+struct applet cache_reval_applet = {
+	.obj_type = OBJ_TYPE_APPLET,
+	.name = "<CACHEREVAL>", /* used for logging */
+	.fct = cache_reval_io_handler,
+	.release = cache_reval_release,
+};
+
 /* config parsers for this section */
 REGISTER_CONFIG_SECTION("cache", cfg_parse_cache, cfg_post_parse_section_cache);
 REGISTER_POST_CHECK(post_check_cache);
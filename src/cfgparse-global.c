@@ -437,6 +437,16 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 	}
+	else if (!strcmp(args[0], "tune.pattern.regset")) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code))
+			goto out;
+		if (!*args[1] || (global.tune.pattern_regset = atoi(args[1])) < 0) {
+			ha_alert("parsing [%s:%d] : '%s' expects a positive numeric value\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+	}
 	else if (!strcmp(args[0], "tune.pattern.cache-size")) {
 		if (*args[1]) {
 			global.tune.pattern_cache = atoi(args[1]);
@@ -434,6 +434,7 @@ int cfg_parse_listen(const char *file, int linenum, char **args, int kwm)
 			curproxy->comp = calloc(1, sizeof(struct comp));
 			curproxy->comp->algos = defproxy.comp->algos;
 			curproxy->comp->types = defproxy.comp->types;
+			curproxy->comp->async = defproxy.comp->async;
 		}
 
 		curproxy->grace  = defproxy.grace;
@@ -2638,9 +2639,10 @@ stats_error_parsing:
 	else if (!strcmp(args[0], "hash-type")) { /* set hashing method */
 		/**
 		 * The syntax for hash-type config element is
-		 * hash-type {map-based|consistent} [[<algo>] avalanche]
+		 * hash-type {map-based|consistent|maglev} [[<algo>] avalanche]
 		 *
-		 * The default hash function is sdbm for map-based and sdbm+avalanche for consistent.
+		 * The default hash function is sdbm for map-based and sdbm+avalanche for consistent
+		 * and maglev.
 		 */
 		curproxy->lbprm.algo &= ~(BE_LB_HASH_TYPE | BE_LB_HASH_FUNC | BE_LB_HASH_MOD);
 
@@ -2653,13 +2655,16 @@ stats_error_parsing:
 		else if (strcmp(args[1], "map-based") == 0) {	/* use map-based hashing */
 			curproxy->lbprm.algo |= BE_LB_HASH_MAP;
 		}
+		else if (strcmp(args[1], "maglev") == 0) {	/* use Maglev hashing */
+			curproxy->lbprm.algo |= BE_LB_HASH_MAGLEV;
+		}
 		else if (strcmp(args[1], "avalanche") == 0) {
 			ha_alert("parsing [%s:%d] : experimental feature '%s %s' is not supported anymore, please use '%s map-based sdbm avalanche' instead.\n", file, linenum, args[0], args[1], args[0]);
 			err_code |= ERR_ALERT | ERR_FATAL;
 			goto out;
 		}
 		else {
-			ha_alert("parsing [%s:%d] : '%s' only supports 'consistent' and 'map-based'.\n", file, linenum, args[0]);
+			ha_alert("parsing [%s:%d] : '%s' only supports 'consistent', 'map-based' and 'maglev'.\n", file, linenum, args[0]);
 			err_code |= ERR_ALERT | ERR_FATAL;
 			goto out;
 		}
@@ -2669,8 +2674,9 @@ stats_error_parsing:
 			/* the default algo is sdbm */
 			curproxy->lbprm.algo |= BE_LB_HFCN_SDBM;
 
-			/* if consistent with no argument, then avalanche modifier is also applied */
-			if ((curproxy->lbprm.algo & BE_LB_HASH_TYPE) == BE_LB_HASH_CONS)
+			/* if consistent or maglev with no argument, then avalanche modifier is also applied */
+			if ((curproxy->lbprm.algo & BE_LB_HASH_TYPE) == BE_LB_HASH_CONS ||
+			    (curproxy->lbprm.algo & BE_LB_HASH_TYPE) == BE_LB_HASH_MAGLEV)
 				curproxy->lbprm.algo |= BE_LB_HMOD_AVAL;
 		} else {
 			/* set the hash function */
@@ -68,6 +68,7 @@
 #include <proto/lb_fas.h>
 #include <proto/lb_fwlc.h>
 #include <proto/lb_fwrr.h>
+#include <proto/lb_maglev.h>
 #include <proto/lb_map.h>
 #include <proto/listener.h>
 #include <proto/log.h>
@@ -911,6 +912,17 @@ int cfg_parse_peers(const char *file, int linenum, char **args, int kwm)
 		t->next = stktables_list;
 		stktables_list = t;
 	}
+	else if (!strcmp(args[0], "compression")) {  /* deflate batched updates */
+		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+			goto out;
+#if defined(USE_ZLIB)
+		curpeers->compress = 1;
+#else
+		ha_warning("parsing [%s:%d] : '%s' is not supported without zlib support, ignored.\n",
+		           file, linenum, args[0]);
+		err_code |= ERR_WARN;
+#endif
+	}
 	else if (!strcmp(args[0], "disabled")) {  /* disables this peers section */
 		curpeers->state = PR_STSTOPPED;
 	}
@@ -999,12 +1011,14 @@ int cfg_parse_resolvers(const char *file, int linenum, char **args, int kwm)
 		LIST_INIT(&curr_resolvers->nameservers);
 		LIST_INIT(&curr_resolvers->resolutions.curr);
 		LIST_INIT(&curr_resolvers->resolutions.wait);
+		curr_resolvers->resolutions.names = EB_ROOT;
 		HA_SPIN_INIT(&curr_resolvers->lock);
 	}
 	else if (strcmp(args[0], "nameserver") == 0) { /* nameserver definition */
 		struct sockaddr_storage *sk;
 		int port1, port2;
 		struct protocol *proto;
+		char *addr;
 
 		if (!*args[2]) {
 			ha_alert("parsing [%s:%d] : '%s' expects <name> and <addr>[:<port>] as arguments.\n",
@@ -1043,7 +1057,13 @@ int cfg_parse_resolvers(const char *file, int linenum, char **args, int kwm)
 		newnameserver->conf.line = linenum;
 		newnameserver->id = strdup(args[1]);
 
-		sk = str2sa_range(args[2], NULL, &port1, &port2, &errmsg, NULL, NULL, 1);
+		addr = args[2];
+		if (strncmp(addr, "tcp@", 4) == 0) {
+			newnameserver->flags |= DNS_NS_F_TCP;
+			addr += 4;
+		}
+
+		sk = str2sa_range(addr, NULL, &port1, &port2, &errmsg, NULL, NULL, 1);
 		if (!sk) {
 			ha_alert("parsing [%s:%d] : '%s %s' : %s\n", file, linenum, args[0], args[1], errmsg);
 			err_code |= ERR_ALERT | ERR_FATAL;
@@ -2775,6 +2795,11 @@ int check_config_validity()
 				         curproxy->id, target->id, curproxy->id);
 				cfgerr++;
 			}
+			else if (target->sketch.width) {
+				ha_alert("Proxy '%s': stick-table '%s' uses a sketch and cannot be referenced by stick rules.\n",
+				         curproxy->id, target->id);
+				cfgerr++;
+			}
 			else {
 				free((void *)mrule->table.name);
 				mrule->table.t = target;
@@ -2813,6 +2838,11 @@ int check_config_validity()
 				         curproxy->id, target->id, curproxy->id);
 				cfgerr++;
 			}
+			else if (target->sketch.width) {
+				ha_alert("Proxy '%s': stick-table '%s' uses a sketch and cannot be referenced by stick rules.\n",
+				         curproxy->id, target->id);
+				cfgerr++;
+			}
 			else {
 				free((void *)mrule->table.name);
 				mrule->table.t = target;
@@ -3013,6 +3043,14 @@ out_uri_auth_compat:
 			curproxy->conf.lfsd_line = 0;
 		}
 
+		/* binary logs don't use the log-format but still need all the
+		 * information it would collect, so let's pick the default one.
+		 */
+		if ((curproxy->cap & PR_CAP_FE) && (curproxy->options2 & PR_O2_BINLOG) &&
+		    !curproxy->conf.logformat_string)
+			curproxy->conf.logformat_string = (curproxy->mode == PR_MODE_HTTP) ?
+				default_http_log_format : default_tcp_log_format;
+
 		if (curproxy->conf.logformat_string) {
 			curproxy->conf.args.ctx = ARGC_LOG;
 			curproxy->conf.args.file = curproxy->conf.lfs_file;
@@ -3027,6 +3065,13 @@ out_uri_auth_compat:
 			}
 			curproxy->conf.args.file = NULL;
 			curproxy->conf.args.line = 0;
+
+			/* the binary records need these whatever the log-format */
+			if (curproxy->options2 & PR_O2_BINLOG) {
+				curproxy->to_log |= LW_INIT | LW_CLIP | LW_SVID | LW_BYTES;
+				if (curproxy->mode == PR_MODE_HTTP)
+					curproxy->to_log |= LW_REQ | LW_RESP;
+			}
 		}
 
 		if (curproxy->conf.logformat_sd_string) {
@@ -3040,7 +3085,8 @@ out_uri_auth_compat:
 					 curproxy->conf.lfs_file, curproxy->conf.lfs_line, err);
 				free(err);
 				cfgerr++;
-			} else if (!add_to_logformat_list(NULL, NULL, LF_SEPARATOR, &curproxy->logformat_sd, &err)) {
+			} else if (!add_to_logformat_list(NULL, NULL, LF_SEPARATOR, &curproxy->logformat_sd, &err) ||
+			           !compile_logformat_list(&curproxy->logformat_sd, &err)) {
 				ha_alert("Parsing [%s:%d]: failed to parse log-format-sd : %s.\n",
 					 curproxy->conf.lfs_file, curproxy->conf.lfs_line, err);
 				free(err);
@@ -3359,7 +3405,8 @@ out_uri_auth_compat:
 			if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_STATIC) {
 				curproxy->lbprm.algo |= BE_LB_LKUP_MAP;
 				init_server_map(curproxy);
-			} else if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM) {
+			} else if ((curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_RANDOM ||
+			           (curproxy->lbprm.algo & BE_LB_PARM) == BE_LB_RR_EWMA) {
 				curproxy->lbprm.algo |= BE_LB_LKUP_CHTREE | BE_LB_PROP_DYN;
 				chash_init_server_tree(curproxy);
 			} else {
@@ -3382,6 +3429,13 @@ out_uri_auth_compat:
 			if ((curproxy->lbprm.algo & BE_LB_HASH_TYPE) == BE_LB_HASH_CONS) {
 				curproxy->lbprm.algo |= BE_LB_LKUP_CHTREE | BE_LB_PROP_DYN;
 				chash_init_server_tree(curproxy);
+			} else if ((curproxy->lbprm.algo & BE_LB_HASH_TYPE) == BE_LB_HASH_MAGLEV) {
+				curproxy->lbprm.algo |= BE_LB_LKUP_MGTABLE | BE_LB_PROP_DYN;
+				if (maglev_init_server_table(curproxy) < 0) {
+					ha_alert("config : %s '%s' : out of memory while allocating the Maglev table.\n",
+						 proxy_type_str(curproxy), curproxy->id);
+					cfgerr++;
+				}
 			} else {
 				curproxy->lbprm.algo |= BE_LB_LKUP_MAP;
 				init_server_map(curproxy);
@@ -3674,8 +3728,8 @@ out_uri_auth_compat:
 					}
 				}
 
-				newsrv->idle_conns = calloc((unsigned)global.nbthread, sizeof(*newsrv->idle_conns));
-				if (!newsrv->idle_conns) {
+				newsrv->idle_conns_tree = calloc((unsigned)global.nbthread, sizeof(*newsrv->idle_conns_tree));
+				if (!newsrv->idle_conns_tree) {
 					ha_alert("parsing [%s:%d] : failed to allocate idle connections for server '%s'.\n",
 					    newsrv->conf.file, newsrv->conf.line, newsrv->id);
 					cfgerr++;
@@ -3683,10 +3737,10 @@ out_uri_auth_compat:
 				}
 
 				for (i = 0; i < global.nbthread; i++)
-					MT_LIST_INIT(&newsrv->idle_conns[i]);
+					newsrv->idle_conns_tree[i] = EB_ROOT;
 
-				newsrv->safe_conns = calloc((unsigned)global.nbthread, sizeof(*newsrv->safe_conns));
-				if (!newsrv->safe_conns) {
+				newsrv->safe_conns_tree = calloc((unsigned)global.nbthread, sizeof(*newsrv->safe_conns_tree));
+				if (!newsrv->safe_conns_tree) {
 					ha_alert("parsing [%s:%d] : failed to allocate idle connections for server '%s'.\n",
 					    newsrv->conf.file, newsrv->conf.line, newsrv->id);
 					cfgerr++;
@@ -3694,7 +3748,21 @@ out_uri_auth_compat:
 				}
 
 				for (i = 0; i < global.nbthread; i++)
+					newsrv->safe_conns_tree[i] = EB_ROOT;
+
+				newsrv->idle_conns = calloc((unsigned)global.nbthread, sizeof(*newsrv->idle_conns));
+				newsrv->safe_conns = calloc((unsigned)global.nbthread, sizeof(*newsrv->safe_conns));
+				if (!newsrv->idle_conns || !newsrv->safe_conns) {
+					ha_alert("parsing [%s:%d] : failed to allocate idle connections for server '%s'.\n",
+					    newsrv->conf.file, newsrv->conf.line, newsrv->id);
+					cfgerr++;
+					continue;
+				}
+
+				for (i = 0; i < global.nbthread; i++) {
+					MT_LIST_INIT(&newsrv->idle_conns[i]);
 					MT_LIST_INIT(&newsrv->safe_conns[i]);
+				}
 
 				newsrv->curr_idle_thr = calloc(global.nbthread, sizeof(int));
 				if (!newsrv->curr_idle_thr)
@@ -12,6 +12,9 @@
  */
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #if defined(USE_SLZ)
 #include <slz.h>
@@ -26,6 +29,18 @@
 #undef free_func
 #endif /* USE_ZLIB */
 
+#ifdef USE_ZSTD
+#include <zstd.h>
+#ifdef USE_OPENSSL
+#include <openssl/sha.h>
+#endif
+#endif
+
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <common/base64.h>
 #include <common/cfgparse.h>
 #include <common/compat.h>
 #include <common/hathreads.h>
@@ -64,6 +79,35 @@ static int global_tune_zlibwindowsize = MAX_WBITS;  /* zlib window size */
 
 #endif
 
+#ifdef USE_ZSTD
+
+/* number of idle zstd streams kept by each thread for reuse */
+#define ZSTD_CCTX_CACHE 4
+
+static THREAD_LOCAL ZSTD_CCtx *zstd_cctx_cache[ZSTD_CCTX_CACHE];
+static THREAD_LOCAL int zstd_cctx_cached = 0;
+
+static int global_tune_zstdlevel = 3;               /* zstd compression level */
+static char *zstd_dict_file = NULL;                 /* shared dictionary file */
+static void *zstd_dict = NULL;                      /* shared dictionary contents */
+static size_t zstd_dict_len = 0;
+static ZSTD_CDict *zstd_cdict = NULL;               /* prepared dictionary, shared by all threads */
+
+/* A "dcz" response starts with a skippable frame holding the SHA-256 of the
+ * dictionary (RFC 9842), which the client announces as a structured field
+ * byte sequence in the Available-Dictionary header.
+ */
+#define ZSTD_DCZ_HDR_LEN 40
+static unsigned char zstd_dcz_hdr[ZSTD_DCZ_HDR_LEN] = { 0x5e, 0x2a, 0x4d, 0x18, 0x20, 0x00, 0x00, 0x00 };
+static char zstd_dcz_id[48];                        /* ":<base64 hash>:" */
+
+#endif
+
+#ifdef USE_BROTLI
+static int global_tune_brotliquality = 4;           /* brotli quality */
+static int global_tune_brotliwindow = 18;           /* brotli window size (log2) */
+#endif
+
 unsigned int compress_min_idle = 0;
 
 static int identity_init(struct comp_ctx **comp_ctx, int level);
@@ -94,6 +138,27 @@ static int deflate_end(struct comp_ctx **comp_ctx);
 
 #endif /* USE_ZLIB */
 
+#ifdef USE_ZSTD
+
+static int zstd_init(struct comp_ctx **comp_ctx, int level);
+static int zstd_dict_init(struct comp_ctx **comp_ctx, int level);
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int zstd_end(struct comp_ctx **comp_ctx);
+
+#endif /* USE_ZSTD */
+
+#ifdef USE_BROTLI
+
+static int brotli_init(struct comp_ctx **comp_ctx, int level);
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out);
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out);
+static int brotli_end(struct comp_ctx **comp_ctx);
+
+#endif /* USE_BROTLI */
+
 
 const struct comp_algo comp_algos[] =
 {
@@ -107,6 +172,13 @@ const struct comp_algo comp_algos[] =
 	{ "raw-deflate", 11, "deflate",  7, raw_def_init,  deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
 	{ "gzip",         4, "gzip",     4, gzip_init,     deflate_add_data,  deflate_flush,  deflate_finish,  deflate_end },
 #endif /* USE_ZLIB */
+#if defined(USE_ZSTD)
+	{ "zstd",         4, "zstd",     4, zstd_init,      zstd_add_data,     zstd_flush,     zstd_finish,     zstd_end },
+	{ "zstd-dict",    9, "dcz",      3, zstd_dict_init, zstd_add_data,     zstd_flush,     zstd_finish,     zstd_end, zstd_dcz_id },
+#endif /* USE_ZSTD */
+#if defined(USE_BROTLI)
+	{ "br",           2, "br",       2, brotli_init,    brotli_add_data,   brotli_flush,   brotli_finish,   brotli_end },
+#endif /* USE_BROTLI */
 	{ NULL,       0, NULL,          0, NULL ,         NULL,              NULL,           NULL,           NULL }
 };
 
@@ -145,7 +217,7 @@ int comp_append_algo(struct comp *comp, const char *algo)
 	return -1;
 }
 
-#if defined(USE_ZLIB) || defined(USE_SLZ)
+#if defined(USE_ZLIB) || defined(USE_SLZ) || defined(USE_ZSTD) || defined(USE_BROTLI)
 DECLARE_STATIC_POOL(pool_comp_ctx, "comp_ctx", sizeof(struct comp_ctx));
 
 /*
@@ -696,12 +768,400 @@ static int zlib_parse_global_windowsize(char **args, int section_type, struct pr
 
 #endif /* USE_ZLIB */
 
+#ifdef USE_ZSTD
+
+/**************************
+****  zstd algorithm   ****
+***************************/
+
+/* Takes a zstd stream from the thread's cache or creates a new one. The
+ * dictionary is only used when <dict> is set. Returns < 0 on error.
+ */
+static int zstd_init_common(struct comp_ctx **comp_ctx, int dict)
+{
+	ZSTD_CCtx *cctx;
+
+	if (init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	if (zstd_cctx_cached)
+		cctx = zstd_cctx_cache[--zstd_cctx_cached];
+	else
+		cctx = ZSTD_createCCtx();
+
+	if (!cctx ||
+	    ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, global_tune_zstdlevel)) ||
+	    ZSTD_isError(ZSTD_CCtx_refCDict(cctx, dict ? zstd_cdict : NULL))) {
+		ZSTD_freeCCtx(cctx);
+		deinit_comp_ctx(comp_ctx);
+		return -1;
+	}
+
+	(*comp_ctx)->zstd = cctx;
+	(*comp_ctx)->zstd_hdr = dict;
+	(*comp_ctx)->cur_lvl = global_tune_zstdlevel;
+	return 0;
+}
+
+static int zstd_init(struct comp_ctx **comp_ctx, int level)
+{
+	return zstd_init_common(comp_ctx, 0);
+}
+
+/* same as zstd but with the dictionary from "tune.zstd.dictionary" */
+static int zstd_dict_init(struct comp_ctx **comp_ctx, int level)
+{
+	if (!zstd_dict)
+		return -1;
+	return zstd_init_common(comp_ctx, 1);
+}
+
+/* Runs the zstd stream with the <mode> directive on <in_data> until it was
+ * fully consumed or <out> is full, and for ZSTD_e_flush and ZSTD_e_end, until
+ * everything was emitted. Returns the amount of data consumed, or -1 on error.
+ */
+static int zstd_process(struct comp_ctx *comp_ctx, const char *in_data, int in_len,
+                        struct buffer *out, ZSTD_EndDirective mode)
+{
+	ZSTD_inBuffer in = { in_data, in_len, 0 };
+	ZSTD_outBuffer zout;
+	size_t ret;
+
+	if (comp_ctx->zstd_hdr) {
+		if (b_room(out) < ZSTD_DCZ_HDR_LEN)
+			return -1;
+		memcpy(b_tail(out), zstd_dcz_hdr, ZSTD_DCZ_HDR_LEN);
+		b_add(out, ZSTD_DCZ_HDR_LEN);
+		comp_ctx->zstd_hdr = 0;
+	}
+
+	zout = (ZSTD_outBuffer){ b_tail(out), b_room(out), 0 };
+	do {
+		ret = ZSTD_compressStream2(comp_ctx->zstd, &zout, &in, mode);
+		if (ZSTD_isError(ret))
+			return -1;
+		if (mode == ZSTD_e_continue && in.pos == in.size)
+			break;
+	} while (ret && zout.pos < zout.size);
+
+	b_add(out, zout.pos);
+	/* some flushed data did not fit in <out> */
+	if (mode != ZSTD_e_continue && ret)
+		return -1;
+	return in.pos;
+}
+
+static int zstd_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	if (in_len <= 0)
+		return 0;
+
+	if (b_room(out) <= 0)
+		return -1;
+
+	return zstd_process(comp_ctx, in_data, in_len, out, ZSTD_e_continue);
+}
+
+static int zstd_flush_or_finish(struct comp_ctx *comp_ctx, struct buffer *out, ZSTD_EndDirective mode)
+{
+	size_t out_len = b_data(out);
+
+	if (zstd_process(comp_ctx, NULL, 0, out, mode) < 0)
+		return -1;
+	return b_data(out) - out_len;
+}
+
+static int zstd_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return zstd_flush_or_finish(comp_ctx, out, ZSTD_e_flush);
+}
+
+static int zstd_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return zstd_flush_or_finish(comp_ctx, out, ZSTD_e_end);
+}
+
+/* Gives the zstd stream back to the thread's cache, or releases it when the
+ * cache is full.
+ */
+static int zstd_end(struct comp_ctx **comp_ctx)
+{
+	ZSTD_CCtx *cctx = (*comp_ctx)->zstd;
+
+	if (zstd_cctx_cached < ZSTD_CCTX_CACHE &&
+	    !ZSTD_isError(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only)))
+		zstd_cctx_cache[zstd_cctx_cached++] = cctx;
+	else
+		ZSTD_freeCCtx(cctx);
+
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+/* prepares the dictionary loaded by "tune.zstd.dictionary" once the level is
+ * known.
+ */
+static int zstd_post_check()
+{
+	if (!zstd_dict)
+		return 0;
+
+	zstd_cdict = ZSTD_createCDict(zstd_dict, zstd_dict_len, global_tune_zstdlevel);
+	if (!zstd_cdict) {
+		ha_alert("zstd: failed to load the dictionary from '%s'.\n", zstd_dict_file);
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return 0;
+}
+
+static void zstd_free_per_thread()
+{
+	while (zstd_cctx_cached)
+		ZSTD_freeCCtx(zstd_cctx_cache[--zstd_cctx_cached]);
+}
+
+static void zstd_deinit()
+{
+	ZSTD_freeCDict(zstd_cdict);
+	zstd_cdict = NULL;
+	free(zstd_dict);
+	zstd_dict = NULL;
+	free(zstd_dict_file);
+	zstd_dict_file = NULL;
+}
+
+REGISTER_POST_CHECK(zstd_post_check);
+REGISTER_PER_THREAD_FREE(zstd_free_per_thread);
+REGISTER_POST_DEINIT(zstd_deinit);
+
+/* config parser for global "tune.zstd.level" */
+static int zstd_parse_global_level(char **args, int section_type, struct proxy *curpx,
+                                   struct proxy *defpx, const char *file, int line,
+                                   char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	global_tune_zstdlevel = atoi(args[1]);
+	if (global_tune_zstdlevel < 1 || global_tune_zstdlevel > ZSTD_maxCLevel()) {
+		memprintf(err, "'%s' expects a numeric value between 1 and %d.", args[0], ZSTD_maxCLevel());
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.zstd.dictionary" */
+static int zstd_parse_global_dictionary(char **args, int section_type, struct proxy *curpx,
+                                        struct proxy *defpx, const char *file, int line,
+                                        char **err)
+{
+	struct stat st;
+	ssize_t ret;
+	size_t len = 0;
+	int fd;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (*(args[1]) == 0) {
+		memprintf(err, "'%s' expects a file name.", args[0]);
+		return -1;
+	}
+
+#ifndef USE_OPENSSL
+	memprintf(err, "'%s' : OpenSSL support is required to hash the dictionary.", args[0]);
+	return -1;
+#endif
+
+	if (zstd_dict) {
+		memprintf(err, "'%s' already specified.", args[0]);
+		return -1;
+	}
+
+	fd = open(args[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || !st.st_size) {
+		memprintf(err, "'%s' : cannot load dictionary '%s'.", args[0], args[1]);
+		goto fail;
+	}
+
+	zstd_dict = malloc(st.st_size);
+	if (!zstd_dict) {
+		memprintf(err, "'%s' : out of memory.", args[0]);
+		goto fail;
+	}
+
+	while (len < st.st_size) {
+		ret = read(fd, zstd_dict + len, st.st_size - len);
+		if (ret <= 0) {
+			memprintf(err, "'%s' : cannot read dictionary '%s'.", args[0], args[1]);
+			goto fail;
+		}
+		len += ret;
+	}
+	close(fd);
+	zstd_dict_len = len;
+	zstd_dict_file = strdup(args[1]);
+
+#ifdef USE_OPENSSL
+	SHA256(zstd_dict, len, zstd_dcz_hdr + 8);
+	zstd_dcz_id[0] = ':';
+	len = a2base64((char *)zstd_dcz_hdr + 8, SHA256_DIGEST_LENGTH, zstd_dcz_id + 1, sizeof(zstd_dcz_id) - 2);
+	zstd_dcz_id[len + 1] = ':';
+	zstd_dcz_id[len + 2] = 0;
+#endif
+	return 0;
+
+ fail:
+	free(zstd_dict);
+	zstd_dict = NULL;
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+#endif /* USE_ZSTD */
+
+#ifdef USE_BROTLI
+
+/**************************
+****  brotli algorithm ****
+***************************/
+
+static int brotli_init(struct comp_ctx **comp_ctx, int level)
+{
+	BrotliEncoderState *state;
+
+	if (init_comp_ctx(comp_ctx) < 0)
+		return -1;
+
+	state = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+	if (!state ||
+	    !BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, global_tune_brotliquality) ||
+	    !BrotliEncoderSetParameter(state, BROTLI_PARAM_LGWIN, global_tune_brotliwindow)) {
+		if (state)
+			BrotliEncoderDestroyInstance(state);
+		deinit_comp_ctx(comp_ctx);
+		return -1;
+	}
+
+	(*comp_ctx)->brotli = state;
+	(*comp_ctx)->cur_lvl = global_tune_brotliquality;
+	return 0;
+}
+
+/* Runs the brotli stream with operation <op> on <in_data> until it was fully
+ * consumed or <out> is full, and for flush and finish operations, until
+ * everything was emitted. Returns the amount of data consumed, or -1 on error.
+ */
+static int brotli_process(struct comp_ctx *comp_ctx, const char *in_data, int in_len,
+                          struct buffer *out, BrotliEncoderOperation op)
+{
+	BrotliEncoderState *state = comp_ctx->brotli;
+	const uint8_t *next_in = (const uint8_t *)in_data;
+	size_t avail_in = in_len;
+	uint8_t *next_out = (uint8_t *)b_tail(out);
+	size_t avail_out = b_room(out);
+
+	while (1) {
+		if (!BrotliEncoderCompressStream(state, op, &avail_in, &next_in, &avail_out, &next_out, NULL))
+			return -1;
+		if (!avail_out)
+			break;
+		if (op == BROTLI_OPERATION_PROCESS ? !avail_in :
+		    !BrotliEncoderHasMoreOutput(state) &&
+		    (op != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(state)))
+			break;
+	}
+
+	b_add(out, b_room(out) - avail_out);
+	/* some flushed data did not fit in <out> */
+	if (op != BROTLI_OPERATION_PROCESS && BrotliEncoderHasMoreOutput(state))
+		return -1;
+	return in_len - avail_in;
+}
+
+static int brotli_add_data(struct comp_ctx *comp_ctx, const char *in_data, int in_len, struct buffer *out)
+{
+	if (in_len <= 0)
+		return 0;
+
+	if (b_room(out) <= 0)
+		return -1;
+
+	return brotli_process(comp_ctx, in_data, in_len, out, BROTLI_OPERATION_PROCESS);
+}
+
+static int brotli_flush_or_finish(struct comp_ctx *comp_ctx, struct buffer *out, BrotliEncoderOperation op)
+{
+	size_t out_len = b_data(out);
+
+	if (brotli_process(comp_ctx, NULL, 0, out, op) < 0)
+		return -1;
+	return b_data(out) - out_len;
+}
+
+static int brotli_flush(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return brotli_flush_or_finish(comp_ctx, out, BROTLI_OPERATION_FLUSH);
+}
+
+static int brotli_finish(struct comp_ctx *comp_ctx, struct buffer *out)
+{
+	return brotli_flush_or_finish(comp_ctx, out, BROTLI_OPERATION_FINISH);
+}
+
+static int brotli_end(struct comp_ctx **comp_ctx)
+{
+	BrotliEncoderDestroyInstance((*comp_ctx)->brotli);
+	deinit_comp_ctx(comp_ctx);
+	return 0;
+}
+
+/* config parser for global "tune.brotli.quality" and "tune.brotli.window" */
+static int brotli_parse_global(char **args, int section_type, struct proxy *curpx,
+                               struct proxy *defpx, const char *file, int line,
+                               char **err)
+{
+	int min, max, *val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[0], "tune.brotli.quality") == 0) {
+		min = BROTLI_MIN_QUALITY;
+		max = BROTLI_MAX_QUALITY;
+		val = &global_tune_brotliquality;
+	}
+	else {
+		min = BROTLI_MIN_WINDOW_BITS;
+		max = BROTLI_MAX_WINDOW_BITS;
+		val = &global_tune_brotliwindow;
+	}
+
+	*val = atoi(args[1]);
+	if (*(args[1]) == 0 || *val < min || *val > max) {
+		memprintf(err, "'%s' expects a numeric value between %d and %d.", args[0], min, max);
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* USE_BROTLI */
+
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
 #ifdef USE_ZLIB
 	{ CFG_GLOBAL, "tune.zlib.memlevel",   zlib_parse_global_memlevel },
 	{ CFG_GLOBAL, "tune.zlib.windowsize", zlib_parse_global_windowsize },
+#endif
+#ifdef USE_ZSTD
+	{ CFG_GLOBAL, "tune.zstd.level",      zstd_parse_global_level },
+	{ CFG_GLOBAL, "tune.zstd.dictionary", zstd_parse_global_dictionary },
+#endif
+#ifdef USE_BROTLI
+	{ CFG_GLOBAL, "tune.brotli.quality",  brotli_parse_global },
+	{ CFG_GLOBAL, "tune.brotli.window",   brotli_parse_global },
 #endif
 	{ 0, NULL, NULL }
 }};
@@ -733,6 +1193,15 @@ static void comp_register_build_opts(void)
 	memprintf(&ptr, "Built with libslz for stateless compression.");
 #else
 	memprintf(&ptr, "Built without compression support (neither USE_ZLIB nor USE_SLZ are set).");
+#endif
+#ifdef USE_ZSTD
+	memprintf(&ptr, "%s\nBuilt with zstd version : " ZSTD_VERSION_STRING, ptr);
+	memprintf(&ptr, "%s\nRunning on zstd version : %s", ptr, ZSTD_versionString());
+#endif
+#ifdef USE_BROTLI
+	memprintf(&ptr, "%s\nRunning on brotli version : %u.%u.%u", ptr,
+		  BrotliEncoderVersion() >> 24, (BrotliEncoderVersion() >> 12) & 0xfff,
+		  BrotliEncoderVersion() & 0xfff);
 #endif
 	memprintf(&ptr, "%s\nCompression algorithms supported :", ptr);
 
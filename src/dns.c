@@ -63,6 +63,8 @@ DECLARE_POOL(dns_requester_pool,  "dns_requester",  sizeof(struct dns_requester)
 static unsigned int resolution_uuid = 1;
 unsigned int dns_failed_resolutions = 0;
 
+static void dns_stream_fd_handler(int fd);
+
 /* Returns a pointer to the resolvers matching the id <id>. NULL is returned if
  * no match is found.
  */
@@ -90,6 +92,63 @@ static __inline int dns_hostname_cmp(const char *name1, const char *name2, int l
 	return 0;
 }
 
+/* Returns a case-insensitive hash of the <len> first bytes of domain name <dn>
+ * mixed with <seed>, so that names which dns_hostname_cmp() considers equal
+ * always get the same key in the trees indexing names.
+ */
+static inline unsigned int dns_name_hash(const char *dn, int len, unsigned int seed)
+{
+	unsigned int hash = 2166136261U ^ seed;
+	int i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)tolower(dn[i])) * 16777619U;
+	return hash;
+}
+
+/* Returns the key of answer record <item> in its response's answer tree: the
+ * hash of its address for A and AAAA records, and the hash of its target for
+ * SRV records, regardless of the port, so that they may also be found from
+ * the name of an additional record.
+ */
+static unsigned int dns_answer_key(const struct dns_answer_item *item)
+{
+	switch (item->type) {
+		case DNS_RTYPE_A:
+			return dns_name_hash((char *)&((struct sockaddr_in *)&item->address)->sin_addr,
+					     sizeof(struct in_addr), item->type);
+		case DNS_RTYPE_AAAA:
+			return dns_name_hash((char *)&((struct sockaddr_in6 *)&item->address)->sin6_addr,
+					     sizeof(struct in6_addr), item->type);
+		case DNS_RTYPE_SRV:
+			return dns_name_hash(item->target, item->data_len, item->type);
+		default:
+			return item->type;
+	}
+}
+
+/* Returns non-zero if answer record <item> was not seen for longer than the
+ * "hold obsolete" period of <resolvers>.
+ */
+static inline int dns_answer_is_obsolete(const struct dns_resolvers *resolvers,
+					 const struct dns_answer_item *item)
+{
+	return (item->last_seen + resolvers->hold.obsolete / 1000) < now.tv_sec;
+}
+
+/* Returns the date until which the last valid response of resolution <res>
+ * may be served from the cache: "hold valid" after the resolution, unless one
+ * of its answers had a shorter TTL.
+ */
+static inline int dns_cache_expire(const struct dns_resolution *res)
+{
+	unsigned int hold = res->resolvers->hold.valid;
+
+	if (res->response.min_ttl < hold / 1000)
+		hold = res->response.min_ttl * 1000;
+	return tick_add(res->last_resolution, hold);
+}
+
 /* Returns a pointer on the SRV request matching the name <name> for the proxy
  * <px>. NULL is returned if no match is found.
  */
@@ -170,6 +229,7 @@ static inline int dns_resolution_timeout(struct dns_resolution *res)
 static void dns_update_resolvers_timeout(struct dns_resolvers *resolvers)
 {
 	struct dns_resolution *res;
+	struct dns_nameserver *ns;
 	int next;
 
 	next = tick_add(now_ms, resolvers->timeout.resolve);
@@ -181,6 +241,11 @@ static void dns_update_resolvers_timeout(struct dns_resolvers *resolvers)
 	list_for_each_entry(res, &resolvers->resolutions.wait, list)
 		next = MIN(next, tick_add(res->last_resolution, dns_resolution_timeout(res)));
 
+	list_for_each_entry(ns, &resolvers->nameservers, list) {
+		if (ns->stream)
+			next = tick_first(next, ns->stream->exp);
+	}
+
 	resolvers->t->expire = next;
 	task_queue(resolvers->t);
 }
@@ -278,6 +343,142 @@ static int dns_build_query(int query_id, int query_type, unsigned int accepted_p
 	return (p - buf);
 }
 
+/* Closes the TCP connection of nameserver <ns> if any, and releases its
+ * buffers. If some queries were not answered yet, the resolutions which
+ * queued them on this connection and are still waiting for a response are
+ * moved to the head of the active list with an expired query so that the
+ * resolvers task immediately retries them or reports a timeout. If <err> is set, the TCP transport is not used again
+ * before DNS_TCP_RETRY_DELAY to retry truncated responses.
+ */
+static void dns_stream_close(struct dns_nameserver *ns, int err)
+{
+	struct dns_stream *stream = ns->stream;
+	struct dns_resolvers *resolvers = ns->resolvers;
+	struct dns_resolution *res, *resback;
+
+	if (stream->pending) {
+		list_for_each_entry_safe(res, resback, &resolvers->resolutions.curr, list) {
+			if (!ha_bit_test(res->query_id, stream->qids) ||
+			    res->nb_responses >= res->nb_queries)
+				continue;
+			res->last_query = tick_add(now_ms, -resolvers->timeout.retry);
+			LIST_DEL(&res->list);
+			LIST_ADD(&resolvers->resolutions.curr, &res->list);
+		}
+		stream->pending = 0;
+	}
+	stream->exp = TICK_ETERNITY;
+
+	if (stream->fd != -1) {
+		fd_delete(stream->fd);
+		stream->fd = -1;
+	}
+	stream->connected = 0;
+	free(stream->obuf.area);
+	free(stream->ibuf.area);
+	free(stream->qids);
+	stream->qids = NULL;
+	stream->obuf = BUF_NULL;
+	stream->ibuf = BUF_NULL;
+	if (err)
+		stream->retry_exp = tick_add(now_ms, DNS_TCP_RETRY_DELAY);
+}
+
+/* Starts to connect nameserver <ns> over TCP, if not already done. Returns 0
+ * on success, -1 otherwise.
+ */
+static int dns_stream_connect(struct dns_nameserver *ns)
+{
+	struct dns_stream *stream = ns->stream;
+	int fd, one = 1;
+
+	if (stream->fd != -1)
+		return 0;
+
+	/* truncated responses are not retried over TCP for a while after an
+	 * error, but "tcp@" nameservers have no other choice.
+	 */
+	if (!(ns->flags & DNS_NS_F_TCP) && tick_isset(stream->retry_exp) &&
+	    !tick_is_expired(stream->retry_exp, now_ms))
+		return -1;
+	stream->retry_exp = TICK_ETERNITY;
+
+	stream->obuf = b_make(malloc(DNS_TCP_BUFSIZE), DNS_TCP_BUFSIZE, 0, 0);
+	stream->ibuf = b_make(malloc(DNS_MAX_TCP_MESSAGE + 2), DNS_MAX_TCP_MESSAGE + 2, 0, 0);
+	stream->qids = calloc(65536 / (8 * sizeof(*stream->qids)), sizeof(*stream->qids));
+	if (!b_orig(&stream->obuf) || !b_orig(&stream->ibuf) || !stream->qids)
+		goto fail;
+
+	if ((fd = socket(ns->addr.ss_family, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+		send_log(NULL, LOG_WARNING,
+			 "DNS : resolvers '%s': can't create TCP socket for nameserver '%s'.\n",
+			 ns->resolvers->id, ns->id);
+		goto fail;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr*)&ns->addr, get_addr_len(&ns->addr)) == -1 &&
+	    errno != EINPROGRESS) {
+		send_log(NULL, LOG_WARNING,
+			 "DNS : resolvers '%s': can't connect TCP socket for nameserver '%s'.\n",
+			 ns->resolvers->id, ns->id);
+		close(fd);
+		goto fail;
+	}
+
+	stream->fd = fd;
+	stream->exp = tick_add(now_ms, ns->resolvers->timeout.retry);
+	fd_insert(fd, ns, dns_stream_fd_handler, MAX_THREADS_MASK);
+	fd_want_recv(fd);
+	fd_want_send(fd);
+	return 0;
+
+  fail:
+	dns_stream_close(ns, 1);
+	return -1;
+}
+
+/* Queues the query of resolution <res> on the TCP connection of nameserver
+ * <ns>, connecting it first if needed. The query is sent as soon as the
+ * connection is ready, after the ones already queued. Returns 0 on success,
+ * -1 if the query could not be queued.
+ */
+static int dns_stream_send_query(struct dns_nameserver *ns, struct dns_resolution *res)
+{
+	struct dns_stream *stream = ns->stream;
+	int len;
+
+	if (!stream || dns_stream_connect(ns) == -1)
+		return -1;
+
+	len = dns_build_query(res->query_id, res->query_type,
+	                      ns->resolvers->accepted_payload_size,
+	                      res->hostname_dn, res->hostname_dn_len,
+	                      trash.area, trash.size);
+	if (len < 0 || b_room(&stream->obuf) < len + 2)
+		return -1;
+
+	b_putchr(&stream->obuf, len >> 8);
+	b_putchr(&stream->obuf, len);
+	b_putblk(&stream->obuf, trash.area, len);
+	fd_want_send(stream->fd);
+	ns->counters.tcp++;
+
+	/* a query sent again before its response is only counted once. The
+	 * connect timeout also covers the first queries, otherwise the idle
+	 * timeout is replaced by the response timeout.
+	 */
+	if (ha_bit_test(res->query_id, stream->qids))
+		return 0;
+	ha_bit_set(res->query_id, stream->qids);
+	if (stream->connected && !stream->pending++)
+		stream->exp = tick_add(now_ms, ns->resolvers->timeout.retry);
+	else if (!stream->connected)
+		stream->pending++;
+	return 0;
+}
+
 /* Sends a DNS query to resolvers associated to a resolution. It returns 0 on
  * success, -1 otherwise.
  */
@@ -298,9 +499,18 @@ static int dns_send_query(struct dns_resolution *resolution)
 	                      trash.area, trash.size);
 
 	list_for_each_entry(ns, &resolvers->nameservers, list) {
-		int fd = ns->dgram->t.sock.fd;
+		int fd;
 		int ret;
 
+		if (ns->flags & DNS_NS_F_TCP) {
+			if (dns_stream_send_query(ns, resolution) == -1)
+				goto snd_error;
+			ns->counters.sent++;
+			resolution->nb_queries++;
+			continue;
+		}
+
+		fd = ns->dgram->t.sock.fd;
 		if (fd == -1) {
 			if (dns_connect_namesaver(ns) == -1)
 				continue;
@@ -398,7 +608,7 @@ void dns_trigger_resolution(struct dns_requester *req)
 
 	/* The resolution must not be triggered yet. Use the cached response, if
 	 * valid */
-	exp = tick_add(res->last_resolution, resolvers->hold.valid);
+	exp = dns_cache_expire(res);
 	if (resolvers->t && (res->status != RSLV_STATUS_VALID ||
 	    !tick_isset(res->last_resolution) || tick_is_expired(exp, now_ms)))
 		task_wakeup(resolvers->t, TASK_WOKEN_OTHER);
@@ -518,161 +728,213 @@ int dns_read_name(unsigned char *buffer, unsigned char *bufend,
 	return 0;
 }
 
-/* Checks for any obsolete record, also identify any SRV request, and try to
- * find a corresponding server.
-*/
-static void dns_check_dns_response(struct dns_resolution *res)
+/* Releases additional record <item> of response <dns_p>, after detaching it
+ * from the SRV records it was attached to.
+ */
+static void dns_free_ar_item(struct dns_response_packet *dns_p, struct dns_answer_item *item)
+{
+	struct dns_answer_item *srv_item;
+	struct eb32_node *node;
+	int len = strlen(item->name);
+
+	node = eb32_lookup(&dns_p->answer_tree, dns_name_hash(item->name, len, DNS_RTYPE_SRV));
+	for (; node; node = eb32_next_dup(node)) {
+		srv_item = eb32_entry(node, struct dns_answer_item, link);
+		if (srv_item->ar_item == item)
+			srv_item->ar_item = NULL;
+	}
+
+	eb32_delete(&item->link);
+	LIST_DEL(&item->list);
+	pool_free(dns_answer_item_pool, item);
+}
+
+/* Looks up in <targets> the server using the same target and port as SRV
+ * record <item>, starting after <node> if not NULL. Returns the server with
+ * its lock held, or NULL if none is found.
+ */
+static struct server *dns_srvrq_lookup(struct eb_root *targets, struct eb32_node *node,
+				       const struct dns_answer_item *item)
+{
+	struct server *srv;
+
+	if (!node)
+		node = eb32_lookup(targets, dns_name_hash(item->target, item->data_len, item->port));
+	else
+		node = eb32_next_dup(node);
+
+	for (; node; node = eb32_next_dup(node)) {
+		srv = eb32_entry(node, struct server, srvrq_node);
+		HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
+		if (srv->hostname_dn && srv->svc_port == item->port &&
+		    item->data_len == srv->hostname_dn_len &&
+		    !dns_hostname_cmp(srv->hostname_dn, item->target, item->data_len))
+			return srv;
+		HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+	}
+	return NULL;
+}
+
+/* Applies the SRV records of the response of resolution <res> to the servers
+ * of SRV request <srvrq>, all at once. The servers are first indexed by target
+ * and port so that each record finds its server without walking the whole
+ * server list. The servers of obsolete records are released first so that the
+ * new records may reuse their slots, then the other records update the weight
+ * of their server or take the first free one.
+ */
+static void dns_srvrq_apply_response(struct dns_resolution *res, struct dns_srvrq *srvrq)
 {
 	struct dns_resolvers   *resolvers = res->resolvers;
-	struct dns_requester   *req, *reqback;
-	struct dns_answer_item *item, *itemback;
-	struct server          *srv;
-	struct dns_srvrq       *srvrq;
+	struct eb_root          targets = EB_ROOT;
+	struct dns_answer_item *item;
+	struct server          *srv, *free_srv;
+	struct eb32_node       *node;
+
+	for (srv = srvrq->proxy->srv; srv != NULL; srv = srv->next) {
+		HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
+		if (srv->srvrq == srvrq && srv->hostname_dn) {
+			srv->srvrq_node.key = dns_name_hash(srv->hostname_dn, srv->hostname_dn_len,
+							    srv->svc_port);
+			eb32_insert(&targets, &srv->srvrq_node);
+		}
+		HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+	}
 
-	/* clean up obsolete Additional records */
-	list_for_each_entry_safe(item, itemback, &res->response.ar_list, list) {
-		if ((item->last_seen + resolvers->hold.obsolete / 1000) < now.tv_sec) {
-			LIST_DEL(&item->list);
-			pool_free(dns_answer_item_pool, item);
+	/* Remove any server associated to an obsolete record */
+	list_for_each_entry(item, &res->response.answer_list, list) {
+		if (item->type != DNS_RTYPE_SRV || !dns_answer_is_obsolete(resolvers, item))
+			continue;
+
+		node = NULL;
+		while ((srv = dns_srvrq_lookup(&targets, node, item)) != NULL) {
+			node = &srv->srvrq_node;
+			snr_update_srv_status(srv, 1);
+			free(srv->hostname);
+			free(srv->hostname_dn);
+			srv->hostname        = NULL;
+			srv->hostname_dn     = NULL;
+			srv->hostname_dn_len = 0;
+			dns_unlink_resolution(srv->dns_requester);
+			HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
 		}
 	}
 
-	list_for_each_entry_safe(item, itemback, &res->response.answer_list, list) {
-
-		/* Remove obsolete items */
-		if ((item->last_seen + resolvers->hold.obsolete / 1000) < now.tv_sec) {
-			if (item->type != DNS_RTYPE_SRV)
-				goto rm_obselete_item;
+	/* Now process the other SRV records */
+	free_srv = srvrq->proxy->srv;
+	list_for_each_entry(item, &res->response.answer_list, list) {
+		const char *msg = NULL;
+		char weight[9];
+		int ha_weight;
+		char hostname[DNS_MAX_NAME_SIZE];
 
-			list_for_each_entry_safe(req, reqback, &res->requesters, list) {
-				if ((srvrq = objt_dns_srvrq(req->owner)) == NULL)
-					continue;
+		if (item->type != DNS_RTYPE_SRV || dns_answer_is_obsolete(resolvers, item))
+			continue;
 
-				/* Remove any associated server */
-				for (srv = srvrq->proxy->srv; srv != NULL; srv = srv->next) {
-					HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
-					if (srv->srvrq == srvrq && srv->svc_port == item->port &&
-					    item->data_len == srv->hostname_dn_len &&
-					    !dns_hostname_cmp(srv->hostname_dn, item->target, item->data_len)) {
-						snr_update_srv_status(srv, 1);
-						free(srv->hostname);
-						free(srv->hostname_dn);
-						srv->hostname        = NULL;
-						srv->hostname_dn     = NULL;
-						srv->hostname_dn_len = 0;
-						dns_unlink_resolution(srv->dns_requester);
-					}
-					HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
-				}
+		/* DNS weight range if from 0 to 65535
+		 * HAProxy weight is from 0 to 256
+		 * The rule below ensures that weight 0 is well respected
+		 * while allowing a "mapping" from DNS weight into HAProxy's one.
+		 */
+		ha_weight = (item->weight + 255) / 256;
+
+		/* Check if a server already uses that hostname */
+		srv = dns_srvrq_lookup(&targets, NULL, item);
+		if (srv) {
+			if (!srv->dns_opts.ignore_weight && srv->uweight != ha_weight) {
+				snprintf(weight, sizeof(weight), "%d", ha_weight);
+				server_parse_weight_change_request(srv, weight);
 			}
-
-		  rm_obselete_item:
-			LIST_DEL(&item->list);
-			pool_free(dns_answer_item_pool, item);
+			HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
 			continue;
 		}
 
-		if (item->type != DNS_RTYPE_SRV)
+		/* If not, try to find a server with undefined hostname. The
+		 * servers before <free_srv> were already checked and taken.
+		 */
+		for (srv = free_srv; srv != NULL; srv = srv->next) {
+			HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
+			if (srv->srvrq == srvrq && !srv->hostname_dn)
+				break;
+			HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+		}
+		free_srv = srv;
+		if (!srv)
 			continue;
 
-		/* Now process SRV records */
-		list_for_each_entry_safe(req, reqback, &res->requesters, list) {
-			if ((srvrq = objt_dns_srvrq(req->owner)) == NULL)
-				continue;
+		/* And update this server */
+		if (dns_dn_label_to_str(item->target, item->data_len+1,
+					hostname, DNS_MAX_NAME_SIZE) == -1) {
+			HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+			continue;
+		}
 
-			/* Check if a server already uses that hostname */
-			for (srv = srvrq->proxy->srv; srv != NULL; srv = srv->next) {
-				HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
-				if (srv->srvrq == srvrq && srv->svc_port == item->port &&
-				    item->data_len == srv->hostname_dn_len &&
-				    !dns_hostname_cmp(srv->hostname_dn, item->target, item->data_len) &&
-				    !srv->dns_opts.ignore_weight) {
-					int ha_weight;
-
-					/* DNS weight range if from 0 to 65535
-					 * HAProxy weight is from 0 to 256
-					 * The rule below ensures that weight 0 is well respected
-					 * while allowing a "mapping" from DNS weight into HAProxy's one.
-					 */
-					ha_weight = (item->weight + 255) / 256;
-					if (srv->uweight != ha_weight) {
-						char weight[9];
-
-						snprintf(weight, sizeof(weight), "%d", ha_weight);
-						server_parse_weight_change_request(srv, weight);
-					}
-					HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
-					break;
-				}
-				HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
-			}
-			if (srv)
-				continue;
+		/* Check if an Additional Record is associated to this SRV record.
+		 * Perform some sanity checks too to ensure the record can be used.
+		 * If all fine, we simply pick up the IP address found and associate
+		 * it to the server.
+		 */
+		if ((item->ar_item != NULL) &&
+		    (item->ar_item->type == DNS_RTYPE_A || item->ar_item->type == DNS_RTYPE_AAAA))
+		    {
 
-			/* If not, try to find a server with undefined hostname */
-			for (srv = srvrq->proxy->srv; srv != NULL; srv = srv->next) {
-				HA_SPIN_LOCK(SERVER_LOCK, &srv->lock);
-				if (srv->srvrq == srvrq && !srv->hostname_dn)
-					break;
-				HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+			switch (item->ar_item->type) {
+				case DNS_RTYPE_A:
+					update_server_addr(srv, &(((struct sockaddr_in*)&item->ar_item->address)->sin_addr), AF_INET, "DNS additional recrd");
+				break;
+				case DNS_RTYPE_AAAA:
+					update_server_addr(srv, &(((struct sockaddr_in6*)&item->ar_item->address)->sin6_addr), AF_INET6, "DNS additional recrd");
+				break;
 			}
-			/* And update this server, if found */
-			if (srv) {
-				const char *msg = NULL;
-				char weight[9];
-				int ha_weight;
-				char hostname[DNS_MAX_NAME_SIZE];
-
-				if (dns_dn_label_to_str(item->target, item->data_len+1,
-							hostname, DNS_MAX_NAME_SIZE) == -1) {
-					HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
-					continue;
-				}
 
-				/* Check if an Additional Record is associated to this SRV record.
-				 * Perform some sanity checks too to ensure the record can be used.
-				 * If all fine, we simply pick up the IP address found and associate
-				 * it to the server.
-				 */
-				if ((item->ar_item != NULL) &&
-				    (item->ar_item->type == DNS_RTYPE_A || item->ar_item->type == DNS_RTYPE_AAAA))
-				    {
-
-					switch (item->ar_item->type) {
-						case DNS_RTYPE_A:
-							update_server_addr(srv, &(((struct sockaddr_in*)&item->ar_item->address)->sin_addr), AF_INET, "DNS additional recrd");
-						break;
-						case DNS_RTYPE_AAAA:
-							update_server_addr(srv, &(((struct sockaddr_in6*)&item->ar_item->address)->sin6_addr), AF_INET6, "DNS additional recrd");
-						break;
-					}
-
-					srv->flags |= SRV_F_NO_RESOLUTION;
-				}
+			srv->flags |= SRV_F_NO_RESOLUTION;
+		}
 
-				msg = update_server_fqdn(srv, hostname, "SRV record", 1);
-				if (msg)
-					send_log(srv->proxy, LOG_NOTICE, "%s", msg);
-
-				srv->svc_port = item->port;
-				srv->flags   &= ~SRV_F_MAPPORTS;
-				if ((srv->check.state & CHK_ST_CONFIGURED) &&
-				    !(srv->flags & SRV_F_CHECKPORT))
-					srv->check.port = item->port;
-
-				if (!srv->dns_opts.ignore_weight) {
-					/* DNS weight range if from 0 to 65535
-					 * HAProxy weight is from 0 to 256
-					 * The rule below ensures that weight 0 is well respected
-					 * while allowing a "mapping" from DNS weight into HAProxy's one.
-					 */
-					ha_weight = (item->weight + 255) / 256;
-
-					snprintf(weight, sizeof(weight), "%d", ha_weight);
-					server_parse_weight_change_request(srv, weight);
-				}
-				HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
-			}
+		msg = update_server_fqdn(srv, hostname, "SRV record", 1);
+		if (msg)
+			send_log(srv->proxy, LOG_NOTICE, "%s", msg);
+
+		srv->svc_port = item->port;
+		srv->flags   &= ~SRV_F_MAPPORTS;
+		if ((srv->check.state & CHK_ST_CONFIGURED) &&
+		    !(srv->flags & SRV_F_CHECKPORT))
+			srv->check.port = item->port;
+
+		if (!srv->dns_opts.ignore_weight) {
+			snprintf(weight, sizeof(weight), "%d", ha_weight);
+			server_parse_weight_change_request(srv, weight);
+		}
+		HA_SPIN_UNLOCK(SERVER_LOCK, &srv->lock);
+	}
+}
+
+/* Checks for any obsolete record, also identify any SRV request, and try to
+ * find a corresponding server.
+*/
+static void dns_check_dns_response(struct dns_resolution *res)
+{
+	struct dns_resolvers   *resolvers = res->resolvers;
+	struct dns_requester   *req, *reqback;
+	struct dns_answer_item *item, *itemback;
+	struct dns_srvrq       *srvrq;
+
+	/* clean up obsolete Additional records */
+	list_for_each_entry_safe(item, itemback, &res->response.ar_list, list) {
+		if (dns_answer_is_obsolete(resolvers, item))
+			dns_free_ar_item(&res->response, item);
+	}
+
+	/* Apply the SRV records to the servers of each SRV request */
+	list_for_each_entry_safe(req, reqback, &res->requesters, list) {
+		if ((srvrq = objt_dns_srvrq(req->owner)) != NULL)
+			dns_srvrq_apply_response(res, srvrq);
+	}
+
+	/* Remove obsolete items */
+	list_for_each_entry_safe(item, itemback, &res->response.answer_list, list) {
+		if (dns_answer_is_obsolete(resolvers, item)) {
+			eb32_delete(&item->link);
+			LIST_DEL(&item->list);
+			pool_free(dns_answer_item_pool, item);
 		}
 	}
 }
@@ -697,6 +959,8 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 	struct dns_query_item *dns_query;
 	struct dns_answer_item *dns_answer_record, *tmp_record;
 	struct dns_response_packet *dns_p;
+	struct eb32_node *node;
+	unsigned int key;
 	int i, found = 0;
 
 	reader         = resp;
@@ -815,6 +1079,7 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 
 	/* now parsing response records */
 	nb_saved_records = 0;
+	dns_p->min_ttl = ~0U;
 	for (i = 0; i < dns_p->header.ancount; i++) {
 		if (reader >= bufend)
 			return DNS_RESP_INVALID;
@@ -989,9 +1254,14 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 			   ? offset
 			   : dns_answer_record->data_len);
 
+		if ((unsigned int)dns_answer_record->ttl < dns_p->min_ttl)
+			dns_p->min_ttl = dns_answer_record->ttl;
+
 		/* Lookup to see if we already had this entry */
 		found = 0;
-		list_for_each_entry(tmp_record, &dns_p->answer_list, list) {
+		key = dns_answer_key(dns_answer_record);
+		for (node = eb32_lookup(&dns_p->answer_tree, key); node; node = eb32_next_dup(node)) {
+			tmp_record = eb32_entry(node, struct dns_answer_item, link);
 			if (tmp_record->type != dns_answer_record->type)
 				continue;
 
@@ -1034,6 +1304,8 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 		else {
 			dns_answer_record->last_seen = now.tv_sec;
 			dns_answer_record->ar_item = NULL;
+			dns_answer_record->link.key = key;
+			eb32_insert(&dns_p->answer_tree, &dns_answer_record->link);
 			LIST_ADDQ(&dns_p->answer_list, &dns_answer_record->list);
 		}
 	} /* for i 0 to ancount */
@@ -1152,8 +1424,11 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 
 		/* Lookup to see if we already had this entry */
 		found = 0;
-		list_for_each_entry(tmp_record, &dns_p->answer_list, list) {
-			if (tmp_record->type != dns_answer_record->type)
+		key = dns_name_hash(dns_answer_record->name, len, dns_answer_record->type);
+		for (node = eb32_lookup(&dns_p->ar_tree, key); node; node = eb32_next_dup(node)) {
+			tmp_record = eb32_entry(node, struct dns_answer_item, link);
+			if (tmp_record->type != dns_answer_record->type ||
+			    dns_hostname_cmp(tmp_record->name, dns_answer_record->name, len + 1) != 0)
 				continue;
 
 			switch(tmp_record->type) {
@@ -1182,24 +1457,25 @@ static int dns_validate_dns_response(unsigned char *resp, unsigned char *bufend,
 		if (found == 1) {
 			tmp_record->last_seen = now.tv_sec;
 			pool_free(dns_answer_item_pool, dns_answer_record);
+			dns_answer_record = tmp_record;
 		}
 		else {
 			dns_answer_record->last_seen = now.tv_sec;
 			dns_answer_record->ar_item = NULL;
+			dns_answer_record->link.key = key;
+			eb32_insert(&dns_p->ar_tree, &dns_answer_record->link);
+			LIST_ADDQ(&dns_p->ar_list, &dns_answer_record->list);
+		}
 
-			// looking for the SRV record in the response list linked to this additional record
-			list_for_each_entry(tmp_record, &dns_p->answer_list, list) {
-				if ( !(
-					(tmp_record->type == DNS_RTYPE_SRV) &&
-					(tmp_record->ar_item == NULL) &&
-					(dns_hostname_cmp(tmp_record->target, dns_answer_record->name, tmp_record->data_len) == 0)
-				      )
-				   )
-					continue;
+		// looking for the SRV records in the response list linked to this additional record
+		key = dns_name_hash(dns_answer_record->name, len, DNS_RTYPE_SRV);
+		for (node = eb32_lookup(&dns_p->answer_tree, key); node; node = eb32_next_dup(node)) {
+			tmp_record = eb32_entry(node, struct dns_answer_item, link);
+			if (tmp_record->type == DNS_RTYPE_SRV &&
+			    tmp_record->ar_item == NULL &&
+			    tmp_record->data_len == len &&
+			    dns_hostname_cmp(tmp_record->target, dns_answer_record->name, len) == 0)
 				tmp_record->ar_item = dns_answer_record;
-			}
-
-			LIST_ADDQ(&dns_p->ar_list, &dns_answer_record->list);
 		}
 	} /* for i 0 to arcount */
 
@@ -1523,22 +1799,16 @@ static struct dns_resolution *dns_pick_resolution(struct dns_resolvers *resolver
 						  int query_type)
 {
 	struct dns_resolution *res;
+	struct eb32_node *node;
+	unsigned int key = 0;
 
 	if (!*hostname_dn)
 		goto from_pool;
 
-	/* Search for same hostname and query type in resolutions.curr */
-	list_for_each_entry(res, &resolvers->resolutions.curr, list) {
-		if (!res->hostname_dn)
-			continue;
-		if ((query_type == res->prefered_query_type) &&
-		    hostname_dn_len == res->hostname_dn_len  &&
-		    !dns_hostname_cmp(*hostname_dn, res->hostname_dn, hostname_dn_len))
-			return res;
-	}
-
-	/* Search for same hostname and query type in resolutions.wait */
-	list_for_each_entry(res, &resolvers->resolutions.wait, list) {
+	/* Search for same hostname and query type in all resolutions */
+	key = dns_name_hash(*hostname_dn, hostname_dn_len, query_type);
+	for (node = eb32_lookup(&resolvers->resolutions.names, key); node; node = eb32_next_dup(node)) {
+		res = eb32_entry(node, struct dns_resolution, name);
 		if (!res->hostname_dn)
 			continue;
 		if ((query_type == res->prefered_query_type) &&
@@ -1561,12 +1831,19 @@ static struct dns_resolution *dns_pick_resolution(struct dns_resolvers *resolver
 		LIST_INIT(&res->requesters);
 		LIST_INIT(&res->response.answer_list);
 		LIST_INIT(&res->response.ar_list);
+		res->response.answer_tree = EB_ROOT;
+		res->response.ar_tree     = EB_ROOT;
 
 		res->prefered_query_type = query_type;
 		res->query_type          = query_type;
 		res->hostname_dn         = *hostname_dn;
 		res->hostname_dn_len     = hostname_dn_len;
 
+		if (*hostname_dn) {
+			res->name.key = key;
+			eb32_insert(&resolvers->resolutions.names, &res->name);
+		}
+
 		++resolution_uuid;
 
 		/* Move the resolution to the resolvers wait queue */
@@ -1579,12 +1856,23 @@ static struct dns_resolution *dns_pick_resolution(struct dns_resolvers *resolver
 static void dns_free_resolution(struct dns_resolution *resolution)
 {
 	struct dns_requester *req, *reqback;
+	struct dns_answer_item *item, *itemback;
 
 	/* clean up configuration */
 	dns_reset_resolution(resolution);
+	eb32_delete(&resolution->name);
 	resolution->hostname_dn = NULL;
 	resolution->hostname_dn_len = 0;
 
+	list_for_each_entry_safe(item, itemback, &resolution->response.answer_list, list) {
+		LIST_DEL(&item->list);
+		pool_free(dns_answer_item_pool, item);
+	}
+	list_for_each_entry_safe(item, itemback, &resolution->response.ar_list, list) {
+		LIST_DEL(&item->list);
+		pool_free(dns_answer_item_pool, item);
+	}
+
 	list_for_each_entry_safe(req, reqback, &resolution->requesters, list) {
 		LIST_DEL(&req->list);
 		req->resolution = NULL;
@@ -1750,27 +2038,192 @@ void dns_unlink_resolution(struct dns_requester *requester)
 	}
 }
 
-/* Called when a network IO is generated on a name server socket for an incoming
- * packet. It performs the following actions:
+/* Processes DNS response <buf> of <buflen> bytes received from nameserver <ns>
+ * over UDP, or over TCP if <tcp> is set. It performs the following actions:
  *  - check if the packet requires processing (not outdated resolution)
+ *  - retry a truncated UDP response over TCP
  *  - ensure the DNS packet received is valid and call requester's callback
  *  - call requester's error callback if invalid response
  *  - check the dn_name in the packet against the one sent
+ *
+ * Must be called with the resolvers' lock held.
  */
-static void dns_resolve_recv(struct dgram_conn *dgram)
+static void dns_recv_response(struct dns_nameserver *ns, unsigned char *buf, int buflen, int tcp)
 {
-	struct dns_nameserver *ns, *tmpns;
-	struct dns_resolvers  *resolvers;
+	struct dns_nameserver *tmpns;
+	struct dns_resolvers  *resolvers = ns->resolvers;
 	struct dns_resolution *res;
 	struct dns_query_item *query;
-	unsigned char  buf[DNS_MAX_UDP_MESSAGE + 1];
 	unsigned char *bufend;
-	int fd, buflen, dns_resp;
+	int dns_resp;
 	int max_answer_records;
 	unsigned short query_id;
 	struct eb32_node *eb;
 	struct dns_requester *req;
 
+	/* initializing variables */
+	bufend = buf + buflen;	/* pointer to mark the end of the buffer */
+
+	/* read the query id from the packet (16 bits) */
+	if (buf + 2 > bufend) {
+		ns->counters.invalid++;
+		return;
+	}
+	query_id = dns_response_get_query_id(buf);
+
+	/* search the query_id in the pending resolution tree */
+	eb = eb32_lookup(&resolvers->query_ids, query_id);
+	if (eb == NULL) {
+		/* unknown query id means an outdated response and can be safely ignored */
+		ns->counters.outdated++;
+		return;
+	}
+
+	/* known query id means a resolution in progress */
+	res = eb32_entry(eb, struct dns_resolution, qid);
+
+	/* A truncated UDP response is retried over TCP on the same nameserver,
+	 * and only processed as is if this is not possible.
+	 */
+	if (!tcp && buf + 4 <= bufend && (buf[2] & (DNS_FLAG_TRUNCATED >> 8)) &&
+	    dns_stream_send_query(ns, res) == 0) {
+		ns->counters.truncated++;
+		return;
+	}
+
+	/* number of responses received */
+	res->nb_responses++;
+
+	max_answer_records = ((tcp ? DNS_MAX_TCP_MESSAGE : resolvers->accepted_payload_size) - DNS_HEADER_SIZE) / DNS_MIN_RECORD_SIZE;
+	dns_resp = dns_validate_dns_response(buf, bufend, res, max_answer_records);
+
+	switch (dns_resp) {
+		case DNS_RESP_VALID:
+			break;
+
+		case DNS_RESP_INVALID:
+		case DNS_RESP_QUERY_COUNT_ERROR:
+		case DNS_RESP_WRONG_NAME:
+			res->status = RSLV_STATUS_INVALID;
+			ns->counters.invalid++;
+			break;
+
+		case DNS_RESP_NX_DOMAIN:
+			res->status = RSLV_STATUS_NX;
+			ns->counters.nx++;
+			break;
+
+		case DNS_RESP_REFUSED:
+			res->status = RSLV_STATUS_REFUSED;
+			ns->counters.refused++;
+			break;
+
+		case DNS_RESP_ANCOUNT_ZERO:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.any_err++;
+			break;
+
+		case DNS_RESP_CNAME_ERROR:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.cname_error++;
+			break;
+
+		case DNS_RESP_TRUNCATED:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.truncated++;
+			break;
+
+		case DNS_RESP_NO_EXPECTED_RECORD:
+		case DNS_RESP_ERROR:
+		case DNS_RESP_INTERNAL:
+			res->status = RSLV_STATUS_OTHER;
+			ns->counters.other++;
+			break;
+	}
+
+	/* Wait all nameservers response to handle errors */
+	if (dns_resp != DNS_RESP_VALID && res->nb_responses < resolvers->nb_nameservers)
+		return;
+
+	/* Process error codes */
+	if (dns_resp != DNS_RESP_VALID)  {
+		if (res->prefered_query_type != res->query_type) {
+			/* The fallback on the query type was already performed,
+			 * so check the try counter. If it falls to 0, we can
+			 * report an error. Else, wait the next attempt. */
+			if (!res->try)
+				goto report_res_error;
+		}
+		else {
+			/* Fallback from A to AAAA or the opposite and re-send
+			 * the resolution immediately. try counter is not
+			 * decremented. */
+			if (res->prefered_query_type == DNS_RTYPE_A) {
+				res->query_type = DNS_RTYPE_AAAA;
+				dns_send_query(res);
+			}
+			else if (res->prefered_query_type == DNS_RTYPE_AAAA) {
+				res->query_type = DNS_RTYPE_A;
+				dns_send_query(res);
+			}
+		}
+		return;
+	}
+
+	/* Now let's check the query's dname corresponds to the one we
+	 * sent. We can check only the first query of the list. We send
+	 * one query at a time so we get one query in the response */
+	query = LIST_NEXT(&res->response.query_list, struct dns_query_item *, list);
+	if (query && dns_hostname_cmp(query->name, res->hostname_dn, res->hostname_dn_len) != 0) {
+		dns_resp = DNS_RESP_WRONG_NAME;
+		ns->counters.other++;
+		goto report_res_error;
+	}
+
+	/* So the resolution succeeded */
+	res->status     = RSLV_STATUS_VALID;
+	res->last_valid = now_ms;
+	ns->counters.valid++;
+	goto report_res_success;
+
+  report_res_error:
+	list_for_each_entry(req, &res->requesters, list)
+		req->requester_error_cb(req, dns_resp);
+	dns_reset_resolution(res);
+	LIST_DEL(&res->list);
+	LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
+	return;
+
+  report_res_success:
+	/* Only the 1rst requester s managed by the server, others are
+	 * from the cache */
+	tmpns = ns;
+	list_for_each_entry(req, &res->requesters, list) {
+		struct server *s = objt_server(req->owner);
+
+		if (s)
+			HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
+		req->requester_cb(req, tmpns);
+		if (s)
+			HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
+		tmpns = NULL;
+	}
+
+	dns_reset_resolution(res);
+	LIST_DEL(&res->list);
+	LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
+}
+
+/* Called when a network IO is generated on a name server socket for an incoming
+ * packet. All pending messages are passed to dns_recv_response().
+ */
+static void dns_resolve_recv(struct dgram_conn *dgram)
+{
+	struct dns_nameserver *ns;
+	struct dns_resolvers  *resolvers;
+	unsigned char  buf[DNS_MAX_UDP_MESSAGE + 1];
+	int fd, buflen;
+
 	fd = dgram->t.sock.fd;
 
 	/* check if ready for reading */
@@ -1807,149 +2260,131 @@ static void dns_resolve_recv(struct dgram_conn *dgram)
 			continue;
 		}
 
-		/* initializing variables */
-		bufend = buf + buflen;	/* pointer to mark the end of the buffer */
-
-		/* read the query id from the packet (16 bits) */
-		if (buf + 2 > bufend) {
-			ns->counters.invalid++;
-			continue;
-		}
-		query_id = dns_response_get_query_id(buf);
-
-		/* search the query_id in the pending resolution tree */
-		eb = eb32_lookup(&resolvers->query_ids, query_id);
-		if (eb == NULL) {
-			/* unknown query id means an outdated response and can be safely ignored */
-			ns->counters.outdated++;
-			continue;
-		}
-
-		/* known query id means a resolution in progress */
-		res = eb32_entry(eb, struct dns_resolution, qid);
-		/* number of responses received */
-		res->nb_responses++;
-
-		max_answer_records = (resolvers->accepted_payload_size - DNS_HEADER_SIZE) / DNS_MIN_RECORD_SIZE;
-		dns_resp = dns_validate_dns_response(buf, bufend, res, max_answer_records);
-
-		switch (dns_resp) {
-			case DNS_RESP_VALID:
-				break;
-
-			case DNS_RESP_INVALID:
-			case DNS_RESP_QUERY_COUNT_ERROR:
-			case DNS_RESP_WRONG_NAME:
-				res->status = RSLV_STATUS_INVALID;
-				ns->counters.invalid++;
-				break;
-
-			case DNS_RESP_NX_DOMAIN:
-				res->status = RSLV_STATUS_NX;
-				ns->counters.nx++;
-				break;
+		dns_recv_response(ns, buf, buflen, 0);
+	}
+	dns_update_resolvers_timeout(resolvers);
+	HA_SPIN_UNLOCK(DNS_LOCK, &resolvers->lock);
+}
 
-			case DNS_RESP_REFUSED:
-				res->status = RSLV_STATUS_REFUSED;
-				ns->counters.refused++;
-				break;
+/* Sends the queries queued on the TCP connection of nameserver <ns>. Returns
+ * -1 on error, otherwise 0.
+ */
+static int dns_stream_send(struct dns_nameserver *ns)
+{
+	struct dns_stream *stream = ns->stream;
+	int ret;
 
-			case DNS_RESP_ANCOUNT_ZERO:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.any_err++;
-				break;
+	if (!stream->connected) {
+		socklen_t len = sizeof(ret);
 
-			case DNS_RESP_CNAME_ERROR:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.cname_error++;
-				break;
-
-			case DNS_RESP_TRUNCATED:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.truncated++;
-				break;
+		if (getsockopt(stream->fd, SOL_SOCKET, SO_ERROR, &ret, &len) == -1 || ret)
+			return -1;
+		stream->connected = 1;
+		stream->exp = tick_add(now_ms, stream->pending ? ns->resolvers->timeout.retry : DNS_TCP_IDLE_TIMEOUT);
+	}
 
-			case DNS_RESP_NO_EXPECTED_RECORD:
-			case DNS_RESP_ERROR:
-			case DNS_RESP_INTERNAL:
-				res->status = RSLV_STATUS_OTHER;
-				ns->counters.other++;
-				break;
+	while (b_data(&stream->obuf)) {
+		ret = send(stream->fd, b_head(&stream->obuf), b_contig_data(&stream->obuf, 0),
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret <= 0) {
+			if (ret == -1 && errno == EAGAIN) {
+				fd_cant_send(stream->fd);
+				return 0;
+			}
+			return -1;
 		}
+		b_del(&stream->obuf, ret);
+	}
+	fd_stop_send(stream->fd);
+	return 0;
+}
 
-		/* Wait all nameservers response to handle errors */
-		if (dns_resp != DNS_RESP_VALID && res->nb_responses < resolvers->nb_nameservers)
-			continue;
+/* Receives and processes the responses from the TCP connection of nameserver
+ * <ns>. Returns -1 on error, 0 once the connection was closed by the server,
+ * otherwise 1.
+ */
+static int dns_stream_recv(struct dns_nameserver *ns)
+{
+	struct dns_stream *stream = ns->stream;
+	struct buffer *buf = &stream->ibuf;
+	unsigned short qid;
+	int ret, len;
 
-		/* Process error codes */
-		if (dns_resp != DNS_RESP_VALID)  {
-			if (res->prefered_query_type != res->query_type) {
-				/* The fallback on the query type was already performed,
-				 * so check the try counter. If it falls to 0, we can
-				 * report an error. Else, wait the next attempt. */
-				if (!res->try)
-					goto report_res_error;
+	while (1) {
+		ret = recv(stream->fd, b_tail(buf), b_room(buf), 0);
+		if (ret == 0)
+			return 0;
+		if (ret < 0) {
+			if (errno == EAGAIN) {
+				fd_cant_recv(stream->fd);
+				return 1;
 			}
-			else {
-				/* Fallback from A to AAAA or the opposite and re-send
-				 * the resolution immediately. try counter is not
-				 * decremented. */
-				if (res->prefered_query_type == DNS_RTYPE_A) {
-					res->query_type = DNS_RTYPE_AAAA;
-					dns_send_query(res);
-				}
-				else if (res->prefered_query_type == DNS_RTYPE_AAAA) {
-					res->query_type = DNS_RTYPE_A;
-					dns_send_query(res);
+			return -1;
+		}
+		b_add(buf, ret);
+
+		/* process all the complete responses */
+		while (b_data(buf) >= 2) {
+			len = (unsigned char)*b_head(buf) << 8 | (unsigned char)*b_peek(buf, 1);
+			if (b_data(buf) < len + 2)
+				break;
+			if (len >= 2) {
+				qid = dns_response_get_query_id((unsigned char *)b_peek(buf, 2));
+				if (ha_bit_test(qid, stream->qids)) {
+					ha_bit_clr(qid, stream->qids);
+					stream->pending--;
 				}
 			}
-			continue;
+			stream->exp = tick_add(now_ms, stream->pending ? ns->resolvers->timeout.retry : DNS_TCP_IDLE_TIMEOUT);
+			dns_recv_response(ns, (unsigned char *)b_peek(buf, 2), len, 1);
+			/* the connection may have been closed by a new query */
+			if (stream->fd == -1)
+				return 1;
+			b_del(buf, len + 2);
 		}
 
-		/* Now let's check the query's dname corresponds to the one we
-		 * sent. We can check only the first query of the list. We send
-		 * one query at a time so we get one query in the response */
-		query = LIST_NEXT(&res->response.query_list, struct dns_query_item *, list);
-		if (query && dns_hostname_cmp(query->name, res->hostname_dn, res->hostname_dn_len) != 0) {
-			dns_resp = DNS_RESP_WRONG_NAME;
-			ns->counters.other++;
-			goto report_res_error;
+		/* keep the partial response at the beginning */
+		if (!b_data(buf))
+			b_reset(buf);
+		else if (b_head_ofs(buf)) {
+			memmove(b_orig(buf), b_head(buf), b_data(buf));
+			buf->head = 0;
 		}
+	}
+}
 
-		/* So the resolution succeeded */
-		res->status     = RSLV_STATUS_VALID;
-		res->last_valid = now_ms;
-		ns->counters.valid++;
-		goto report_res_success;
-
-	report_res_error:
-		list_for_each_entry(req, &res->requesters, list)
-			req->requester_error_cb(req, dns_resp);
-		dns_reset_resolution(res);
-		LIST_DEL(&res->list);
-		LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
-		continue;
+/* I/O callback of the TCP connections to the nameservers */
+static void dns_stream_fd_handler(int fd)
+{
+	struct dns_nameserver *ns = fdtab[fd].owner;
+	struct dns_resolvers  *resolvers;
+	struct dns_stream     *stream;
+	int ret;
 
-	report_res_success:
-		/* Only the 1rst requester s managed by the server, others are
-		 * from the cache */
-		tmpns = ns;
-		list_for_each_entry(req, &res->requesters, list) {
-			struct server *s = objt_server(req->owner);
+	if (unlikely(!ns))
+		return;
 
-			if (s)
-				HA_SPIN_LOCK(SERVER_LOCK, &s->lock);
-			req->requester_cb(req, tmpns);
-			if (s)
-				HA_SPIN_UNLOCK(SERVER_LOCK, &s->lock);
-			tmpns = NULL;
-		}
+	resolvers = ns->resolvers;
+	HA_SPIN_LOCK(DNS_LOCK, &resolvers->lock);
 
-		dns_reset_resolution(res);
-		LIST_DEL(&res->list);
-		LIST_ADDQ(&resolvers->resolutions.wait, &res->list);
-		continue;
+	/* the connection may have been closed in the mean time */
+	stream = ns->stream;
+	if (stream->fd != fd)
+		goto end;
+
+	if (fd_send_ready(fd) && dns_stream_send(ns) < 0) {
+		dns_stream_close(ns, 1);
+		goto end;
 	}
+
+	if (fd_recv_ready(fd)) {
+		/* an idle connection closed by the server is not an error */
+		ret = dns_stream_recv(ns);
+		if (ret <= 0 && stream->fd == fd)
+			dns_stream_close(ns, ret < 0);
+	}
+
+  end:
 	dns_update_resolvers_timeout(resolvers);
 	HA_SPIN_UNLOCK(DNS_LOCK, &resolvers->lock);
 }
@@ -2020,10 +2455,30 @@ static struct task *dns_process_resolvers(struct task *t, void *context, unsigne
 {
 	struct dns_resolvers  *resolvers = context;
 	struct dns_resolution *res, *resback;
+	struct dns_nameserver *ns;
 	int exp;
 
 	HA_SPIN_LOCK(DNS_LOCK, &resolvers->lock);
 
+	/* Close the expired TCP connections. An idle one is simply closed,
+	 * otherwise this is an error and the resolutions waiting for it are
+	 * requeued before the active list is processed.
+	 */
+	list_for_each_entry(ns, &resolvers->nameservers, list) {
+		if (!ns->stream || ns->stream->fd == -1 ||
+		    !tick_is_expired(ns->stream->exp, now_ms))
+			continue;
+		if (ns->stream->connected && !ns->stream->pending) {
+			dns_stream_close(ns, 0);
+			continue;
+		}
+		ns->counters.timeout += ns->stream->pending;
+		send_log(NULL, LOG_WARNING,
+			 "DNS : resolvers '%s': TCP connection to nameserver '%s' timed out.\n",
+			 resolvers->id, ns->id);
+		dns_stream_close(ns, 1);
+	}
+
 	/* Handle all expired resolutions from the active list */
 	list_for_each_entry_safe(res, resback, &resolvers->resolutions.curr, list) {
 		/* When we find the first resolution in the future, then we can
@@ -2112,6 +2567,9 @@ static void dns_deinit(void)
 			if (ns->dgram && ns->dgram->t.sock.fd != -1)
 				fd_delete(ns->dgram->t.sock.fd);
 			free(ns->dgram);
+			if (ns->stream)
+				dns_stream_close(ns, 0);
+			free(ns->stream);
 			LIST_DEL(&ns->list);
 			free(ns);
 		}
@@ -2167,6 +2625,23 @@ static int dns_finalize_config(void)
 			struct dgram_conn *dgram = NULL;
 			int fd;
 
+			/* The TCP transport is connected on demand, either to
+			 * retry truncated responses or for "tcp@" nameservers.
+			 */
+			if ((ns->stream = calloc(1, sizeof(*ns->stream))) == NULL) {
+				ha_alert("config: resolvers '%s' : out of memory.\n",
+					 resolvers->id);
+				err_code |= (ERR_ALERT|ERR_ABORT);
+				goto err;
+			}
+			ns->stream->fd        = -1;
+			ns->stream->retry_exp = TICK_ETERNITY;
+
+			if (ns->flags & DNS_NS_F_TCP) {
+				resolvers->nb_nameservers++;
+				continue;
+			}
+
 			/* Check nameserver info */
 			if ((fd = socket(ns->addr.ss_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
 				ha_alert("config : resolvers '%s': can't create socket for nameserver '%s'.\n",
@@ -2321,6 +2796,7 @@ static int cli_io_handler_dump_resolvers_to_buffer(struct appctx *appctx)
 					chunk_appendf(&trash, "  invalid:     %lld\n", ns->counters.invalid);
 					chunk_appendf(&trash, "  too_big:     %lld\n", ns->counters.too_big);
 					chunk_appendf(&trash, "  truncated:   %lld\n", ns->counters.truncated);
+					chunk_appendf(&trash, "  tcp:         %lld\n", ns->counters.tcp);
 					chunk_appendf(&trash, "  outdated:    %lld\n",  ns->counters.outdated);
 				}
 				chunk_appendf(&trash, "\n");
@@ -2475,7 +2951,7 @@ enum act_return dns_action_do_resolve(struct act_rule *rule, struct proxy *px,
 	res       = req->resolution;
 	resolvers = res->resolvers;
 
-	exp = tick_add(res->last_resolution, resolvers->hold.valid);
+	exp = dns_cache_expire(res);
 	if (resolvers->t && res->status == RSLV_STATUS_VALID && tick_isset(res->last_resolution)
 		       && !tick_is_expired(exp, now_ms)) {
 		goto use_cache;
@@ -10,12 +10,22 @@
  *
  */
 
+#ifdef USE_THREAD
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
 #include <common/buffer.h>
 #include <common/cfgparse.h>
+#include <common/hathreads.h>
 #include <common/htx.h>
 #include <common/initcall.h>
 #include <common/mini-clist.h>
 #include <common/standard.h>
+#include <common/time.h>
 
 #include <types/compression.h>
 #include <types/filters.h>
@@ -23,6 +33,7 @@
 #include <types/sample.h>
 
 #include <proto/compression.h>
+#include <proto/fd.h>
 #include <proto/filters.h>
 #include <proto/http_htx.h>
 #include <proto/http_ana.h>
@@ -36,10 +47,55 @@ struct flt_ops comp_ops;
 struct comp_state {
 	struct comp_ctx  *comp_ctx;   /* compression context */
 	struct comp_algo *comp_algo;  /* compression algorithm if not NULL */
+	struct comp_job  *job;        /* chunk being compressed by a compression thread, if any */
+};
+
+/* A chunk of response compressed by a compression thread ("compression
+ * async"). The stream's compression context is only used by the compression
+ * thread from the submission of the job until it is handed back to the
+ * stream's thread, which wakes the stream up.
+ */
+struct comp_job {
+	struct mt_list list;       /* element of comp_job_queue, then of the done list of thread <tid> */
+	struct comp_algo *algo;    /* algorithm of the stream */
+	struct comp_ctx *ctx;      /* compression context of the stream */
+	struct task *task;         /* task of the stream */
+	struct buffer in;          /* copy of the data to compress */
+	struct buffer out;         /* compressed data */
+	struct timeval date;       /* date of the submission */
+	unsigned int tid;          /* thread of the stream */
+	int consumed;              /* amount of data of <in> consumed, -1 on error */
+	int state;                 /* COMP_JOB_*, only used by thread <tid> */
 };
 
+#define COMP_JOB_PENDING  0    /* the job is in a compression thread */
+#define COMP_JOB_DONE     1    /* the results may be used */
+#define COMP_JOB_ORPHAN   2    /* the stream was released before the end */
+
+/* chunks smaller than this are always compressed inline */
+#define COMP_ASYNC_MIN_LEN 1024
+/* max number of jobs queued per compression thread */
+#define COMP_ASYNC_MAX_QUEUE 16
+
 /* Pools used to allocate comp_state structs */
 DECLARE_STATIC_POOL(pool_head_comp_state, "comp_state", sizeof(struct comp_state));
+DECLARE_STATIC_POOL(pool_head_comp_job, "comp_job", sizeof(struct comp_job));
+
+static unsigned int comp_async_nbthread = 0;  /* number of compression threads */
+static int comp_async_used = 0;               /* set if a proxy uses "compression async" */
+
+#ifdef USE_THREAD
+static struct mt_list comp_job_queue = MT_LIST_HEAD_INIT(comp_job_queue);
+static sem_t comp_job_sem;                    /* counts the jobs in <comp_job_queue> */
+static unsigned int comp_async_queued = 0;    /* number of jobs not handed back yet */
+
+/* completed jobs of each thread, and the pipe waking it up */
+static struct comp_async_thr {
+	struct mt_list done;
+	int rd, wr;
+	int signaled;
+} comp_async_thr[MAX_THREADS];
+#endif
 
 static THREAD_LOCAL struct buffer tmpbuf;
 static THREAD_LOCAL struct buffer zbuf;
@@ -59,6 +115,228 @@ static int htx_compression_buffer_add_data(struct comp_state *st, const char *da
 					    struct buffer *out);
 static int htx_compression_buffer_end(struct comp_state *st, struct buffer *out, int end);
 
+/***********************************************************************/
+/* Returns non-zero if algorithm <a> was configured before <b>, which then
+ * appears first in their list.
+ */
+static inline int comp_algo_preferred(const struct comp_algo *a, const struct comp_algo *b)
+{
+	for (; b; b = b->next)
+		if (b->next == a)
+			return 1;
+	return 0;
+}
+
+/* Releases the job <job> and its buffers. The compression context is also
+ * released if <end> is set.
+ */
+static void comp_job_free(struct comp_job *job, int end)
+{
+	if (end)
+		job->algo->end(&job->ctx);
+	b_free(&job->in);
+	b_free(&job->out);
+	pool_free(pool_head_comp_job, job);
+}
+
+#ifdef USE_THREAD
+/* Main loop of the compression threads. A job only uses its own buffers and
+ * the stream's compression context, which do not require any allocation once
+ * initialized. It is then handed back to the stream's thread which is woken
+ * up through its pipe.
+ */
+static void *comp_async_worker(void *arg)
+{
+	struct comp_async_thr *thr;
+	struct comp_job *job;
+	int ret;
+
+	while (1) {
+		if (sem_wait(&comp_job_sem) < 0)
+			continue;
+		job = MT_LIST_POP(&comp_job_queue, struct comp_job *, list);
+		if (!job)
+			continue;
+
+		/* the level adjustment relies on the stream thread's idle
+		 * ratio and on the current date.
+		 */
+		ti  = &ha_thread_info[job->tid];
+		now = job->date;
+
+		ret = job->algo->add_data(job->ctx, b_head(&job->in), b_data(&job->in), &job->out);
+		if (ret >= 0 && job->algo->flush(job->ctx, &job->out) < 0)
+			ret = -1;
+		job->consumed = ret;
+
+		thr = &comp_async_thr[job->tid];
+		MT_LIST_ADDQ(&thr->done, &job->list);
+		if (!HA_ATOMIC_XCHG(&thr->signaled, 1)) {
+			char c = 1;
+
+			if (write(thr->wr, &c, 1) < 0) {
+				/* the pipe is full, the thread will be woken up anyway */
+			}
+		}
+	}
+	return NULL;
+}
+
+/* I/O handler of the pipe of the current thread: completed jobs are marked
+ * as such and their streams are woken up. Those whose stream is gone are
+ * released.
+ */
+static void comp_async_io_handler(int fd)
+{
+	struct comp_async_thr *thr = fdtab[fd].owner;
+	struct comp_job *job;
+	char buf[64];
+
+	HA_ATOMIC_STORE(&thr->signaled, 0);
+	while (read(fd, buf, sizeof(buf)) > 0);
+	fd_cant_recv(fd);
+
+	while ((job = MT_LIST_POP(&thr->done, struct comp_job *, list))) {
+		_HA_ATOMIC_SUB(&comp_async_queued, 1);
+		if (job->state == COMP_JOB_ORPHAN) {
+			comp_job_free(job, 1);
+			continue;
+		}
+		job->state = COMP_JOB_DONE;
+		task_wakeup(job->task, TASK_WOKEN_MSG);
+	}
+}
+
+/* Tries to give the chunk <v> of the stream <s> to a compression thread.
+ * Returns 1 if it was queued, otherwise 0 and the data must be compressed
+ * inline.
+ */
+static int comp_async_submit(struct comp_state *st, struct stream *s, struct ist v)
+{
+	struct proxy *fe = strm_fe(s);
+	struct comp_job *job;
+
+	if (!comp_async_nbthread || v.len < COMP_ASYNC_MIN_LEN)
+		return 0;
+	if (!(s->be->comp && s->be->comp->async) && !(fe->comp && fe->comp->async))
+		return 0;
+	/* nothing to win when the level was dropped to zero */
+	if (!st->comp_ctx || st->comp_ctx->cur_lvl <= 0)
+		return 0;
+	if (comp_async_queued >= comp_async_nbthread * COMP_ASYNC_MAX_QUEUE)
+		return 0;
+
+	job = pool_alloc(pool_head_comp_job);
+	if (!job)
+		return 0;
+	job->in  = BUF_NULL;
+	job->out = BUF_NULL;
+	if (!b_alloc(&job->in) || !b_alloc(&job->out) || v.len > b_size(&job->in)) {
+		comp_job_free(job, 0);
+		return 0;
+	}
+	memcpy(b_head(&job->in), v.ptr, v.len);
+	b_set_data(&job->in, v.len);
+
+	MT_LIST_INIT(&job->list);
+	job->algo     = st->comp_algo;
+	job->ctx      = st->comp_ctx;
+	job->task     = s->task;
+	job->date     = now;
+	job->tid      = tid;
+	job->consumed = 0;
+	job->state    = COMP_JOB_PENDING;
+	st->job = job;
+
+	_HA_ATOMIC_ADD(&comp_async_queued, 1);
+	MT_LIST_ADDQ(&comp_job_queue, &job->list);
+	sem_post(&comp_job_sem);
+	return 1;
+}
+
+/* Sets the number of compression threads once the configuration is known */
+static int comp_async_post_check()
+{
+	if (comp_async_used && !comp_async_nbthread)
+		comp_async_nbthread = 1;
+	if (!comp_async_nbthread)
+		return 0;
+	if (sem_init(&comp_job_sem, 0, 0) < 0) {
+		ha_alert("compression: failed to initialize the compression threads.\n");
+		return ERR_ALERT | ERR_FATAL;
+	}
+	return 0;
+}
+
+/* Creates the pipe used by the compression threads to wake the current thread
+ * up. The first thread also starts the compression threads, with all signals
+ * blocked.
+ */
+static int comp_async_init_per_thread()
+{
+	struct comp_async_thr *thr = &comp_async_thr[tid];
+	sigset_t blocked_sig, old_sig;
+	pthread_t pt;
+	int mypipe[2];
+	int i;
+
+	if (!comp_async_nbthread)
+		return 1;
+
+	if (pipe(mypipe) < 0) {
+		ha_alert("compression: cannot create the pipe for thread %u.\n", tid + 1);
+		return 0;
+	}
+	MT_LIST_INIT(&thr->done);
+	thr->signaled = 0;
+	thr->rd = mypipe[0];
+	thr->wr = mypipe[1];
+	fcntl(thr->rd, F_SETFL, O_NONBLOCK);
+	fcntl(thr->wr, F_SETFL, O_NONBLOCK);
+	fd_insert(thr->rd, thr, comp_async_io_handler, tid_bit);
+	fd_want_recv(thr->rd);
+
+	if (tid != 0)
+		return 1;
+
+	sigfillset(&blocked_sig);
+	pthread_sigmask(SIG_SETMASK, &blocked_sig, &old_sig);
+	for (i = 0; i < comp_async_nbthread; i++) {
+		if (pthread_create(&pt, NULL, comp_async_worker, NULL) != 0) {
+			pthread_sigmask(SIG_SETMASK, &old_sig, NULL);
+			ha_alert("compression: cannot create the compression threads.\n");
+			return 0;
+		}
+		pthread_detach(pt);
+	}
+	pthread_sigmask(SIG_SETMASK, &old_sig, NULL);
+	return 1;
+}
+
+static void comp_async_deinit_per_thread()
+{
+	struct comp_async_thr *thr = &comp_async_thr[tid];
+
+	if (!comp_async_nbthread || thr->rd < 0)
+		return;
+	fd_delete(thr->rd);
+	close(thr->wr);
+	thr->rd = thr->wr = -1;
+}
+
+REGISTER_POST_CHECK(comp_async_post_check);
+REGISTER_PER_THREAD_INIT(comp_async_init_per_thread);
+REGISTER_PER_THREAD_DEINIT(comp_async_deinit_per_thread);
+
+#else /* USE_THREAD */
+
+static inline int comp_async_submit(struct comp_state *st, struct stream *s, struct ist v)
+{
+	return 0;
+}
+
+#endif /* USE_THREAD */
+
 /***********************************************************************/
 static int
 comp_flt_init(struct proxy *px, struct flt_conf *fconf)
@@ -97,6 +375,7 @@ comp_strm_init(struct stream *s, struct filter *filter)
 
 	st->comp_algo = NULL;
 	st->comp_ctx  = NULL;
+	st->job       = NULL;
 	filter->ctx   = st;
 
 	/* Register post-analyzer on AN_RES_WAIT_HTTP because we need to
@@ -115,6 +394,19 @@ comp_strm_deinit(struct stream *s, struct filter *filter)
 	if (!st)
 		return;
 
+	if (st->job) {
+		/* the context is released with the job if it is still in use
+		 * by a compression thread.
+		 */
+		if (st->job->state == COMP_JOB_PENDING) {
+			st->job->state = COMP_JOB_ORPHAN;
+			st->comp_algo = NULL;
+		}
+		else
+			comp_job_free(st->job, 0);
+		st->job = NULL;
+	}
+
 	/* release any possible compression context */
 	if (st->comp_algo)
 		st->comp_algo->end(&st->comp_ctx);
@@ -174,6 +466,7 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct htx_ret htxret = htx_find_offset(htx, offset);
 	struct htx_blk *blk;
+	struct buffer *out;
 	int ret, consumed = 0, to_forward = 0;
 
 	blk = htxret.blk;
@@ -193,25 +486,54 @@ comp_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
 				v.len -= offset;
 				if (v.len > len)
 					v.len = len;
-				if (htx_compression_buffer_init(htx, &trash) < 0) {
-					msg->chn->flags |= CF_WAKE_WRITE;
+				if (st->job) {
+					/* the chunk at <offset> was given to a
+					 * compression thread.
+					 */
+					if (st->job->state != COMP_JOB_DONE)
+						goto end;
+					ret = st->job->consumed;
+					if (ret < 0 || ret > v.len)
+						goto error;
+					out = &st->job->out;
+					if (b_data(out) > ret && htx_free_space(htx) < b_data(out) - ret) {
+						msg->chn->flags |= CF_WAKE_WRITE;
+						goto end;
+					}
+				}
+				else if (comp_async_submit(st, s, v)) {
+					/* wait for the compression thread */
 					goto end;
 				}
-				ret = htx_compression_buffer_add_data(st, v.ptr, v.len, &trash);
-				if (ret < 0)
-					goto error;
-				if (htx_compression_buffer_end(st, &trash, 0) < 0)
-					goto error;
+				else {
+					if (htx_compression_buffer_init(htx, &trash) < 0) {
+						msg->chn->flags |= CF_WAKE_WRITE;
+						goto end;
+					}
+					ret = htx_compression_buffer_add_data(st, v.ptr, v.len, &trash);
+					if (ret < 0)
+						goto error;
+					if (htx_compression_buffer_end(st, &trash, 0) < 0)
+						goto error;
+					out = &trash;
+				}
 				len -= ret;
 				consumed += ret;
-				to_forward += b_data(&trash);
-				if (ret == sz && !b_data(&trash)) {
+				to_forward += b_data(out);
+				if (ret == sz && !b_data(out)) {
 					offset = 0;
 					blk = htx_remove_blk(htx, blk);
-					continue;
 				}
-				v.len = ret;
-				blk = htx_replace_blk_value(htx, blk, v, ist2(b_head(&trash), b_data(&trash)));
+				else {
+					v.len = ret;
+					blk = htx_replace_blk_value(htx, blk, v, ist2(b_head(out), b_data(out)));
+				}
+				if (st->job) {
+					comp_job_free(st->job, 0);
+					st->job = NULL;
+				}
+				if (ret == sz && !b_data(out))
+					continue;
 				break;
 
 			case HTX_BLK_TLR:
@@ -340,6 +662,9 @@ set_compression_response_header(struct comp_state *st, struct stream *s, struct
 	if (!http_add_header(htx, ist("Vary"), ist("Accept-Encoding")))
 		goto error;
 
+	if (st->comp_algo->dict_id && !http_add_header(htx, ist("Vary"), ist("Available-Dictionary")))
+		goto error;
+
 	return 1;
 
   error:
@@ -349,15 +674,20 @@ set_compression_response_header(struct comp_state *st, struct stream *s, struct
 }
 
 /*
- * Selects a compression algorithm depending on the client request.
+ * Selects a compression algorithm for the stream <s> depending on the client
+ * request <htx>. <from_hdr> is set if it was negotiated using Accept-Encoding,
+ * otherwise it may only be identity. Returns NULL if none may be used.
  */
-static int
-select_compression_request_header(struct comp_state *st, struct stream *s, struct http_msg *msg)
+static struct comp_algo *
+comp_negotiate_algo(struct stream *s, struct htx *htx, int *from_hdr)
 {
-	struct htx *htx = htxbuf(&msg->chn->buf);
 	struct http_hdr_ctx ctx;
 	struct comp_algo *comp_algo = NULL;
 	struct comp_algo *comp_algo_back = NULL;
+	struct comp_algo *best, *selected = NULL;
+	struct ist avail_dict = IST_NULL;
+
+	*from_hdr = 0;
 
 	/* Disable compression for older user agents announcing themselves as "Mozilla/4"
 	 * unless they are known good (MSIE 6 with XP SP2, or MSIE 7 and later).
@@ -371,16 +701,21 @@ select_compression_request_header(struct comp_state *st, struct stream *s, struc
 	     memcmp(ctx.value.ptr + 25, "MSIE ", 5) != 0 ||
 	     *(ctx.value.ptr + 30) < '6' ||
 	     (*(ctx.value.ptr + 30) == '6' &&
-	      (ctx.value.len < 54 || memcmp(ctx.value.ptr + 51, "SV1", 3) != 0)))) {
-		st->comp_algo = NULL;
-		return 0;
-	}
+	      (ctx.value.len < 54 || memcmp(ctx.value.ptr + 51, "SV1", 3) != 0))))
+		return NULL;
 
 	/* search for the algo in the backend in priority or the frontend */
 	if ((s->be->comp && (comp_algo_back = s->be->comp->algos)) ||
 	    (strm_fe(s)->comp && (comp_algo_back = strm_fe(s)->comp->algos))) {
 		int best_q = 0;
 
+		/* dictionary-based algorithms require the client to announce
+		 * the dictionary they were configured with.
+		 */
+		ctx.blk = NULL;
+		if (http_find_header(htx, ist("Available-Dictionary"), &ctx, 1))
+			avail_dict = ctx.value;
+
 		ctx.blk = NULL;
 		while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 0)) {
 			const char *qval;
@@ -420,44 +755,91 @@ select_compression_request_header(struct comp_state *st, struct stream *s, struc
 			/* here we have qval pointing to the first "q=" attribute or NULL if not found */
 			q = qval ? http_parse_qvalue(qval + 2, NULL) : 1000;
 
-			if (q <= best_q)
+			if (!q || q < best_q)
 				continue;
 
+			/* the algorithms are listed in reverse configuration
+			 * order, so the last match is the preferred one. On
+			 * equal q-values, the one configured first wins.
+			 */
+			best = NULL;
 			for (comp_algo = comp_algo_back; comp_algo; comp_algo = comp_algo->next) {
+				if (comp_algo->dict_id &&
+				    (*(ctx.value.ptr) == '*' || !avail_dict.len ||
+				     !isteq(avail_dict, ist(comp_algo->dict_id))))
+					continue;
 				if (*(ctx.value.ptr) == '*' ||
-				    word_match(ctx.value.ptr, toklen, comp_algo->ua_name, comp_algo->ua_name_len)) {
-					st->comp_algo = comp_algo;
-					best_q = q;
-					break;
-				}
+				    word_match(ctx.value.ptr, toklen, comp_algo->ua_name, comp_algo->ua_name_len))
+					best = comp_algo;
+			}
+
+			if (best && (q > best_q || comp_algo_preferred(best, selected))) {
+				selected = best;
+				best_q = q;
 			}
 		}
 	}
 
-	/* remove all occurrences of the header when "compression offload" is set */
-	if (st->comp_algo) {
-		if ((s->be->comp && s->be->comp->offload) ||
-		    (strm_fe(s)->comp && strm_fe(s)->comp->offload)) {
-			http_remove_header(htx, &ctx);
-			ctx.blk = NULL;
-			while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 1))
-				http_remove_header(htx, &ctx);
-		}
-		return 1;
+	if (selected) {
+		*from_hdr = 1;
+		return selected;
 	}
 
 	/* identity is implicit does not require headers */
 	if ((s->be->comp && (comp_algo_back = s->be->comp->algos)) ||
 	    (strm_fe(s)->comp && (comp_algo_back = strm_fe(s)->comp->algos))) {
 		for (comp_algo = comp_algo_back; comp_algo; comp_algo = comp_algo->next) {
-			if (comp_algo->cfg_name_len == 8 && memcmp(comp_algo->cfg_name, "identity", 8) == 0) {
-				st->comp_algo = comp_algo;
-				return 1;
-			}
+			if (comp_algo->cfg_name_len == 8 && memcmp(comp_algo->cfg_name, "identity", 8) == 0)
+				return comp_algo;
 		}
 	}
 
-	st->comp_algo = NULL;
+	return NULL;
+}
+
+/*
+ * Selects a compression algorithm depending on the client request.
+ */
+static int
+select_compression_request_header(struct comp_state *st, struct stream *s, struct http_msg *msg)
+{
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct http_hdr_ctx ctx;
+	int from_hdr;
+
+	st->comp_algo = comp_negotiate_algo(s, htx, &from_hdr);
+	if (!st->comp_algo)
+		return 0;
+
+	/* remove all occurrences of the header when "compression offload" is set */
+	if (from_hdr &&
+	    ((s->be->comp && s->be->comp->offload) ||
+	     (strm_fe(s)->comp && strm_fe(s)->comp->offload))) {
+		ctx.blk = NULL;
+		while (http_find_header(htx, ist("Accept-Encoding"), &ctx, 1))
+			http_remove_header(htx, &ctx);
+	}
+	return 1;
+}
+
+/* Returns the content-coding the compression filter will apply to the response
+ * to the request <htx> of the stream <s>, as 1 + its index in comp_algos[], or
+ * 0 if the response will not be encoded. This is used by the cache to store
+ * one variant per content-coding.
+ */
+int comp_select_encoding(struct stream *s, struct htx *htx)
+{
+	struct comp_algo *algo;
+	int from_hdr, i;
+
+	algo = comp_negotiate_algo(s, htx, &from_hdr);
+	if (!algo || !from_hdr)
+		return 0;
+
+	for (i = 1; comp_algos[i].cfg_name; i++) {
+		if (strcmp(comp_algos[i].cfg_name, algo->cfg_name) == 0)
+			return i + 1;
+	}
 	return 0;
 }
 
@@ -664,6 +1046,15 @@ parse_compression_options(char **args, int section, struct proxy *proxy,
 	}
 	else if (!strcmp(args[1], "offload"))
 		comp->offload = 1;
+	else if (!strcmp(args[1], "async")) {
+#ifdef USE_THREAD
+		comp->async = 1;
+		comp_async_used = 1;
+#else
+		memprintf(err, "'%s %s' requires thread support.\n", args[0], args[1]);
+		return -1;
+#endif
+	}
 	else if (!strcmp(args[1], "type")) {
 		int cur_arg = 2;
 
@@ -678,7 +1069,7 @@ parse_compression_options(char **args, int section, struct proxy *proxy,
 		}
 	}
 	else {
-		memprintf(err, "'%s' expects 'algo', 'type' or 'offload'\n",
+		memprintf(err, "'%s' expects 'algo', 'type', 'offload' or 'async'\n",
 			  args[0]);
 		return -1;
 	}
@@ -686,6 +1077,33 @@ parse_compression_options(char **args, int section, struct proxy *proxy,
 	return 0;
 }
 
+/* parses the "tune.comp.async-threads" global keyword */
+static int
+parse_comp_async_threads(char **args, int section, struct proxy *curpx,
+			 struct proxy *defpx, const char *file, int line,
+			 char **err)
+{
+	char *stop;
+	long nb;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	nb = strtol(args[1], &stop, 10);
+	if (!*args[1] || *stop || nb < 0 || nb > MAX_THREADS) {
+		memprintf(err, "'%s' expects a number of threads between 0 and %d.", args[0], MAX_THREADS);
+		return -1;
+	}
+#ifndef USE_THREAD
+	if (nb) {
+		memprintf(err, "'%s' requires thread support.", args[0]);
+		return -1;
+	}
+#endif
+	comp_async_nbthread = nb;
+	return 0;
+}
+
 static int
 parse_http_comp_flt(char **args, int *cur_arg, struct proxy *px,
                     struct flt_conf *fconf, char **err, void *private)
@@ -722,16 +1140,7 @@ check_implicit_http_comp_flt(struct proxy *proxy)
 		list_for_each_entry(fconf, &proxy->filter_configs, list) {
 			if (fconf->id == http_comp_flt_id)
 				comp = 1;
-			else if (fconf->id == cache_store_flt_id) {
-				if (comp) {
-					ha_alert("config: %s '%s': unable to enable the compression filter "
-						 "before any cache filter.\n",
-						 proxy_type_str(proxy), proxy->id);
-					err++;
-					goto end;
-				}
-			}
-			else if (fconf->id == fcgi_flt_id)
+			else if (fconf->id == cache_store_flt_id || fconf->id == fcgi_flt_id)
 				continue;
 			else
 				explicit = 1;
@@ -811,6 +1220,7 @@ smp_fetch_res_comp_algo(const struct arg *args, struct sample *smp,
 /* Declare the config parser for "compression" keyword */
 static struct cfg_kw_list cfg_kws = {ILH, {
 		{ CFG_LISTEN, "compression", parse_compression_options },
+		{ CFG_GLOBAL, "tune.comp.async-threads", parse_comp_async_threads },
 		{ 0, NULL, NULL },
 	}
 };
@@ -217,6 +217,168 @@ void h1_parse_connection_header(struct h1m *h1m, struct ist *value)
 		}                                                         \
 	} while (0)
 
+/* The parser may skip over header names, header values and request URIs 16
+ * or 32 bytes at a time using SSE2 or AVX2. SSE2 is always present on x86_64
+ * while AVX2 is detected at boot. Header names are short, so they are always
+ * scanned using SSE2. The functions below all return a pointer to the first
+ * byte which doesn't belong to the scanned element, or to the first one which
+ * cannot be checked as a whole vector before <end>. The remaining bytes are
+ * left to the portable scanners.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5)
+#define H1_USE_SIMD
+#include <immintrin.h>
+#endif
+
+enum h1_simd h1_simd_level = H1_SIMD_NONE;
+
+#ifdef H1_USE_SIMD
+/* skips the groups of 4 bytes which the portable URI scanner skips at once:
+ * the word arithmetic it uses to check for bytes 0x21 to 0x7e is applied to
+ * each 32-bit lane, so that both accept exactly the same bytes, including the
+ * few combinations of bytes 0x7f and above which pass this check. The
+ * returned pointer is always a multiple of 4 bytes away from <ptr>.
+ */
+static inline char *h1_sse2_skip_uri(char *ptr, const char *end)
+{
+	const __m128i top = _mm_set1_epi32(0x80808080);
+	const __m128i zero = _mm_setzero_si128();
+
+	while (ptr <= end - 16) {
+		__m128i x = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)ptr), _mm_set1_epi32(0x21212121));
+		__m128i y = _mm_sub_epi32(x, _mm_set1_epi32(0x5e5e5e5e));
+		__m128i ok = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(y, top), zero),
+		                              _mm_cmpeq_epi32(_mm_and_si128(x, top), zero));
+		unsigned int m = ~_mm_movemask_ps(_mm_castsi128_ps(ok)) & 0xf;
+
+		if (m)
+			return ptr + 4 * __builtin_ctz(m);
+		ptr += 16;
+	}
+	return ptr;
+}
+
+/* skips the most common header name characters: letters, digits, '-' and
+ * '_'. Upper case letters are turned to lower case if <lower> is set.
+ */
+static inline char *h1_sse2_skip_name(char *ptr, const char *end, int lower)
+{
+	const __m128i idx = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	while (ptr <= end - 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)ptr);
+		__m128i l = _mm_or_si128(x, _mm_set1_epi8(0x20));
+		__m128i ok = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+		                           _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), l));
+		unsigned int m, len;
+
+		ok = _mm_or_si128(ok, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+		                                    _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), x)));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, _mm_set1_epi8('-')));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+		m = ~_mm_movemask_epi8(ok) & 0xffff;
+		len = m ? __builtin_ctz(m) : 16;
+
+		if (lower) {
+			__m128i up = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)),
+			                           _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), x));
+
+			up = _mm_and_si128(up, _mm_cmpgt_epi8(_mm_set1_epi8(len), idx));
+			if (_mm_movemask_epi8(up))
+				_mm_storeu_si128((__m128i *)ptr, _mm_or_si128(x, _mm_and_si128(up, _mm_set1_epi8(0x20))));
+		}
+
+		ptr += len;
+		if (m)
+			break;
+	}
+	return ptr;
+}
+
+/* skips bytes above 0x0d, so that CR and LF are found */
+static inline char *h1_sse2_skip_val(char *ptr, const char *end)
+{
+	while (ptr <= end - 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)ptr);
+		unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x0d)), x));
+
+		if (m)
+			return ptr + __builtin_ctz(m);
+		ptr += 16;
+	}
+	return ptr;
+}
+
+/* AVX2 equivalent of h1_sse2_skip_uri() */
+__attribute__((target("avx2")))
+static char *h1_avx2_skip_uri(char *ptr, const char *end)
+{
+	const __m256i top = _mm256_set1_epi32(0x80808080);
+	const __m256i zero = _mm256_setzero_si256();
+
+	while (ptr <= end - 32) {
+		__m256i x = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *)ptr), _mm256_set1_epi32(0x21212121));
+		__m256i y = _mm256_sub_epi32(x, _mm256_set1_epi32(0x5e5e5e5e));
+		__m256i ok = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_and_si256(y, top), zero),
+		                                 _mm256_cmpeq_epi32(_mm256_and_si256(x, top), zero));
+		unsigned int m = ~_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xff;
+
+		if (m)
+			return ptr + 4 * __builtin_ctz(m);
+		ptr += 32;
+	}
+	return h1_sse2_skip_uri(ptr, end);
+}
+
+/* AVX2 equivalent of h1_sse2_skip_val() */
+__attribute__((target("avx2")))
+static char *h1_avx2_skip_val(char *ptr, const char *end)
+{
+	while (ptr <= end - 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)ptr);
+		unsigned int m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(0x0d)), x));
+
+		if (m)
+			return ptr + __builtin_ctz(m);
+		ptr += 32;
+	}
+	return h1_sse2_skip_val(ptr, end);
+}
+#endif /* H1_USE_SIMD */
+
+/* Sets the instruction set used by the HTTP/1 parser to <level>, or to the
+ * best one supported by the CPU below it. Returns the level which was set.
+ */
+enum h1_simd h1_set_simd_level(enum h1_simd level)
+{
+#ifdef H1_USE_SIMD
+	__builtin_cpu_init();
+	if (level >= H1_SIMD_AVX2 && !__builtin_cpu_supports("avx2"))
+		level = H1_SIMD_SSE2;
+#else
+	level = H1_SIMD_NONE;
+#endif
+	h1_simd_level = level;
+	return level;
+}
+
+/* returns the name of SIMD level <level> */
+const char *h1_simd_name(enum h1_simd level)
+{
+	switch (level) {
+	case H1_SIMD_NONE: return "none";
+	case H1_SIMD_SSE2: return "sse2";
+	case H1_SIMD_AVX2: return "avx2";
+	}
+	return "unknown";
+}
+
+__attribute__((constructor))
+static void __h1_init(void)
+{
+	h1_set_simd_level(H1_SIMD_AVX2);
+}
+
 /* This function parses a contiguous HTTP/1 headers block starting at <start>
  * and ending before <stop>, at once, and converts it a list of (name,value)
  * pairs representing header fields into the array <hdr> of size <hdr_num>,
@@ -386,6 +548,12 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 
 	case H1_MSG_RQURI:
 	http_msg_rquri:
+#ifdef H1_USE_SIMD
+		if (h1_simd_level >= H1_SIMD_AVX2)
+			ptr = h1_avx2_skip_uri(ptr, end);
+		else if (h1_simd_level)
+			ptr = h1_sse2_skip_uri(ptr, end);
+#endif
 #ifdef HA_UNALIGNED_LE
 		/* speedup: skip bytes not between 0x21 and 0x7e inclusive */
 		while (ptr <= end - sizeof(int)) {
@@ -660,13 +828,22 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 	case H1_MSG_HDR_NAME:
 	http_msg_hdr_name:
 		/* assumes sol points to the first char */
+#ifdef H1_USE_SIMD
+		if (h1_simd_level)
+			ptr = h1_sse2_skip_name(ptr, end, !skip_update && (h1m->flags & H1_MF_TOLOWER));
+#endif
+		if (ptr >= end) {
+			state = H1_MSG_HDR_NAME;
+			goto http_msg_ood;
+		}
+	http_msg_hdr_name2:
 		if (likely(HTTP_IS_TOKEN(*ptr))) {
 			if (!skip_update) {
 				/* turn it to lower case if needed */
 				if (isupper((unsigned char)*ptr) && h1m->flags & H1_MF_TOLOWER)
 					*ptr = tolower(*ptr);
 			}
-			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 		}
 
 		if (likely(*ptr == ':')) {
@@ -683,7 +860,7 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 			h1m->err_pos = ptr - start + skip; /* >= 0 now */
 
 		/* and we still accept this non-token character */
-		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 
 	case H1_MSG_HDR_L1_SP:
 	http_msg_hdr_l1_sp:
@@ -731,7 +908,14 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 		 * and lower. In fact since most of the time is spent in the loop, we
 		 * also remove the sign bit test so that bytes 0x8e..0x0d break the
 		 * loop, but we don't care since they're very rare in header values.
+		 * The vector scanners exactly stop on bytes 0x0D and lower.
 		 */
+#ifdef H1_USE_SIMD
+		if (h1_simd_level >= H1_SIMD_AVX2)
+			ptr = h1_avx2_skip_val(ptr, end);
+		else if (h1_simd_level)
+			ptr = h1_sse2_skip_val(ptr, end);
+#endif
 #ifdef HA_UNALIGNED_LE64
 		while (ptr <= end - sizeof(long)) {
 			if ((*(long *)ptr - 0x0e0e0e0e0e0e0e0eULL) & 0x8080808080808080ULL)
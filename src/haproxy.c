@@ -119,6 +119,7 @@
 #include <proto/filters.h>
 #include <proto/hlua.h>
 #include <proto/http_rules.h>
+#include <proto/lb_maglev.h>
 #include <proto/listener.h>
 #include <proto/log.h>
 #include <proto/mworker.h>
@@ -325,6 +326,16 @@ struct post_deinit_fct {
 	void (*fct)();
 };
 
+/* These functions are called at the beginning of deinit, once everything is
+ * stopped but before anything is released, so that they may still use the
+ * proxies, servers, tables and pools. They don't return anything.
+ */
+struct list pre_deinit_list = LIST_HEAD_INIT(pre_deinit_list);
+struct pre_deinit_fct {
+	struct list list;
+	void (*fct)();
+};
+
 /* These functions are called when freeing a proxy during the deinit, after
  * everything isg stopped. They don't return anything. They should not release
  * the proxy itself or any shared resources that are possibly used by other
@@ -435,6 +446,22 @@ void hap_register_post_server_check(int (*fct)(struct server *))
 	LIST_ADDQ(&post_server_check_list, &b->list);
 }
 
+/* used to register some de-initialization functions to call once everything
+ * has stopped, before anything is released.
+ */
+void hap_register_pre_deinit(void (*fct)())
+{
+	struct pre_deinit_fct *b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	b->fct = fct;
+	LIST_ADDQ(&pre_deinit_list, &b->list);
+}
+
 /* used to register some de-initialization functions to call after everything
  * has stopped.
  */
@@ -2599,10 +2626,14 @@ void deinit(void)
 	struct logformat_node *lf, *lfb;
 	struct bind_conf *bind_conf, *bind_back;
 	struct build_opts_str *bol, *bolb;
+	struct pre_deinit_fct *prdf;
 	struct post_deinit_fct *pdf;
 	struct proxy_deinit_fct *pxdf;
 	struct server_deinit_fct *srvdf;
 
+	list_for_each_entry(prdf, &pre_deinit_list, list)
+		prdf->fct();
+
 	deinit_signals();
 	while (p) {
 		free(p->conf.file);
@@ -2624,6 +2655,8 @@ void deinit(void)
 		free(p->conf.uif_file);
 		if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MAP)
 			free(p->lbprm.map.srv);
+		else if ((p->lbprm.algo & BE_LB_LKUP) == BE_LB_LKUP_MGTABLE)
+			maglev_deinit_server_table(p);
 
 		if (p->conf.logformat_sd_string != default_rfc5424_sd_log_format)
 			free(p->conf.logformat_sd_string);
@@ -2747,6 +2780,8 @@ void deinit(void)
 			free(s->cookie);
 			free(s->hostname_dn);
 			free((char*)s->conf.file);
+			free(s->idle_conns_tree);
+			free(s->safe_conns_tree);
 			free(s->idle_conns);
 			free(s->safe_conns);
 			free(s->available_conns);
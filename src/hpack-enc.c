@@ -31,6 +31,8 @@
 #include <string.h>
 
 #include <common/hpack-enc.h>
+#include <common/hpack-huff.h>
+#include <common/hpack-tbl.h>
 #include <common/http-hdr.h>
 #include <common/ist.h>
 
@@ -140,73 +142,385 @@ const signed short hpack_pos_len[32] = {
          /*   24: */   -1,  609,   -1,  636,   -1,   -1,   -1,   -1,
 };
 
-/* Tries to encode header whose name is <n> and value <v> into the chunk <out>.
- * Returns non-zero on success, 0 on failure (buffer full).
+struct pool_head *pool_head_hpack_enc = NULL;
+
+/* Returns the index of header field name <n> in the static table, or 0 if it
+ * is not there.
  */
-int hpack_encode_header(struct buffer *out, const struct ist n,
-			const struct ist v)
+static inline int hpack_find_static_name(const struct ist n)
+{
+	int pos;
+
+	if (n.len >= sizeof(hpack_pos_len) / sizeof(hpack_pos_len[0]))
+		return 0;
+
+	pos = hpack_pos_len[n.len];
+	if (pos < 0)
+		return 0;
+
+	/* At least one header field of this length exist */
+	do {
+		char idx;
+
+		pos++;
+		idx = hpack_enc_stream[pos++];
+		pos += n.len;
+		if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n))
+			return idx;
+	} while ((unsigned char)hpack_enc_stream[pos] == n.len);
+
+	return 0;
+}
+
+/* Hashes the <len> bytes at <p> starting from <h>, 8 bytes at a time. */
+static inline uint64_t hpack_enc_hash(uint64_t h, const char *p, size_t len)
+{
+	uint64_t w;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	if (len) {
+		w = 0;
+		memcpy(&w, p, len);
+		h = (h ^ w ^ ((uint64_t)len << 56)) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+/* Returns the index the peer knows the entry referenced by <slot> under, once
+ * the fields of the current block are inserted, or 0 if the entry is not in
+ * the table anymore or will be evicted by these insertions.
+ */
+static inline uint32_t hpack_enc_slot_idx(const struct hpack_enc *enc,
+                                          const struct hpack_enc_slot *slot)
 {
+	uint32_t age = enc->seq - slot->seq;
+
+	if (!slot->seq || age >= enc->dht->used)
+		return 0;
+
+	if (enc->cum - slot->cum + enc->pend_bytes > enc->dht->size)
+		return 0;
+
+	return HPACK_SHT_SIZE + age + enc->pend_cnt;
+}
+
+/* Looks up the tag of hash <h> in the table of recently seen fields of <enc>
+ * and returns non-zero if it was found. Otherwise it is added as the most
+ * recent entry of its set and zero is returned.
+ */
+static inline int hpack_enc_seen(struct hpack_enc *enc, uint64_t h)
+{
+	uint16_t *set = &enc->seen[(h >> 32) % (HPACK_ENC_SEEN_SIZE / 2) * 2];
+	uint16_t tag = h | 1;
+
+	if (set[0] == tag || set[1] == tag)
+		return 1;
+
+	set[1] = set[0];
+	set[0] = tag;
+	return 0;
+}
+
+/* Appends string <str> to <out>+<pos> as a string literal (RFC7541#5.2), which
+ * is huffman-encoded when this is shorter. The encoded string is directly
+ * produced in place and the raw one is copied over it if it is not shorter.
+ * Returns the new position. The caller is responsible for checking for room
+ * for the raw string.
+ */
+static inline int hpack_encode_str(char *out, int pos, const struct ist str)
+{
+	int lb = hpack_len_to_bytes(str.len);
+	int start = pos;
+	int hlen;
+
+	hlen = huff_enc(str.ptr, str.len, out + pos + lb, str.len - 1);
+	if (hlen) {
+		if (hpack_len_to_bytes(hlen) < lb)
+			memmove(out + pos + hpack_len_to_bytes(hlen), out + pos + lb, hlen);
+		pos = hpack_encode_len(out, pos, hlen);
+		out[start] |= 0x80;
+		return pos + hlen;
+	}
+
+	pos = hpack_encode_len(out, pos, str.len);
+	memcpy(out + pos, str.ptr, str.len);
+	return pos + str.len;
+}
+
+/* Tries to encode header whose name is <n> and value <v> into the chunk <out>,
+ * using and feeding the dynamic table of encoder <enc> when not NULL. The name
+ * is looked up in the static table, then both the name and the name+value are
+ * looked up in the dynamic table. Fields which are not fully indexed may be
+ * inserted into the dynamic table depending on the encoder's policy, except
+ * sensitive ones which are never indexed. Strings are huffman-encoded when it
+ * makes them shorter. Returns non-zero on success, 0 on failure (buffer full).
+ */
+int hpack_enc_header(struct hpack_enc *enc, struct buffer *out,
+		     const struct ist n, const struct ist v)
+{
+	struct hpack_enc_pend *pend = NULL;
 	int len = out->data;
 	int size = out->size;
-	int pos;
+	uint64_t hn = 0, hnv = 0;
+	uint32_t idx, bit;
+	uint8_t flags = 0x00; /* literal without indexing */
+	int bits = 4;
+	int need;
 
 	if (len >= size)
 		return 0;
 
-	/* look for the header field <n> in the static table */
-	if (n.len >= sizeof(hpack_pos_len) / sizeof(hpack_pos_len[0]))
-		goto make_literal;
+	idx = hpack_find_static_name(n);
 
-	pos = hpack_pos_len[n.len];
-	if (pos >= 0) {
-		/* At least one header field of this length exist */
-		do {
-			char idx;
-
-			pos++;
-			idx = hpack_enc_stream[pos++];
-			pos += n.len;
-			if (isteq(ist2(&hpack_enc_stream[pos - n.len], n.len), n)) {
-				/* emit literal with indexing (7541#6.2.1) :
-				 * [ 0 | 1 | Index (6+) ]
-				 */
-				out->area[len++] = idx | 0x40;
-				goto emit_value;
-			}
-		} while ((unsigned char)hpack_enc_stream[pos] == n.len);
+	/* the only static field worth sending indexed here */
+	if (idx == 16 && isteq(v, ist("gzip, deflate"))) {
+		out->area[len++] = 0x80 | idx;
+		out->data = len;
+		return 1;
 	}
 
- make_literal:
-	if (likely(n.len < 127 && len + 2 + n.len <= size)) {
-		out->area[len++] = 0x00;      /* literal without indexing -- new name */
-		out->area[len++] = n.len;     /* single-byte length encoding */
-		ist2bin(out->area + len, n);
-		len += n.len;
+	if (idx == 23 || idx == 49) {
+		/* authorization, proxy-authorization: RFC7541#7.1.3 */
+		flags = 0x10; /* never indexed */
+		goto emit;
 	}
-	else if (hpack_len_to_bytes(n.len) &&
-		 len + 1 + hpack_len_to_bytes(n.len) + n.len <= size) {
-		out->area[len++] = 0x00;      /* literal without indexing -- new name */
-		len = hpack_encode_len(out->area, len, n.len);
-		ist2bin(out->area + len, n);
-		len += n.len;
+
+	if (idx == 32 || idx == 55 || !enc || !enc->dht || !enc->dht->size)
+		goto emit; /* cookie, set-cookie */
+
+	hn = hpack_enc_hash(0, n.ptr, n.len);
+	hnv = hpack_enc_hash(hn, v.ptr, v.len);
+
+	/* look for the whole field in the dynamic table */
+	bit = hpack_enc_slot_idx(enc, &enc->nv_idx[hnv % HPACK_ENC_HASH_SIZE]);
+	if (bit) {
+		const struct hpack_dte *dte;
+
+		dte = hpack_get_dte(enc->dht, bit - HPACK_SHT_SIZE - enc->pend_cnt + 1);
+		if (dte && isteq(hpack_get_name(enc->dht, dte), n) &&
+		    isteq(hpack_get_value(enc->dht, dte), v)) {
+			/* indexed header field (7541#6.1) :
+			 * [ 1 | Index (7+) ]
+			 */
+			if (len + 3 > size)
+				return 0;
+			out->data = hpack_encode_int(out->area, len, 0x80, 7, bit);
+			return 1;
+		}
 	}
-	else {
-		/* header field name too large for the buffer */
-		return 0;
+
+	/* otherwise only look for the name */
+	if (!idx) {
+		idx = hpack_enc_slot_idx(enc, &enc->n_idx[hn % HPACK_ENC_HASH_SIZE]);
+		if (idx) {
+			const struct hpack_dte *dte;
+
+			dte = hpack_get_dte(enc->dht, idx - HPACK_SHT_SIZE - enc->pend_cnt + 1);
+			if (!dte || !isteq(hpack_get_name(enc->dht, dte), n))
+				idx = 0;
+		}
 	}
 
- emit_value:
-	/* copy literal header field value */
-	if (!hpack_len_to_bytes(v.len) ||
-	    len + hpack_len_to_bytes(v.len) + v.len > size) {
-		/* header value too large for the buffer */
+	/* decide whether the field is worth being inserted */
+	if (enc->pend_cnt >= HPACK_ENC_MAX_PEND ||
+	    n.len + v.len + 32 > enc->dht->size / 2)
+		goto emit;
+
+	if (enc->policy == HPACK_ENC_POL_REPEATED) {
+		/* the fields and names seen last are remembered as 16-bit
+		 * tags in sets of 2 slots. A first occurrence only remembers
+		 * the field, except if its name was already seen and is not
+		 * indexed anywhere, in which case inserting it provides the
+		 * name.
+		 */
+		if (!hpack_enc_seen(enc, hnv) && (idx || !hpack_enc_seen(enc, hn)))
+			goto emit;
+	}
+
+	/* literal with incremental indexing (7541#6.2.1) :
+	 * [ 0 | 1 | Index (6+) ]
+	 */
+	flags = 0x40;
+	bits = 6;
+	pend = &enc->pend[enc->pend_cnt];
+
+ emit:
+	/* literal header field, with an indexed or a literal name */
+	need = 5;
+	if (!idx) {
+		if (!hpack_len_to_bytes(n.len))
+			return 0; /* header field name too large */
+		need += hpack_len_to_bytes(n.len) + n.len;
+	}
+	if (!hpack_len_to_bytes(v.len))
+		return 0; /* header field value too large */
+	need += hpack_len_to_bytes(v.len) + v.len;
+
+	if (len + need > size)
 		return 0;
+
+	len = hpack_encode_int(out->area, len, flags, bits, idx);
+	if (!idx)
+		len = hpack_encode_str(out->area, len, n);
+	len = hpack_encode_str(out->area, len, v);
+	out->data = len;
+
+	if (pend) {
+		/* it will only be inserted once the block is committed */
+		pend->n = n;
+		pend->v = v;
+		pend->hn = hn;
+		pend->hnv = hnv;
+		enc->pend_cnt++;
+		enc->pend_bytes += n.len + v.len + 32;
 	}
+	return 1;
+}
 
-	len = hpack_encode_len(out->area, len, v.len);
-	memcpy(out->area + len, v.ptr, v.len);
-	len += v.len;
+/* Tries to encode header whose name is <n> and value <v> into the chunk <out>
+ * without any dynamic table. Returns non-zero on success, 0 on failure (buffer
+ * full).
+ */
+int hpack_encode_header(struct buffer *out, const struct ist n,
+			const struct ist v)
+{
+	return hpack_enc_header(NULL, out, n, v);
+}
+
+/* Starts a new header block for encoder <enc> into <out>. Any field inserted by
+ * a previous block which was not committed is forgotten, and a pending dynamic
+ * table size update is emitted. Returns non-zero on success, 0 on failure
+ * (buffer full).
+ */
+int hpack_enc_begin(struct hpack_enc *enc, struct buffer *out)
+{
+	int len = out->data;
+
+	enc->pend_cnt = 0;
+	enc->pend_bytes = 0;
 
+	if (enc->upd_size == HPACK_ENC_NO_UPDATE)
+		return 1;
+
+	if (len + 10 > out->size)
+		return 0;
+
+	/* dynamic table size update (7541#6.3), the smallest size reached
+	 * since the last update must be signaled first :
+	 * [ 0 | 0 | 1 | Max size (5+) ]
+	 */
+	if (enc->upd_min < enc->upd_size)
+		len = hpack_encode_int(out->area, len, 0x20, 5, enc->upd_min);
+	len = hpack_encode_int(out->area, len, 0x20, 5, enc->upd_size);
 	out->data = len;
 	return 1;
 }
+
+/* Commits the header block being encoded by <enc> once it was emitted: the
+ * fields it inserted are now added to the dynamic table.
+ */
+void hpack_enc_commit(struct hpack_enc *enc)
+{
+	struct hpack_enc_pend *pend;
+	int i;
+
+	enc->upd_size = HPACK_ENC_NO_UPDATE;
+
+	for (i = 0; i < enc->pend_cnt; i++) {
+		pend = &enc->pend[i];
+
+		if (pend->n.len + pend->v.len + 32 > enc->dht->size) {
+			/* the peer empties its table and does not insert it */
+			hpack_dht_init(enc->dht, enc->dht->size);
+			continue;
+		}
+
+		if (hpack_dht_insert(enc->dht, pend->n, pend->v) < 0) {
+			/* the peer inserted it anyway. Forgetting all the
+			 * older entries keeps the remaining indexes right.
+			 */
+			hpack_dht_init(enc->dht, enc->dht->size);
+		}
+
+		enc->seq++;
+		enc->nv_idx[pend->hnv % HPACK_ENC_HASH_SIZE].seq = enc->seq;
+		enc->nv_idx[pend->hnv % HPACK_ENC_HASH_SIZE].cum = enc->cum;
+		enc->n_idx[pend->hn % HPACK_ENC_HASH_SIZE].seq = enc->seq;
+		enc->n_idx[pend->hn % HPACK_ENC_HASH_SIZE].cum = enc->cum;
+		enc->cum += pend->n.len + pend->v.len + 32;
+	}
+	enc->pend_cnt = 0;
+	enc->pend_bytes = 0;
+}
+
+/* Sets to <size> the maximum dynamic table size the peer accepts (its
+ * SETTINGS_HEADER_TABLE_SIZE), within the limit configured for <enc>. The
+ * change is signaled at the beginning of the next header block. The table is
+ * emptied since it is only expected to happen once on a connection.
+ */
+void hpack_enc_set_size(struct hpack_enc *enc, unsigned int size)
+{
+	struct hpack_dht *dht = enc->dht;
+
+	if (!dht)
+		return;
+
+	if (size > enc->max_size)
+		size = enc->max_size;
+
+	if (size == dht->size)
+		return;
+
+	if (enc->upd_size == HPACK_ENC_NO_UPDATE || size < enc->upd_min)
+		enc->upd_min = size;
+	enc->upd_size = size;
+
+	hpack_dht_init(dht, size);
+}
+
+/* Allocates an encoder whose dynamic table will not exceed <size> bytes (0
+ * disables it, larger values are limited to the size of the decoding tables)
+ * and inserts fields according to <policy>. The peer's table is assumed to be
+ * of the default size (4096) until hpack_enc_set_size() is called. Returns
+ * NULL on allocation failure.
+ */
+struct hpack_enc *hpack_enc_alloc(unsigned int size, enum hpack_enc_policy policy)
+{
+	struct hpack_enc *enc;
+
+	enc = hpack_alloc(pool_head_hpack_enc);
+	if (!enc)
+		return NULL;
+
+	memset(enc, 0, sizeof(*enc));
+	enc->upd_size = HPACK_ENC_NO_UPDATE;
+	enc->policy = policy;
+
+	if (size) {
+		enc->dht = hpack_dht_alloc();
+		if (!enc->dht) {
+			hpack_free(pool_head_hpack_enc, enc);
+			return NULL;
+		}
+		if (size > enc->dht->size)
+			size = enc->dht->size;
+		enc->max_size = size;
+		hpack_dht_init(enc->dht, size < 4096 ? size : 4096);
+	}
+	return enc;
+}
+
+/* Releases encoder <enc> and its dynamic table */
+void hpack_enc_free(struct hpack_enc *enc)
+{
+	if (!enc)
+		return;
+	if (enc->dht)
+		hpack_dht_free(enc->dht);
+	hpack_free(pool_head_hpack_enc, enc);
+}
@@ -1386,25 +1386,53 @@ struct rht rht_bit11_4[256] = {
 	/* Note, when l==30, bits 2..3 give 00:0x0a, 01:0x0d, 10:0x16, 11:EOS */
 };
 
-/* huffman-encode string <s> into the huff_tmp buffer and returns the amount
- * of output bytes. The caller must ensure the output is large enough (ie at
- * least 4 times as long as s).
- *
- * FIXME: bits are only counted for now, no code is emitted!
+/* huffman-encode the <len> bytes of string <s> into <out> and returns the
+ * amount of output bytes, or 0 if more than <max> bytes would be needed, in
+ * which case no more than <max> bytes were written. This allows the caller to
+ * try to encode the string in place and to fall back to the raw string when
+ * the encoded one is not shorter. The codes are accumulated into a 64-bit word
+ * which is flushed 32 bits at a time, and the last byte is padded with the
+ * most significant bits of the EOS code as required by RFC7541#5.2.
  */
-int huff_enc(const char *s, char *out)
+int huff_enc(const char *s, int len, char *out, int max)
 {
+	const uint8_t *p = (const uint8_t *)s;
+	const uint8_t *end = p + len;
+	uint8_t *o = (uint8_t *)out;
+	uint8_t *lim = o + max;
+	uint64_t acc = 0;
+	uint32_t word;
 	int bits = 0;
 
-	while (*s) {
-		bits += ht[(uint8_t)*s].b;
-		s++;
+	while (p < end) {
+		acc = (acc << ht[*p].b) | ht[*p].c;
+		bits += ht[*p].b;
+		p++;
+		if (bits >= 32) {
+			if (o + 4 > lim)
+				return 0;
+			bits -= 32;
+			word = acc >> bits;
+			o[0] = word >> 24;
+			o[1] = word >> 16;
+			o[2] = word >> 8;
+			o[3] = word;
+			o += 4;
+		}
+	}
+
+	if (o + (bits + 7) / 8 > lim)
+		return 0;
+
+	while (bits >= 8) {
+		bits -= 8;
+		*o++ = acc >> bits;
 	}
-	bits += 7;
 
-	/*  FIXME: huffman code is not emitted yet. */
-	//memset(out, 'H', bits / 8);
-	return bits / 8;
+	if (bits)
+		*o++ = (acc << (8 - bits)) | (0xff >> bits);
+
+	return o - (uint8_t *)out;
 }
 
 /* pass a huffman string, it will decode it and return the new output size or
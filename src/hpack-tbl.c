@@ -179,6 +179,8 @@ static struct hpack_dht *hpack_dht_defrag(struct hpack_dht *dht)
 	if (!alt_dht)
 		return NULL;
 
+	/* an encoder's table may be smaller than the allocated one */
+	alt_dht->size = dht->size;
 	alt_dht->total = dht->total;
 	alt_dht->used = dht->used;
 	alt_dht->wrap = dht->used;
@@ -56,6 +56,141 @@ struct conf_errors {
 	struct list list;                           /* next conf_errors */
 };
 
+/* Lookups of a header by its exact name may rely on an index of the header
+ * blocks of the message, built on the first lookup. It maps a hash of the names
+ * to the blocks positions, chained in the message order. Indexes are stored in
+ * a few per-thread slots and the message only keeps the generation of its
+ * index in htx->hdr_gen, which is reset when blocks are added or moved and when
+ * a header is renamed. Removed blocks keep their position and are simply
+ * skipped. The generations are 64-bit and each thread only produces those of
+ * its own residue modulo MAX_THREADS, so that a generation is never reused.
+ */
+#define HTTP_HDR_IDX_SLOTS   4     /* number of indexes per thread */
+#define HTTP_HDR_IDX_BITS    6     /* number of bits of the buckets table */
+#define HTTP_HDR_IDX_MAX     255   /* max number of indexed headers per message */
+
+struct http_hdr_idx {
+	uint64_t gen;                             /* generation of the indexed message, 0 if unused */
+	int32_t  first;                           /* first block of the message when indexed */
+	uint16_t count;                           /* number of entries, > HTTP_HDR_IDX_MAX if not indexable */
+	uint8_t  bucket[1 << HTTP_HDR_IDX_BITS];  /* first entry of each bucket, 1-based, 0 if empty */
+	struct {
+		int32_t  pos;                     /* position of the header block */
+		uint32_t hash;                    /* hash of the header name */
+		uint8_t  next;                    /* next entry of the bucket, 1-based, 0 if none */
+	} ent[HTTP_HDR_IDX_MAX];
+};
+
+/* minimum number of blocks for a message to be indexed, 0 disables indexing */
+static unsigned int http_hdr_idx_min = 8;
+
+static THREAD_LOCAL struct http_hdr_idx http_hdr_idx[HTTP_HDR_IDX_SLOTS];
+static THREAD_LOCAL uint64_t http_hdr_idx_gen;       /* last generation used by this thread */
+static THREAD_LOCAL unsigned int http_hdr_idx_next;  /* next slot to recycle */
+
+/* Returns the case-insensitive hash of the header name <name> */
+static inline uint32_t http_hdr_idx_hash(const struct ist name)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < name.len; i++)
+		hash = (hash ^ (unsigned char)(name.ptr[i] | 0x20)) * 16777619U;
+	return hash;
+}
+
+/* Returns the header index of the HTX message <htx>, after building it if it
+ * doesn't exist yet. NULL is returned if the message is empty, too small to be
+ * worth indexing or has too many headers. The message is only modified to
+ * store the generation of its index.
+ */
+static struct http_hdr_idx *http_get_hdr_idx(struct htx *htx)
+{
+	struct http_hdr_idx *idx;
+	struct htx_blk *blk;
+	uint8_t last[1 << HTTP_HDR_IDX_BITS];
+	int i;
+
+	if (htx->hdr_gen) {
+		for (i = 0; i < HTTP_HDR_IDX_SLOTS; i++) {
+			idx = &http_hdr_idx[i];
+			if (idx->gen != htx->hdr_gen)
+				continue;
+			if (idx->first != htx->first)
+				goto build;
+			return (idx->count > HTTP_HDR_IDX_MAX) ? NULL : idx;
+		}
+	}
+
+	if (!http_hdr_idx_min || htx_is_empty(htx) || htx_nbblks(htx) < http_hdr_idx_min)
+		return NULL;
+
+	idx = &http_hdr_idx[http_hdr_idx_next++ % HTTP_HDR_IDX_SLOTS];
+	do {
+		http_hdr_idx_gen = http_hdr_idx_gen ? http_hdr_idx_gen + MAX_THREADS : tid + 1;
+	} while (!http_hdr_idx_gen);
+	idx->gen = htx->hdr_gen = http_hdr_idx_gen;
+
+  build:
+	idx->first = htx->first;
+	idx->count = 0;
+	memset(idx->bucket, 0, sizeof(idx->bucket));
+
+	for (blk = htx_get_first_blk(htx); blk; blk = htx_get_next_blk(htx, blk)) {
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t hash;
+		int b;
+
+		if (type == HTX_BLK_EOH || type == HTX_BLK_EOM)
+			break;
+		if (type != HTX_BLK_HDR)
+			continue;
+
+		if (idx->count == HTTP_HDR_IDX_MAX) {
+			idx->count++;
+			return NULL;
+		}
+
+		hash = http_hdr_idx_hash(htx_get_blk_name(htx, blk));
+		idx->ent[idx->count].pos  = htx_get_blk_pos(htx, blk);
+		idx->ent[idx->count].hash = hash;
+		idx->ent[idx->count].next = 0;
+		idx->count++;
+
+		b = hash & ((1 << HTTP_HDR_IDX_BITS) - 1);
+		if (!idx->bucket[b])
+			idx->bucket[b] = idx->count;
+		else
+			idx->ent[last[b] - 1].next = idx->count;
+		last[b] = idx->count;
+	}
+	return idx;
+}
+
+/* Returns the first header block of the HTX message <htx> named <name> whose
+ * position is <from> or above, using its index <idx>. <hash> is the hash of
+ * <name>. NULL is returned if none is found.
+ */
+static struct htx_blk *http_hdr_idx_find(const struct htx *htx, const struct http_hdr_idx *idx,
+                                         const struct ist name, uint32_t hash, int32_t from)
+{
+	struct htx_blk *blk;
+	unsigned int e;
+
+	for (e = idx->bucket[hash & ((1 << HTTP_HDR_IDX_BITS) - 1)]; e; e = idx->ent[e - 1].next) {
+		int32_t pos = idx->ent[e - 1].pos;
+
+		/* the block may have been removed since */
+		if (idx->ent[e - 1].hash != hash || pos < from || pos < htx->head || pos > htx->tail)
+			continue;
+
+		blk = htx_get_blk(htx, pos);
+		if (htx_get_blk_type(blk) == HTX_BLK_HDR && isteqi(htx_get_blk_name(htx, blk), name))
+			return blk;
+	}
+	return NULL;
+}
+
 /* Returns the next unporocessed start line in the HTX message. It returns NULL
  * if the start-line is undefined (first == -1). Otherwise, it returns the
  * pointer on the htx_sl structure.
@@ -128,9 +263,18 @@ size_t http_get_hdrs_size(struct htx *htx)
 static int __http_find_header(const struct htx *htx, const void *pattern, struct http_hdr_ctx *ctx, int flags)
 {
 	struct htx_blk *blk = ctx->blk;
+	struct http_hdr_idx *idx = NULL;
+	uint32_t hash = 0;
 	struct ist n, v;
 	enum htx_blk_type type;
 
+	if ((flags & HTTP_FIND_FL_MATCH_TYPE) == HTTP_FIND_FL_MATCH_STR && istlen(*(const struct ist *)pattern)) {
+		/* the message is only modified to store its index generation */
+		idx = http_get_hdr_idx((struct htx *)htx);
+		if (idx)
+			hash = http_hdr_idx_hash(*(const struct ist *)pattern);
+	}
+
 	if (blk) {
 		char *p;
 
@@ -158,6 +302,15 @@ static int __http_find_header(const struct htx *htx, const void *pattern, struct
 
 	for (blk = htx_get_first_blk(htx); blk; blk = htx_get_next_blk(htx, blk)) {
 	  rescan_hdr:
+		if (idx) {
+			/* jump to the next header with this name */
+			blk = http_hdr_idx_find(htx, idx, *(const struct ist *)pattern, hash,
+			                        htx_get_blk_pos(htx, blk));
+			if (!blk)
+				break;
+			goto match;
+		}
+
 		type = htx_get_blk_type(blk);
 		if (type == HTX_BLK_EOH || type == HTX_BLK_EOM)
 			break;
@@ -2156,7 +2309,26 @@ out:
 	return err_code;
 }
 
+/* config parser for global "tune.http.hdr-index" */
+static int cfg_parse_http_hdr_index(char **args, int section_type, struct proxy *curpx,
+                                    struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	http_hdr_idx_min = strtoul(args[1], &end, 10);
+	if (!*args[1] || *end) {
+		memprintf(err, "'%s' expects a positive numeric value.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 static struct cfg_kw_list cfg_kws = {ILH, {
+        { CFG_GLOBAL, "tune.http.hdr-index", cfg_parse_http_hdr_index },
         { CFG_LISTEN, "errorloc",     proxy_parse_errorloc },
         { CFG_LISTEN, "errorloc302",  proxy_parse_errorloc },
         { CFG_LISTEN, "errorloc303",  proxy_parse_errorloc },
@@ -33,6 +33,7 @@ struct htx_blk *htx_defrag(struct htx *htx, struct htx_blk *blk)
 	if (htx->head == -1)
 		return NULL;
 
+	htx_drop_hdr_index(htx);
 	blkpos = -1;
 
 	new  = 0;
@@ -82,6 +83,7 @@ static void htx_defrag_blks(struct htx *htx)
 {
 	int32_t pos, new;
 
+	htx_drop_hdr_index(htx);
 	new = 0;
 	for (pos = htx_get_head(htx); pos != -1; pos = htx_get_next(htx, pos)) {
 		struct htx_blk *posblk, *newblk;
@@ -120,6 +122,7 @@ static struct htx_blk *htx_reserve_nxblk(struct htx *htx, uint32_t blksz)
 	if (blksz > htx_free_data_space(htx))
 		return NULL; /* full */
 
+	htx_drop_hdr_index(htx);
 	if (htx->head == -1) {
 		/* Empty message */
 		htx->head = htx->tail = htx->first = 0;
@@ -745,6 +748,7 @@ struct htx_blk *htx_replace_header(struct htx *htx, struct htx_blk *blk,
 	/* Set the new block size and update HTX message */
 	blk->info = (type << 28) + (value.len << 8) + name.len;
 	htx->data += delta;
+	htx_drop_hdr_index(htx);
 
 	/* Replace in place or at a new address is the same. We replace all the
 	 * header (name+value). Only take care to defrag the message if
@@ -1044,6 +1048,7 @@ void htx_move_blk_before(struct htx *htx, struct htx_blk **blk, struct htx_blk *
 {
 	struct htx_blk *cblk, *pblk;
 
+	htx_drop_hdr_index(htx);
 	cblk = *blk;
 	for (pblk = htx_get_prev_blk(htx, cblk); pblk; pblk = htx_get_prev_blk(htx, pblk)) {
 		/* Swap .addr and .info fields */
@@ -0,0 +1,286 @@
+/*
+ * Maglev hashing load-balancing
+ *
+ * This implements the lookup table described in "Maglev: A Fast and Reliable
+ * Software Network Load Balancer" (Eisenbud et al., NSDI 2016). Each server
+ * owns a permutation of the table's entries derived from its ID, and servers
+ * take turns claiming their next preferred free entry until the table is full.
+ * A lookup is then a simple modulo, and removing or adding a server only moves
+ * the entries it loses or gains, plus a small fraction of the other ones.
+ * Weights are supported by letting servers claim entries proportionally to
+ * their weight.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/debug.h>
+#include <common/standard.h>
+
+#include <types/global.h>
+#include <types/server.h>
+
+#include <proto/backend.h>
+#include <proto/lb_chash.h>
+#include <proto/lb_maglev.h>
+#include <proto/queue.h>
+
+/* table sizes, primes roughly doubling each time */
+static const unsigned int maglev_sizes[] = {
+	1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071, 262139, 524287, 1048573
+};
+
+/* Returns the first entry of server <srv>'s permutation of a table of <size>
+ * entries, and its skip value in <skip>. Both only depend on the server's ID
+ * so that they don't change across reloads.
+ */
+static inline unsigned int maglev_srv_offset(const struct server *srv, unsigned int size, unsigned int *skip)
+{
+	*skip = full_hash(srv->puid * SRV_EWGHT_RANGE + SRV_EWGHT_RANGE - 1) % (size - 1) + 1;
+	return full_hash(srv->puid * SRV_EWGHT_RANGE) % size;
+}
+
+/* This function recomputes the lookup table of proxy <p> from the servers which
+ * will be usable. Only active servers are used if any, otherwise the backup
+ * ones. It relies on p->srv_act and p->lbprm.tot_weight so it must be called
+ * after recount_servers() and update_backend_weight(). Each server claims in
+ * turn its next preferred free entry. Weights are honored by giving each
+ * server a credit of its weight per round, an entry costing the largest
+ * weight.
+ *
+ * The lbprm's lock must be held.
+ */
+void maglev_recalc_table(struct proxy *p)
+{
+	struct lb_maglev *mg = &p->lbprm.maglev;
+	unsigned int size = mg->size;
+	unsigned int filled;
+	struct server *srv;
+	int flag, maxw, i;
+
+	if (!mg->table)
+		return;
+
+	memset(mg->table, 0, size * sizeof(*mg->table));
+
+	if (!p->lbprm.tot_weight)
+		return;
+
+	flag = p->srv_act ? 0 : SRV_F_BACKUP;
+
+	maxw = 0;
+	for (srv = p->srv, i = 0; srv && i < mg->nbsrv; srv = srv->next, i++) {
+		mg->pos[i] = maglev_srv_offset(srv, size, &mg->skip[i]);
+		mg->credit[i] = 0;
+		if ((srv->flags & SRV_F_BACKUP) == flag && srv_willbe_usable(srv) &&
+		    srv->next_eweight > maxw)
+			maxw = srv->next_eweight;
+	}
+
+	if (!maxw)
+		return;
+
+	filled = 0;
+	while (filled < size) {
+		for (srv = p->srv, i = 0; srv && i < mg->nbsrv; srv = srv->next, i++) {
+			if ((srv->flags & SRV_F_BACKUP) != flag || !srv_willbe_usable(srv))
+				continue;
+
+			mg->credit[i] += srv->next_eweight;
+			if (mg->credit[i] < maxw)
+				continue;
+			mg->credit[i] -= maxw;
+
+			/* claim the next free entry of this server's permutation */
+			while (mg->table[mg->pos[i]]) {
+				mg->pos[i] += mg->skip[i];
+				if (mg->pos[i] >= size)
+					mg->pos[i] -= size;
+			}
+			mg->table[mg->pos[i]] = srv;
+			if (++filled == size)
+				break;
+		}
+	}
+}
+
+/* Updates the table according to server <srv>'s new state or weight. The
+ * whole table is recomputed, which remains cheap given that it is only done
+ * on state changes.
+ *
+ * The server's lock must be held. The lbprm's lock will be used.
+ */
+static void maglev_update_server(struct server *srv)
+{
+	struct proxy *p = srv->proxy;
+
+	if (!srv_lb_status_changed(srv))
+		return;
+
+	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+	recount_servers(p);
+	update_backend_weight(p);
+	maglev_recalc_table(p);
+	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	srv_lb_commit_status(srv);
+}
+
+/* This function is responsible for allocating the lookup table of proxy <p>
+ * and the per-server build state. The table has at least
+ * MAGLEV_ENTRIES_PER_SRV entries per server so that the weights are respected
+ * with a good precision. It also sets p->lbprm.wdiv to the eweight to uweight
+ * ratio. It should be called only once per proxy, at config time. Returns 0 on
+ * success or -1 on allocation failure.
+ */
+int maglev_init_server_table(struct proxy *p)
+{
+	struct lb_maglev *mg = &p->lbprm.maglev;
+	struct server *srv;
+	int i;
+
+	p->lbprm.set_server_status_up   = maglev_update_server;
+	p->lbprm.set_server_status_down = maglev_update_server;
+	p->lbprm.update_server_eweight  = maglev_update_server;
+	p->lbprm.server_take_conn = NULL;
+	p->lbprm.server_drop_conn = NULL;
+
+	p->lbprm.wdiv = BE_WEIGHT_SCALE;
+	mg->nbsrv = 0;
+	for (srv = p->srv; srv; srv = srv->next) {
+		srv->next_eweight = (srv->uweight * p->lbprm.wdiv + p->lbprm.wmult - 1) / p->lbprm.wmult;
+		srv_lb_commit_status(srv);
+		mg->nbsrv++;
+	}
+
+	for (i = 0; i < (int)(sizeof(maglev_sizes) / sizeof(maglev_sizes[0])) - 1; i++)
+		if (maglev_sizes[i] >= (unsigned int)mg->nbsrv * MAGLEV_ENTRIES_PER_SRV)
+			break;
+	mg->size = maglev_sizes[i];
+	mg->rr_idx = 0;
+
+	mg->table  = calloc(mg->size, sizeof(*mg->table));
+	mg->pos    = calloc(mg->nbsrv + 1, sizeof(*mg->pos));
+	mg->skip   = calloc(mg->nbsrv + 1, sizeof(*mg->skip));
+	mg->credit = calloc(mg->nbsrv + 1, sizeof(*mg->credit));
+	if (!mg->table || !mg->pos || !mg->skip || !mg->credit) {
+		maglev_deinit_server_table(p);
+		return -1;
+	}
+
+	recount_servers(p);
+	update_backend_weight(p);
+	maglev_recalc_table(p);
+	return 0;
+}
+
+/* Releases the lookup table of proxy <p> and its build state */
+void maglev_deinit_server_table(struct proxy *p)
+{
+	struct lb_maglev *mg = &p->lbprm.maglev;
+
+	free(mg->table);
+	free(mg->pos);
+	free(mg->skip);
+	free(mg->credit);
+	mg->table = NULL;
+	mg->pos = NULL;
+	mg->skip = NULL;
+	mg->credit = NULL;
+}
+
+/* Returns the server designated by <hash> in the lookup table of proxy <p>, or
+ * NULL if no server is usable. When the first backup server is used, it is
+ * always returned. If the server is <avoid> or if it is not eligible with
+ * regards to the hash-balance-factor, the next entries are tried.
+ *
+ * The lbprm's lock will be used.
+ */
+struct server *maglev_get_server_hash(struct proxy *p, unsigned int hash, const struct server *avoid)
+{
+	struct lb_maglev *mg = &p->lbprm.maglev;
+	struct server *srv;
+	unsigned int idx, loop;
+
+	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+
+	if (!p->srv_act && p->lbprm.fbck) {
+		srv = p->lbprm.fbck;
+		goto out;
+	}
+
+	if (!p->lbprm.tot_weight || !mg->table) {
+		srv = NULL;
+		goto out;
+	}
+
+	idx = hash % mg->size;
+	srv = mg->table[idx];
+
+	for (loop = 1; loop < mg->size && srv &&
+	     (srv == avoid || (p->lbprm.hash_balance_factor && !chash_server_is_eligible(srv))); loop++) {
+		if (++idx == mg->size)
+			idx = 0;
+		srv = mg->table[idx];
+	}
+
+ out:
+	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	return srv;
+}
+
+/* Returns the next server from the lookup table of proxy <p> in round robin
+ * order, which respects the weights. This is used when the hashing criterion
+ * is not found. Saturated servers and <srvtoavoid> are skipped if possible.
+ * Returns NULL if no server is usable.
+ *
+ * The lbprm's lock will be used.
+ */
+struct server *maglev_get_next_server(struct proxy *p, struct server *srvtoavoid)
+{
+	struct lb_maglev *mg = &p->lbprm.maglev;
+	struct server *srv, *avoided;
+	unsigned int idx, loop;
+
+	avoided = NULL;
+	HA_SPIN_LOCK(LBPRM_LOCK, &p->lbprm.lock);
+
+	if (!p->srv_act && p->lbprm.fbck) {
+		avoided = p->lbprm.fbck;
+		goto out;
+	}
+
+	if (!p->lbprm.tot_weight || !mg->table)
+		goto out;
+
+	idx = mg->rr_idx;
+	for (loop = 0; loop < mg->size; loop++) {
+		srv = mg->table[idx];
+		if (++idx >= mg->size)
+			idx = 0;
+
+		if (!srv || (srv->maxconn && (srv->nbpend || srv->served >= srv_dynamic_maxconn(srv))))
+			continue;
+
+		/* remember that it was selected yet avoided */
+		avoided = srv;
+		if (srv != srvtoavoid)
+			break;
+	}
+	mg->rr_idx = idx;
+
+ out:
+	HA_SPIN_UNLOCK(LBPRM_LOCK, &p->lbprm.lock);
+	return avoided;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -10,6 +10,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdarg.h>
@@ -24,6 +25,7 @@
 #include <sys/time.h>
 #include <sys/uio.h>
 
+#include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/compat.h>
 #include <common/initcall.h>
@@ -46,6 +48,7 @@
 #include <proto/ssl_sock.h>
 #include <proto/stream.h>
 #include <proto/stream_interface.h>
+#include <proto/task.h>
 
 struct log_fmt {
 	char *name;
@@ -237,6 +240,41 @@ char default_rfc5424_sd_log_format[] = "- ";
 /* total number of dropped logs */
 unsigned int dropped_logs = 0;
 
+/* Log messages sent to syslog servers or file descriptors may be queued per
+ * thread and sent together, up to <log_batch_size> at once and after no more
+ * than <log_batch_delay> milliseconds. There is one batch per socket (inet and
+ * unix) and one for the file descriptors.
+ */
+#ifndef HA_HAVE_SENDMMSG
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+#endif
+
+enum {
+	LOG_BATCH_INET = 0,
+	LOG_BATCH_UNIX,
+	LOG_BATCH_FD,
+	LOG_BATCHES
+};
+
+struct log_batch {
+	char *area;            /* the messages, one after the other */
+	size_t size;           /* size of <area> */
+	size_t data;           /* bytes used in <area> */
+	int count;             /* number of messages */
+	int fd;                /* socket or file descriptor they are sent to */
+	struct iovec *iov;     /* location of each message in <area> */
+	struct mmsghdr *msg;   /* headers of each message for the sockets */
+	int *logger;           /* logger number of each message, for errors */
+};
+
+static int log_batch_size = 0; /* 0 or 1 = disabled */
+static int log_batch_delay = 10;
+static THREAD_LOCAL struct log_batch log_batch[LOG_BATCHES];
+static THREAD_LOCAL struct task *log_batch_task = NULL;
+
 /* This is a global syslog header, common to all outgoing messages in
  * RFC3164 format. It begins with time-based part and is updated by
  * update_log_hdr().
@@ -472,6 +510,7 @@ int add_to_logformat_list(char *start, char *end, int type, struct list *list_fo
 		strncpy(str, start, end - start);
 		str[end - start] = '\0';
 		node->arg = str;
+		node->arg_len = end - start;
 		node->type = LOG_FMT_TEXT; // type string
 		LIST_ADDQ(list_format, &node->list);
 	} else if (type == LF_SEPARATOR) {
@@ -561,6 +600,18 @@ int add_sample_to_logformat_list(char *text, char *arg, int arg_len, struct prox
 	return 0;
 }
 
+/* Installs literal run <lit> of <lit_len> chars ending with last_isspace
+ * <space> into its first node <head>. The node's own text, if any, is at the
+ * beginning of the run.
+ */
+static void lf_close_run(struct logformat_node *head, char *lit, int lit_len, int space)
+{
+	free(head->arg);
+	head->arg = lit;
+	head->lit_len = lit_len;
+	head->lit_space = space;
+}
+
 /*
  * Parse the log_format string and fill a linked list.
  * Variable name are preceded by % and composed by characters [a-zA-Z0-9]* : %varname
@@ -735,12 +786,111 @@ int parse_logformat_string(const char *fmt, struct proxy *curproxy, struct list
 	}
 	free(backfmt);
 
-	return 1;
+	return compile_logformat_list(list_format, err);
  fail:
 	free(backfmt);
 	return 0;
 }
 
+/*
+ * Prepares the complete list <list_format> so that sess_build_logline() does
+ * as little work as possible. A separator only emits a space when the previous
+ * node did not emit one, which is known here for all nodes but the captured
+ * header lists. Separators which are known to emit nothing are skipped, the
+ * other known ones are turned to a space. Consecutive texts and spaces are
+ * then merged into a single literal run of <lit_len> chars stored in the <arg>
+ * of the run's first node, and copied at once. The nodes to emit are chained
+ * via their <next> pointer, the first node of the list always being part of
+ * the chain. The list itself is left intact since its users may inspect it,
+ * and the function may be called again after a node was appended.
+ *
+ * The function returns 1 in success case, otherwise, it returns 0 and err is
+ * filled.
+ */
+int compile_logformat_list(struct list *list_format, char **err)
+{
+	struct logformat_node *node, *prev = NULL, *head = NULL;
+	char *lit = NULL;
+	int lit_len = 0;
+	int space = 1; /* last_isspace before the node, -1 if unknown */
+	int new_space;
+
+	list_for_each_entry(node, list_format, list) {
+		const char *txt = NULL;
+		int len = 0;
+
+		node->next = NULL;
+		node->lit_len = 0;
+
+		switch (node->type) {
+		case LOG_FMT_TEXT:
+			/* an empty text ends the line, it is left to the emitter */
+			txt = node->arg;
+			len = node->arg_len;
+			new_space = 0;
+			break;
+		case LOG_FMT_SEPARATOR:
+			if (space == 1 && prev)
+				continue;
+			if (space == 0) {
+				txt = " ";
+				len = 1;
+			}
+			new_space = 1;
+			break;
+		case LOG_FMT_HDRREQUEST:
+		case LOG_FMT_HDRREQUESTLIST:
+		case LOG_FMT_HDRRESPONS:
+		case LOG_FMT_HDRRESPONSLIST:
+			/* nothing is emitted when there is no capture */
+			new_space = (space == 0) ? 0 : -1;
+			break;
+		default:
+			new_space = 0;
+		}
+
+		if (!len) {
+			/* not a literal, this ends the current run */
+			if (head)
+				lf_close_run(head, lit, lit_len, space);
+			head = NULL;
+		}
+		else if (head) {
+			/* extend the current run */
+			lit = my_realloc2(lit, lit_len + len + 1);
+			if (!lit)
+				goto oom;
+			head->lit_tail = lit_len;
+			memcpy(lit + lit_len, txt, len);
+			lit_len += len;
+			lit[lit_len] = 0;
+			space = new_space;
+			continue;
+		}
+		else {
+			/* start a new run */
+			lit = my_strndup(txt, len);
+			if (!lit)
+				goto oom;
+			lit_len = len;
+			head = node;
+			head->lit_tail = 0;
+		}
+
+		if (prev)
+			prev->next = node;
+		prev = node;
+		space = new_space;
+	}
+
+	if (head)
+		lf_close_run(head, lit, lit_len, space);
+	return 1;
+ oom:
+	memprintf(err, "out of memory error");
+	return 0;
+}
+
 /*
  * Parse the first range of indexes from a string made of a list of comma separated
  * ranges of indexes. Note that an index may be considered as a particular range
@@ -1345,7 +1495,9 @@ char *lf_text_len(char *dst, const char *src, size_t len, size_t size, const str
 			len = ret - dst;
 		}
 		else {
-			len = strlcpy2(dst, src, len);
+			/* same as strlcpy2() but faster on long strings */
+			len = strnlen(src, len - 1);
+			memcpy(dst, src, len);
 		}
 
 		size -= len;
@@ -1372,6 +1524,35 @@ static inline char *lf_text(char *dst, const char *src, size_t size, const struc
 	return lf_text_len(dst, src, size, size, node);
 }
 
+/* Writes IPv4 address <addr> in dotted-quad notation to <dst> which must have
+ * room for 16 chars. This is the same as inet_ntop() but without the printf()
+ * overhead. Returns a pointer to the trailing zero.
+ */
+static char *lf_ipv4_str(char *dst, const struct in_addr *addr)
+{
+	const unsigned char *a = (const unsigned char *)&addr->s_addr;
+	unsigned int b;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		b = a[i];
+		if (b >= 100) {
+			*dst++ = '0' + b / 100;
+			b %= 100;
+			*dst++ = '0' + b / 10;
+			b %= 10;
+		}
+		else if (b >= 10) {
+			*dst++ = '0' + b / 10;
+			b %= 10;
+		}
+		*dst++ = '0' + b;
+		*dst++ = '.';
+	}
+	*--dst = '\0';
+	return dst;
+}
+
 /*
  * Write a IP address to the log string
  * +X option write in hexadecimal notation, most significant byte on the left
@@ -1402,7 +1583,10 @@ char *lf_ip(char *dst, const struct sockaddr *sockaddr, size_t size, const struc
 			return NULL;
 		ret += iret;
 	} else {
-		addr_to_str((struct sockaddr_storage *)sockaddr, pn, sizeof(pn));
+		if (sockaddr->sa_family == AF_INET)
+			lf_ipv4_str(pn, &((struct sockaddr_in *)sockaddr)->sin_addr);
+		else
+			addr_to_str((struct sockaddr_storage *)sockaddr, pn, sizeof(pn));
 		ret = lf_text(dst, pn, size, node);
 		if (ret == NULL)
 			return NULL;
@@ -1538,6 +1722,133 @@ void send_log(struct proxy *p, int level, const char *format, ...)
 		   logline, data_len, default_rfc5424_sd_log_format, 2);
 }
 
+/* Sends all the messages queued in batch <b> at once, using a single
+ * sendmmsg() for the sockets, or a single writev() for the file descriptors.
+ * Messages which cannot be sent are accounted as dropped, and the batch is
+ * empty on return.
+ */
+static void log_batch_flush(struct log_batch *b)
+{
+	static char once;
+	int done = 0;
+	int ret;
+
+	if (b == &log_batch[LOG_BATCH_FD]) {
+		struct ist msg = ist2(b->area, b->data);
+
+		ret = fd_write_frag_line(b->fd, ~0, NULL, 0, &msg, 1, 0);
+		if (ret > 0) {
+			/* lines which were started are not lost */
+			while (done < b->count && (char *)b->iov[done].iov_base < b->area + ret)
+				done++;
+		}
+		else if (errno != EAGAIN)
+			done = b->count;
+		if (done < b->count)
+			_HA_ATOMIC_ADD(&dropped_logs, b->count - done);
+		if (ret <= 0 && errno != EAGAIN && !once) {
+			once = 1; /* note: no need for atomic ops here */
+			ha_alert("writev() failed in logger #%d: %s (errno=%d)\n",
+			         b->logger[0], strerror(errno), errno);
+		}
+		goto end;
+	}
+
+	while (done < b->count) {
+#ifdef HA_HAVE_SENDMMSG
+		ret = sendmmsg(b->fd, b->msg + done, b->count - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+		ret = sendmsg(b->fd, &b->msg[done].msg_hdr, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 ? -1 : 1;
+#endif
+		if (ret > 0) {
+			done += ret;
+			continue;
+		}
+
+		/* the first remaining message failed, skip it, the next ones
+		 * may be sent to another address.
+		 */
+		if (errno == EAGAIN)
+			_HA_ATOMIC_ADD(&dropped_logs, 1);
+		else if (!once) {
+			once = 1; /* note: no need for atomic ops here */
+			ha_alert("sendmmsg() failed in logger #%d: %s (errno=%d)\n",
+			         b->logger[done], strerror(errno), errno);
+		}
+		done++;
+	}
+ end:
+	b->data = 0;
+	b->count = 0;
+}
+
+/* Queues message <msg> made of <nmsg> parts for logger #<nblogger> <logsrv>,
+ * sent to socket or file descriptor <fd>, into the current thread's batch.
+ * The batch is sent once full, or when the batch task expires.
+ */
+static void log_batch_add(struct logsrv *logsrv, int nblogger, int fd, const struct ist *msg, int nmsg)
+{
+	struct log_batch *b;
+	size_t len = 0;
+	char *p;
+	int i;
+
+	if (logsrv->type == LOG_TARGET_FD)
+		b = &log_batch[LOG_BATCH_FD];
+	else if (logsrv->addr.ss_family == AF_UNIX)
+		b = &log_batch[LOG_BATCH_UNIX];
+	else
+		b = &log_batch[LOG_BATCH_INET];
+
+	for (i = 0; i < nmsg; i++)
+		len += msg[i].len;
+
+	if (b->count && (b->fd != fd || b->data + len > b->size))
+		log_batch_flush(b);
+
+	p = b->area + b->data;
+	for (i = 0; i < nmsg; i++) {
+		if (msg[i].len)
+			memcpy(p, msg[i].ptr, msg[i].len);
+		p += msg[i].len;
+	}
+
+	b->iov[b->count].iov_base = b->area + b->data;
+	b->iov[b->count].iov_len  = len;
+	if (b != &log_batch[LOG_BATCH_FD]) {
+		struct msghdr *hdr = &b->msg[b->count].msg_hdr;
+
+		hdr->msg_name = (struct sockaddr *)&logsrv->addr;
+		hdr->msg_namelen = get_addr_len(&logsrv->addr);
+		hdr->msg_iov = &b->iov[b->count];
+		hdr->msg_iovlen = 1;
+	}
+	b->logger[b->count] = nblogger;
+	b->fd = fd;
+	b->data += len;
+	b->count++;
+
+	if (b->count >= log_batch_size)
+		log_batch_flush(b);
+	else if (!tick_isset(log_batch_task->expire)) {
+		log_batch_task->expire = tick_add(now_ms, log_batch_delay);
+		task_queue(log_batch_task);
+	}
+}
+
+/* Sends the current thread's pending log messages */
+static struct task *log_batch_expire(struct task *t, void *context, unsigned short state)
+{
+	int i;
+
+	for (i = 0; i < LOG_BATCHES; i++) {
+		if (log_batch[i].count)
+			log_batch_flush(&log_batch[i]);
+	}
+	t->expire = TICK_ETERNITY;
+	return t;
+}
+
 /*
  * This function sends a syslog message to <logsrv>.
  * <pid_str> is the string to be used for the PID of the caller, <pid_size> is length.
@@ -1734,6 +2045,21 @@ static inline void __do_send_log(struct logsrv *logsrv, int nblogger, char *pid_
 
 	max = MIN(size, maxlen - sd_max - 1);
 send:
+	if (log_batch_task && logsrv->type != LOG_TARGET_BUFFER) {
+		struct ist msg[8];
+
+		msg[0] = ist2(hdr_ptr, hdr_max);
+		msg[1] = ist2(tag_str, tag_max);
+		msg[2] = ist2(pid_sep1, pid_sep1_max);
+		msg[3] = ist2(pid_str, pid_max);
+		msg[4] = ist2(pid_sep2, pid_sep2_max);
+		msg[5] = ist2(sd, sd_max);
+		msg[6] = ist2(dataptr, max);
+		msg[7] = ist2("\n", 1);
+		log_batch_add(logsrv, nblogger, *plogfd, msg, 8);
+		return;
+	}
+
 	if (logsrv->addr.ss_family == AF_UNSPEC) {
 		/* the target is a file descriptor or a ring buffer */
 		struct ist msg[7];
@@ -1799,14 +2125,27 @@ send:
  * The arguments <sd> and <sd_size> are used for the structured-data part
  * in RFC5424 formatted syslog messages.
  */
+/* Returns a chunk holding the current process' PID as a string */
+static struct buffer *log_pid_chunk()
+{
+	static THREAD_LOCAL int curr_pid;
+	static THREAD_LOCAL char pidstr[100];
+	static THREAD_LOCAL struct buffer pid;
+
+	if (unlikely(curr_pid != getpid())) {
+		curr_pid = getpid();
+		ltoa_o(curr_pid, pidstr, sizeof(pidstr));
+		chunk_initstr(&pid, pidstr);
+	}
+	return &pid;
+}
+
 void __send_log(struct list *logsrvs, struct buffer *tag, int level,
 		char *message, size_t size, char *sd, size_t sd_size)
 {
 	struct logsrv *logsrv;
+	struct buffer *pid;
 	int nblogger;
-	static THREAD_LOCAL int curr_pid;
-	static THREAD_LOCAL char pidstr[100];
-	static THREAD_LOCAL struct buffer pid;
 
 	if (logsrvs == NULL) {
 		if (!LIST_ISEMPTY(&global.logsrvs)) {
@@ -1819,11 +2158,7 @@ void __send_log(struct list *logsrvs, struct buffer *tag, int level,
 	if (!logsrvs || LIST_ISEMPTY(logsrvs))
 		return;
 
-	if (unlikely(curr_pid != getpid())) {
-		curr_pid = getpid();
-		ltoa_o(curr_pid, pidstr, sizeof(pidstr));
-		chunk_initstr(&pid, pidstr);
-	}
+	pid = log_pid_chunk();
 
 	/* Send log messages to syslog server. */
 	nblogger = 0;
@@ -1852,7 +2187,7 @@ void __send_log(struct list *logsrvs, struct buffer *tag, int level,
 			HA_SPIN_UNLOCK(LOGSRV_LOCK, &logsrv->lock);
 		}
 		if (in_range)
-			__do_send_log(logsrv, ++nblogger, pid.area, pid.data, level,
+			__do_send_log(logsrv, ++nblogger, pid->area, pid->data, level,
 			              message, size, sd, sd_size, tag->area, tag->data);
 	}
 }
@@ -1979,6 +2314,25 @@ void deinit_log_buffers()
 	logline_rfc5424   = NULL;
 }
 
+/* Fills <tm> with the local date (or the GMT one if <gmt> is set) for <sec>.
+ * The last date of each kind is kept per thread since consecutive log lines
+ * are very likely to be emitted within the same second.
+ */
+static inline void lf_get_tm(time_t sec, struct tm *tm, int gmt)
+{
+	static THREAD_LOCAL time_t tm_date[2] = { -1, -1 };
+	static THREAD_LOCAL struct tm tm_cache[2];
+
+	if (unlikely(tm_date[gmt] != sec)) {
+		if (gmt)
+			get_gmtime(sec, &tm_cache[gmt]);
+		else
+			get_localtime(sec, &tm_cache[gmt]);
+		tm_date[gmt] = sec;
+	}
+	*tm = tm_cache[gmt];
+}
+
 /* Builds a log line in <dst> based on <list_format>, and stops before reaching
  * <maxsize> characters. Returns the size of the output string in characters,
  * not counting the trailing zero which is always added if the resulting size
@@ -2062,12 +2416,30 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 	if (LIST_ISEMPTY(list_format))
 		return 0;
 
-	list_for_each_entry(tmp, list_format, list) {
+	/* only follow the nodes chained by compile_logformat_list() */
+	for (tmp = LIST_NEXT(list_format, struct logformat_node *, list); tmp; tmp = tmp->next) {
 		struct connection *conn;
 		const char *src = NULL;
 		struct sample *key;
 		const struct buffer empty = { };
 
+		if (tmp->lit_len) {
+			/* literal run: texts and known spaces. A truncated run
+			 * only goes on with the next node if its last part was
+			 * started, just like when emitting the parts one at a
+			 * time.
+			 */
+			iret = MIN(tmp->lit_len, dst + maxsize - 1 - tmplog);
+			if (iret <= 0)
+				goto out;
+			memcpy(tmplog, tmp->arg, iret);
+			tmplog += iret;
+			if (iret < tmp->lit_len && iret <= tmp->lit_tail)
+				goto out;
+			last_isspace = tmp->lit_space;
+			continue;
+		}
+
 		switch (tmp->type) {
 			case LOG_FMT_SEPARATOR:
 				if (!last_isspace) {
@@ -2217,7 +2589,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 				break;
 
 			case LOG_FMT_DATE: // %t = accept date
-				get_localtime(logs->accept_date.tv_sec, &tm);
+				lf_get_tm(logs->accept_date.tv_sec, &tm, 0);
 				ret = date2str_log(tmplog, &tm, &logs->accept_date, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2228,7 +2600,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 			case LOG_FMT_tr: // %tr = start of request date
 				/* Note that the timers are valid if we get here */
 				tv_ms_add(&tv, &logs->accept_date, logs->t_idle >= 0 ? logs->t_idle + logs->t_handshake : 0);
-				get_localtime(tv.tv_sec, &tm);
+				lf_get_tm(tv.tv_sec, &tm, 0);
 				ret = date2str_log(tmplog, &tm, &tv, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2237,7 +2609,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 				break;
 
 			case LOG_FMT_DATEGMT: // %T = accept date, GMT
-				get_gmtime(logs->accept_date.tv_sec, &tm);
+				lf_get_tm(logs->accept_date.tv_sec, &tm, 1);
 				ret = gmt2str_log(tmplog, &tm, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2247,7 +2619,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_trg: // %trg = start of request date, GMT
 				tv_ms_add(&tv, &logs->accept_date, logs->t_idle >= 0 ? logs->t_idle + logs->t_handshake : 0);
-				get_gmtime(tv.tv_sec, &tm);
+				lf_get_tm(tv.tv_sec, &tm, 1);
 				ret = gmt2str_log(tmplog, &tm, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2256,7 +2628,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 				break;
 
 			case LOG_FMT_DATELOCAL: // %Tl = accept date, local
-				get_localtime(logs->accept_date.tv_sec, &tm);
+				lf_get_tm(logs->accept_date.tv_sec, &tm, 0);
 				ret = localdate2str_log(tmplog, logs->accept_date.tv_sec, &tm, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2266,7 +2638,7 @@ int sess_build_logline(struct session *sess, struct stream *s, char *dst, size_t
 
 			case LOG_FMT_trl: // %trl = start of request date, local
 				tv_ms_add(&tv, &logs->accept_date, logs->t_idle >= 0 ? logs->t_idle + logs->t_handshake : 0);
-				get_localtime(tv.tv_sec, &tm);
+				lf_get_tm(tv.tv_sec, &tm, 0);
 				ret = localdate2str_log(tmplog, tv.tv_sec, &tm, dst + maxsize - tmplog);
 				if (ret == NULL)
 					goto out;
@@ -2991,6 +3363,266 @@ out:
 
 }
 
+/* writes the 16-bit little endian value <v> at <p> and returns the next byte */
+static inline char *binlog_put16(char *p, unsigned int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+/* writes the 32-bit little endian value <v> at <p> and returns the next byte */
+static inline char *binlog_put32(char *p, unsigned int v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	return p + 4;
+}
+
+/* writes timer <v> at <p> as a varint of v+1 so that -1 (unset) is zero */
+static inline void binlog_put_timer(char **p, char *end, int v)
+{
+	encode_varint(v >= -1 ? v + 1 : 0, p, end);
+}
+
+/* Frames body <body> of <len> bytes followed by <extra> of <extra_len> bytes
+ * into a record of type <type> at <dst>, and terminates it with a zero which
+ * is not counted, just like for the text log lines. <dst> must have room for
+ * the whole record and the zero. Returns the length of the record.
+ */
+static int binlog_frame(char *dst, char type, const char *body, size_t len,
+                        const char *extra, size_t extra_len)
+{
+	char *p = dst;
+
+	*p++ = BINLOG_MAGIC;
+	*p++ = type;
+	encode_varint(len + extra_len, &p, p + 10);
+	memcpy(p, body, len);
+	p += len;
+	memcpy(p, extra, extra_len);
+	p += extra_len;
+	*p++ = BINLOG_TRAILER;
+	*p = 0;
+	return p - dst;
+}
+
+/* Sends a name record for proxy <px> or for server <srv> of proxy <px> if
+ * <srv> is not NULL to all the loggers of frontend <fe>. Contrary to access
+ * records, name records are neither sampled nor filtered by level, so that
+ * each logger knows all the names referenced by the records it receives.
+ */
+static void binlog_send_name(struct proxy *fe, struct proxy *px, struct server *srv)
+{
+	const char *name = srv ? srv->id : px->id;
+	struct buffer *tag = fe->log_tag.area ? &fe->log_tag : &global.log_tag;
+	struct buffer *pid = log_pid_chunk();
+	struct logsrv *logsrv;
+	struct buffer *buf;
+	char body[9];
+	int len, nblogger = 0;
+
+	body[0] = srv ? BINLOG_N_SERVER : BINLOG_N_PROXY;
+	binlog_put32(body + 1, px->uuid);
+	binlog_put32(body + 5, srv ? srv->puid : 0);
+
+	buf = get_trash_chunk();
+	len = MIN(strlen(name), b_size(buf) - sizeof(body) - 16);
+	len = binlog_frame(buf->area, BINLOG_T_NAME, body, sizeof(body), name, len);
+
+	list_for_each_entry(logsrv, &fe->logsrvs, list)
+		__do_send_log(logsrv, ++nblogger, pid->area, pid->data, logsrv->level,
+		              buf->area, len + 1, NULL, 0, tag->area, tag->data);
+}
+
+/* Sends the names of frontend <fe> and of all backends and their servers to
+ * the loggers of <fe> if they were not sent by this frontend during the last
+ * BINLOG_NAMES_PERIOD seconds. This is called before each access record of
+ * <fe> so that the names always precede the records referencing them. All
+ * backends are announced because the frontend may switch to any of them.
+ */
+static void binlog_send_names(struct proxy *fe)
+{
+	unsigned int prev = fe->binlog_date;
+	struct proxy *px;
+	struct server *srv;
+
+	if (prev && (unsigned int)date.tv_sec - prev < BINLOG_NAMES_PERIOD)
+		return;
+
+	if (!HA_ATOMIC_CAS(&fe->binlog_date, &prev, (unsigned int)date.tv_sec))
+		return;
+
+	if (!(fe->cap & PR_CAP_BE))
+		binlog_send_name(fe, fe, NULL);
+
+	for (px = proxies_list; px; px = px->next) {
+		if (!(px->cap & PR_CAP_BE) || px->state == PR_STSTOPPED)
+			continue;
+		binlog_send_name(fe, px, NULL);
+		for (srv = px->srv; srv; srv = srv->next)
+			binlog_send_name(fe, px, srv);
+	}
+}
+
+/* Returns the largest record which may be sent to all loggers of <fe> */
+static inline size_t binlog_maxlen(struct proxy *fe)
+{
+	struct logsrv *logsrv;
+	size_t maxlen = global.max_syslog_len;
+
+	list_for_each_entry(logsrv, &fe->logsrvs, list)
+		maxlen = MIN(maxlen, logsrv->maxlen);
+	return maxlen;
+}
+
+/* Builds the binary access record of stream <s>, or of session <sess> alone
+ * if <s> is NULL, into <dst> which has room for <maxsize> bytes. The request
+ * line is truncated if needed. The record is followed by a zero which is not
+ * counted, just like for the text log lines. Returns the record's length, or
+ * 0 if it cannot fit. The layout is documented with "option binlog".
+ */
+int sess_build_binlog(struct session *sess, struct stream *s, char *dst, size_t maxsize)
+{
+	struct proxy *fe = sess->fe;
+	struct proxy *be;
+	struct http_txn *txn;
+	const struct strm_logs *logs;
+	struct strm_logs tmp_strm_log;
+	struct connection *conn;
+	struct server *srv = NULL;
+	const char *applet = NULL;
+	const char *uri = NULL;
+	unsigned int s_flags;
+	char body[256], *p, *end;
+	size_t len, uri_len = 0;
+	int t_request, retries;
+
+	if (likely(s)) {
+		be = s->be;
+		txn = s->txn;
+		s_flags = s->flags;
+		logs = &s->logs;
+		retries = (s->si[1].conn_retries > 0) ?
+			(be->conn_retries - s->si[1].conn_retries) : be->conn_retries;
+		srv = objt_server(s->target);
+		if (objt_applet(s->target))
+			applet = __objt_applet(s->target)->name;
+	} else {
+		/* same as sess_build_logline() */
+		be = fe;
+		txn = NULL;
+		s_flags = SF_ERR_PRXCOND | SF_FINST_R;
+		retries = be->conn_retries;
+		_HA_ATOMIC_ADD(&global.req_count, 1);
+
+		tmp_strm_log.accept_date = sess->accept_date;
+		tmp_strm_log.tv_accept = sess->tv_accept;
+		tmp_strm_log.t_handshake = sess->t_handshake;
+		tmp_strm_log.t_idle = tv_ms_elapsed(&sess->tv_accept, &now) - sess->t_handshake;
+		tv_zero(&tmp_strm_log.tv_request);
+		tmp_strm_log.t_queue = -1;
+		tmp_strm_log.t_connect = -1;
+		tmp_strm_log.t_data = -1;
+		tmp_strm_log.t_close = tv_ms_elapsed(&sess->tv_accept, &now);
+		tmp_strm_log.bytes_in = 0;
+		tmp_strm_log.bytes_out = 0;
+		tmp_strm_log.prx_queue_pos = 0;
+		tmp_strm_log.srv_queue_pos = 0;
+		logs = &tmp_strm_log;
+	}
+
+	t_request = -1;
+	if (tv_isge(&logs->tv_request, &logs->tv_accept))
+		t_request = tv_ms_elapsed(&logs->tv_accept, &logs->tv_request);
+
+	/* fixed-size part */
+	p = body;
+	*p = 0;
+	if (fe->mode == PR_MODE_HTTP)
+		*p |= BINLOG_F_HTTP;
+	if (s_flags & SF_REDISP)
+		*p |= BINLOG_F_REDISP;
+	if (!(fe->to_log & LW_BYTES))
+		*p |= BINLOG_F_ASAP;
+	if (applet)
+		*p |= BINLOG_F_APPLET;
+
+	conn = objt_conn(sess->origin);
+	if (conn && conn_get_src(conn)) {
+		if (conn->src->ss_family == AF_INET)
+			*p |= BINLOG_F_IPV4;
+		else if (conn->src->ss_family == AF_INET6)
+			*p |= BINLOG_F_IPV6;
+	}
+	p++;
+
+	p = binlog_put32(p, logs->accept_date.tv_sec);
+	p = binlog_put16(p, logs->accept_date.tv_usec / 1000);
+	p = binlog_put32(p, fe->uuid);
+	p = binlog_put32(p, be->uuid);
+	p = binlog_put32(p, srv ? srv->puid : 0);
+	p = binlog_put16(p, txn ? txn->status : 0);
+	*p++ = sess_term_cond[(s_flags & SF_ERR_MASK) >> SF_ERR_SHIFT];
+	*p++ = sess_fin_state[(s_flags & SF_FINST_MASK) >> SF_FINST_SHIFT];
+	*p++ = (txn && (be->ck_opts & PR_CK_ANY)) ? sess_cookie[(txn->flags & TX_CK_MASK) >> TX_CK_SHIFT] : '-';
+	*p++ = (txn && (be->ck_opts & PR_CK_ANY)) ? sess_set_cookie[(txn->flags & TX_SCK_MASK) >> TX_SCK_SHIFT] : '-';
+
+	/* optional parts */
+	if (*body & BINLOG_F_IPV4) {
+		memcpy(p, &((struct sockaddr_in *)conn->src)->sin_addr, 4);
+		p = binlog_put16(p + 4, ntohs(((struct sockaddr_in *)conn->src)->sin_port));
+	}
+	else if (*body & BINLOG_F_IPV6) {
+		memcpy(p, &((struct sockaddr_in6 *)conn->src)->sin6_addr, 16);
+		p = binlog_put16(p + 16, ntohs(((struct sockaddr_in6 *)conn->src)->sin6_port));
+	}
+
+	end = body + sizeof(body);
+	if (applet) {
+		len = MIN(strlen(applet), 64);
+		encode_varint(len, &p, end);
+		memcpy(p, applet, len);
+		p += len;
+	}
+
+	/* timers, sizes and counters, as varints */
+	binlog_put_timer(&p, end, logs->t_handshake);
+	binlog_put_timer(&p, end, logs->t_idle);
+	binlog_put_timer(&p, end, (t_request >= 0) ? t_request - logs->t_idle - logs->t_handshake : -1);
+	binlog_put_timer(&p, end, (logs->t_queue >= 0) ? logs->t_queue - t_request : -1);
+	binlog_put_timer(&p, end, (logs->t_connect >= 0) ? logs->t_connect - logs->t_queue : -1);
+	binlog_put_timer(&p, end, (logs->t_data >= 0) ? logs->t_data - logs->t_connect : -1);
+	binlog_put_timer(&p, end, logs->t_close - (logs->t_idle >= 0 ? logs->t_idle + logs->t_handshake : 0));
+	encode_varint(logs->bytes_out, &p, end);
+	encode_varint(logs->bytes_in, &p, end);
+	encode_varint(actconn, &p, end);
+	encode_varint(fe->feconn, &p, end);
+	encode_varint(be->beconn, &p, end);
+	encode_varint(srv ? srv->cur_sess : 0, &p, end);
+	encode_varint(retries, &p, end);
+	encode_varint(logs->srv_queue_pos, &p, end);
+	encode_varint(logs->prx_queue_pos, &p, end);
+
+	/* the request line ends the record and is truncated to fit, leaving
+	 * room for the record's header, the length of the request line, the
+	 * trailer and the final zero.
+	 */
+	if (fe->mode == PR_MODE_HTTP) {
+		uri = txn && txn->uri ? txn->uri : "<BADREQ>";
+		uri_len = strlen(uri);
+	}
+
+	len = p - body;
+	if (maxsize < len + 16)
+		return 0;
+	uri_len = MIN(uri_len, maxsize - len - 16);
+	encode_varint(uri_len, &p, end);
+
+	return binlog_frame(dst, BINLOG_T_ACCESS, body, p - body, uri, uri_len);
+}
 /*
  * send a log for the stream when we have enough info about it.
  * Will not log if the frontend has no log defined.
@@ -3032,12 +3664,19 @@ void strm_log(struct stream *s)
 		stream_generate_unique_id(s, &sess->fe->format_unique_id);
 	}
 
-	if (!LIST_ISEMPTY(&sess->fe->logformat_sd)) {
-		sd_size = build_logline(s, logline_rfc5424, global.max_syslog_len,
-		                        &sess->fe->logformat_sd);
+	if (sess->fe->options2 & PR_O2_BINLOG) {
+		binlog_send_names(sess->fe);
+		size = sess_build_binlog(sess, s, logline, binlog_maxlen(sess->fe));
+	}
+	else {
+		if (!LIST_ISEMPTY(&sess->fe->logformat_sd)) {
+			sd_size = build_logline(s, logline_rfc5424, global.max_syslog_len,
+			                        &sess->fe->logformat_sd);
+		}
+
+		size = build_logline(s, logline, global.max_syslog_len, &sess->fe->logformat);
 	}
 
-	size = build_logline(s, logline, global.max_syslog_len, &sess->fe->logformat);
 	if (size > 0) {
 		_HA_ATOMIC_ADD(&sess->fe->log_count, 1);
 		__send_log(&sess->fe->logsrvs, &sess->fe->log_tag, level,
@@ -3070,13 +3709,20 @@ void sess_log(struct session *sess)
 	if (sess->fe->options2 & PR_O2_LOGERRORS)
 		level = LOG_ERR;
 
-	if (!LIST_ISEMPTY(&sess->fe->logformat_sd)) {
-		sd_size = sess_build_logline(sess, NULL,
-		                             logline_rfc5424, global.max_syslog_len,
-		                             &sess->fe->logformat_sd);
+	if (sess->fe->options2 & PR_O2_BINLOG) {
+		binlog_send_names(sess->fe);
+		size = sess_build_binlog(sess, NULL, logline, binlog_maxlen(sess->fe));
+	}
+	else {
+		if (!LIST_ISEMPTY(&sess->fe->logformat_sd)) {
+			sd_size = sess_build_logline(sess, NULL,
+			                             logline_rfc5424, global.max_syslog_len,
+			                             &sess->fe->logformat_sd);
+		}
+
+		size = sess_build_logline(sess, NULL, logline, global.max_syslog_len, &sess->fe->logformat);
 	}
 
-	size = sess_build_logline(sess, NULL, logline, global.max_syslog_len, &sess->fe->logformat);
 	if (size > 0) {
 		_HA_ATOMIC_ADD(&sess->fe->log_count, 1);
 		__send_log(&sess->fe->logsrvs, &sess->fe->log_tag, level,
@@ -3122,7 +3768,105 @@ static struct cli_kw_list cli_kws = {{ },{
 
 INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
 
+/* Prepares the current thread's log batches when enabled */
+static int init_log_batch_per_thread()
+{
+	struct log_batch *b;
+	int i;
+
+	if (log_batch_size <= 1)
+		return 1;
+
+	for (i = 0; i < LOG_BATCHES; i++) {
+		b = &log_batch[i];
+		b->size  = (size_t)log_batch_size * global.max_syslog_len;
+		b->area  = malloc(b->size);
+		b->iov   = calloc(log_batch_size, sizeof(*b->iov));
+		b->msg   = calloc(log_batch_size, sizeof(*b->msg));
+		b->logger = calloc(log_batch_size, sizeof(*b->logger));
+		if (!b->area || !b->iov || !b->msg || !b->logger)
+			goto fail;
+	}
+
+	log_batch_task = task_new(tid_bit);
+	if (!log_batch_task)
+		goto fail;
+	log_batch_task->process = log_batch_expire;
+	return 1;
+ fail:
+	ha_alert("Failed to allocate the log batches for thread %u.\n", tid);
+	return 0;
+}
+
+/* Sends the current thread's pending log messages and releases its batches.
+ * Messages emitted after this are sent immediately.
+ */
+static void deinit_log_batch_per_thread()
+{
+	struct log_batch *b;
+	int i;
+
+	if (log_batch_task)
+		log_batch_expire(log_batch_task, NULL, 0);
+	task_destroy(log_batch_task);
+	log_batch_task = NULL;
+
+	for (i = 0; i < LOG_BATCHES; i++) {
+		b = &log_batch[i];
+		free(b->area);
+		free(b->iov);
+		free(b->msg);
+		free(b->logger);
+		memset(b, 0, sizeof(*b));
+	}
+}
+
+/* config parser for global "tune.log.batch" and "tune.log.batch-delay" */
+static int cfg_parse_log_batch(char **args, int section_type, struct proxy *curpx,
+                               struct proxy *defpx, const char *file, int line,
+                               char **err)
+{
+	const char *res;
+	unsigned int delay;
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[0], "tune.log.batch") == 0) {
+		log_batch_size = strtol(args[1], &end, 10);
+		if (!*args[1] || *end || log_batch_size < 0 || log_batch_size > 1024) {
+			memprintf(err, "'%s' expects a number of messages between 0 and 1024.", args[0]);
+			return -1;
+		}
+		return 0;
+	}
+
+	/* tune.log.batch-delay */
+	if (!*args[1]) {
+		memprintf(err, "'%s' expects a delay in milliseconds.", args[0]);
+		return -1;
+	}
+	res = parse_time_err(args[1], &delay, TIME_UNIT_MS);
+	if (res == PARSE_TIME_OVER || res == PARSE_TIME_UNDER || res || !delay) {
+		memprintf(err, "'%s' expects a strictly positive delay in milliseconds, not '%s'.", args[0], args[1]);
+		return -1;
+	}
+	log_batch_delay = delay;
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.log.batch",       cfg_parse_log_batch },
+	{ CFG_GLOBAL, "tune.log.batch-delay", cfg_parse_log_batch },
+	{ 0, NULL, NULL },
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 REGISTER_PER_THREAD_ALLOC(init_log_buffers);
+REGISTER_PER_THREAD_INIT(init_log_batch_per_thread);
+REGISTER_PER_THREAD_DEINIT(deinit_log_batch_per_thread);
 REGISTER_PER_THREAD_FREE(deinit_log_buffers);
 
 /*
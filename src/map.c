@@ -629,6 +629,75 @@ static int cli_parse_get_map(char **args, char *payload, struct appctx *appctx,
 	return 1;
 }
 
+/* Dumps the statistics of the regsets built for the "-m reg" patterns, one
+ * line per pattern expression.
+ */
+static int cli_io_handler_regsets(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct pattern_expr *expr;
+	struct pat_regset *rs;
+
+	switch (appctx->st2) {
+	case STAT_ST_INIT:
+		chunk_reset(&trash);
+		chunk_appendf(&trash, "# id (file) patterns fallbacks nfa_states classes build_us "
+		              "dfa_states dfa_kb execs dfa_misses nfa_execs fallback_execs\n");
+		if (ci_putchk(si_ic(si), &trash) == -1) {
+			si_rx_room_blk(si);
+			return 0;
+		}
+
+		appctx->ctx.map.ref = LIST_ELEM(&pattern_reference, struct pat_ref *, list);
+		appctx->ctx.map.ref = pat_list_get_next(appctx->ctx.map.ref, &pattern_reference,
+		                                        appctx->ctx.map.display_flags);
+		appctx->st2 = STAT_ST_LIST;
+		/* fall through */
+
+	case STAT_ST_LIST:
+		while (appctx->ctx.map.ref) {
+			chunk_reset(&trash);
+
+			HA_SPIN_LOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+			list_for_each_entry(expr, &appctx->ctx.map.ref->pat, list) {
+				HA_RWLOCK_RDLOCK(PATEXP_LOCK, &expr->lock);
+				rs = expr->regset;
+				if (rs)
+					chunk_appendf(&trash, "%d (%s) %u %u %u %u %u %u %u %llu %llu %llu %llu\n",
+					              appctx->ctx.map.ref->unique_id,
+					              appctx->ctx.map.ref->reference ? appctx->ctx.map.ref->reference : "",
+					              rs->set->nb_patterns, rs->nb_fallback, rs->set->nb_nstates,
+					              rs->set->nb_classes, rs->set->build_time, rs->set->nb_dstates,
+					              (unsigned int)(rs->set->dfa_mem >> 10), rs->set->execs,
+					              rs->set->dfa_misses, rs->set->nfa_execs, rs->fallback_execs);
+				HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &expr->lock);
+			}
+			HA_SPIN_UNLOCK(PATREF_LOCK, &appctx->ctx.map.ref->lock);
+
+			if (ci_putchk(si_ic(si), &trash) == -1) {
+				si_rx_room_blk(si);
+				return 0;
+			}
+
+			appctx->ctx.map.ref = pat_list_get_next(appctx->ctx.map.ref, &pattern_reference,
+			                                        appctx->ctx.map.display_flags);
+		}
+
+		/* fall through */
+
+	default:
+		appctx->st2 = STAT_ST_FIN;
+		return 1;
+	}
+	return 0;
+}
+
+static int cli_parse_show_regsets(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	appctx->ctx.map.display_flags = PAT_REF_MAP | PAT_REF_ACL;
+	return 0;
+}
+
 static void cli_release_show_map(struct appctx *appctx)
 {
 	if (appctx->st2 == STAT_ST_LIST) {
@@ -979,6 +1048,7 @@ static struct cli_kw_list cli_kws = {{ },{
 	{ { "get",   "map", NULL }, "get map        : report the keys and values matching a sample for a map", cli_parse_get_map, cli_io_handler_map_lookup, cli_release_mlook },
 	{ { "set",   "map", NULL }, "set map        : modify map entry", cli_parse_set_map, NULL },
 	{ { "show",  "map", NULL }, "show map [id]  : report available maps or dump a map's contents", cli_parse_show_map, NULL },
+	{ { "show",  "regsets", NULL }, "show regsets   : report the regex sets built for \"-m reg\" patterns", cli_parse_show_regsets, cli_io_handler_regsets },
 	{ { NULL }, NULL, NULL, NULL }
 }};
 
@@ -2935,8 +2935,10 @@ static struct task *fcgi_io_cb(struct task *t, void *ctx, unsigned short status)
 	TRACE_POINT(FCGI_EV_FCONN_WAKE, conn);
 
 	conn_in_list = conn->flags & CO_FL_LIST_MASK;
-	if (conn_in_list)
+	if (conn_in_list) {
 		MT_LIST_DEL(&conn->list);
+		eb64_delete(&conn->hash_node);
+	}
 
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
@@ -2953,12 +2955,9 @@ static struct task *fcgi_io_cb(struct task *t, void *ctx, unsigned short status)
 	 * called then ret will be 0 anyway.
 	 */
 	if (!ret && conn_in_list) {
-		struct server *srv = objt_server(conn->target);
+		struct server *srv = __objt_server(conn->target);
 
-		if (conn_in_list == CO_FL_SAFE_LIST)
-			MT_LIST_ADDQ(&srv->safe_conns[tid], &conn->list);
-		else
-			MT_LIST_ADDQ(&srv->idle_conns[tid], &conn->list);
+		srv_add_to_idle_tree(srv, conn, conn_in_list);
 	}
 	return NULL;
 }
@@ -3094,8 +3093,10 @@ static struct task *fcgi_timeout_task(struct task *t, void *context, unsigned sh
 	 */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 
-	if (fconn && fconn->conn->flags & CO_FL_LIST_MASK)
+	if (fconn && fconn->conn->flags & CO_FL_LIST_MASK) {
 		MT_LIST_DEL(&fconn->conn->list);
+		eb64_delete(&fconn->conn->hash_node);
+	}
 
 	/* Somebody already stole the connection from us, so we should not
 	 * free it, we just have to free the task.
@@ -2241,8 +2241,10 @@ static struct task *h1_io_cb(struct task *t, void *ctx, unsigned short status)
 	 * to use it while we handle the I/O events
 	 */
 	conn_in_list = conn->flags & CO_FL_LIST_MASK;
-	if (conn_in_list)
+	if (conn_in_list) {
 		MT_LIST_DEL(&conn->list);
+		eb64_delete(&conn->hash_node);
+	}
 
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
@@ -2258,12 +2260,9 @@ static struct task *h1_io_cb(struct task *t, void *ctx, unsigned short status)
 	 * called then ret will be 0 anyway.
 	 */
 	if (!ret && conn_in_list) {
-		struct server *srv = objt_server(conn->target);
+		struct server *srv = __objt_server(conn->target);
 
-		if (conn_in_list == CO_FL_SAFE_LIST)
-			MT_LIST_ADDQ(&srv->safe_conns[tid], &conn->list);
-		else
-			MT_LIST_ADDQ(&srv->idle_conns[tid], &conn->list);
+		srv_add_to_idle_tree(srv, conn, conn_in_list);
 	}
 	return NULL;
 }
@@ -2313,8 +2312,10 @@ static struct task *h1_timeout_task(struct task *t, void *context, unsigned shor
 	 */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 
-	if (h1c && h1c->conn->flags & CO_FL_LIST_MASK)
+	if (h1c && h1c->conn->flags & CO_FL_LIST_MASK) {
 		MT_LIST_DEL(&h1c->conn->list);
+		eb64_delete(&h1c->conn->hash_node);
+	}
 
 	/* Somebody already stole the connection from us, so we should not
 	 * free it, we just have to free the task.
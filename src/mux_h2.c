@@ -110,6 +110,7 @@ struct h2c {
 	int32_t last_sid; /* last processed stream ID for GOAWAY, <0 before preface */
 
 	/* states for the mux direction */
+	struct hpack_enc *edht; /* mux HPACK encoder and its dynamic table */
 	struct buffer mbuf[H2C_MBUF_CNT];   /* mux buffers (ring) */
 	int32_t msi; /* mux stream ID (<0 = idle) */
 	int32_t mfl; /* mux frame length (if dsi >= 0) */
@@ -397,6 +398,8 @@ static int h2_settings_header_table_size      =  4096; /* initial value */
 static int h2_settings_initial_window_size    = 65535; /* initial value */
 static unsigned int h2_settings_max_concurrent_streams = 100;
 static int h2_settings_max_frame_size         = 0;     /* unset */
+static int h2_settings_encoder_table_size     =  4096; /* 0 = no dynamic table */
+static enum hpack_enc_policy h2_settings_encoder_table_policy = HPACK_ENC_POL_REPEATED;
 
 /* a dmumy closed stream */
 static const struct h2s *h2_closed_stream = &(const struct h2s){
@@ -827,6 +830,12 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	if (!h2c->ddht)
 		goto fail;
 
+	h2c->edht = hpack_enc_alloc(h2_settings_encoder_table_size, h2_settings_encoder_table_policy);
+	if (!h2c->edht) {
+		hpack_dht_free(h2c->ddht);
+		goto fail;
+	}
+
 	/* Initialise the context. */
 	h2c->st0 = H2_CS_PREFACE;
 	h2c->conn = conn;
@@ -879,6 +888,7 @@ static int h2_init(struct connection *conn, struct proxy *prx, struct session *s
 	TRACE_LEAVE(H2_EV_H2C_NEW, conn);
 	return 0;
   fail_stream:
+	hpack_enc_free(h2c->edht);
 	hpack_dht_free(h2c->ddht);
   fail:
 	task_destroy(t);
@@ -937,6 +947,7 @@ static void h2_release(struct h2c *h2c)
 
 		TRACE_DEVEL("freeing h2c", H2_EV_H2C_END, conn);
 		hpack_dht_free(h2c->ddht);
+		hpack_enc_free(h2c->edht);
 
 		if (MT_LIST_ADDED(&h2c->buf_wait.list))
 			MT_LIST_DEL(&h2c->buf_wait.list);
@@ -2010,6 +2021,10 @@ static int h2c_handle_settings(struct h2c *h2c)
 		int32_t  arg  = h2_get_n32(&h2c->dbuf, offset + 2);
 
 		switch (type) {
+		case H2_SETTINGS_HEADER_TABLE_SIZE:
+			/* the encoder signals the change in the next HEADERS */
+			hpack_enc_set_size(h2c->edht, (uint32_t)arg);
+			break;
 		case H2_SETTINGS_INITIAL_WINDOW_SIZE:
 			/* we need to update all existing streams with the
 			 * difference from the previous iws.
@@ -3544,8 +3559,10 @@ static struct task *h2_io_cb(struct task *t, void *ctx, unsigned short status)
 	/* Remove the connection from the list, to be sure nobody attempts
 	 * to use it while we handle the I/O events
 	 */
-	if (conn_in_list)
+	if (conn_in_list) {
 		MT_LIST_DEL(&conn->list);
+		eb64_delete(&conn->hash_node);
+	}
 
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
@@ -3562,12 +3579,9 @@ static struct task *h2_io_cb(struct task *t, void *ctx, unsigned short status)
 	 * called then ret will be 0 anyway.
 	 */
 	if (!ret && conn_in_list) {
-		struct server *srv = objt_server(conn->target);
+		struct server *srv = __objt_server(conn->target);
 
-		if (conn_in_list == CO_FL_SAFE_LIST)
-			MT_LIST_ADDQ(&srv->safe_conns[tid], &conn->list);
-		else
-			MT_LIST_ADDQ(&srv->idle_conns[tid], &conn->list);
+		srv_add_to_idle_tree(srv, conn, conn_in_list);
 	}
 
 	TRACE_LEAVE(H2_EV_H2C_WAKE);
@@ -3644,12 +3658,14 @@ static int h2_process(struct h2c *h2c)
 		/* connections in error must be removed from the idle lists */
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 		MT_LIST_DEL((struct mt_list *)&conn->list);
+		eb64_delete(&conn->hash_node);
 		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 	}
 	else if (h2c->st0 == H2_CS_ERROR) {
 		/* connections in error must be removed from the idle lists */
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 		MT_LIST_DEL((struct mt_list *)&conn->list);
+		eb64_delete(&conn->hash_node);
 		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 	}
 
@@ -3722,8 +3738,10 @@ static struct task *h2_timeout_task(struct task *t, void *context, unsigned shor
 	 */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 
-	if (h2c && h2c->conn->flags & CO_FL_LIST_MASK)
+	if (h2c && h2c->conn->flags & CO_FL_LIST_MASK) {
 		MT_LIST_DEL(&h2c->conn->list);
+		eb64_delete(&h2c->conn->hash_node);
+	}
 
 	/* Somebody already stole the connection from us, so we should not
 	 * free it, we just have to free the task.
@@ -3779,6 +3797,7 @@ static struct task *h2_timeout_task(struct task *t, void *context, unsigned shor
 	/* in any case this connection must not be considered idle anymore */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 	MT_LIST_DEL((struct mt_list *)&h2c->conn->list);
+	eb64_delete(&h2c->conn->hash_node);
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
 	/* either we can release everything now or it will be done later once
@@ -4716,6 +4735,12 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	if (!hpack_enc_begin(h2c->edht, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode status, which necessarily is the first one */
 	if (!hpack_encode_int_status(&outbuf, h2s->status)) {
 		if (b_space_wraps(mbuf))
@@ -4740,7 +4765,7 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 		if (isteq(list[hdr].n, ist("")))
 			break; // end
 
-		if (!hpack_encode_header(&outbuf, list[hdr].n, list[hdr].v)) {
+		if (!hpack_enc_header(h2c->edht, &outbuf, list[hdr].n, list[hdr].v)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -4777,6 +4802,7 @@ static size_t h2s_frt_make_resp_headers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_USER("sent H2 response", H2_EV_TX_FRAME|H2_EV_TX_HDR, h2c->conn, h2s, htx);
 	b_add(mbuf, outbuf.data);
+	hpack_enc_commit(h2c->edht);
 
 	/* indicates the HEADERS frame was sent, except for 1xx responses. For
 	 * 1xx responses, another HEADERS frame is expected.
@@ -4964,6 +4990,12 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	if (!hpack_enc_begin(h2c->edht, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode the method, which necessarily is the first one */
 	if (!hpack_encode_method(&outbuf, sl->info.req.meth, meth)) {
 		if (b_space_wraps(mbuf))
@@ -4981,7 +5013,7 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
 	if (unlikely(sl->info.req.meth == HTTP_METH_CONNECT)) {
 		auth = uri;
 
-		if (!hpack_encode_header(&outbuf, ist(":authority"), auth)) {
+		if (!hpack_enc_header(h2c->edht, &outbuf, ist(":authority"), auth)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -5040,7 +5072,7 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
 			goto full;
 		}
 
-		if (auth.len && !hpack_encode_header(&outbuf, ist(":authority"), auth)) {
+		if (auth.len && !hpack_enc_header(h2c->edht, &outbuf, ist(":authority"), auth)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -5098,7 +5130,7 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
 		if (isteq(n, ist("")))
 			break; // end
 
-		if (!hpack_encode_header(&outbuf, n, v)) {
+		if (!hpack_enc_header(h2c->edht, &outbuf, n, v)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -5139,6 +5171,7 @@ static size_t h2s_bck_make_req_headers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_USER("sent H2 request", H2_EV_TX_FRAME|H2_EV_TX_HDR, h2c->conn, h2s, htx);
 	b_add(mbuf, outbuf.data);
+	hpack_enc_commit(h2c->edht);
 	h2s->flags |= H2_SF_HEADERS_SENT;
 	h2s->st = H2_SS_OPEN;
 
@@ -5565,6 +5598,12 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	write_n32(outbuf.area + 5, h2s->id); // 4 bytes
 	outbuf.data = 9;
 
+	if (!hpack_enc_begin(h2c->edht, &outbuf)) {
+		if (b_space_wraps(mbuf))
+			goto realign_again;
+		goto full;
+	}
+
 	/* encode all headers */
 	for (idx = 0; idx < hdr; idx++) {
 		/* these ones do not exist in H2 or must not appear in
@@ -5584,7 +5623,7 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 		if (*(list[idx].n.ptr) == ':')
 			continue;
 
-		if (!hpack_encode_header(&outbuf, list[idx].n, list[idx].v)) {
+		if (!hpack_enc_header(h2c->edht, &outbuf, list[idx].n, list[idx].v)) {
 			/* output full */
 			if (b_space_wraps(mbuf))
 				goto realign_again;
@@ -5618,6 +5657,7 @@ static size_t h2s_make_trailers(struct h2s *h2s, struct htx *htx)
 	/* commit the H2 response */
 	TRACE_PROTO("sent H2 trailers HEADERS frame", H2_EV_TX_FRAME|H2_EV_TX_HDR|H2_EV_TX_EOI, h2c->conn, h2s);
 	b_add(mbuf, outbuf.data);
+	hpack_enc_commit(h2c->edht);
 	h2s->flags |= H2_SF_ES_SENT;
 
 	if (h2s->st == H2_SS_OPEN)
@@ -6104,6 +6144,41 @@ static int h2_parse_header_table_size(char **args, int section_type, struct prox
 	return 0;
 }
 
+/* config parser for global "tune.h2.encoder-table-size" */
+static int h2_parse_encoder_table_size(char **args, int section_type, struct proxy *curpx,
+                                       struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	h2_settings_encoder_table_size = atoi(args[1]);
+	if (h2_settings_encoder_table_size < 0 || h2_settings_encoder_table_size > 65536) {
+		memprintf(err, "'%s' expects a numeric value between 0 and 65536.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.h2.encoder-table-policy" */
+static int h2_parse_encoder_table_policy(char **args, int section_type, struct proxy *curpx,
+                                         struct proxy *defpx, const char *file, int line,
+                                         char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "all") == 0)
+		h2_settings_encoder_table_policy = HPACK_ENC_POL_ALL;
+	else if (strcmp(args[1], "repeated") == 0)
+		h2_settings_encoder_table_policy = HPACK_ENC_POL_REPEATED;
+	else {
+		memprintf(err, "'%s' expects either 'all' or 'repeated'.", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "tune.h2.initial-window-size" */
 static int h2_parse_initial_window_size(char **args, int section_type, struct proxy *curpx,
                                         struct proxy *defpx, const char *file, int line,
@@ -6187,6 +6262,8 @@ INITCALL1(STG_REGISTER, register_mux_proto, &mux_proto_h2);
 
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.h2.encoder-table-policy",   h2_parse_encoder_table_policy   },
+	{ CFG_GLOBAL, "tune.h2.encoder-table-size",     h2_parse_encoder_table_size     },
 	{ CFG_GLOBAL, "tune.h2.header-table-size",      h2_parse_header_table_size      },
 	{ CFG_GLOBAL, "tune.h2.initial-window-size",    h2_parse_initial_window_size    },
 	{ CFG_GLOBAL, "tune.h2.max-concurrent-streams", h2_parse_max_concurrent_streams },
@@ -6206,6 +6283,17 @@ static int init_h2()
 	                                  MEM_F_SHARED|MEM_F_EXACT);
 	if (!pool_head_hpack_tbl)
 		return -1;
+
+	/* the encoder's table is allocated from the same pool */
+	if (h2_settings_encoder_table_size > h2_settings_header_table_size) {
+		ha_warning("config: 'tune.h2.encoder-table-size' limited to the 'tune.h2.header-table-size' value (%d).\n",
+			   h2_settings_header_table_size);
+		h2_settings_encoder_table_size = h2_settings_header_table_size;
+	}
+
+	pool_head_hpack_enc = create_pool("hpack_enc", sizeof(struct hpack_enc), MEM_F_SHARED);
+	if (!pool_head_hpack_enc)
+		return -1;
 	return 0;
 }
 
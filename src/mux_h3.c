@@ -3544,8 +3544,10 @@ static struct task *h3_io_cb(struct task *t, void *ctx, unsigned short status)
 	/* Remove the connection from the list, to be sure nobody attempts
 	 * to use it while we handle the I/O events
 	 */
-	if (conn_in_list)
+	if (conn_in_list) {
 		MT_LIST_DEL(&conn->list);
+		eb64_delete(&conn->hash_node);
+	}
 
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
@@ -3562,12 +3564,9 @@ static struct task *h3_io_cb(struct task *t, void *ctx, unsigned short status)
 	 * called then ret will be 0 anyway.
 	 */
 	if (!ret && conn_in_list) {
-		struct server *srv = objt_server(conn->target);
+		struct server *srv = __objt_server(conn->target);
 
-		if (conn_in_list == CO_FL_SAFE_LIST)
-			MT_LIST_ADDQ(&srv->safe_conns[tid], &conn->list);
-		else
-			MT_LIST_ADDQ(&srv->idle_conns[tid], &conn->list);
+		srv_add_to_idle_tree(srv, conn, conn_in_list);
 	}
 
 	TRACE_LEAVE(H3_EV_H3C_WAKE);
@@ -3644,12 +3643,14 @@ static int h3_process(struct h3c *h3c)
 		/* connections in error must be removed from the idle lists */
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 		MT_LIST_DEL((struct mt_list *)&conn->list);
+		eb64_delete(&conn->hash_node);
 		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 	}
 	else if (h3c->st0 == H3_CS_ERROR) {
 		/* connections in error must be removed from the idle lists */
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 		MT_LIST_DEL((struct mt_list *)&conn->list);
+		eb64_delete(&conn->hash_node);
 		HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 	}
 
@@ -3722,8 +3723,10 @@ static struct task *h3_timeout_task(struct task *t, void *context, unsigned shor
 	 */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 
-	if (h3c && h3c->conn->flags & CO_FL_LIST_MASK)
+	if (h3c && h3c->conn->flags & CO_FL_LIST_MASK) {
 		MT_LIST_DEL(&h3c->conn->list);
+		eb64_delete(&h3c->conn->hash_node);
+	}
 
 	/* Somebody already stole the connection from us, so we should not
 	 * free it, we just have to free the task.
@@ -3779,6 +3782,7 @@ static struct task *h3_timeout_task(struct task *t, void *context, unsigned shor
 	/* in any case this connection must not be considered idle anymore */
 	HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[tid]);
 	MT_LIST_DEL((struct mt_list *)&h3c->conn->list);
+	eb64_delete(&h3c->conn->hash_node);
 	HA_SPIN_UNLOCK(OTHER_LOCK, &toremove_lock[tid]);
 
 	/* either we can release everything now or it will be done later once
@@ -578,8 +578,122 @@ struct pattern *pat_match_regm(struct sample *smp, struct pattern_expr *expr, in
 	return ret;
 }
 
+/* Releases the regset of expression <expr> if any. It must be called with the
+ * expression write-locked each time its list of patterns changes.
+ */
+static void pat_regset_free(struct pattern_expr *expr)
+{
+	struct pat_regset *rs = expr->regset;
+
+	if (!rs)
+		return;
+
+	expr->regset = NULL;
+	regset_free(rs->set);
+	free(rs->pats);
+	free(rs->fallback);
+	free(rs);
+}
+
+/* Compiles the "-m reg" patterns of <expr> into a regset if there are at
+ * least "tune.pattern.regset" of them. It is called with the expression
+ * read-locked when matching, so only one thread builds it while the other
+ * ones keep matching the patterns one at a time. The patterns which use
+ * constructs the regset does not support are left to the regex library.
+ */
+static void pat_regset_build(struct pattern_expr *expr)
+{
+	unsigned long long revision = expr->revision;
+	struct pattern_list *lst;
+	struct pat_regset *rs = NULL;
+	unsigned int count = 0;
+	char *err = NULL;
+
+	if (HA_SPIN_TRYLOCK(PATEXP_LOCK, &expr->regset_lock) != 0)
+		return;
+
+	/* another thread may have done it in the mean time */
+	if (expr->regset || expr->regset_rev == revision)
+		goto out;
+
+	list_for_each_entry(lst, &expr->patterns, list)
+		count++;
+
+	if (count < global.tune.pattern_regset)
+		goto out;
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		goto fail;
+
+	rs->set = regset_new(!!(expr->mflags & PAT_MF_IGNORE_CASE));
+	rs->pats = calloc(count, sizeof(*rs->pats));
+	rs->fallback = calloc(count, sizeof(*rs->fallback));
+	if (!rs->set || !rs->pats || !rs->fallback)
+		goto fail;
+
+	list_for_each_entry(lst, &expr->patterns, list) {
+		rs->pats[rs->nb_pats] = &lst->pat;
+		if (!regset_add(rs->set, lst->pat.ref ? lst->pat.ref->pattern : NULL, rs->nb_pats))
+			rs->fallback[rs->nb_fallback++] = rs->nb_pats;
+		rs->nb_pats++;
+	}
+
+	if (!rs->set->nb_patterns || !regset_compile(rs->set, &err))
+		goto fail;
+
+	/* the regset must be complete before being visible */
+	__ha_barrier_store();
+	expr->regset = rs;
+	goto out;
+
+  fail:
+	if (err) {
+		send_log(NULL, LOG_WARNING, "regex set not built for %s: %s.\n",
+			 expr->ref ? expr->ref->display : "pattern list", err);
+		free(err);
+	}
+	if (rs) {
+		regset_free(rs->set);
+		free(rs->pats);
+		free(rs->fallback);
+		free(rs);
+	}
+  out:
+	expr->regset_rev = revision;
+	HA_SPIN_UNLOCK(PATEXP_LOCK, &expr->regset_lock);
+}
+
+/* Looks for the first pattern of <rs> which matches sample <smp>. The regset
+ * reports the first of its own patterns which matches, so only the patterns
+ * it refused and which come before this one have to be executed. Returns 0
+ * if the regset could not be used, otherwise 1 with <ret> set to the
+ * pattern which matched or NULL.
+ */
+static int pat_regset_match(struct pat_regset *rs, struct sample *smp, struct pattern **ret)
+{
+	unsigned int id, i;
+	int found;
+
+	found = regset_exec(rs->set, smp->data.u.str.area, smp->data.u.str.data, &id);
+	if (found < 0)
+		return 0;
+
+	for (i = 0; i < rs->nb_fallback && (!found || rs->fallback[i] < id); i++) {
+		HA_ATOMIC_ADD(&rs->fallback_execs, 1);
+		if (regex_exec2(rs->pats[rs->fallback[i]]->ptr.reg, smp->data.u.str.area, smp->data.u.str.data)) {
+			*ret = rs->pats[rs->fallback[i]];
+			return 1;
+		}
+	}
+
+	*ret = found ? rs->pats[id] : NULL;
+	return 1;
+}
+
 /* Executes a regex. It temporarily changes the data to add a trailing zero,
- * and restores the previous character when leaving.
+ * and restores the previous character when leaving. Large lists may be
+ * compiled into a single regset (see "tune.pattern.regset").
  */
 struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -599,6 +713,12 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	if (global.tune.pattern_regset && !expr->regset && expr->regset_rev != expr->revision)
+		pat_regset_build(expr);
+
+	if (expr->regset && pat_regset_match(expr->regset, smp, &ret))
+		goto end;
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -608,6 +728,7 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+  end:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->revision, NULL);
 
@@ -1097,6 +1218,7 @@ void pat_prune_reg(struct pattern_expr *expr)
 {
 	struct pattern_list *pat, *tmp;
 
+	pat_regset_free(expr);
 	list_for_each_entry_safe(pat, tmp, &expr->patterns, list) {
 		regex_free(pat->pat.ptr.ptr);
 		free(pat->pat.data);
@@ -1217,6 +1339,7 @@ int pat_idx_list_reg_cap(struct pattern_expr *expr, struct pattern *pat, int cap
 	}
 
 	/* chain pattern in the expression */
+	pat_regset_free(expr);
 	LIST_ADDQ(&expr->patterns, &patl->list);
 	expr->revision = rdtsc();
 
@@ -1501,6 +1624,7 @@ void pat_del_list_reg(struct pattern_expr *expr, struct pat_ref_elt *ref)
 	struct pattern_list *pat;
 	struct pattern_list *safe;
 
+	pat_regset_free(expr);
 	list_for_each_entry_safe(pat, safe, &expr->patterns, list) {
 		/* Check equality. */
 		if (pat->pat.ref != ref)
@@ -1521,6 +1645,8 @@ void pattern_init_expr(struct pattern_expr *expr)
 	expr->revision = 0;
 	expr->pattern_tree = EB_ROOT;
 	expr->pattern_tree_2 = EB_ROOT;
+	expr->regset = NULL;
+	expr->regset_rev = 0;
 }
 
 void pattern_init_head(struct pattern_head *head)
@@ -2216,6 +2342,7 @@ struct pattern_expr *pattern_new_expr(struct pattern_head *head, struct pat_ref
 		expr->ref = ref;
 
 		HA_RWLOCK_INIT(&expr->lock);
+		HA_SPIN_INIT(&expr->regset_lock);
 
 		/* We must free this pattern if it is no more used. */
 		list->do_free = 1;
@@ -20,6 +20,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#if defined(USE_ZLIB)
+#include <zlib.h>
+#endif
+
 #include <common/compat.h>
 #include <common/config.h>
 #include <common/net_helper.h>
@@ -85,12 +89,16 @@
 #define PEER_F_TEACH_COMPLETE       0x00000010 /* All that we know already taught to current peer, used only for a local peer */
 #define PEER_F_LEARN_ASSIGN         0x00000100 /* Current peer was assigned for a lesson */
 #define PEER_F_LEARN_NOTUP2DATE     0x00000200 /* Learn from peer finished but peer is not up to date */
+#define PEER_F_CAPS_SENT            0x00001000 /* Our capabilities were announced to the current peer */
+#define PEER_F_BATCH                0x00002000 /* Current peer accepts batched updates */
+#define PEER_F_INFLATE              0x00004000 /* Current peer accepts deflated batches */
 #define PEER_F_ALIVE                0x20000000 /* Used to flag a peer a alive. */
 #define PEER_F_HEARTBEAT            0x40000000 /* Heartbeat message to send. */
 #define PEER_F_DWNGRD               0x80000000 /* When this flag is enabled, we must downgrade the supported version announced during peer sessions. */
 
 #define PEER_TEACH_RESET            ~(PEER_F_TEACH_PROCESS|PEER_F_TEACH_FINISHED) /* PEER_F_TEACH_COMPLETE should never be reset */
 #define PEER_LEARN_RESET            ~(PEER_F_LEARN_ASSIGN|PEER_F_LEARN_NOTUP2DATE)
+#define PEER_CAPS_RESET             ~(PEER_F_CAPS_SENT|PEER_F_BATCH|PEER_F_INFLATE)
 
 #define PEER_RESYNC_TIMEOUT         5000 /* 5 seconds */
 #define PEER_RECONNECT_TIMEOUT      5000 /* 5 seconds */
@@ -115,8 +123,16 @@ enum {
 	PEER_MSG_CTRL_RESYNCPARTIAL,
 	PEER_MSG_CTRL_RESYNCCONFIRM,
 	PEER_MSG_CTRL_HEARTBEAT,
+	PEER_MSG_CTRL_CAPABILITIES = 0x80, /* contains data, ignored by older peers */
 };
 
+/* capabilities announced in PEER_MSG_CTRL_CAPABILITIES messages */
+#define PEER_CAP_BATCH                 0x01 /* batched update messages */
+#define PEER_CAP_INFLATE               0x02 /* deflated batched update messages */
+
+/* flags of PEER_MSG_STKT_BATCH messages */
+#define PEER_BATCH_F_DEFLATE           0x01 /* the updates are deflated */
+
 /*****************************/
 /* error message types       */
 /*****************************/
@@ -210,6 +226,7 @@ struct peer_prep_params {
 #define PEER_MSG_STKT_ACK              0x84
 #define PEER_MSG_STKT_UPDATE_TIMED     0x85
 #define PEER_MSG_STKT_INCUPDATE_TIMED  0x86
+#define PEER_MSG_STKT_BATCH            0x87
 /* All the stick-table message identifiers abova have the #7 bit set */
 #define PEER_MSG_STKT_BIT                 7
 #define PEER_MSG_STKT_BIT_MASK         (1 << PEER_MSG_STKT_BIT)
@@ -247,6 +264,14 @@ struct peer_prep_params {
 
 #define PEER_STKT_CACHE_MAX_ENTRIES       128
 
+/* number of updates picked at once by the teaching functions */
+#define PEER_TEACH_BULK 16
+
+/* Room reserved in front of a batch of updates for the message header: class,
+ * type, encoded length, flags and encoded length of the deflated updates.
+ */
+#define PEER_BATCH_HEADROOM  (PEER_MSG_HEADER_LEN + 2 * PEER_MSG_ENC_LENGTH_MAXLEN + 1)
+
 /**********************************/
 /* Peer Session IO handler states */
 /**********************************/
@@ -752,6 +777,95 @@ static int peer_prepare_ackmsg(char *msg, size_t size, struct peer_prep_params *
 	return (cursor - msg) + datalen;
 }
 
+/*
+ * This prepares the capabilities message announcing the protocol extensions
+ * supported by the local peer, followed by the largest message it accepts.
+ *  <msg> is a buffer of <size> to receive data message content
+ * If function returns 0, the caller should consider we were unable to encode this message (TODO:
+ * check size)
+ */
+static int peer_prepare_capsmsg(char *msg, size_t size, struct peer_prep_params *p)
+{
+	unsigned short datalen;
+	char *cursor, *datamsg;
+	unsigned int caps;
+
+	cursor = datamsg = msg + PEER_MSG_HEADER_LEN + PEER_MSG_ENC_LENGTH_MAXLEN;
+
+	caps = PEER_CAP_BATCH;
+#if defined(USE_ZLIB)
+	caps |= PEER_CAP_INFLATE;
+#endif
+	intencode(caps, &cursor);
+	intencode(trash.size, &cursor);
+
+	/* Compute datalen */
+	datalen = (cursor - datamsg);
+
+	/*  prepare message header */
+	msg[0] = PEER_MSG_CLASS_CONTROL;
+	msg[1] = PEER_MSG_CTRL_CAPABILITIES;
+	cursor = &msg[2];
+	intencode(datalen, &cursor);
+
+	/* move data after header */
+	memmove(cursor, datamsg, datalen);
+
+	/* return header size + data_len */
+	return (cursor - msg) + datalen;
+}
+
+#if defined(USE_ZLIB)
+/* Deflates the <inlen> bytes at <in> into the <outsz> bytes at <out>. Returns
+ * the length of the deflated data, or 0 if it did not fit. The stream is kept
+ * per thread to avoid allocating it for each batch.
+ */
+static size_t peer_deflate(const char *in, size_t inlen, char *out, size_t outsz)
+{
+	static THREAD_LOCAL z_stream strm;
+	static THREAD_LOCAL int ready;
+
+	if (!ready) {
+		if (deflateInit(&strm, Z_BEST_SPEED) != Z_OK)
+			return 0;
+		ready = 1;
+	}
+	else
+		deflateReset(&strm);
+
+	strm.next_in = (Bytef *)in;
+	strm.avail_in = inlen;
+	strm.next_out = (Bytef *)out;
+	strm.avail_out = outsz;
+	if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+		return 0;
+	return strm.total_out;
+}
+
+/* Inflates the <inlen> bytes at <in> which must produce exactly <outlen> bytes
+ * at <out>. Returns non-zero on success, 0 on error.
+ */
+static int peer_inflate(const char *in, size_t inlen, char *out, size_t outlen)
+{
+	static THREAD_LOCAL z_stream strm;
+	static THREAD_LOCAL int ready;
+
+	if (!ready) {
+		if (inflateInit(&strm) != Z_OK)
+			return 0;
+		ready = 1;
+	}
+	else
+		inflateReset(&strm);
+
+	strm.next_in = (Bytef *)in;
+	strm.avail_in = inlen;
+	strm.next_out = (Bytef *)out;
+	strm.avail_out = outlen;
+	return inflate(&strm, Z_FINISH) == Z_STREAM_END && strm.total_out == outlen;
+}
+#endif
+
 /*
  * Function to deinit connected peer
  */
@@ -1014,6 +1128,151 @@ static inline int peer_send_updatemsg(struct shared_table *st, struct appctx *ap
 	return peer_send_msg(appctx, peer_prepare_updatemsg, &p);
 }
 
+/*
+ * Send the update messages accumulated in <batch> after PEER_BATCH_HEADROOM
+ * bytes, <batch> being reset on success. A single message is sent as is, and
+ * several ones as a batch message, deflated if enabled for the peers section
+ * and supported by the remote peer.
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static int peer_send_batchmsg(struct appctx *appctx, struct buffer *batch, int count)
+{
+	struct stream_interface *si = appctx->owner;
+#if defined(USE_ZLIB)
+	struct peer *peer = appctx->ctx.peers.ptr;
+	struct peers *peers = strm_fe(si_strm(si))->parent;
+#endif
+	struct buffer *zbuf = NULL;
+	char head[PEER_BATCH_HEADROOM], *cursor, *data, *msg;
+	char opts[1 + PEER_MSG_ENC_LENGTH_MAXLEN], *ocur = opts;
+	size_t len, datalen, headlen;
+	int ret;
+
+	data = b_orig(batch) + PEER_BATCH_HEADROOM;
+	len = datalen = b_data(batch) - PEER_BATCH_HEADROOM;
+
+	if (count == 1) {
+		/* only the class byte is missing */
+		msg = data - 1;
+		*msg = PEER_MSG_CLASS_STICKTABLE;
+		ret = ci_putblk(si_ic(si), msg, len + 1);
+		goto end;
+	}
+
+#if defined(USE_ZLIB)
+	if (peers->compress && (peer->flags & PEER_F_INFLATE) && (zbuf = alloc_trash_chunk())) {
+		size_t zlen;
+
+		zlen = peer_deflate(data, len, b_orig(zbuf) + PEER_BATCH_HEADROOM,
+		                    b_size(zbuf) - PEER_BATCH_HEADROOM);
+		if (zlen && zlen < len) {
+			intencode(PEER_BATCH_F_DEFLATE, &ocur);
+			intencode(len, &ocur);
+			data = b_orig(zbuf) + PEER_BATCH_HEADROOM;
+			datalen = zlen;
+		}
+	}
+#endif
+	if (ocur == opts)
+		intencode(0, &ocur);
+
+	/*  prepare message header and stick it in front of the data */
+	cursor = head;
+	*cursor++ = PEER_MSG_CLASS_STICKTABLE;
+	*cursor++ = PEER_MSG_STKT_BATCH;
+	intencode((ocur - opts) + datalen, &cursor);
+	memcpy(cursor, opts, ocur - opts);
+	cursor += ocur - opts;
+	headlen = cursor - head;
+	memcpy(data - headlen, head, headlen);
+	ret = ci_putblk(si_ic(si), data - headlen, headlen + datalen);
+
+ end:
+	free_trash_chunk(zbuf);
+	if (ret <= 0) {
+		if (ret == -1) {
+			/* No more write possible */
+			si_rx_room_blk(si);
+			return -1;
+		}
+		appctx->st0 = PEER_SESS_ST_END;
+		return ret;
+	}
+
+	batch->data = PEER_BATCH_HEADROOM;
+	return ret;
+}
+
+/*
+ * Append a stick-table update message to <batch> which holds <*count> messages,
+ * after having sent the batch if there is not enough room left for it, in which
+ * case <*flushed> is set.
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static int peer_batch_updatemsg(struct shared_table *st, struct appctx *appctx,
+                                struct buffer *batch, int *count, int *flushed,
+                                struct stksess *ts, unsigned int updateid,
+                                int use_identifier, int use_timed)
+{
+	struct stream_interface *si = appctx->owner;
+	struct peer *peer = appctx->ctx.peers.ptr;
+	struct peer_prep_params p = {
+		.updt.stksess = ts,
+		.updt.shared_table = st,
+		.updt.updateid = updateid,
+		.updt.use_identifier = use_identifier,
+		.updt.use_timed = use_timed,
+		.updt.peer = peer,
+	};
+	size_t max, msglen;
+	int ret;
+
+	msglen = peer_prepare_updatemsg(trash.area, trash.size, &p);
+	if (!msglen) {
+		/* internal error: message does not fit in trash */
+		appctx->st0 = PEER_SESS_ST_END;
+		return 0;
+	}
+
+	/* the class byte is implicit in batches, and the batch must fit both
+	 * in the remote buffer and in the channel.
+	 */
+	msglen--;
+	max = MIN(peer->batch_size, b_size(batch));
+	max = MIN(max, channel_recv_max(si_ic(si)));
+	if (*count && b_data(batch) + msglen > max) {
+		ret = peer_send_batchmsg(appctx, batch, *count);
+		if (ret <= 0)
+			return ret;
+		*count = 0;
+		*flushed = 1;
+	}
+
+	if (b_data(batch) + msglen > b_size(batch)) {
+		/* too large for a batch, send it alone */
+		ret = ci_putblk(si_ic(si), trash.area, msglen + 1);
+		if (ret <= 0) {
+			if (ret == -1) {
+				si_rx_room_blk(si);
+				return -1;
+			}
+			appctx->st0 = PEER_SESS_ST_END;
+		}
+		return ret;
+	}
+
+	memcpy(b_tail(batch), trash.area + 1, msglen);
+	batch->data += msglen;
+	(*count)++;
+	return 1;
+}
+
 /*
  * Build a peer protocol control class message.
  * Returns the number of written bytes used to build the message if succeeded,
@@ -1097,6 +1356,18 @@ static inline int peer_send_heartbeatmsg(struct appctx *appctx)
 	return peer_send_msg(appctx, peer_prepare_control_msg, &p);
 }
 
+/*
+ * Send a capabilities message.
+ * Return 0 if the message could not be built modifying the appctx st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appctx st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static inline int peer_send_capsmsg(struct appctx *appctx)
+{
+	return peer_send_msg(appctx, peer_prepare_capsmsg, NULL);
+}
+
 /*
  * Build a peer protocol error class message.
  * Returns the number of written bytes used to build the message if succeeded,
@@ -1228,6 +1499,9 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
                                       struct shared_table *st, int locked)
 {
 	int ret, new_pushed, use_timed;
+	struct buffer *batch = NULL;
+	unsigned int committed;
+	int count = 0, flags;
 
 	ret = 1;
 	use_timed = 0;
@@ -1245,44 +1519,114 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 	/* We force new pushed to 1 to force identifier in update message */
 	new_pushed = 1;
 
+	/* When the peer supports it, the updates are batched, in which case
+	 * <last_pushed> only becomes valid once they are sent, so its last
+	 * sent value is kept in <committed> with the teaching flags in case
+	 * the batch cannot be sent.
+	 */
+	if (p->flags & PEER_F_BATCH) {
+		batch = alloc_trash_chunk();
+		if (batch)
+			batch->data = PEER_BATCH_HEADROOM;
+	}
+
 	if (!locked)
 		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
 
+	committed = st->last_pushed;
+	flags = st->flags;
 	while (1) {
-		struct stksess *ts;
-		unsigned updateid;
+		struct stksess *ts[PEER_TEACH_BULK];
+		unsigned int updateid[PEER_TEACH_BULK];
+		unsigned int start, next;
+		int i, n, flushed = 0;
+
+		/* Pick several updates at once so that the table lock, also taken
+		 * by all the threads updating the table, is not acquired for each
+		 * of them. <last_pushed> is then rewound since the messages are
+		 * built relative to the previously pushed update, and <next> is
+		 * where the lookup function stopped.
+		 */
+		start = st->last_pushed;
+		for (n = 0; n < PEER_TEACH_BULK; n++) {
+			ts[n] = peer_stksess_lookup(st);
+			if (!ts[n])
+				break;
 
-		/* push local updates */
-		ts = peer_stksess_lookup(st);
-		if (!ts)
+			updateid[n] = ts[n]->upd.key;
+			ts[n]->ref_cnt++;
+			st->last_pushed = updateid[n];
+		}
+
+		if (!n)
 			break;
 
-		updateid = ts->upd.key;
-		ts->ref_cnt++;
+		next = st->last_pushed;
+		st->last_pushed = start;
 		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
 
-		ret = peer_send_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
+		/* push local updates */
+		for (i = 0; i < n; i++) {
+			if (batch)
+				ret = peer_batch_updatemsg(st, appctx, batch, &count, &flushed,
+				                           ts[i], updateid[i], new_pushed, use_timed);
+			else
+				ret = peer_send_updatemsg(st, appctx, ts[i], updateid[i], new_pushed, use_timed);
+			if (ret <= 0)
+				break;
+
+			if (!batch || flushed)
+				committed = batch ? st->last_pushed : updateid[i];
+			st->last_pushed = updateid[i];
+			flushed = 0;
+
+			/* identifier may not needed in next update message */
+			new_pushed = 0;
+		}
+
+		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
+		for (i = 0; i < n; i++)
+			ts[i]->ref_cnt--;
+
 		if (ret <= 0) {
-			HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-			ts->ref_cnt--;
+			/* unsent updates will be pushed again, and the end of
+			 * the lesson possibly reached by the lookup is forgotten.
+			 */
+			if (batch && !flushed)
+				st->last_pushed = committed;
+			st->flags = flags;
+			free_trash_chunk(batch);
 			if (!locked)
 				HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
 			return ret;
 		}
 
-		HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
-		ts->ref_cnt--;
-		st->last_pushed = updateid;
-
+		st->last_pushed = next;
 		if (peer_stksess_lookup == peer_teach_process_stksess_lookup &&
-		    (int)(st->last_pushed - st->table->commitupdate) > 0)
-			st->table->commitupdate = st->last_pushed;
+		    (int)(committed - st->table->commitupdate) > 0)
+			st->table->commitupdate = committed;
 
-		/* identifier may not needed in next update message */
-		new_pushed = 0;
+		if (n < PEER_TEACH_BULK)
+			break;
+	}
+
+	if (batch) {
+		if (count) {
+			HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+			ret = peer_send_batchmsg(appctx, batch, count);
+			HA_SPIN_LOCK(STK_TABLE_LOCK, &st->table->lock);
+			if (ret <= 0) {
+				st->last_pushed = committed;
+				st->flags = flags;
+				free_trash_chunk(batch);
+				if (!locked)
+					HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
+				return ret;
+			}
+		}
+		free_trash_chunk(batch);
 	}
 
- out:
 	if (!locked)
 		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &st->table->lock);
 	return 1;
@@ -1346,7 +1690,8 @@ static inline int peer_send_teach_stage2_msgs(struct appctx *appctx, struct peer
  * <updt> must be set for  PEER_MSG_STKT_UPDATE or PEER_MSG_STKT_UPDATE_TIMED stick-table
  * messages, in this case the stick-table update message is received with a stick-table
  * update ID.
- * <totl> is the length of the stick-table update message computed upon receipt.
+ * <totl> is the length of the stick-table update message computed upon receipt,
+ * or 0 for an update of a batch message, which is not skipped when ignored.
  */
 static int peer_treat_updatemsg(struct appctx *appctx, struct peer *p, int updt, int exp,
                                 char **msg_cur, char *msg_end, int msg_len, int totl)
@@ -1550,7 +1895,8 @@ static int peer_treat_updatemsg(struct appctx *appctx, struct peer *p, int updt,
 
  ignore_msg:
 	/* skip consumed message */
-	co_skip(si_oc(si), totl);
+	if (totl)
+		co_skip(si_oc(si), totl);
 	return 0;
 
  malformed_unlock:
@@ -1568,6 +1914,120 @@ static int peer_treat_updatemsg(struct appctx *appctx, struct peer *p, int updt,
 	return 0;
 }
 
+/*
+ * Function used to parse a batch of stick-table update messages after it has
+ * been received by <p> peer with <msg_cur> as address of the pointer to the
+ * position in the receipt buffer with <msg_end> being the position of the end
+ * of the message. Each update is treated by peer_treat_updatemsg().
+ * Ignored updates are skipped one by one and do not stop the treatment of the
+ * batch, which is consumed as a whole by the caller.
+ * Return 1 if succeeded, 0 if not with the appctx state st0 set to PEER_SESS_ST_ERRPROTO.
+ */
+static int peer_treat_batchmsg(struct appctx *appctx, struct peer *p,
+                               char **msg_cur, char *msg_end)
+{
+	struct buffer *chunk = NULL;
+	unsigned int flags;
+	char *cur, *end;
+	int ret = 0;
+
+	flags = intdecode(msg_cur, msg_end);
+	if (!*msg_cur)
+		goto malformed_exit;
+
+	cur = *msg_cur;
+	end = msg_end;
+	if (flags & PEER_BATCH_F_DEFLATE) {
+#if defined(USE_ZLIB)
+		uint64_t len;
+
+		len = intdecode(msg_cur, msg_end);
+		if (!*msg_cur)
+			goto malformed_exit;
+
+		chunk = alloc_trash_chunk();
+		if (!chunk || len > b_size(chunk) ||
+		    !peer_inflate(*msg_cur, msg_end - *msg_cur, b_orig(chunk), len))
+			goto malformed_exit;
+
+		cur = b_orig(chunk);
+		end = cur + len;
+#else
+		goto malformed_exit;
+#endif
+	}
+
+	while (cur < end) {
+		unsigned char type = *cur++;
+		uint64_t len;
+		char *next;
+		int update, expire;
+
+		if (type != PEER_MSG_STKT_UPDATE && type != PEER_MSG_STKT_INCUPDATE &&
+		    type != PEER_MSG_STKT_UPDATE_TIMED && type != PEER_MSG_STKT_INCUPDATE_TIMED)
+			goto malformed_exit;
+
+		len = intdecode(&cur, end);
+		if (!cur || len > end - cur)
+			goto malformed_exit;
+
+		next = cur + len;
+		update = type == PEER_MSG_STKT_UPDATE || type == PEER_MSG_STKT_UPDATE_TIMED;
+		expire = type == PEER_MSG_STKT_UPDATE_TIMED || type == PEER_MSG_STKT_INCUPDATE_TIMED;
+		if (!peer_treat_updatemsg(appctx, p, update, expire, &cur, next, len, 0) &&
+		    appctx->st0 == PEER_SESS_ST_ERRPROTO)
+			goto out;
+		/* treated or ignored, go on with the next update */
+		cur = next;
+	}
+
+	*msg_cur = msg_end;
+	ret = 1;
+	goto out;
+
+ malformed_exit:
+	/* malformed message */
+	appctx->st0 = PEER_SESS_ST_ERRPROTO;
+ out:
+	free_trash_chunk(chunk);
+	return ret;
+}
+
+/*
+ * Function used to parse a capabilities message after it has been received by
+ * <p> peer with <msg_cur> as address of the pointer to the position in the
+ * receipt buffer with <msg_end> being the position of the end of the message.
+ * Unknown capabilities and trailing data are ignored.
+ * Return 1 if succeeded, 0 if not with the appctx state st0 set to PEER_SESS_ST_ERRPROTO.
+ */
+static inline int peer_treat_capsmsg(struct appctx *appctx, struct peer *p,
+                                     char **msg_cur, char *msg_end)
+{
+	unsigned int caps, size;
+
+	caps = intdecode(msg_cur, msg_end);
+	if (!*msg_cur)
+		goto malformed_exit;
+
+	size = intdecode(msg_cur, msg_end);
+	if (!*msg_cur)
+		goto malformed_exit;
+
+	p->flags &= ~(PEER_F_BATCH|PEER_F_INFLATE);
+	if ((caps & PEER_CAP_BATCH) && size > PEER_BATCH_HEADROOM) {
+		p->flags |= PEER_F_BATCH;
+		p->batch_size = size;
+	}
+	if (caps & PEER_CAP_INFLATE)
+		p->flags |= PEER_F_INFLATE;
+	return 1;
+
+ malformed_exit:
+	/* malformed message */
+	appctx->st0 = PEER_SESS_ST_ERRPROTO;
+	return 0;
+}
+
 /*
  * Function used to parse a stick-table update acknowledgement message after it
  * has been received by <p> peer with <msg_cur> as address of the pointer to the position in the
@@ -1744,8 +2204,8 @@ static inline int peer_recv_msg(struct appctx *appctx, char *msg_head, size_t ms
 
 	*totl += reql;
 
-	if ((unsigned int)msg_head[2] < PEER_ENC_2BYTES_MIN) {
-		*msg_len = msg_head[2];
+	if ((unsigned char)msg_head[2] < PEER_ENC_2BYTES_MIN) {
+		*msg_len = (unsigned char)msg_head[2];
 	}
 	else {
 		int i;
@@ -1873,6 +2333,10 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 			peer->reconnect = tick_add(now_ms, MS_TO_TICKS(PEER_RECONNECT_TIMEOUT));
 			peer->rx_hbt++;
 		}
+		else if (msg_head[1] == PEER_MSG_CTRL_CAPABILITIES) {
+			if (!peer_treat_capsmsg(appctx, peer, msg_cur, msg_end))
+				return 0;
+		}
 	}
 	else if (msg_head[0] == PEER_MSG_CLASS_STICKTABLE) {
 		if (msg_head[1] == PEER_MSG_STKT_DEFINE) {
@@ -1896,6 +2360,10 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 				return 0;
 
 		}
+		else if (msg_head[1] == PEER_MSG_STKT_BATCH) {
+			if (!peer_treat_batchmsg(appctx, peer, msg_cur, msg_end))
+				return 0;
+		}
 		else if (msg_head[1] == PEER_MSG_STKT_ACK) {
 			if (!peer_treat_ackmsg(appctx, peer, msg_cur, msg_end))
 				return 0;
@@ -1923,6 +2391,15 @@ static inline int peer_send_msgs(struct appctx *appctx, struct peer *peer)
 	struct stream *s = si_strm(si);
 	struct peers *peers = strm_fe(s)->parent;
 
+	/* Announce the protocol extensions we support, older peers ignore it */
+	if (!(peer->flags & PEER_F_CAPS_SENT)) {
+		repl = peer_send_capsmsg(appctx);
+		if (repl <= 0)
+			return repl;
+
+		peer->flags |= PEER_F_CAPS_SENT;
+	}
+
 	/* Need to request a resync */
 	if ((peer->flags & PEER_F_LEARN_ASSIGN) &&
 		(peers->flags & PEERS_F_RESYNC_ASSIGN) &&
@@ -2144,6 +2621,7 @@ static inline void init_accepted_peer(struct peer *peer, struct peers *peers)
 	/* reset teaching and learning flags to 0 */
 	peer->flags &= PEER_TEACH_RESET;
 	peer->flags &= PEER_LEARN_RESET;
+	peer->flags &= PEER_CAPS_RESET;
 
 	/* if current peer is local */
 	if (peer->local) {
@@ -2183,6 +2661,7 @@ static inline void init_connected_peer(struct peer *peer, struct peers *peers)
 	/* reset teaching and learning flags to 0 */
 	peer->flags &= PEER_TEACH_RESET;
 	peer->flags &= PEER_LEARN_RESET;
+	peer->flags &= PEER_CAPS_RESET;
 
 	/* If current peer is local */
 	if (peer->local) {
@@ -2542,6 +3021,7 @@ void peers_setup_frontend(struct proxy *fe)
 static struct appctx *peer_session_create(struct peers *peers, struct peer *peer)
 {
 	struct proxy *p = peers->peers_fe; /* attached frontend */
+	unsigned long thread_mask = 1UL << peer->thr;
 	struct appctx *appctx;
 	struct session *sess;
 	struct stream *s;
@@ -2551,7 +3031,7 @@ static struct appctx *peer_session_create(struct peers *peers, struct peer *peer
 	peer->statuscode = PEER_SESS_SC_CONNECTCODE;
 	s = NULL;
 
-	appctx = appctx_new(&peer_applet, tid_bit);
+	appctx = appctx_new(&peer_applet, thread_mask);
 	if (!appctx)
 		goto out_close;
 
@@ -2569,9 +3049,13 @@ static struct appctx *peer_session_create(struct peers *peers, struct peer *peer
 		goto out_free_sess;
 	}
 
+	/* the stream is run by the peer's thread, which is not necessarily
+	 * the current one, so it must not be woken up before being complete.
+	 */
+	task_set_affinity(s->task, thread_mask);
+
 	/* applet is waiting for data */
 	si_cant_get(&s->si[0]);
-	appctx_wakeup(appctx);
 
 	/* initiate an outgoing connection */
 	s->target = peer_session_target(peer, s);
@@ -2587,6 +3071,7 @@ static struct appctx *peer_session_create(struct peers *peers, struct peer *peer
 	s->res.flags |= CF_READ_DONTWAIT;
 
 	peer->appctx = appctx;
+	appctx_wakeup(appctx);
 	task_wakeup(s->task, TASK_WOKEN_INIT);
 	_HA_ATOMIC_ADD(&active_peers, 1);
 	return appctx;
@@ -2851,10 +3336,15 @@ static struct task *process_peer_sync(struct task * task, void *context, unsigne
  */
 int peers_init_sync(struct peers *peers)
 {
+	static unsigned int next_thr;
 	struct peer * curpeer;
 
 	for (curpeer = peers->remote; curpeer; curpeer = curpeer->next) {
 		peers->peers_fe->maxconn += 3;
+		/* spread the outgoing sessions over all threads so that the
+		 * updates sent to all the peers are not built by a single one.
+		 */
+		curpeer->thr = next_thr++ % global.nbthread;
 	}
 
 	peers->sync_task = task_new(MAX_THREADS_MASK);
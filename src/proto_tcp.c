@@ -404,16 +404,17 @@ int tcp_connect_server(struct connection *conn, int flags)
 		int ret, flags = 0;
 
 		if (conn->src && is_inet_addr(conn->src)) {
+			/* client-dependent addresses are part of the
+			 * connection's hash, so the connection remains
+			 * shareable with requests using the same address.
+			 */
 			switch (src->opts & CO_SRC_TPROXY_MASK) {
 			case CO_SRC_TPROXY_CLI:
-				conn->flags |= CO_FL_PRIVATE;
-				/* fall through */
 			case CO_SRC_TPROXY_ADDR:
 				flags = 3;
 				break;
 			case CO_SRC_TPROXY_CIP:
 			case CO_SRC_TPROXY_DYN:
-				conn->flags |= CO_FL_PRIVATE;
 				flags = 1;
 				break;
 			}
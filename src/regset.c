@@ -0,0 +1,1101 @@
+/*
+ * Matching of a set of regular expressions at once
+ *
+ * All the expressions of a set are compiled into a single Thompson NFA whose
+ * initial states are entered again before each byte of the subject, so that
+ * it searches all of them anywhere in the subject. The NFA is then turned on
+ * demand into a DFA: each DFA state is the set of NFA states reached after
+ * some input, and its transitions are only computed the first time they are
+ * needed, then shared by all threads. The bytes which no expression tells
+ * apart are grouped into classes to keep the DFA states small. When the DFA
+ * reaches its memory limit, the remaining subjects are finished by simulating
+ * the NFA, which is slower but still reads each byte only once.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/config.h>
+#include <common/initcall.h>
+#include <common/regset.h>
+#include <common/standard.h>
+#include <common/time.h>
+
+#include <types/global.h>
+
+#define REGSET_NONE     (~0U)
+
+/* positions for regset_closure() */
+#define RS_BOL          0x01  /* at the beginning of the subject */
+#define RS_EOL          0x02  /* at the end of the subject */
+#define RS_SKIPBASE     0x04  /* ignore the states of the restart set */
+
+#define RS_CSET_LONGS   (256 / (8 * sizeof(long)))
+#define RS_LONG_BITS    (8 * sizeof(long))
+
+/* a piece of NFA being built: its initial state and the list of its dangling
+ * transitions, linked through the transitions themselves (see rs_slot()).
+ */
+struct regset_frag {
+	int start;
+	int out;
+};
+
+struct regset_parser {
+	struct regset *set;
+	const char *p;         /* current position in the expression */
+	unsigned int id;       /* id of the expression */
+	int at_start;          /* nothing may be matched before <p> */
+	int anchors;           /* number of anchors met so far */
+};
+
+/* per-thread work areas, sized for the largest set */
+static THREAD_LOCAL unsigned int *rs_mark;   /* generation which visited each state */
+static THREAD_LOCAL unsigned int rs_gen;
+static THREAD_LOCAL int *rs_stack;
+static THREAD_LOCAL unsigned int *rs_list[3];
+static THREAD_LOCAL unsigned int rs_size;
+
+/* Makes sure the work areas can hold <size> NFA states. Returns 0 on memory
+ * allocation failure, otherwise 1.
+ */
+static int regset_alloc_work(unsigned int size)
+{
+	void *ptr;
+	int i;
+
+	if (size <= rs_size)
+		return 1;
+
+	if (!(ptr = realloc(rs_mark, size * sizeof(*rs_mark))))
+		return 0;
+	rs_mark = ptr;
+	memset(rs_mark + rs_size, 0, (size - rs_size) * sizeof(*rs_mark));
+
+	if (!(ptr = realloc(rs_stack, size * sizeof(*rs_stack))))
+		return 0;
+	rs_stack = ptr;
+
+	for (i = 0; i < 3; i++) {
+		if (!(ptr = realloc(rs_list[i], size * sizeof(*rs_list[i]))))
+			return 0;
+		rs_list[i] = ptr;
+	}
+	rs_size = size;
+	return 1;
+}
+
+static void regset_free_work()
+{
+	int i;
+
+	free(rs_mark);
+	free(rs_stack);
+	for (i = 0; i < 3; i++)
+		free(rs_list[i]);
+	rs_mark = NULL;
+	rs_stack = NULL;
+	rs_size = 0;
+}
+
+/* starts a new marking of the NFA states */
+static inline void regset_new_gen()
+{
+	if (unlikely(!++rs_gen)) {
+		memset(rs_mark, 0, rs_size * sizeof(*rs_mark));
+		rs_gen = 1;
+	}
+}
+
+static inline int regset_cset_has(const struct regset *set, unsigned int cset, unsigned char c)
+{
+	return !!(set->csets[cset][c / RS_LONG_BITS] & (1UL << (c % RS_LONG_BITS)));
+}
+
+/* Appends to <lst> which already holds <n> states the states which may be
+ * reached from state <s> without reading anything, <flags> (RS_*) telling
+ * the position in the subject, and returns the new number of states. Only
+ * the char, EOL and match states are listed. The states already visited
+ * during the current generation are skipped.
+ */
+static unsigned int regset_closure(const struct regset *set, int s, int flags,
+                                   unsigned int *lst, unsigned int n)
+{
+	const struct regset_nstate *st;
+	int sp = 0;
+
+#define RS_PUSH(x) do {							\
+		if (rs_mark[x] != rs_gen &&				\
+		    !((flags & RS_SKIPBASE) && set->in_base[x])) {	\
+			rs_mark[x] = rs_gen;				\
+			rs_stack[sp++] = (x);				\
+		}							\
+	} while (0)
+
+	RS_PUSH(s);
+	while (sp) {
+		s = rs_stack[--sp];
+		st = &set->nstates[s];
+
+		switch (st->type) {
+		case REGSET_N_CHAR:
+		case REGSET_N_MATCH:
+			lst[n++] = s;
+			continue;
+		case REGSET_N_EOL:
+			lst[n++] = s;
+			if (!(flags & RS_EOL))
+				continue;
+			break;
+		case REGSET_N_BOL:
+			if (!(flags & RS_BOL))
+				continue;
+			break;
+		case REGSET_N_SPLIT:
+			RS_PUSH(st->out1);
+			break;
+		}
+		RS_PUSH(st->out);
+	}
+#undef RS_PUSH
+	return n;
+}
+
+/* Computes into <dst> the states reached from the <n> states of <src> and
+ * from the restart set after reading byte <c>, excluding the restart set.
+ * Returns the number of states.
+ */
+static unsigned int regset_step(const struct regset *set, const unsigned int *src, unsigned int n,
+                                unsigned char c, unsigned int *dst)
+{
+	const struct regset_nstate *st;
+	unsigned int i, nb = 0;
+
+	regset_new_gen();
+	for (i = 0; i < n; i++) {
+		st = &set->nstates[src[i]];
+		if (st->type == REGSET_N_CHAR && regset_cset_has(set, st->arg, c))
+			nb = regset_closure(set, st->out, RS_SKIPBASE, dst, nb);
+	}
+	for (i = 0; i < set->nb_base; i++) {
+		st = &set->nstates[set->base[i]];
+		if (st->type == REGSET_N_CHAR && regset_cset_has(set, st->arg, c))
+			nb = regset_closure(set, st->out, RS_SKIPBASE, dst, nb);
+	}
+	return nb;
+}
+
+/* Reports for the <n> states of <lst> the lowest id of the expressions which
+ * match, which match if the subject ends here, and which may still match.
+ * <bol> tells if we're at the beginning of the subject. The restart set is
+ * not accounted for.
+ */
+static void regset_eval(const struct regset *set, const unsigned int *lst, unsigned int n, int bol,
+                        unsigned int *match, unsigned int *eol_match, unsigned int *minlive)
+{
+	const struct regset_nstate *st;
+	unsigned int i, j, k;
+
+	*match = *eol_match = *minlive = REGSET_NONE;
+	for (i = 0; i < n; i++) {
+		st = &set->nstates[lst[i]];
+		if (st->type == REGSET_N_MATCH) {
+			*match = MIN(*match, st->id);
+			continue;
+		}
+
+		*minlive = MIN(*minlive, st->id);
+		if (st->type != REGSET_N_EOL || st->id >= *eol_match)
+			continue;
+
+		regset_new_gen();
+		k = regset_closure(set, st->out, RS_EOL | (bol ? RS_BOL : 0), rs_list[2], 0);
+		for (j = 0; j < k; j++)
+			if (set->nstates[rs_list[2][j]].type == REGSET_N_MATCH)
+				*eol_match = MIN(*eol_match, set->nstates[rs_list[2][j]].id);
+	}
+}
+
+/* same as above but including the restart set */
+static void regset_eval_all(const struct regset *set, const unsigned int *lst, unsigned int n, int bol,
+                            unsigned int *match, unsigned int *eol_match, unsigned int *minlive)
+{
+	unsigned int m, e, l;
+
+	regset_eval(set, lst, n, bol, match, eol_match, minlive);
+	if (bol)
+		regset_eval(set, set->base, set->nb_base, bol, &m, &e, &l);
+	else {
+		m = set->base_match;
+		e = set->base_eol_match;
+		l = set->base_minlive;
+	}
+	*match = MIN(*match, m);
+	*eol_match = MIN(*eol_match, MIN(*match, e));
+	*minlive = MIN(*minlive, l);
+}
+
+static int regset_cmp_uint(const void *a, const void *b)
+{
+	unsigned int ua = *(const unsigned int *)a, ub = *(const unsigned int *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+/* Returns the DFA state made of the <n> NFA states of <lst>, creating it if
+ * needed, or NULL if the DFA is full. <lst> gets sorted. Must be called with
+ * the set's lock held, except during the compilation.
+ */
+static struct regset_dstate *regset_dfa_state(struct regset *set, unsigned int *lst, unsigned int n, int bol)
+{
+	struct regset_dstate *d;
+	unsigned int hash = 2166136261U ^ bol;
+	unsigned int i;
+	size_t size;
+
+	qsort(lst, n, sizeof(*lst), regset_cmp_uint);
+	for (i = 0; i < n; i++)
+		hash = (hash ^ lst[i]) * 16777619U;
+
+	for (d = set->htable[hash >> (32 - REGSET_HASH_BITS)]; d; d = d->hnext) {
+		if (d->hash == hash && d->bol == bol && d->nb == n &&
+		    memcmp(d->nfa, lst, n * sizeof(*lst)) == 0)
+			return d;
+	}
+
+	size = sizeof(*d) + set->nb_classes * sizeof(d->next[0]) + n * sizeof(*lst);
+	if (set->dfa_full || set->dfa_mem + size > REGSET_MAX_DFA_MEM) {
+		set->dfa_full = 1;
+		return NULL;
+	}
+
+	d = calloc(1, size);
+	if (!d)
+		return NULL;
+
+	d->hash = hash;
+	d->bol = bol;
+	d->nb = n;
+	d->nfa = (unsigned int *)&d->next[set->nb_classes];
+	memcpy(d->nfa, lst, n * sizeof(*lst));
+	regset_eval_all(set, d->nfa, n, bol, &d->match, &d->eol_match, &d->minlive);
+
+	d->hnext = set->htable[hash >> (32 - REGSET_HASH_BITS)];
+	set->htable[hash >> (32 - REGSET_HASH_BITS)] = d;
+	set->dfa_mem += size;
+	set->nb_dstates++;
+	return d;
+}
+
+/* Computes the transition of DFA state <d> on byte <c>. Returns the next
+ * state or NULL if the DFA is full.
+ */
+static struct regset_dstate *regset_dfa_next(struct regset *set, struct regset_dstate *d, unsigned char c)
+{
+	struct regset_dstate *next;
+	unsigned int n;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &set->lock);
+	/* another thread may have done it in the mean time */
+	next = d->next[set->bclass[c]];
+	if (!next) {
+		n = regset_step(set, d->nfa, d->nb, c, rs_list[0]);
+		next = regset_dfa_state(set, rs_list[0], n, 0);
+		if (next) {
+			/* the state must be complete before being visible */
+			__ha_barrier_store();
+			d->next[set->bclass[c]] = next;
+			HA_ATOMIC_ADD(&set->dfa_misses, 1);
+		}
+	}
+	HA_SPIN_UNLOCK(OTHER_LOCK, &set->lock);
+	return next;
+}
+
+/* Searches the <len> bytes of <s> from DFA state <d> by simulating the NFA,
+ * and returns the lowest id among <best> and the expressions which match.
+ */
+static unsigned int regset_simulate(struct regset *set, const struct regset_dstate *d,
+                                    const unsigned char *s, int len, unsigned int best)
+{
+	unsigned int *cur = rs_list[0], *nxt = rs_list[1], *tmp;
+	unsigned int n, match, eol_match, minlive;
+	int i;
+
+	HA_ATOMIC_ADD(&set->nfa_execs, 1);
+	n = regset_step(set, d->nfa, d->nb, s[0], cur);
+	for (i = 1; ; i++) {
+		regset_eval_all(set, cur, n, 0, &match, &eol_match, &minlive);
+		best = MIN(best, match);
+		if (best <= minlive)
+			return best;
+		if (i == len)
+			return MIN(best, eol_match);
+#if defined(USE_PCRE) || defined(USE_PCRE2)
+		/* "$" also matches before a final newline */
+		if (i == len - 1 && s[i] == '\n')
+			best = MIN(best, eol_match);
+#endif
+		n = regset_step(set, cur, n, s[i], nxt);
+		tmp = cur; cur = nxt; nxt = tmp;
+	}
+}
+
+/* Searches all the expressions of compiled set <set> in the <length> bytes of
+ * <subject>. Returns 1 and sets <id> to the lowest id of the matching
+ * expressions if any, 0 if none matches, or -1 if the work area could not be
+ * allocated.
+ */
+int regset_exec(struct regset *set, const char *subject, int length, unsigned int *id)
+{
+	const unsigned char *s = (const unsigned char *)subject;
+	struct regset_dstate *d = set->start, *next;
+	unsigned int best = REGSET_NONE;
+	int i;
+
+#if !defined(USE_PCRE) && !defined(USE_PCRE2)
+	const char *end;
+
+	/* the POSIX regex functions stop at the first zero */
+	end = memchr(subject, 0, length);
+	if (end)
+		length = end - subject;
+#endif
+
+	if (!regset_alloc_work(set->nb_nstates))
+		return -1;
+
+	HA_ATOMIC_ADD(&set->execs, 1);
+	for (i = 0; i < length; i++) {
+		best = MIN(best, d->match);
+		if (best <= d->minlive)
+			goto end;
+#if defined(USE_PCRE) || defined(USE_PCRE2)
+		/* "$" also matches before a final newline */
+		if (i == length - 1 && s[i] == '\n')
+			best = MIN(best, d->eol_match);
+#endif
+		next = d->next[set->bclass[s[i]]];
+		if (!next && !(next = regset_dfa_next(set, d, s[i]))) {
+			best = regset_simulate(set, d, s + i, length - i, best);
+			goto end;
+		}
+		d = next;
+	}
+	best = MIN(best, d->eol_match);
+  end:
+	if (best == REGSET_NONE)
+		return 0;
+	*id = best;
+	return 1;
+}
+
+/*
+ * NFA construction
+ */
+
+/* Returns a new NFA state or -1 if there are too many of them. */
+static int regset_new_nstate(struct regset_parser *ps, int type, int out, int out1, unsigned int arg)
+{
+	struct regset *set = ps->set;
+	struct regset_nstate *st;
+
+	if (set->nb_nstates >= set->alloc_nstates) {
+		unsigned int alloc = set->alloc_nstates ? set->alloc_nstates * 2 : 256;
+
+		if (alloc > REGSET_MAX_NSTATES)
+			return -1;
+		st = realloc(set->nstates, alloc * sizeof(*st));
+		if (!st)
+			return -1;
+		set->nstates = st;
+		set->alloc_nstates = alloc;
+	}
+
+	st = &set->nstates[set->nb_nstates];
+	st->type = type;
+	st->out  = out;
+	st->out1 = out1;
+	st->arg  = arg;
+	st->id   = ps->id;
+	return set->nb_nstates++;
+}
+
+/* The dangling transitions of a fragment are chained through their own
+ * <out> or <out1> fields. A link designates the <out1> field of state <s> if
+ * <which> is set, otherwise its <out> field, and 0 ends the list.
+ */
+static inline int rs_slot(int s, int which)
+{
+	return (s << 1 | which) + 1;
+}
+
+static inline int *rs_slot_ptr(struct regset *set, int slot)
+{
+	struct regset_nstate *st = &set->nstates[(slot - 1) >> 1];
+
+	return ((slot - 1) & 1) ? &st->out1 : &st->out;
+}
+
+/* connects all the dangling transitions of list <slot> to state <s> */
+static void regset_patch(struct regset *set, int slot, int s)
+{
+	int *ptr;
+
+	while (slot) {
+		ptr = rs_slot_ptr(set, slot);
+		slot = *ptr;
+		*ptr = s;
+	}
+}
+
+/* returns the concatenation of the dangling lists <l1> and <l2> */
+static int regset_append(struct regset *set, int l1, int l2)
+{
+	int slot = l1, *ptr;
+
+	if (!l1)
+		return l2;
+	while (*(ptr = rs_slot_ptr(set, slot)))
+		slot = *ptr;
+	*ptr = l2;
+	return l1;
+}
+
+/* Returns the index of a char set made of the <bits>, adding it if needed,
+ * or -1 on memory allocation failure.
+ */
+static int regset_cset(struct regset *set, const unsigned long *bits)
+{
+	unsigned int i, count = 0;
+	int single = -1;
+
+	for (i = 0; i < 256; i++) {
+		if (bits[i / RS_LONG_BITS] & (1UL << (i % RS_LONG_BITS))) {
+			count++;
+			single = i;
+		}
+	}
+
+	if (count == 1 && set->single_cset[single] >= 0)
+		return set->single_cset[single];
+
+	if (count != 1) {
+		for (i = 0; i < set->nb_csets; i++)
+			if (memcmp(set->csets[i], bits, sizeof(set->csets[i])) == 0)
+				return i;
+	}
+
+	if (set->nb_csets >= set->alloc_csets) {
+		unsigned int alloc = set->alloc_csets ? set->alloc_csets * 2 : 64;
+		void *ptr = realloc(set->csets, alloc * sizeof(*set->csets));
+
+		if (!ptr)
+			return -1;
+		set->csets = ptr;
+		set->alloc_csets = alloc;
+	}
+
+	memcpy(set->csets[set->nb_csets], bits, sizeof(set->csets[0]));
+	if (count == 1)
+		set->single_cset[single] = set->nb_csets;
+	return set->nb_csets++;
+}
+
+static inline void rs_bit_set(unsigned long *bits, int c)
+{
+	bits[c / RS_LONG_BITS] |= 1UL << (c % RS_LONG_BITS);
+}
+
+static inline int rs_bit_get(const unsigned long *bits, int c)
+{
+	return !!(bits[c / RS_LONG_BITS] & (1UL << (c % RS_LONG_BITS)));
+}
+
+/* Builds a fragment reading one byte among <bits>, or among the other bytes
+ * if <neg> is set. Returns 0 on success or -1 on failure.
+ */
+static int regset_char_frag(struct regset_parser *ps, unsigned long *bits, int neg, struct regset_frag *f)
+{
+	int c, cset, s;
+
+	if (ps->set->icase) {
+		for (c = 'a'; c <= 'z'; c++) {
+			if (rs_bit_get(bits, c) || rs_bit_get(bits, c - 'a' + 'A')) {
+				rs_bit_set(bits, c);
+				rs_bit_set(bits, c - 'a' + 'A');
+			}
+		}
+	}
+
+	if (neg)
+		for (c = 0; c < RS_CSET_LONGS; c++)
+			bits[c] = ~bits[c];
+
+	cset = regset_cset(ps->set, bits);
+	if (cset < 0)
+		return -1;
+
+	s = regset_new_nstate(ps, REGSET_N_CHAR, 0, -1, cset);
+	if (s < 0)
+		return -1;
+
+	f->start = s;
+	f->out = rs_slot(s, 0);
+	return 0;
+}
+
+/* Parses a bracket expression. Backslashes, character classes, equivalence
+ * classes, collating symbols and ranges out of ASCII are not supported since
+ * the POSIX and PCRE libraries don't agree on them.
+ */
+static int regset_parse_bracket(struct regset_parser *ps, struct regset_frag *f)
+{
+	unsigned long bits[RS_CSET_LONGS] = { 0 };
+	const char *p = ps->p + 1;
+	int neg = 0, first = 1;
+	int lo, hi, c;
+
+	if (*p == '^') {
+		neg = 1;
+		p++;
+	}
+
+	while (1) {
+		lo = (unsigned char)*p;
+		if (!lo || lo == '\\')
+			return -1;
+		if (lo == ']' && !first)
+			break;
+		if (lo == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+			return -1;
+
+		hi = lo;
+		p++;
+		if (*p == '-' && p[1] && p[1] != ']') {
+			hi = (unsigned char)p[1];
+			if (hi == '\\' || hi == '[' || hi < lo || hi >= 0x80)
+				return -1;
+			p += 2;
+		}
+
+		for (c = lo; c <= hi; c++)
+			rs_bit_set(bits, c);
+		first = 0;
+	}
+
+	ps->p = p + 1;
+	return regset_char_frag(ps, bits, neg, f);
+}
+
+/* Parses an escaped character. Only \w, \s (and \d with PCRE) and their
+ * negations are supported among the alphanumerical ones.
+ */
+static int regset_parse_escape(struct regset_parser *ps, struct regset_frag *f)
+{
+	unsigned long bits[RS_CSET_LONGS] = { 0 };
+	int c = (unsigned char)ps->p[1];
+	int neg = 0, i;
+
+	switch (c) {
+	case 0:
+		return -1;
+	/* GNU word and buffer anchors */
+	case '<': case '>': case '`': case '\'':
+		return -1;
+	case 'W':
+		neg = 1;
+		/* fall through */
+	case 'w':
+		for (i = 0; i < 256; i++)
+			if (isalnum(i) || i == '_')
+				rs_bit_set(bits, i);
+		break;
+	case 'S':
+		neg = 1;
+		/* fall through */
+	case 's':
+		for (i = 0; i < 256; i++)
+			if (isspace(i))
+				rs_bit_set(bits, i);
+		break;
+#if defined(USE_PCRE) || defined(USE_PCRE2)
+	case 'D':
+		neg = 1;
+		/* fall through */
+	case 'd':
+		for (i = '0'; i <= '9'; i++)
+			rs_bit_set(bits, i);
+		break;
+#endif
+	default:
+		if (isalnum(c))
+			return -1;
+		rs_bit_set(bits, c);
+		break;
+	}
+
+	ps->p += 2;
+	return regset_char_frag(ps, bits, neg, f);
+}
+
+static int regset_parse_alt(struct regset_parser *ps, struct regset_frag *f);
+
+/* Tells if nothing may be matched after position <p> of an expression, which
+ * is then only followed by the ends of its groups and by other alternatives.
+ */
+static int regset_at_end(const char *p)
+{
+	int depth;
+
+	while (1) {
+		if (!*p)
+			return 1;
+
+		if (*p == ')') {
+			p++;
+			if (*p == '*' || *p == '+' || *p == '?' || *p == '{')
+				return 0;
+			continue;
+		}
+
+		if (*p != '|')
+			return 0;
+
+		/* skip the other alternatives of the current group */
+		for (depth = 0; *p; p++) {
+			if (*p == '\\' && p[1])
+				p++;
+			else if (*p == '[') {
+				p++;
+				if (*p == '^')
+					p++;
+				if (*p == ']')
+					p++;
+				while (*p && *p != ']')
+					p++;
+				if (!*p)
+					return 0;
+			}
+			else if (*p == '(')
+				depth++;
+			else if (*p == ')' && !depth--)
+				break;
+		}
+	}
+}
+
+/* Parses one atom of an expression. */
+static int regset_parse_atom(struct regset_parser *ps, struct regset_frag *f)
+{
+	unsigned long bits[RS_CSET_LONGS] = { 0 };
+	int c = (unsigned char)*ps->p;
+	int s;
+
+	switch (c) {
+	case '(':
+		/* PCRE extensions */
+		if (ps->p[1] == '?')
+			return -1;
+		ps->p++;
+		if (regset_parse_alt(ps, f) < 0 || *ps->p != ')')
+			return -1;
+		ps->p++;
+		return 0;
+
+	case '[':
+		return regset_parse_bracket(ps, f);
+
+	case '\\':
+		return regset_parse_escape(ps, f);
+
+	case '.':
+		ps->p++;
+		memset(bits, 0xff, sizeof(bits));
+#if defined(USE_PCRE) || defined(USE_PCRE2)
+		bits['\n' / RS_LONG_BITS] &= ~(1UL << ('\n' % RS_LONG_BITS));
+#endif
+		return regset_char_frag(ps, bits, 0, f);
+
+	case '^':
+	case '$':
+		/* the libraries don't agree on anchors which are not at the
+		 * beginning or at the end of the expression.
+		 */
+		if (c == '^' ? !ps->at_start : !regset_at_end(ps->p + 1))
+			return -1;
+		ps->p++;
+		ps->anchors++;
+		s = regset_new_nstate(ps, c == '^' ? REGSET_N_BOL : REGSET_N_EOL, 0, -1, 0);
+		if (s < 0)
+			return -1;
+		f->start = s;
+		f->out = rs_slot(s, 0);
+		return 0;
+
+	case 0: case '*': case '+': case '?': case '{': case ')': case '|':
+		return -1;
+
+	default:
+		ps->p++;
+		rs_bit_set(bits, c);
+		return regset_char_frag(ps, bits, 0, f);
+	}
+}
+
+/* Makes <f> optional, repeated at least once or repeated any number of times
+ * depending on <op> ('?', '+' or '*'). Returns 0 on success, -1 on failure.
+ */
+static int regset_quantify(struct regset_parser *ps, struct regset_frag *f, int op)
+{
+	int s = regset_new_nstate(ps, REGSET_N_SPLIT, f->start, 0, 0);
+
+	if (s < 0)
+		return -1;
+
+	if (op == '?') {
+		f->out = regset_append(ps->set, f->out, rs_slot(s, 1));
+		f->start = s;
+		return 0;
+	}
+
+	regset_patch(ps->set, f->out, s);
+	if (op == '*')
+		f->start = s;
+	f->out = rs_slot(s, 1);
+	return 0;
+}
+
+/* Builds <min> to <max> (-1 for no limit) repetitions of the atom starting at
+ * <atom>, whose first copy is <f>, by parsing it again for each new copy.
+ */
+static int regset_repeat(struct regset_parser *ps, const char *atom, struct regset_frag *f, long min, long max)
+{
+	const char *end = ps->p;
+	struct regset_frag res, copy;
+	int i, have = 0, used = 0, s;
+
+	for (i = 0; max < 0 ? i < MAX(min, 1) : i < max; i++) {
+		if (!used) {
+			copy = *f;
+			used = 1;
+		}
+		else {
+			ps->p = atom;
+			if (regset_parse_atom(ps, &copy) < 0)
+				return -1;
+		}
+
+		if (max < 0 && i == MAX(min, 1) - 1) {
+			if (regset_quantify(ps, &copy, min ? '+' : '*') < 0)
+				return -1;
+		}
+		else if (i >= min) {
+			if (regset_quantify(ps, &copy, '?') < 0)
+				return -1;
+		}
+
+		if (!have)
+			res = copy;
+		else {
+			regset_patch(ps->set, res.out, copy.start);
+			res.out = copy.out;
+		}
+		have = 1;
+	}
+
+	if (!have) {
+		/* x{0} matches the empty string */
+		s = regset_new_nstate(ps, REGSET_N_EMPTY, 0, -1, 0);
+		if (s < 0)
+			return -1;
+		res.start = s;
+		res.out = rs_slot(s, 0);
+	}
+
+	ps->p = end;
+	*f = res;
+	return 0;
+}
+
+/* Parses an atom followed by its quantifier if any. */
+static int regset_parse_repeat(struct regset_parser *ps, struct regset_frag *f)
+{
+	const char *atom = ps->p;
+	int anchors = ps->anchors;
+	long min, max;
+	char *end;
+
+	if (regset_parse_atom(ps, f) < 0)
+		return -1;
+
+	switch (*ps->p) {
+	case '*':
+		min = 0; max = -1;
+		break;
+	case '+':
+		min = 1; max = -1;
+		break;
+	case '?':
+		min = 0; max = 1;
+		break;
+	case '{':
+		if (!isdigit((unsigned char)ps->p[1]))
+			return -1;
+		min = max = strtol(ps->p + 1, &end, 10);
+		if (*end == ',') {
+			max = -1;
+			if (isdigit((unsigned char)end[1]))
+				max = strtol(end + 1, &end, 10);
+			else
+				end++;
+		}
+		if (*end != '}' || min > REGSET_MAX_REPEAT || max > REGSET_MAX_REPEAT ||
+		    (max >= 0 && max < min))
+			return -1;
+		ps->p = end;
+		break;
+	default:
+		return 0;
+	}
+	ps->p++;
+
+	/* anchors cannot be repeated */
+	if (ps->anchors != anchors)
+		return -1;
+
+	/* a second quantifier makes the first one lazy with PCRE, or applies
+	 * to the repeated atom with POSIX. Both only accept the same subjects
+	 * for "*?" and "??".
+	 */
+	if (*ps->p == '?' && (ps->p[-1] == '*' || ps->p[-1] == '?'))
+		ps->p++;
+	if (*ps->p == '*' || *ps->p == '+' || *ps->p == '?' || *ps->p == '{')
+		return -1;
+
+	if (min == 0 && max == 1)
+		return regset_quantify(ps, f, '?');
+	if (min <= 1 && max < 0)
+		return regset_quantify(ps, f, min ? '+' : '*');
+	return regset_repeat(ps, atom, f, min, max);
+}
+
+/* Parses a concatenation of atoms. Empty ones are not supported. */
+static int regset_parse_concat(struct regset_parser *ps, struct regset_frag *f)
+{
+	struct regset_frag next;
+	int start = ps->at_start;
+	int first = 1;
+
+	while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+		ps->at_start = first && start;
+		if (regset_parse_repeat(ps, first ? f : &next) < 0)
+			return -1;
+		if (!first) {
+			regset_patch(ps->set, f->out, next.start);
+			f->out = next.out;
+		}
+		first = 0;
+	}
+	return first ? -1 : 0;
+}
+
+/* Parses alternations of concatenations. */
+static int regset_parse_alt(struct regset_parser *ps, struct regset_frag *f)
+{
+	struct regset_frag next;
+	int start = ps->at_start;
+	int s;
+
+	if (regset_parse_concat(ps, f) < 0)
+		return -1;
+
+	while (*ps->p == '|') {
+		ps->p++;
+		ps->at_start = start;
+		if (regset_parse_concat(ps, &next) < 0)
+			return -1;
+		s = regset_new_nstate(ps, REGSET_N_SPLIT, f->start, next.start, 0);
+		if (s < 0)
+			return -1;
+		f->start = s;
+		f->out = regset_append(ps->set, f->out, next.out);
+	}
+	return 0;
+}
+
+/* Allocates an empty set. Expressions are case-insensitive if <icase> is
+ * set. Returns NULL on memory allocation failure.
+ */
+struct regset *regset_new(int icase)
+{
+	struct regset *set = calloc(1, sizeof(*set));
+	int i;
+
+	if (!set)
+		return NULL;
+
+	set->icase = icase;
+	for (i = 0; i < 256; i++)
+		set->single_cset[i] = -1;
+	HA_SPIN_INIT(&set->lock);
+	return set;
+}
+
+/* Adds expression <str> to set <set> with id <id>, which is reported when it
+ * matches. Returns 1 if it was added, or 0 if it uses an unsupported
+ * construct or if there is no more room for it, in which case the set is left
+ * unchanged. Expressions are expected to be valid for the regex library.
+ */
+int regset_add(struct regset *set, const char *str, unsigned int id)
+{
+	struct regset_parser ps = { .set = set, .p = str, .id = id, .at_start = 1 };
+	unsigned int nb_nstates = set->nb_nstates;
+	unsigned int nb_csets = set->nb_csets;
+	struct regset_frag f;
+	int s, i;
+
+	if (set->start || !str)
+		return 0;
+
+	if (regset_parse_alt(&ps, &f) < 0 || *ps.p)
+		goto fail;
+
+	s = regset_new_nstate(&ps, REGSET_N_MATCH, -1, -1, 0);
+	if (s < 0)
+		goto fail;
+	regset_patch(set, f.out, s);
+
+	if (set->nb_starts >= set->alloc_starts) {
+		unsigned int alloc = set->alloc_starts ? set->alloc_starts * 2 : 64;
+		int *ptr = realloc(set->starts, alloc * sizeof(*ptr));
+
+		if (!ptr)
+			goto fail;
+		set->starts = ptr;
+		set->alloc_starts = alloc;
+	}
+	set->starts[set->nb_starts++] = f.start;
+	set->nb_patterns++;
+	return 1;
+
+  fail:
+	set->nb_nstates = nb_nstates;
+	set->nb_csets = nb_csets;
+	for (i = 0; i < 256; i++)
+		if (set->single_cset[i] >= (int)nb_csets)
+			set->single_cset[i] = -1;
+	return 0;
+}
+
+/* Prepares set <set> for regset_exec() once all the expressions were added.
+ * Returns 1 on success, otherwise 0 with <err> filled.
+ */
+int regset_compile(struct regset *set, char **err)
+{
+	uint64_t start = now_mono_time();
+	short remap[512];
+	unsigned int i, n, c;
+
+	if (!set->nb_starts) {
+		memprintf(err, "no expression in the set");
+		return 0;
+	}
+
+	/* group the bytes that no char set tells apart */
+	memset(set->bclass, 0, sizeof(set->bclass));
+	set->nb_classes = 1;
+	for (i = 0; i < set->nb_csets; i++) {
+		memset(remap, 0xff, sizeof(remap));
+		n = 0;
+		for (c = 0; c < 256; c++) {
+			unsigned int key = set->bclass[c] * 2 + regset_cset_has(set, i, c);
+
+			if (remap[key] < 0)
+				remap[key] = n++;
+			set->bclass[c] = remap[key];
+		}
+		set->nb_classes = n;
+	}
+	for (c = 256; c--; )
+		set->brep[set->bclass[c]] = c;
+
+	if (!regset_alloc_work(set->nb_nstates))
+		goto oom;
+
+	/* the restart set, and all the states it goes through */
+	set->in_base = calloc(set->nb_nstates, sizeof(*set->in_base));
+	if (!set->in_base)
+		goto oom;
+
+	regset_new_gen();
+	for (i = n = 0; i < set->nb_starts; i++)
+		n = regset_closure(set, set->starts[i], 0, rs_list[0], n);
+	for (i = 0; i < set->nb_nstates; i++)
+		set->in_base[i] = rs_mark[i] == rs_gen;
+
+	set->base = malloc(MAX(n, 1) * sizeof(*set->base));
+	if (!set->base)
+		goto oom;
+	memcpy(set->base, rs_list[0], n * sizeof(*set->base));
+	set->nb_base = n;
+	regset_eval(set, set->base, n, 0, &set->base_match, &set->base_eol_match, &set->base_minlive);
+
+	/* the initial state adds what is reachable at the beginning only */
+	regset_new_gen();
+	for (i = n = 0; i < set->nb_starts; i++)
+		n = regset_closure(set, set->starts[i], RS_BOL, rs_list[1], n);
+	for (i = c = 0; i < n; i++)
+		if (!set->in_base[rs_list[1][i]])
+			rs_list[1][c++] = rs_list[1][i];
+
+	set->start = regset_dfa_state(set, rs_list[1], c, 1);
+	if (!set->start)
+		goto oom;
+
+	set->build_time = (now_mono_time() - start) / 1000;
+	return 1;
+
+  oom:
+	memprintf(err, "out of memory while compiling the regex set");
+	return 0;
+}
+
+void regset_free(struct regset *set)
+{
+	struct regset_dstate *d, *next;
+	int i;
+
+	if (!set)
+		return;
+
+	for (i = 0; i < (1 << REGSET_HASH_BITS); i++) {
+		for (d = set->htable[i]; d; d = next) {
+			next = d->hnext;
+			free(d);
+		}
+	}
+	free(set->nstates);
+	free(set->csets);
+	free(set->starts);
+	free(set->in_base);
+	free(set->base);
+	HA_SPIN_DESTROY(&set->lock);
+	free(set);
+}
+
+REGISTER_PER_THREAD_FREE(regset_free_work);
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
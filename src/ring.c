@@ -51,6 +51,8 @@ struct ring *ring_new(size_t size)
 	LIST_INIT(&ring->waiters);
 	ring->readers_count = 0;
 	ring->ofs = 0;
+	ring->committed = 1;
+	ring->reserved = 1;
 	ring->buf = b_make(area, size, 0, 0);
 	/* write the initial RC byte */
 	b_putchr(&ring->buf, 0);
@@ -77,7 +79,16 @@ struct ring *ring_resize(struct ring *ring, size_t size)
 	if (!area)
 		return NULL;
 
-	HA_RWLOCK_WRLOCK(LOGSRV_LOCK, &ring->lock);
+	/* wait for writers still copying their messages into the old area,
+	 * which they do without the lock.
+	 */
+	while (1) {
+		HA_RWLOCK_WRLOCK(LOGSRV_LOCK, &ring->lock);
+		if (HA_ATOMIC_LOAD(&ring->committed) == ring->ofs + b_data(&ring->buf))
+			break;
+		HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
+		ha_thread_relax();
+	}
 
 	/* recheck the buffer's size, it may have changed during the malloc */
 	if (b_size(&ring->buf) < size) {
@@ -103,20 +114,83 @@ void ring_free(struct ring *ring)
 	free(ring);
 }
 
+/* Returns the position in the storage area of <blk> of the byte at absolute
+ * offset <ofs>, knowing that the tail of <blk> is at absolute offset <end>-1.
+ * <ofs> must not be more than the area's size away from <end>.
+ */
+static inline size_t ring_pos(const struct buffer *blk, size_t end, size_t ofs)
+{
+	if (ofs >= end)
+		return (b_tail_ofs(blk) + 1 + ofs - end) % b_size(blk);
+	return (b_tail_ofs(blk) + 1 + b_size(blk) - (end - ofs) % b_size(blk)) % b_size(blk);
+}
+
+/* Publishes the ready messages of ring <ring> which follow the published ones,
+ * until the end of the reserved ones or until one is still being written, in
+ * which case its writer will publish it and the ready ones after it. <blk> is
+ * an empty buffer whose tail is the read counter which precedes <end> in the
+ * ring's storage area, and is only used to locate the messages.
+ */
+static void ring_publish(struct ring *ring, const struct buffer *blk, size_t end)
+{
+	struct buffer view;
+	uint64_t msg_len;
+	size_t committed, reserved, next, len;
+
+	committed = HA_ATOMIC_LOAD(&ring->committed);
+	while (1) {
+		/* the reserved messages have their length and their read
+		 * counter set before <reserved> is advanced past them.
+		 */
+		reserved = HA_ATOMIC_LOAD(&ring->reserved);
+		if (committed >= reserved)
+			break;
+
+		/* the storage area cannot be moved nor the messages which
+		 * follow <committed> be deleted until they are published,
+		 * so unless <committed> is already outdated, <view> starts
+		 * with the first unpublished message.
+		 */
+		if (reserved - committed <= b_size(blk)) {
+			view = b_make(b_orig(blk), b_size(blk), ring_pos(blk, end, committed),
+			              reserved - committed);
+			len = b_peek_varint(&view, 0, &msg_len);
+			if (len && len + msg_len + 1 <= b_data(&view) &&
+			    (unsigned char)HA_ATOMIC_LOAD(b_peek(&view, len + msg_len)) != RING_BUSY) {
+				if (HA_ATOMIC_CAS(&ring->committed, &committed, committed + len + msg_len + 1))
+					committed += len + msg_len + 1;
+				continue;
+			}
+		}
+
+		/* this message is not ready. Its writer marks it ready before
+		 * loading <committed>, and we loaded its read counter after
+		 * advancing <committed>, so its writer will see our progress
+		 * and publish it.
+		 */
+		next = HA_ATOMIC_LOAD(&ring->committed);
+		if (next == committed)
+			break;
+		committed = next;
+	}
+}
+
 /* Tries to send <npfx> parts from <prefix> followed by <nmsg> parts from <msg>
  * to ring <ring>. The message is sent atomically. It may be truncated to
  * <maxlen> bytes if <maxlen> is non-null. There is no distinction between the
  * two lists, it's just a convenience to help the caller prepend some prefixes
- * when necessary. It takes the ring's write lock to make sure no other thread
- * will touch the buffer during the update. Returns the number of bytes sent,
- * or <=0 on failure.
+ * when necessary. It only takes the ring's write lock to reserve room for the
+ * message, which is then copied in parallel with other writers, and published
+ * in reservation order. Returns the number of bytes sent, or <=0 on failure.
  */
 ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], size_t npfx, const struct ist msg[], size_t nmsg)
 {
 	struct buffer *buf = &ring->buf;
+	struct buffer blk;
 	struct appctx *appctx;
 	size_t totlen = 0;
 	size_t lenlen;
+	size_t start;
 	uint64_t dellen;
 	int dellenlen;
 	ssize_t sent = 0;
@@ -125,10 +199,9 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 	/* we have to find some room to add our message (the buffer is
 	 * never empty and at least contains the previous counter) and
 	 * to update both the buffer contents and heads at the same
-	 * time (it's doable using atomic ops but not worth the
-	 * trouble, let's just lock). For this we first need to know
-	 * the total message's length. We cannot measure it while
-	 * copying due to the varint encoding of the length.
+	 * time, which is done under the lock. For this we first need
+	 * to know the total message's length. We cannot measure it
+	 * while copying due to the varint encoding of the length.
 	 */
 	for (i = 0; i < npfx; i++)
 		totlen += pfx[i].len;
@@ -159,12 +232,33 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 			goto done_buf;
 		BUG_ON(b_data(buf) < 1 + dellenlen + dellen);
 
+		/* another writer is still copying this message. It will
+		 * publish it without the lock, but we must not wait for it
+		 * with the lock held, so let's release it and check again.
+		 */
+		if (ring->ofs + 1 + dellenlen + dellen >= HA_ATOMIC_LOAD(&ring->committed)) {
+			HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
+			ha_thread_relax();
+			HA_RWLOCK_WRLOCK(LOGSRV_LOCK, &ring->lock);
+			continue;
+		}
+
 		b_del(buf, 1 + dellenlen + dellen);
 		ring->ofs += 1 + dellenlen + dellen;
 	}
 
-	/* OK now we do have room */
+	/* OK now we do have room. Let's reserve it with the message's
+	 * length and the new read counter, which remains at RING_BUSY
+	 * until the message is ready. The payload will be copied once
+	 * the lock is released.
+	 */
+	start = ring->ofs + b_data(buf);
 	__b_put_varint(buf, totlen);
+	blk = b_make(b_orig(buf), b_size(buf), b_tail_ofs(buf), 0);
+	b_add(buf, totlen);
+	*b_tail(buf) = RING_BUSY; buf->data++; // new read counter
+	HA_ATOMIC_STORE(&ring->reserved, ring->ofs + b_data(buf));
+	HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
 
 	totlen = 0;
 	for (i = 0; i < npfx; i++) {
@@ -173,7 +267,7 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 		if (len + totlen > maxlen)
 			len = maxlen - totlen;
 		if (len)
-			__b_putblk(buf, pfx[i].ptr, len);
+			__b_putblk(&blk, pfx[i].ptr, len);
 		totlen += len;
 	}
 
@@ -183,16 +277,27 @@ ssize_t ring_write(struct ring *ring, size_t maxlen, const struct ist pfx[], siz
 		if (len + totlen > maxlen)
 			len = maxlen - totlen;
 		if (len)
-			__b_putblk(buf, msg[i].ptr, len);
+			__b_putblk(&blk, msg[i].ptr, len);
 		totlen += len;
 	}
 
-	*b_tail(buf) = 0; buf->data++;; // new read counter
 	sent = lenlen + totlen + 1;
 
+	/* mark the message as ready, and publish it as well as all the
+	 * ready ones after it if all the previous ones were published.
+	 * Otherwise the writer of the first unpublished one will do it.
+	 */
+	HA_ATOMIC_STORE(b_tail(&blk), 0);
+	ring_publish(ring, &blk, start + sent);
+
 	/* notify potential readers */
-	list_for_each_entry(appctx, &ring->waiters, wait_entry)
-		appctx_wakeup(appctx);
+	if (!LIST_ISEMPTY(&ring->waiters)) {
+		HA_RWLOCK_RDLOCK(LOGSRV_LOCK, &ring->lock);
+		list_for_each_entry(appctx, &ring->waiters, wait_entry)
+			appctx_wakeup(appctx);
+		HA_RWLOCK_RDUNLOCK(LOGSRV_LOCK, &ring->lock);
+	}
+	return sent;
 
  done_buf:
 	HA_RWLOCK_WRUNLOCK(LOGSRV_LOCK, &ring->lock);
@@ -275,7 +380,7 @@ int cli_io_handler_show_ring(struct appctx *appctx)
 	struct buffer *buf = &ring->buf;
 	size_t ofs = appctx->ctx.cli.o0;
 	uint64_t msg_len;
-	size_t len, cnt;
+	size_t len, cnt, data;
 	int ret;
 
 	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
@@ -300,7 +405,7 @@ int cli_io_handler_show_ring(struct appctx *appctx)
 
 		/* going to the end means looking at tail-1 */
 		if (appctx->ctx.cli.i0 & 2)
-			ofs += b_data(buf) - 1;
+			ofs += ring_data(ring) - 1;
 
 		HA_ATOMIC_ADD(b_peek(buf, ofs), 1);
 		ofs += ring->ofs;
@@ -318,13 +423,14 @@ int cli_io_handler_show_ring(struct appctx *appctx)
 	 * stop before the end (ret=0).
 	 */
 	ret = 1;
-	while (ofs + 1 < b_data(buf)) {
+	data = ring_data(ring);
+	while (ofs + 1 < data) {
 		cnt = 1;
 		len = b_peek_varint(buf, ofs + cnt, &msg_len);
 		if (!len)
 			break;
 		cnt += len;
-		BUG_ON(msg_len + ofs + cnt + 1 > b_data(buf));
+		BUG_ON(msg_len + ofs + cnt + 1 > data);
 
 		if (unlikely(msg_len + 1 > b_size(&trash))) {
 			/* too large a message to ever fit, let's skip it */
@@ -5211,10 +5211,9 @@ static void srv_cleanup_connections(struct server *srv)
 		did_remove = 0;
 		HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
 		for (j = 0; j < srv->curr_idle_conns; j++) {
-			conn = MT_LIST_POP(&srv->idle_conns[i], struct connection *, list);
+			conn = conn_take_oldest_idle(&srv->idle_conns[i]);
 			if (!conn)
-				conn = MT_LIST_POP(&srv->safe_conns[i],
-				                   struct connection *, list);
+				conn = conn_take_oldest_idle(&srv->safe_conns[i]);
 			if (!conn)
 				break;
 			did_remove = 1;
@@ -5283,10 +5282,9 @@ struct task *srv_cleanup_idle_connections(struct task *task, void *context, unsi
 			           curr_idle + 1;
 			HA_SPIN_LOCK(OTHER_LOCK, &toremove_lock[i]);
 			for (j = 0; j < max_conn; j++) {
-				struct connection *conn = MT_LIST_POP(&srv->idle_conns[i], struct connection *, list);
+				struct connection *conn = conn_take_oldest_idle(&srv->idle_conns[i]);
 				if (!conn)
-					conn = MT_LIST_POP(&srv->safe_conns[i],
-					                   struct connection *, list);
+					conn = conn_take_oldest_idle(&srv->safe_conns[i]);
 				if (!conn)
 					break;
 				did_remove = 1;
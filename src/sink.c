@@ -344,7 +344,7 @@ static void sink_forward_io_handler(struct appctx *appctx)
 	struct ring *ring = sink->ctx.ring;
 	struct buffer *buf = &ring->buf;
 	uint64_t msg_len;
-	size_t len, cnt, ofs;
+	size_t len, cnt, ofs, data;
 	int ret = 0;
 
 	/* if stopping was requested, close immediatly */
@@ -418,13 +418,14 @@ static void sink_forward_io_handler(struct appctx *appctx)
 	 */
 	if (si_opposite(si)->state == SI_ST_EST) {
 		ret = 1;
-		while (ofs + 1 < b_data(buf)) {
+		data = ring_data(ring);
+		while (ofs + 1 < data) {
 			cnt = 1;
 			len = b_peek_varint(buf, ofs + cnt, &msg_len);
 			if (!len)
 				break;
 			cnt += len;
-			BUG_ON(msg_len + ofs + cnt + 1 > b_data(buf));
+			BUG_ON(msg_len + ofs + cnt + 1 > data);
 
 			if (unlikely(msg_len + 1 > b_size(&trash))) {
 				/* too large a message to ever fit, let's skip it */
@@ -483,7 +484,7 @@ static void sink_forward_oc_io_handler(struct appctx *appctx)
 	struct ring *ring = sink->ctx.ring;
 	struct buffer *buf = &ring->buf;
 	uint64_t msg_len;
-	size_t len, cnt, ofs;
+	size_t len, cnt, ofs, data;
 	int ret = 0;
 	char *p;
 
@@ -558,13 +559,14 @@ static void sink_forward_oc_io_handler(struct appctx *appctx)
 	 */
 	if (si_opposite(si)->state == SI_ST_EST) {
 		ret = 1;
-		while (ofs + 1 < b_data(buf)) {
+		data = ring_data(ring);
+		while (ofs + 1 < data) {
 			cnt = 1;
 			len = b_peek_varint(buf, ofs + cnt, &msg_len);
 			if (!len)
 				break;
 			cnt += len;
-			BUG_ON(msg_len + ofs + cnt + 1 > b_data(buf));
+			BUG_ON(msg_len + ofs + cnt + 1 > data);
 
 			chunk_reset(&trash);
 			p = ulltoa(msg_len, trash.area, b_size(&trash));
@@ -251,6 +251,8 @@ const struct name_desc stat_fields[ST_F_TOTAL_FIELDS] = {
 	[ST_F_RT_MAX]                        = { .name = "rtime_max",                   .desc = "Maximum observed time spent waiting for a server response, in milliseconds (backend/server)" },
 	[ST_F_TT_MAX]                        = { .name = "ttime_max",                   .desc = "Maximum observed total request+response time (request+queue+connect+response+processing), in milliseconds (backend/server)" },
 	[ST_F_EINT]                          = { .name = "eint",                        .desc = "Total number of internal errors since process started"},
+	[ST_F_IDLE_HITS]                     = { .name = "idle_hits",                   .desc = "Total number of idle connection pool lookups which found a connection with the same parameters (SNI, source, PROXY header) on this backend/server" },
+	[ST_F_IDLE_MISS]                     = { .name = "idle_miss",                   .desc = "Total number of idle connection pool lookups which found no connection with the same parameters on this backend/server" },
 };
 
 /* one line of info */
@@ -1019,6 +1021,7 @@ static int stats_dump_fields_html(struct buffer *out,
 			chunk_appendf(out,
 			              "<tr><th>New connections:</th><td>%s</td></tr>"
 			              "<tr><th>Reused connections:</th><td>%s</td><td>(%d%%)</td></tr>"
+			              "<tr><th>Idle pool hits:</th><td>%s</td><td>(%d%%)</td></tr>"
 			              "<tr><th>Cum. HTTP requests:</th><td>%s</td></tr>"
 			              "<tr><th>- HTTP 1xx responses:</th><td>%s</td><td>(%d%%)</td></tr>"
 			              "<tr><th>- HTTP 2xx responses:</th><td>%s</td><td>(%d%%)</td></tr>"
@@ -1033,6 +1036,9 @@ static int stats_dump_fields_html(struct buffer *out,
 			              U2H(stats[ST_F_REUSE].u.u64),
 			              (stats[ST_F_CONNECT].u.u64 + stats[ST_F_REUSE].u.u64) ?
 			              (int)(100 * stats[ST_F_REUSE].u.u64 / (stats[ST_F_CONNECT].u.u64 + stats[ST_F_REUSE].u.u64)) : 0,
+			              U2H(stats[ST_F_IDLE_HITS].u.u64),
+			              (stats[ST_F_IDLE_HITS].u.u64 + stats[ST_F_IDLE_MISS].u.u64) ?
+			              (int)(100 * stats[ST_F_IDLE_HITS].u.u64 / (stats[ST_F_IDLE_HITS].u.u64 + stats[ST_F_IDLE_MISS].u.u64)) : 0,
 			              U2H(stats[ST_F_REQ_TOT].u.u64),
 			              U2H(stats[ST_F_HRSP_1XX].u.u64), stats[ST_F_REQ_TOT].u.u64 ?
 			              (int)(100 * stats[ST_F_HRSP_1XX].u.u64 / stats[ST_F_REQ_TOT].u.u64) : 0,
@@ -1257,6 +1263,7 @@ static int stats_dump_fields_html(struct buffer *out,
 			chunk_appendf(out,
 			              "<tr><th>New connections:</th><td>%s</td></tr>"
 			              "<tr><th>Reused connections:</th><td>%s</td><td>(%d%%)</td></tr>"
+			              "<tr><th>Idle pool hits:</th><td>%s</td><td>(%d%%)</td></tr>"
 			              "<tr><th>Cum. HTTP requests:</th><td>%s</td></tr>"
 			              "<tr><th>- HTTP 1xx responses:</th><td>%s</td></tr>"
 			              "<tr><th>- HTTP 2xx responses:</th><td>%s</td></tr>"
@@ -1274,6 +1281,9 @@ static int stats_dump_fields_html(struct buffer *out,
 			              U2H(stats[ST_F_REUSE].u.u64),
 			              (stats[ST_F_CONNECT].u.u64 + stats[ST_F_REUSE].u.u64) ?
 			              (int)(100 * stats[ST_F_REUSE].u.u64 / (stats[ST_F_CONNECT].u.u64 + stats[ST_F_REUSE].u.u64)) : 0,
+			              U2H(stats[ST_F_IDLE_HITS].u.u64),
+			              (stats[ST_F_IDLE_HITS].u.u64 + stats[ST_F_IDLE_MISS].u.u64) ?
+			              (int)(100 * stats[ST_F_IDLE_HITS].u.u64 / (stats[ST_F_IDLE_HITS].u.u64 + stats[ST_F_IDLE_MISS].u.u64)) : 0,
 			              U2H(stats[ST_F_REQ_TOT].u.u64),
 			              U2H(stats[ST_F_HRSP_1XX].u.u64),
 			              U2H(stats[ST_F_HRSP_2XX].u.u64),
@@ -1696,6 +1706,8 @@ int stats_fill_sv_stats(struct proxy *px, struct server *sv, int flags,
 	stats[ST_F_EINT]     = mkf_u64(FN_COUNTER, sv->counters.internal_errors);
 	stats[ST_F_CONNECT]  = mkf_u64(FN_COUNTER, sv->counters.connect);
 	stats[ST_F_REUSE]    = mkf_u64(FN_COUNTER, sv->counters.reuse);
+	stats[ST_F_IDLE_HITS] = mkf_u64(FN_COUNTER, sv->counters.idle_hits);
+	stats[ST_F_IDLE_MISS] = mkf_u64(FN_COUNTER, sv->counters.idle_miss);
 
 	/* status */
 	fld_status = chunk_newstr(out);
@@ -1905,6 +1917,8 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_EINT]     = mkf_u64(FN_COUNTER, px->be_counters.internal_errors);
 	stats[ST_F_CONNECT]  = mkf_u64(FN_COUNTER, px->be_counters.connect);
 	stats[ST_F_REUSE]    = mkf_u64(FN_COUNTER, px->be_counters.reuse);
+	stats[ST_F_IDLE_HITS] = mkf_u64(FN_COUNTER, px->be_counters.idle_hits);
+	stats[ST_F_IDLE_MISS] = mkf_u64(FN_COUNTER, px->be_counters.idle_miss);
 	stats[ST_F_STATUS]   = mkf_str(FO_STATUS, (px->lbprm.tot_weight > 0 || !px->srv) ? "UP" : "DOWN");
 	stats[ST_F_WEIGHT]   = mkf_u32(FN_AVG, (px->lbprm.tot_weight * px->lbprm.wmult + px->lbprm.wdiv - 1) / px->lbprm.wdiv);
 	stats[ST_F_ACT]      = mkf_u32(0, px->srv_act);
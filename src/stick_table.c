@@ -11,8 +11,12 @@
  *
  */
 
+#include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <common/config.h>
 #include <common/cfgparse.h>
@@ -26,18 +30,22 @@
 #include <ebmbtree.h>
 #include <ebsttree.h>
 
+#include <import/xxhash.h>
+
 #include <types/cli.h>
 #include <types/global.h>
 #include <types/stats.h>
 
 #include <proto/arg.h>
 #include <proto/cli.h>
+#include <proto/dict.h>
 #include <proto/http_rules.h>
 #include <proto/log.h>
 #include <proto/http_ana.h>
 #include <proto/proto_tcp.h>
 #include <proto/proxy.h>
 #include <proto/sample.h>
+#include <proto/signal.h>
 #include <proto/stream.h>
 #include <proto/stream_interface.h>
 #include <proto/stick_table.h>
@@ -78,12 +86,164 @@ struct stktable *stktable_find_by_name(const char *name)
 	return NULL;
 }
 
+/* Returns the 64-bit hash of the key of entry <ts> used to index the sketch
+ * of table <t>.
+ */
+static inline uint64_t stktable_sketch_hash(struct stktable *t, struct stksess *ts)
+{
+	size_t len = t->key_size;
+
+	if (t->type == SMP_T_STR)
+		len = strlen((char *)ts->key.key);
+	return XXH64(ts->key.key, len, 0);
+}
+
+/* Returns the address of the virtual stksess matching the cell of row <row>
+ * designated by hash <hash> in the sketch of table <t>, so that the regular
+ * data offsets apply to it.
+ */
+static inline void *stktable_sketch_cell(struct stktable *t, uint64_t hash, unsigned int row)
+{
+	unsigned int h1 = hash;
+	unsigned int h2 = (hash >> 32) | 1;
+	unsigned int col = (h1 + row * h2) % t->sketch.width;
+
+	return t->sketch.cells + ((size_t)row * t->sketch.width + col) * t->sketch.stride + t->data_size;
+}
+
+/* Merges the counters of entry <ts> which is about to leave table <t> into
+ * its cells of the sketch. Each cell keeps the highest value it was given
+ * (conservative update), so that the minimum over all rows always remains an
+ * upper bound of the real value. Rates are first rotated to the current date
+ * so that both counters share the same period. Must be called with the table
+ * locked.
+ */
+static void __stktable_sketch_flush(struct stktable *t, struct stksess *ts)
+{
+	uint64_t hash = stktable_sketch_hash(t, ts);
+	unsigned int row;
+	int type;
+
+	for (row = 0; row < t->sketch.depth; row++) {
+		void *cell = stktable_sketch_cell(t, hash, row);
+
+		for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+			void *src, *dst;
+
+			if (!t->data_ofs[type] || type == STKTABLE_DT_CONN_CUR)
+				continue;
+
+			src = __stktable_data_ptr(t, ts, type);
+			dst = cell + t->data_ofs[type];
+
+			switch (stktable_data_types[type].std_type) {
+			case STD_T_SINT:
+				if (*(int *)src > *(int *)dst)
+					*(int *)dst = *(int *)src;
+				break;
+			case STD_T_UINT:
+				if (*(unsigned int *)src > *(unsigned int *)dst)
+					*(unsigned int *)dst = *(unsigned int *)src;
+				break;
+			case STD_T_ULL:
+				if (*(unsigned long long *)src > *(unsigned long long *)dst)
+					*(unsigned long long *)dst = *(unsigned long long *)src;
+				break;
+			case STD_T_FRQP: {
+				struct freq_ctr_period *sf = src, *df = dst;
+
+				update_freq_ctr_period(sf, t->data_arg[type].u, 0);
+				update_freq_ctr_period(df, t->data_arg[type].u, 0);
+				if (!df->curr_ctr && !df->prev_ctr)
+					*df = *sf;
+				else {
+					df->curr_ctr = MAX(df->curr_ctr, sf->curr_ctr);
+					df->prev_ctr = MAX(df->prev_ctr, sf->prev_ctr);
+				}
+				break;
+			}
+			}
+		}
+	}
+}
+
+/* Initializes the counters of entry <ts> which is entering table <t> from
+ * the estimates found in the sketch, that is the lowest value over all rows.
+ * Returns non-zero if at least one estimate is not null. Must be called with
+ * the table locked.
+ */
+static int __stktable_sketch_load(struct stktable *t, struct stksess *ts)
+{
+	uint64_t hash = stktable_sketch_hash(t, ts);
+	unsigned int row;
+	int type, found = 0;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		void *dst, *best = NULL;
+		unsigned long long val, min = ~0ULL;
+
+		if (!t->data_ofs[type] || type == STKTABLE_DT_CONN_CUR)
+			continue;
+
+		for (row = 0; row < t->sketch.depth; row++) {
+			void *src = stktable_sketch_cell(t, hash, row) + t->data_ofs[type];
+
+			switch (stktable_data_types[type].std_type) {
+			case STD_T_SINT:
+				val = *(int *)src - (long long)INT_MIN;
+				break;
+			case STD_T_UINT:
+				val = *(unsigned int *)src;
+				break;
+			case STD_T_ULL:
+				val = *(unsigned long long *)src;
+				break;
+			case STD_T_FRQP:
+				val = read_freq_ctr_period(src, t->data_arg[type].u);
+				break;
+			default:
+				continue;
+			}
+			if (!best || val < min) {
+				best = src;
+				min = val;
+			}
+		}
+
+		if (!best)
+			continue;
+
+		dst = __stktable_data_ptr(t, ts, type);
+		switch (stktable_data_types[type].std_type) {
+		case STD_T_SINT:
+			*(int *)dst = *(int *)best;
+			found |= !!*(int *)dst;
+			break;
+		case STD_T_UINT:
+			*(unsigned int *)dst = *(unsigned int *)best;
+			found |= !!*(unsigned int *)dst;
+			break;
+		case STD_T_ULL:
+			*(unsigned long long *)dst = *(unsigned long long *)best;
+			found |= !!*(unsigned long long *)dst;
+			break;
+		case STD_T_FRQP:
+			*(struct freq_ctr_period *)dst = *(struct freq_ctr_period *)best;
+			found |= !!min;
+			break;
+		}
+	}
+	return found;
+}
+
 /*
  * Free an allocated sticky session <ts>, and decrease sticky sessions counter
  * in table <t>.
  */
 void __stksess_free(struct stktable *t, struct stksess *ts)
 {
+	if (t->sketch.cells)
+		__stktable_sketch_flush(t, ts);
 	t->current--;
 	pool_free(t->pool, (void *)ts - round_ptr_size(t->data_size));
 }
@@ -323,6 +483,21 @@ struct stksess *stktable_lookup_key(struct stktable *t, struct stktable_key *key
 
 	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
 	ts = __stktable_lookup_key(t, key);
+	if (!ts && t->sketch.cells) {
+		/* the key may only be known from the sketch, in which case an
+		 * entry is created again with the estimated counters.
+		 */
+		ts = __stksess_new(t, key);
+		if (ts) {
+			if (__stktable_sketch_load(t, ts))
+				__stktable_store(t, ts);
+			else {
+				t->current--;
+				pool_free(t->pool, (void *)ts - round_ptr_size(t->data_size));
+				ts = NULL;
+			}
+		}
+	}
 	if (ts)
 		ts->ref_cnt++;
 	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
@@ -489,6 +664,8 @@ struct stksess *__stktable_get_entry(struct stktable *table, struct stktable_key
 		ts = __stksess_new(table, key);
 		if (!ts)
 			return NULL;
+		if (table->sketch.cells)
+			__stktable_sketch_load(table, ts);
 		__stktable_store(table, ts);
 	}
 	return ts;
@@ -633,6 +810,13 @@ int stktable_init(struct stktable *t)
 
 		t->pool = create_pool("sticktables", sizeof(struct stksess) + round_ptr_size(t->data_size) + t->key_size, MEM_F_SHARED);
 
+		if (t->sketch.width) {
+			t->sketch.stride = round_ptr_size(t->data_size);
+			t->sketch.cells = calloc(t->sketch.depth, (size_t)t->sketch.width * t->sketch.stride);
+			if (!t->sketch.cells)
+				return 0;
+		}
+
 		t->exp_next = TICK_ETERNITY;
 		if ( t->expire ) {
 			t->exp_task = task_new(MAX_THREADS_MASK);
@@ -650,6 +834,691 @@ int stktable_init(struct stktable *t)
 	return 1;
 }
 
+/*
+ * Stick-table snapshots. The file starts with a fixed-size header followed by
+ * a payload made of the list of stored data types, then of the entries. All
+ * integers in the payload use the variable-length encoding of the peers
+ * protocol, and entries carry their key and data exactly as in a peers update
+ * message, except for dictionary entries which are stored by value. The header
+ * holds a checksum of the payload so that a truncated or corrupted file is
+ * never loaded.
+ */
+#define STKTABLE_SNAP_MAGIC      "HAPSTKT1"
+#define STKTABLE_SNAP_VERSION    1
+#define STKTABLE_SNAP_HDR_LEN    56
+#define STKTABLE_SNAP_BATCH      10000     /* entries dumped per task call */
+#define STKTABLE_SNAP_INT_MAXLEN 10        /* max length of an encoded integer */
+#define STKTABLE_SNAP_MIN_SIZE   (1 << 20) /* initial size of the temporary file */
+
+/* returns the wall clock date in milliseconds */
+static inline unsigned long long stktable_snapshot_date()
+{
+	return (unsigned long long)date.tv_sec * 1000 + date.tv_usec / 1000;
+}
+
+/* Makes sure there is room for <len> more bytes in the snapshot being dumped,
+ * extending and remapping the temporary file if needed. Returns 0 on success
+ * or -1 on failure.
+ */
+static int stktable_snapshot_reserve(struct stktable_snapshot *snap, size_t len)
+{
+	size_t size;
+	void *area;
+
+	if (snap->data + len <= snap->size)
+		return 0;
+
+	size = snap->size ? snap->size : STKTABLE_SNAP_MIN_SIZE;
+	while (size < snap->data + len)
+		size *= 2;
+
+	if (ftruncate(snap->fd, size) < 0)
+		return -1;
+
+	area = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, snap->fd, 0);
+	if (area == MAP_FAILED)
+		return -1;
+
+	if (snap->area)
+		munmap(snap->area, snap->size);
+	snap->area = area;
+	snap->size = size;
+	return 0;
+}
+
+/* Releases everything related to the snapshot being dumped for table <t>, and
+ * removes the temporary file. Must be called with the table lock held.
+ */
+static void stktable_snapshot_abort(struct stktable *t)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+
+	if (snap->cursor) {
+		snap->cursor->ref_cnt--;
+		snap->cursor = NULL;
+	}
+	if (snap->area)
+		munmap(snap->area, snap->size);
+	if (snap->fd >= 0)
+		close(snap->fd);
+	if (snap->tmpfile)
+		unlink(snap->tmpfile);
+	free(snap->tmpfile);
+	snap->tmpfile = NULL;
+	snap->area = NULL;
+	snap->size = snap->data = 0;
+	snap->entries = 0;
+	snap->fd = -1;
+}
+
+/* Starts a new snapshot of table <t> : creates the temporary file and writes
+ * the list of stored data types after the room reserved for the header.
+ * Returns 0 on success or -1 on failure. Must be called with the table lock
+ * held.
+ */
+static int stktable_snapshot_start(struct stktable *t)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+	char *cursor;
+	int data_type, nb_types;
+
+	memprintf(&snap->tmpfile, "%s.%d.tmp", snap->file, (int)getpid());
+	if (!snap->tmpfile)
+		return -1;
+
+	snap->fd = open(snap->tmpfile, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (snap->fd < 0)
+		return -1;
+
+	snap->date = stktable_snapshot_date();
+	snap->data = STKTABLE_SNAP_HDR_LEN;
+	if (stktable_snapshot_reserve(snap, (1 + 2 * STKTABLE_DATA_TYPES) * STKTABLE_SNAP_INT_MAXLEN) < 0)
+		return -1;
+
+	for (nb_types = data_type = 0; data_type < STKTABLE_DATA_TYPES; data_type++)
+		if (t->data_ofs[data_type])
+			nb_types++;
+
+	cursor = snap->area + snap->data;
+	intencode(nb_types, &cursor);
+	for (data_type = 0; data_type < STKTABLE_DATA_TYPES; data_type++) {
+		if (!t->data_ofs[data_type])
+			continue;
+		intencode(data_type, &cursor);
+		intencode(stktable_data_types[data_type].std_type, &cursor);
+	}
+	snap->data = cursor - snap->area;
+	return 0;
+}
+
+/* Appends entry <ts> of table <t> to the snapshot being dumped. Returns 0 on
+ * success or -1 on failure. Must be called with the table lock held.
+ */
+static int stktable_snapshot_dump_entry(struct stktable *t, struct stksess *ts)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+	unsigned int data_type;
+	unsigned int expire = 0;
+	void *data_ptr;
+	char *cursor;
+	size_t len;
+	int ret = -1;
+
+	if (t->expire) {
+		if (tick_is_expired(ts->expire, now_ms))
+			return 0;
+		expire = TICKS_TO_MS(tick_remain(now_ms, ts->expire));
+		if (!expire)
+			return 0;
+	}
+
+	HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &ts->lock);
+
+	/* compute the worst case length of the entry */
+	len = 2 * STKTABLE_SNAP_INT_MAXLEN + t->key_size;
+	for (data_type = 0; data_type < STKTABLE_DATA_TYPES; data_type++) {
+		data_ptr = stktable_data_ptr(t, ts, data_type);
+		if (!data_ptr)
+			continue;
+		switch (stktable_data_types[data_type].std_type) {
+		case STD_T_FRQP:
+			len += 3 * STKTABLE_SNAP_INT_MAXLEN;
+			break;
+		case STD_T_DICT: {
+			struct dict_entry *de = stktable_data_cast(data_ptr, std_t_dict);
+
+			len += STKTABLE_SNAP_INT_MAXLEN + (de ? de->len : 0);
+			break;
+		}
+		default:
+			len += STKTABLE_SNAP_INT_MAXLEN;
+			break;
+		}
+	}
+
+	if (stktable_snapshot_reserve(snap, len) < 0)
+		goto out;
+
+	cursor = snap->area + snap->data;
+
+	/* remaining time to live, 0 if the table does not expire */
+	intencode(expire, &cursor);
+
+	/* encode the key */
+	if (t->type == SMP_T_STR) {
+		int stlen = strlen((char *)ts->key.key);
+
+		intencode(stlen, &cursor);
+		memcpy(cursor, ts->key.key, stlen);
+		cursor += stlen;
+	}
+	else if (t->type == SMP_T_SINT) {
+		write_n32(cursor, read_u32(ts->key.key));
+		cursor += sizeof(uint32_t);
+	}
+	else {
+		memcpy(cursor, ts->key.key, t->key_size);
+		cursor += t->key_size;
+	}
+
+	/* encode values */
+	for (data_type = 0; data_type < STKTABLE_DATA_TYPES; data_type++) {
+		data_ptr = stktable_data_ptr(t, ts, data_type);
+		if (!data_ptr)
+			continue;
+
+		switch (stktable_data_types[data_type].std_type) {
+		case STD_T_SINT:
+			intencode(stktable_data_cast(data_ptr, std_t_sint), &cursor);
+			break;
+		case STD_T_UINT:
+			intencode(stktable_data_cast(data_ptr, std_t_uint), &cursor);
+			break;
+		case STD_T_ULL:
+			intencode(stktable_data_cast(data_ptr, std_t_ull), &cursor);
+			break;
+		case STD_T_FRQP: {
+			struct freq_ctr_period *frqp;
+
+			frqp = &stktable_data_cast(data_ptr, std_t_frqp);
+			intencode((unsigned int)(now_ms - frqp->curr_tick), &cursor);
+			intencode(frqp->curr_ctr, &cursor);
+			intencode(frqp->prev_ctr, &cursor);
+			break;
+		}
+		case STD_T_DICT: {
+			struct dict_entry *de;
+
+			de = stktable_data_cast(data_ptr, std_t_dict);
+			if (!de) {
+				intencode(0, &cursor);
+				break;
+			}
+			intencode(de->len, &cursor);
+			memcpy(cursor, de->value.key, de->len);
+			cursor += de->len;
+			break;
+		}
+		}
+	}
+
+	snap->data = cursor - snap->area;
+	snap->entries++;
+	ret = 0;
+ out:
+	HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
+	return ret;
+}
+
+/* Completes the snapshot being dumped for table <t> : the header is written,
+ * the file is synced to disk then atomically renamed to its final name.
+ * Returns 0 on success or -1 on failure, in which case the snapshot is left
+ * for stktable_snapshot_abort() to clean up.
+ */
+static int stktable_snapshot_finish(struct stktable *t)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+	char *hdr = snap->area;
+	size_t len = snap->data - STKTABLE_SNAP_HDR_LEN;
+
+	memcpy(hdr, STKTABLE_SNAP_MAGIC, 8);
+	write_n32(hdr + 8, STKTABLE_SNAP_VERSION);
+	write_n32(hdr + 12, t->type);
+	write_n32(hdr + 16, t->key_size);
+	write_n32(hdr + 20, 0);
+	write_n64(hdr + 24, snap->date);
+	write_n64(hdr + 32, snap->entries);
+	write_n64(hdr + 40, len);
+	write_n64(hdr + 48, XXH64(hdr + STKTABLE_SNAP_HDR_LEN, len, 0));
+
+	if (msync(snap->area, snap->data, MS_SYNC) < 0)
+		return -1;
+	munmap(snap->area, snap->size);
+	snap->area = NULL;
+
+	if (ftruncate(snap->fd, snap->data) < 0 || fsync(snap->fd) < 0)
+		return -1;
+
+	if (rename(snap->tmpfile, snap->file) < 0)
+		return -1;
+
+	free(snap->tmpfile);
+	snap->tmpfile = NULL;
+	close(snap->fd);
+	snap->fd = -1;
+	snap->size = snap->data = 0;
+	snap->entries = 0;
+	return 0;
+}
+
+/* Dumps at most <max> entries of table <t> into its snapshot file, starting a
+ * new snapshot if none is in progress. A reference is held on the next entry
+ * to dump so that the table lock is released between two calls. Returns 1 once
+ * the snapshot is complete, 0 if there are more entries to dump, or -1 on
+ * failure, in which case errno is set and the snapshot is aborted.
+ */
+static int stktable_snapshot_dump(struct stktable *t, int max)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+	struct ebmb_node *node;
+	struct stksess *ts;
+	int err;
+
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+
+	if (snap->fd < 0 && stktable_snapshot_start(t) < 0)
+		goto fail;
+
+	if (snap->cursor) {
+		node = &snap->cursor->key;
+		snap->cursor->ref_cnt--;
+		snap->cursor = NULL;
+	}
+	else
+		node = ebmb_first(&t->keys);
+
+	while (node && max--) {
+		ts = ebmb_entry(node, struct stksess, key);
+		node = ebmb_next(node);
+		if (stktable_snapshot_dump_entry(t, ts) < 0)
+			goto fail;
+	}
+
+	if (node) {
+		/* keep our position for the next call */
+		snap->cursor = ebmb_entry(node, struct stksess, key);
+		snap->cursor->ref_cnt++;
+		HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+		return 0;
+	}
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+
+	if (stktable_snapshot_finish(t) == 0)
+		return 1;
+
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+ fail:
+	err = errno;
+	stktable_snapshot_abort(t);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+	errno = err;
+	return -1;
+}
+
+/*
+ * Task processing function to periodically dump the snapshot of a table. The
+ * dump is performed by batches of entries, the task waking itself up until
+ * the snapshot is complete. The table is protected against purging until a
+ * last snapshot is saved upon soft stop, during which the process is also kept
+ * alive. A pointer to the task itself is returned since it never dies.
+ */
+static struct task *process_table_snapshot(struct task *task, void *context, unsigned short state)
+{
+	struct stktable *t = context;
+	int ret;
+
+	if (!t->snapshot.proc) {
+		/* the last snapshot was already saved */
+		task->expire = TICK_ETERNITY;
+		return task;
+	}
+
+	if (relative_pid != t->snapshot.proc) {
+		/* another process is in charge of this table */
+		t->snapshot.proc = 0;
+		t->syncing--;
+		task->expire = TICK_ETERNITY;
+		return task;
+	}
+
+	if ((state & TASK_WOKEN_SIGNAL) && !t->snapshot.final) {
+		t->snapshot.final = 1;
+		_HA_ATOMIC_ADD(&jobs, 1);
+	}
+
+	ret = stktable_snapshot_dump(t, STKTABLE_SNAP_BATCH);
+	if (ret == 0) {
+		task->expire = TICK_ETERNITY;
+		task_wakeup(task, TASK_WOKEN_OTHER);
+		return task;
+	}
+
+	if (ret < 0) {
+		const char *reason = strerror(errno);
+
+		ha_warning("Stick-table '%s': failed to save snapshot to '%s' (%s).\n",
+			   t->id, t->snapshot.file, reason);
+		send_log(t->proxy, LOG_WARNING, "Stick-table '%s': failed to save snapshot to '%s' (%s).\n",
+			 t->id, t->snapshot.file, reason);
+	}
+
+	if (t->snapshot.final) {
+		/* the table may be purged and the process may die now */
+		t->snapshot.proc = 0;
+		t->syncing--;
+		_HA_ATOMIC_SUB(&jobs, 1);
+		task->expire = TICK_ETERNITY;
+		return task;
+	}
+
+	task->expire = tick_add(now_ms, MS_TO_TICKS(t->snapshot.period));
+	return task;
+}
+
+/* Loads the entries of table <t> from its snapshot file, if any. Entries which
+ * expired since the snapshot was taken are skipped, and the data types which
+ * are not stored in the table anymore are ignored. Returns 0 on success or if
+ * there is no snapshot file, otherwise -1 with an error message in <err>. This
+ * is only meant to be called during startup.
+ */
+static int stktable_snapshot_load(struct stktable *t, char **err)
+{
+	struct stktable_snapshot *snap = &t->snapshot;
+	unsigned int types[STKTABLE_DATA_TYPES], std_types[STKTABLE_DATA_TYPES];
+	unsigned long long entries, loaded, elapsed;
+	uint64_t start_time;
+	unsigned int nb_types, i;
+	struct stksess *ts = NULL;
+	struct buffer *chunk;
+	char *area, *cur, *end;
+	struct stat st;
+	int fd, ret = -1;
+
+	start_time = now_mono_time();
+	fd = open(snap->file, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		memprintf(err, "cannot open '%s' (%s)", snap->file, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < STKTABLE_SNAP_HDR_LEN) {
+		memprintf(err, "'%s' is not a valid snapshot file", snap->file);
+		close(fd);
+		return -1;
+	}
+
+	area = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED) {
+		memprintf(err, "cannot map '%s' (%s)", snap->file, strerror(errno));
+		return -1;
+	}
+	madvise(area, st.st_size, MADV_SEQUENTIAL);
+
+	if (memcmp(area, STKTABLE_SNAP_MAGIC, 8) != 0 ||
+	    read_n32(area + 8) != STKTABLE_SNAP_VERSION) {
+		memprintf(err, "'%s' is not a valid snapshot file", snap->file);
+		goto out;
+	}
+
+	if (read_n32(area + 12) != t->type || read_n32(area + 16) != t->key_size) {
+		memprintf(err, "'%s' was saved with a different key type or size", snap->file);
+		goto out;
+	}
+
+	if (read_n64(area + 40) != st.st_size - STKTABLE_SNAP_HDR_LEN ||
+	    read_n64(area + 48) != XXH64(area + STKTABLE_SNAP_HDR_LEN, st.st_size - STKTABLE_SNAP_HDR_LEN, 0)) {
+		memprintf(err, "'%s' is truncated or corrupted", snap->file);
+		goto out;
+	}
+
+	elapsed = stktable_snapshot_date() - read_n64(area + 24);
+	if ((long long)elapsed < 0)
+		elapsed = 0;
+	entries = read_n64(area + 32);
+
+	cur = area + STKTABLE_SNAP_HDR_LEN;
+	end = area + st.st_size;
+
+	nb_types = intdecode(&cur, end);
+	if (!cur || nb_types > STKTABLE_DATA_TYPES)
+		goto corrupted;
+
+	for (i = 0; i < nb_types; i++) {
+		types[i] = intdecode(&cur, end);
+		std_types[i] = intdecode(&cur, end);
+		if (!cur || types[i] >= STKTABLE_DATA_TYPES || std_types[i] > STD_T_DICT)
+			goto corrupted;
+	}
+
+	chunk = get_trash_chunk();
+	HA_SPIN_LOCK(STK_TABLE_LOCK, &t->lock);
+	for (loaded = 0; entries; entries--) {
+		unsigned long long remain;
+		int skip = 0;
+
+		remain = intdecode(&cur, end);
+		if (!cur)
+			goto corrupted_unlock;
+
+		if (t->expire) {
+			if (remain > t->expire)
+				remain = t->expire;
+			if (remain <= elapsed)
+				skip = 1;
+		}
+
+		ts = __stksess_new(t, NULL);
+		if (!ts)
+			break;
+
+		if (t->type == SMP_T_STR) {
+			unsigned int to_read, to_store;
+
+			to_read = intdecode(&cur, end);
+			if (!cur || cur + to_read > end)
+				goto corrupted_unlock;
+
+			to_store = MIN(to_read, t->key_size - 1);
+			memcpy(ts->key.key, cur, to_store);
+			ts->key.key[to_store] = 0;
+			cur += to_read;
+		}
+		else if (t->type == SMP_T_SINT) {
+			if (cur + sizeof(uint32_t) > end)
+				goto corrupted_unlock;
+
+			write_u32(ts->key.key, read_n32(cur));
+			cur += sizeof(uint32_t);
+		}
+		else {
+			if (cur + t->key_size > end)
+				goto corrupted_unlock;
+
+			memcpy(ts->key.key, cur, t->key_size);
+			cur += t->key_size;
+		}
+
+		for (i = 0; i < nb_types; i++) {
+			void *data_ptr = NULL;
+			uint64_t decoded_int;
+
+			if (stktable_data_types[types[i]].std_type == std_types[i])
+				data_ptr = stktable_data_ptr(t, ts, types[i]);
+
+			decoded_int = intdecode(&cur, end);
+			if (!cur)
+				goto corrupted_unlock;
+
+			switch (std_types[i]) {
+			case STD_T_SINT:
+				if (data_ptr)
+					stktable_data_cast(data_ptr, std_t_sint) = decoded_int;
+				break;
+			case STD_T_UINT:
+				if (data_ptr)
+					stktable_data_cast(data_ptr, std_t_uint) = decoded_int;
+				break;
+			case STD_T_ULL:
+				if (data_ptr)
+					stktable_data_cast(data_ptr, std_t_ull) = decoded_int;
+				break;
+			case STD_T_FRQP: {
+				struct freq_ctr_period data;
+
+				/* counters older than a few periods are void anyway */
+				decoded_int += elapsed;
+				if (decoded_int > (1U << 30))
+					decoded_int = 1U << 30;
+				data.curr_tick = tick_add(now_ms, -(int)decoded_int) & ~0x1;
+				data.curr_ctr = intdecode(&cur, end);
+				data.prev_ctr = intdecode(&cur, end);
+				if (!cur)
+					goto corrupted_unlock;
+				if (data_ptr)
+					stktable_data_cast(data_ptr, std_t_frqp) = data;
+				break;
+			}
+			case STD_T_DICT: {
+				struct dict_entry *de;
+
+				if (!decoded_int)
+					break;
+				if (cur + decoded_int > end)
+					goto corrupted_unlock;
+				if (data_ptr && decoded_int < chunk->size) {
+					chunk_memcpy(chunk, cur, decoded_int);
+					chunk->area[chunk->data] = 0;
+					de = dict_insert(&server_name_dict, chunk->area);
+					if (de)
+						stktable_data_cast(data_ptr, std_t_dict) = de;
+				}
+				cur += decoded_int;
+				break;
+			}
+			}
+		}
+
+		/* the key tree is unique so an existing entry is kept */
+		if (skip || ebmb_insert(&t->keys, &ts->key, t->key_size) != &ts->key) {
+			__stksess_free(t, ts);
+			continue;
+		}
+
+		if (t->expire) {
+			ts->expire = tick_add(now_ms, MS_TO_TICKS(remain - elapsed));
+			t->exp_next = tick_first(ts->expire, t->exp_next);
+		}
+		ts->exp.key = ts->expire;
+		eb32_insert(&t->exps, &ts->exp);
+		loaded++;
+	}
+
+	if (t->expire && loaded) {
+		t->exp_task->expire = t->exp_next;
+		task_queue(t->exp_task);
+	}
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+
+	ha_notice("Stick-table '%s': loaded %llu entries from '%s' in %llu ms.\n",
+		  t->id, loaded, snap->file,
+		  (unsigned long long)(now_mono_time() - start_time) / 1000000);
+	ret = 0;
+ out:
+	munmap(area, st.st_size);
+	return ret;
+
+ corrupted_unlock:
+	__stksess_free(t, ts);
+	HA_SPIN_UNLOCK(STK_TABLE_LOCK, &t->lock);
+ corrupted:
+	memprintf(err, "'%s' is corrupted", snap->file);
+	goto out;
+}
+
+/* Loads the snapshots of all stick-tables configured with one, and starts their
+ * periodic snapshot task. Errors while loading a snapshot only cause a warning
+ * so that a corrupted file cannot prevent the process from starting.
+ */
+static int stktable_snapshot_init()
+{
+	struct stktable *t;
+	struct proxy *px;
+	unsigned long mask;
+	char *err = NULL;
+
+	for (t = stktables_list; t; t = t->next) {
+		if (!t->snapshot.file || !t->pool)
+			continue;
+
+		/* the first process the table is bound to saves its snapshots */
+		mask = t->proxy ? t->proxy->bind_proc : 0;
+		for (px = t->proxies_list; px; px = px->next_stkt_ref)
+			mask |= px->bind_proc;
+		if (t->peers.p && t->peers.p->peers_fe)
+			mask |= t->peers.p->peers_fe->bind_proc;
+		t->snapshot.proc = mask ? my_ffsl(mask) : 1;
+
+		if (stktable_snapshot_load(t, &err) < 0) {
+			ha_warning("Stick-table '%s': ignoring snapshot: %s.\n", t->id, err);
+			free(err);
+			err = NULL;
+		}
+
+		t->snapshot.task = task_new(MAX_THREADS_MASK);
+		if (!t->snapshot.task) {
+			ha_alert("Stick-table '%s': out of memory while allocating snapshot task.\n", t->id);
+			return ERR_ALERT | ERR_FATAL;
+		}
+		t->snapshot.task->process = process_table_snapshot;
+		t->snapshot.task->context = t;
+		t->snapshot.task->expire = tick_add(now_ms, MS_TO_TICKS(t->snapshot.period));
+		task_queue(t->snapshot.task);
+		signal_register_task(0, t->snapshot.task, 0);
+
+		/* released once the last snapshot is saved */
+		t->syncing++;
+	}
+	return ERR_NONE;
+}
+
+/* Saves a last snapshot of the tables on exit if this was not completed during
+ * the soft stop. All threads are stopped by now so the dump is
+ * performed in one pass. This must run before deinit() releases the proxies
+ * and pools the entries rely on.
+ */
+static void stktable_snapshot_deinit()
+{
+	struct stktable *t;
+
+	if (master)
+		return;
+
+	for (t = stktables_list; t; t = t->next) {
+		if (!t->snapshot.task || relative_pid != t->snapshot.proc)
+			continue;
+
+		if (stktable_snapshot_dump(t, INT_MAX) < 0)
+			ha_warning("Stick-table '%s': failed to save snapshot to '%s' (%s).\n",
+				   t->id, t->snapshot.file, strerror(errno));
+	}
+}
+
+REGISTER_POST_CHECK(stktable_snapshot_init);
+REGISTER_PRE_DEINIT(stktable_snapshot_deinit);
+
 /*
  * Configuration keywords of known table types
  */
@@ -728,6 +1597,7 @@ int parse_stick_table(const char *file, int linenum, char **args,
 	t->id =  id;
 	t->nid =  nid;
 	t->type = (unsigned int)-1;
+	t->snapshot.fd = -1;
 	t->conf.file = file;
 	t->conf.line = linenum;
 
@@ -795,6 +1665,81 @@ int parse_stick_table(const char *file, int linenum, char **args,
 			t->nopurge = 1;
 			idx++;
 		}
+		else if (strcmp(args[idx], "snapshot") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			free(t->snapshot.file);
+			t->snapshot.file = strdup(args[idx++]);
+		}
+		else if (strcmp(args[idx], "snapshot-period") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			err = parse_time_err(args[idx], &val, TIME_UNIT_MS);
+			if (err == PARSE_TIME_OVER) {
+				ha_alert("parsing [%s:%d]: %s: timer overflow in argument <%s> to <%s>, maximum value is 2147483647 ms (~24.8 days).\n",
+					 file, linenum, args[0], args[idx], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (err == PARSE_TIME_UNDER) {
+				ha_alert("parsing [%s:%d]: %s: timer underflow in argument <%s> to <%s>, minimum non-null value is 1 ms.\n",
+					 file, linenum, args[0], args[idx], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			else if (err || !val) {
+				ha_alert("parsing [%s:%d] : %s: invalid argument '%s' to '%s', expects a non-null delay.\n",
+					 file, linenum, args[0], args[idx], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			t->snapshot.period = val;
+			idx++;
+		}
+		else if (strcmp(args[idx], "sketch") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			if ((err = parse_size_err(args[idx], &t->sketch.width))) {
+				ha_alert("parsing [%s:%d] : %s: unexpected character '%c' in argument of '%s'.\n",
+					 file, linenum, args[0], *err, args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			idx++;
+		}
+		else if (strcmp(args[idx], "sketch-depth") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			val = atoi(args[idx]);
+			if (val < 1 || val > 16) {
+				ha_alert("parsing [%s:%d] : %s: '%s' expects an integer between 1 and 16 (got '%s').\n",
+					 file, linenum, args[0], args[idx-1], args[idx]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			t->sketch.depth = val;
+			idx++;
+		}
 		else if (strcmp(args[idx], "type") == 0) {
 			idx++;
 			if (stktable_parse_type(args, &idx, &t->type, &t->key_size) != 0) {
@@ -894,6 +1839,26 @@ int parse_stick_table(const char *file, int linenum, char **args,
 		goto out;
 	}
 
+	if (t->snapshot.file && !t->snapshot.period)
+		t->snapshot.period = 60000;
+
+	if (t->sketch.width) {
+		if (peers || t->peers.name || t->snapshot.file) {
+			ha_alert("parsing [%s:%d] : %s: 'sketch' is not compatible with '%s'.\n",
+				 file, linenum, args[0], t->snapshot.file ? "snapshot" : "peers");
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (t->data_ofs[STKTABLE_DT_SERVER_ID] || t->data_ofs[STKTABLE_DT_SERVER_NAME]) {
+			ha_alert("parsing [%s:%d] : %s: 'sketch' cannot be used with stored server information.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (!t->sketch.depth)
+			t->sketch.depth = 4;
+	}
+
  out:
 	return err_code;
 }
@@ -3332,6 +4297,10 @@ static int table_dump_head_to_buffer(struct buffer *msg,
 		     t->id, stktable_types[t->type].kw, t->size, t->current);
 
 	/* any other information should be dumped here */
+	if (t->sketch.cells)
+		chunk_appendf(msg, "# sketch: width:%u, depth:%u, bytes:%llu\n",
+			      t->sketch.width, t->sketch.depth,
+			      (unsigned long long)t->sketch.depth * t->sketch.width * t->sketch.stride);
 
 	if (target && (strm_li(s)->bind_conf->level & ACCESS_LVL_MASK) < ACCESS_LVL_OPER)
 		chunk_appendf(msg, "# contents not dumped due to insufficient privileges\n");
@@ -2452,8 +2452,17 @@ void stream_update_time_stats(struct stream *s)
 	if (s->be->mode != PR_MODE_HTTP)
 		t_data = t_connect;
 
-	if (t_connect < 0 || t_data < 0)
+	srv = objt_server(s->target);
+
+	if (t_connect < 0 || t_data < 0) {
+		/* the server did not respond, all the time spent waiting for
+		 * it still counts as its response time for the "ewma" algo.
+		 */
+		if (srv && (s->be->lbprm.algo & BE_LB_ALGO) == BE_LB_ALGO_EWMA &&
+		    t_queue >= 0 && t_close > t_queue)
+			lb_ewma_update(srv, t_close - t_queue);
 		return;
+	}
 
 	if (tv_isge(&s->logs.tv_request, &s->logs.tv_accept))
 		t_request = tv_ms_elapsed(&s->logs.tv_accept, &s->logs.tv_request);
@@ -2462,8 +2471,9 @@ void stream_update_time_stats(struct stream *s)
 	t_connect -= t_queue;
 	t_queue   -= t_request;
 
-	srv = objt_server(s->target);
 	if (srv) {
+		if ((s->be->lbprm.algo & BE_LB_ALGO) == BE_LB_ALGO_EWMA)
+			lb_ewma_update(srv, t_connect + t_data);
 		samples_window = (((s->be->mode == PR_MODE_HTTP) ?
 			srv->counters.p.http.cum_req : srv->counters.cum_lbconn) > TIME_STATS_SAMPLES) ? TIME_STATS_SAMPLES : 0;
 		swrate_add_dynamic(&srv->counters.q_time, samples_window, t_queue);
@@ -0,0 +1,388 @@
+/*
+ * HTTP/1 request parsing benchmark. It first checks that all the scanners
+ * supported by the CPU accept and reject the same bytes in request URIs, header
+ * names and header values. Then it parses a corpus of requests with
+ * h1_headers_to_hdr_list() using each of these scanners, checks that they all
+ * produce the same header lists, and reports the parsing rate for each of
+ * them. The corpus defaults to a few requests captured from common browsers
+ * and clients. Another one may be passed in a file, requests being separated
+ * by an empty line. With -l, header names are turned to lower case as is done
+ * for HTTP/2 and HTTP/3, the request then being copied before each parsing.
+ *
+ *   usage: h1-parse-bench [-l] [-n loops] [file]
+ *
+ * Build like this :
+ *    gcc -Iinclude -Iebtree -O2 -g -fno-strict-aliasing -fwrapv \
+ *        -o h1-parse-bench tests/h1-parse-bench.c src/h1.c src/http.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <common/h1.h>
+#include <common/http-hdr.h>
+#include <common/standard.h>
+
+#define MAX_HDR_NUM 101
+#define MAX_REQS    1000
+
+static const char *default_reqs[] = {
+	/* desktop browser navigation */
+	"GET /en-US/docs/Web/HTTP/Headers/Accept-Encoding"
+	"?utm_source=newsletter&utm_medium=email HTTP/1.1\r\n"
+	"Host: developer.example.org\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"sec-ch-ua: \"Chromium\";v=\"92\", \" Not A;Brand\";v=\"99\", \"Google "
+	"Chrome\";v=\"92\"\r\n"
+	"sec-ch-ua-mobile: ?0\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) "
+	"AppleWebKit/537.36 (KHTML, like Gecko) Chrome/92.0.4515.131 "
+	"Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+	"image/avif,image/webp,image/apng,*/*;q=0.8,"
+	"application/signed-exchange;v=b3;q=0.9\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"Sec-Fetch-Mode: navigate\r\n"
+	"Sec-Fetch-User: ?1\r\n"
+	"Sec-Fetch-Dest: document\r\n"
+	"Referer: https://developer.example.org/en-US/docs/Web/HTTP/Headers\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9,fr;q=0.8\r\n"
+	"Cookie: _ga=GA1.2.1234567890.1600000000; "
+	"_gid=GA1.2.987654321.1620000000; "
+	"session=eyJ1c2VyIjoiam9obiIsImV4cCI6MTYyMDAwMDAwMH0.c2lnbmF0dXJl; "
+	"lang=en-US\r\n"
+	"\r\n",
+
+	/* static resource */
+	"GET /static/js/vendor.3f9a2c1b.chunk.js HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:90.0) Gecko/20100101 "
+	"Firefox/90.0\r\n"
+	"Accept: */*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: https://www.example.com/\r\n"
+	"Connection: keep-alive\r\n"
+	"If-Modified-Since: Tue, 10 Aug 2021 14:12:31 GMT\r\n"
+	"If-None-Match: \"60128a4f-3e4b1\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n",
+
+	/* API call */
+	"POST /api/v2/orders/12345/items?expand=product HTTP/1.1\r\n"
+	"Host: api.example.com\r\n"
+	"Content-Type: application/json; charset=utf-8\r\n"
+	"Content-Length: 83\r\n"
+	"Authorization: Bearer "
+	"eyJhbGciOiJIUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiIxMjM0NTY3ODkwIn0.dozjg"
+	"NryP4J3jVmNHl0w5N_XgL0n3I9PlFUP0THsR8U\r\n"
+	"X-Request-Id: 4bf92f35-77b3-4da6-a3ce-929d0e0e4736\r\n"
+	"X-Forwarded-For: 203.0.113.195, 70.41.3.18\r\n"
+	"Accept: application/json\r\n"
+	"User-Agent: okhttp/4.9.1\r\n"
+	"\r\n",
+
+	/* command line client */
+	"GET /health HTTP/1.1\r\n"
+	"Host: 10.0.0.12:8080\r\n"
+	"User-Agent: curl/7.74.0\r\n"
+	"Accept: */*\r\n"
+	"\r\n",
+
+	/* crawler */
+	"GET /products/category/shoes?page=3&sort=price_asc HTTP/1.1\r\n"
+	"Host: shop.example.net\r\n"
+	"User-Agent: Mozilla/5.0 (compatible; Googlebot/2.1; "
+	"+http://www.google.com/bot.html)\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;"
+	"q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"From: googlebot(at)googlebot.com\r\n"
+	"Connection: close\r\n"
+	"\r\n",
+};
+
+static struct {
+	char *area;
+	int len;
+} reqs[MAX_REQS];
+
+static int nbreqs;
+static char *work[2];
+
+/* normally provided by standard.c */
+unsigned int strl2ui(const char *s, int len)
+{
+	unsigned int i = 0;
+
+	while (len-- > 0 && *s >= '0' && *s <= '9')
+		i = i * 10 + *s++ - '0';
+	return i;
+}
+
+/* adds request <str> of <len> bytes to the corpus, turning bare LFs to CRLF */
+static void add_req(const char *str, int len)
+{
+	char *area;
+	int i, j;
+
+	if (nbreqs >= MAX_REQS || !len)
+		return;
+
+	area = malloc(2 * len + 4);
+	if (!area)
+		exit(1);
+
+	for (i = j = 0; i < len; i++) {
+		if (str[i] == '\n' && (!i || str[i - 1] != '\r'))
+			area[j++] = '\r';
+		area[j++] = str[i];
+	}
+	j += sprintf(area + j, "\r\n");
+	reqs[nbreqs].area = area;
+	reqs[nbreqs].len = j;
+	nbreqs++;
+}
+
+/* loads the requests from file <name>, separated by an empty line */
+static void load_reqs(const char *name)
+{
+	char line[65536], *blk = NULL;
+	int len = 0;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f) {
+		perror(name);
+		exit(1);
+	}
+
+	blk = malloc(1048576);
+	if (!blk)
+		exit(1);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (*line == '\n' || (*line == '\r' && line[1] == '\n')) {
+			add_req(blk, len);
+			len = 0;
+			continue;
+		}
+		if (len + strlen(line) < 1048576) {
+			memcpy(blk + len, line, strlen(line));
+			len += strlen(line);
+		}
+	}
+	add_req(blk, len);
+	free(blk);
+	fclose(f);
+}
+
+/* parses request <r> into <hdr>, using work area <w> when names are turned
+ * to lower case. Returns the number of headers or <0.
+ */
+static int parse_req(int r, struct http_hdr *hdr, int lower, int w)
+{
+	struct h1m h1m;
+	char *area = reqs[r].area;
+	int ret;
+
+	if (lower) {
+		memcpy(work[w], reqs[r].area, reqs[r].len);
+		area = work[w];
+	}
+
+	h1m_init_req(&h1m);
+	if (lower)
+		h1m.flags |= H1_MF_TOLOWER;
+	ret = h1_headers_to_hdr_list(area, area + reqs[r].len, hdr, MAX_HDR_NUM,
+	                             &h1m, NULL);
+	if (ret <= 0)
+		return -1;
+
+	for (ret = 0; hdr[ret].n.len; ret++)
+		;
+	return ret;
+}
+
+/* parses the <len> bytes of <buf> using the scanners of <level>, turning
+ * invalid characters to errors unless <accept> is set. Returns the result of
+ * h1_headers_to_hdr_list(), with <h1m> and <hdr> filled.
+ */
+static int parse_raw(const char *buf, int len, int level, int accept,
+                     struct h1m *h1m, struct http_hdr *hdr)
+{
+	memcpy(work[0], buf, len);
+	h1_set_simd_level(level);
+	h1m_init_req(h1m);
+	if (accept)
+		h1m->err_pos = -1;
+	return h1_headers_to_hdr_list(work[0], work[0] + len, hdr, MAX_HDR_NUM,
+	                              h1m, NULL);
+}
+
+/* Checks that all the levels up to <best> accept and reject exactly the same
+ * bytes as the portable scanners, with and without accept-invalid-http-request.
+ * All pairs of bytes are placed in the URI at all offsets of a 4-byte word,
+ * once in the first vector and once across the 32-byte boundary, since the
+ * portable scanner checks 4 bytes at once. Each byte alone is also placed at
+ * all offsets of a header name and of a header value. Returns the number of
+ * requests parsed differently.
+ */
+static int check_bytes(int best)
+{
+	static const int uri_ofs[] = { 0, 1, 2, 3, 29, 30, 31, 32 };
+	struct http_hdr ref[MAX_HDR_NUM], hdr[MAX_HDR_NUM];
+	struct h1m ref_m, m;
+	char req[256];
+	int type, ofs, nbofs, b1, b2, accept, level, len, ref_ret, ret, i;
+	int errors = 0;
+
+	for (type = 0; type < 3; type++) {
+		nbofs = type ? 40 : sizeof(uri_ofs) / sizeof(uri_ofs[0]);
+		for (ofs = 0; ofs < nbofs; ofs++) {
+			for (b1 = 0; b1 < 256; b1++) {
+				for (b2 = 0; b2 < (type ? 1 : 256); b2++) {
+					char elem[48];
+
+					memset(elem, type == 1 ? 'n' : 'v', 40);
+					elem[40] = 0;
+					if (type) {
+						elem[ofs] = b1;
+					} else {
+						elem[uri_ofs[ofs]] = b1;
+						elem[uri_ofs[ofs] + 1] = b2;
+					}
+
+					if (type == 0)
+						len = sprintf(req, "GET /%.40s HTTP/1.1\r\nh: v\r\n\r\n", elem);
+					else if (type == 1)
+						len = sprintf(req, "GET / HTTP/1.1\r\n%.40s: v\r\n\r\n", elem);
+					else
+						len = sprintf(req, "GET / HTTP/1.1\r\nh: %.40s\r\n\r\n", elem);
+					/* sprintf() stops at NUL bytes */
+					if (!b1 || (!type && !b2))
+						continue;
+
+					for (accept = 0; accept < 2; accept++) {
+						ref_ret = parse_raw(req, len, H1_SIMD_NONE, accept, &ref_m, ref);
+						for (level = H1_SIMD_NONE + 1; level <= best; level++) {
+							ret = parse_raw(req, len, level, accept, &m, hdr);
+							if (ret != ref_ret || m.err_pos != ref_m.err_pos ||
+							    m.err_state != ref_m.err_state)
+								goto bad;
+							for (i = 0; ret > 0 && ref[i].n.len; i++) {
+								if (!isteq(ref[i].n, hdr[i].n) || !isteq(ref[i].v, hdr[i].v))
+									goto bad;
+							}
+							continue;
+						bad:
+							if (errors++ < 10)
+								fprintf(stderr, "%s: %s with bytes 0x%02x 0x%02x at %d "
+								        "parsed differently\n",
+									h1_simd_name(level), type == 0 ? "URI" : type == 1 ? "name" : "value",
+									b1, b2, type ? ofs : uri_ofs[ofs]);
+						}
+					}
+				}
+			}
+		}
+	}
+	return errors;
+}
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	struct http_hdr ref[MAX_HDR_NUM], hdr[MAX_HDR_NUM];
+	unsigned long long start, ns, bytes = 0, base_ns = 0;
+	int loops = 200000, lower = 0;
+	int level, best, opt, r, i, n;
+
+	while ((opt = getopt(argc, argv, "ln:")) != -1) {
+		switch (opt) {
+		case 'l': lower = 1; break;
+		case 'n': loops = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-l] [-n loops] [file]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind < argc)
+		load_reqs(argv[optind]);
+	else
+		for (r = 0; r < sizeof(default_reqs) / sizeof(default_reqs[0]); r++)
+			add_req(default_reqs[r], strlen(default_reqs[r]) - 2);
+
+	work[0] = malloc(2 * 1048576);
+	work[1] = malloc(2 * 1048576);
+	if (!nbreqs || !work[0] || !work[1]) {
+		fprintf(stderr, "no request to parse\n");
+		exit(1);
+	}
+
+	/* reference header counts using the portable parser */
+	h1_set_simd_level(H1_SIMD_NONE);
+	for (r = 0; r < nbreqs; r++) {
+		if (parse_req(r, hdr, lower, 0) < 0) {
+			fprintf(stderr, "request %d is invalid\n", r);
+			exit(1);
+		}
+		bytes += reqs[r].len;
+	}
+
+	best = h1_set_simd_level(H1_SIMD_AVX2);
+	n = check_bytes(best);
+	printf("byte check up to %s: %d mismatches\n", h1_simd_name(best), n);
+	if (n)
+		return 1;
+
+	printf("%d requests, %.1f bytes/req, %s header names\n",
+	       nbreqs, (double)bytes / nbreqs, lower ? "lower-cased" : "unmodified");
+
+	for (level = H1_SIMD_NONE; level <= best; level++) {
+		/* all levels must produce the same headers */
+		for (r = 0; r < nbreqs; r++) {
+			h1_set_simd_level(H1_SIMD_NONE);
+			n = parse_req(r, ref, lower, 0);
+			h1_set_simd_level(level);
+			if (parse_req(r, hdr, lower, 1) != n)
+				goto mismatch;
+			for (i = 0; i < n; i++) {
+				if (!isteq(ref[i].n, hdr[i].n) || !isteq(ref[i].v, hdr[i].v))
+					goto mismatch;
+			}
+		}
+
+		start = now_ns();
+		for (i = 0; i < loops; i++)
+			for (r = 0; r < nbreqs; r++)
+				parse_req(r, hdr, lower, 0);
+		ns = now_ns() - start;
+		if (level == H1_SIMD_NONE)
+			base_ns = ns;
+
+		printf("%-5s: %8.1f ns/req, %10.0f req/s, %6.2f GB/s, x%.2f\n",
+		       h1_simd_name(level), (double)ns / loops / nbreqs,
+		       1e9 * loops * nbreqs / ns, (double)bytes * loops / ns,
+		       (double)base_ns / ns);
+	}
+	return 0;
+
+ mismatch:
+	fprintf(stderr, "%s: request %d parsed differently\n", h1_simd_name(level), r);
+	return 1;
+}
@@ -0,0 +1,188 @@
+/*
+ * Regset check and benchmark. It loads the regular expressions of <patterns>
+ * (one per line) as "-m reg" does, compiles them into a regset, then matches
+ * the subjects of <subjects> (one per line) or random subjects against them,
+ * both with the regset and with the regex library one expression at a time.
+ * Any subject for which both don't report the same first matching expression
+ * is reported, then the time spent by each method.
+ *
+ *   usage: regset-test [-i] [-l loops] [-r random subjects] <patterns> [<subjects>]
+ *
+ * Build like this (without PCRE, as HAProxy's default build does):
+ *    gcc -Iinclude -Iebtree -O2 -g -fno-strict-aliasing -fwrapv \
+ *        -o regset-test tests/regset-test.c src/regset.c
+ */
+
+#include <regex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <common/regset.h>
+#include <common/standard.h>
+
+/* the few symbols src/regset.c needs from the rest of HAProxy */
+void hap_register_per_thread_free(void (*fct)()) { }
+
+char *memprintf(char **out, const char *format, ...)
+{
+	va_list args;
+
+	free(*out);
+	*out = malloc(256);
+	va_start(args, format);
+	vsnprintf(*out, 256, format, args);
+	va_end(args);
+	return *out;
+}
+
+static char **load_lines(const char *file, int *nb)
+{
+	char line[4096], **lines = NULL;
+	FILE *f = fopen(file, "r");
+	int len;
+
+	if (!f) {
+		perror(file);
+		exit(1);
+	}
+	*nb = 0;
+	while (fgets(line, sizeof(line), f)) {
+		len = strlen(line);
+		if (len && line[len - 1] == '\n')
+			line[--len] = 0;
+		lines = realloc(lines, (*nb + 1) * sizeof(*lines));
+		lines[(*nb)++] = strdup(line);
+	}
+	fclose(f);
+	return lines;
+}
+
+static double now_s()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static const char alphabet[] = "aAbB/.-_0123456789xyz\n ";
+	int icase = 0, loops = 1, nb_random = 100000;
+	char **pats, **subjects;
+	int nb_pats, nb_subjects, nb_regs, l, i, j, opt;
+	unsigned int id, *ids;
+	regex_t *regs;
+	int *in_set, *fallback, nb_fallback = 0;
+	struct regset *set;
+	char *err = NULL;
+	double t0, t_lib, t_set;
+	long errors = 0, matches = 0;
+
+	while ((opt = getopt(argc, argv, "il:r:")) != -1) {
+		switch (opt) {
+		case 'i': icase = 1; break;
+		case 'l': loops = atoi(optarg); break;
+		case 'r': nb_random = atoi(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-i] [-l loops] [-r random subjects] <patterns> [<subjects>]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-i] [-l loops] [-r random subjects] <patterns> [<subjects>]\n", argv[0]);
+		exit(1);
+	}
+
+	pats = load_lines(argv[optind], &nb_pats);
+	if (optind + 1 < argc)
+		subjects = load_lines(argv[optind + 1], &nb_subjects);
+	else {
+		srandom(1);
+		nb_subjects = nb_random;
+		subjects = calloc(nb_subjects, sizeof(*subjects));
+		for (i = 0; i < nb_subjects; i++) {
+			int len = random() % 24;
+
+			subjects[i] = calloc(1, len + 1);
+			for (j = 0; j < len; j++)
+				subjects[i][j] = alphabet[random() % (sizeof(alphabet) - 1)];
+		}
+	}
+
+	/* invalid expressions are skipped as HAProxy would refuse them */
+	regs = calloc(nb_pats, sizeof(*regs));
+	in_set = calloc(nb_pats, sizeof(*in_set));
+	ids = calloc(nb_pats, sizeof(*ids));
+	fallback = calloc(nb_pats, sizeof(*fallback));
+	set = regset_new(icase);
+	t0 = now_s();
+	for (i = nb_regs = 0; i < nb_pats; i++) {
+		if (regcomp(&regs[nb_regs], pats[i], REG_EXTENDED | REG_NOSUB | (icase ? REG_ICASE : 0)) != 0)
+			continue;
+		in_set[nb_regs] = regset_add(set, pats[i], nb_regs);
+		if (!in_set[nb_regs])
+			fallback[nb_fallback++] = nb_regs;
+		ids[nb_regs] = i;
+		nb_regs++;
+	}
+	if (!regset_compile(set, &err)) {
+		fprintf(stderr, "regset_compile: %s\n", err);
+		exit(1);
+	}
+	printf("expressions: %d, in set: %u, nfa states: %u, byte classes: %u, build: %.3f ms\n",
+	       nb_regs, set->nb_patterns, set->nb_nstates, set->nb_classes, (now_s() - t0) * 1000);
+
+	/* check */
+	for (i = 0; i < nb_subjects; i++) {
+		int expected = -1, found;
+
+		for (j = 0; j < nb_regs; j++) {
+			if (in_set[j] && regexec(&regs[j], subjects[i], 0, NULL, 0) == 0) {
+				expected = j;
+				break;
+			}
+		}
+		found = regset_exec(set, subjects[i], strlen(subjects[i]), &id) > 0 ? (int)id : -1;
+		matches += expected >= 0;
+		if (found != expected) {
+			if (errors++ < 20)
+				printf("MISMATCH subject '%s': library=%d (%s) regset=%d (%s)\n", subjects[i],
+				       expected, expected >= 0 ? pats[ids[expected]] : "-",
+				       found, found >= 0 ? pats[ids[found]] : "-");
+		}
+	}
+	printf("subjects: %d, matching: %ld, mismatches: %ld\n", nb_subjects, matches, errors);
+
+	/* benchmark: first matching expression as pat_match_reg() does */
+	t0 = now_s();
+	for (l = 0; l < loops; l++)
+		for (i = 0; i < nb_subjects; i++)
+			for (j = 0; j < nb_regs; j++)
+				if (regexec(&regs[j], subjects[i], 0, NULL, 0) == 0)
+					break;
+	t_lib = now_s() - t0;
+
+	t0 = now_s();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < nb_subjects; i++) {
+			int found = regset_exec(set, subjects[i], strlen(subjects[i]), &id) > 0;
+
+			for (j = 0; j < nb_fallback && (!found || fallback[j] < id); j++)
+				if (regexec(&regs[fallback[j]], subjects[i], 0, NULL, 0) == 0)
+					break;
+		}
+	}
+	t_set = now_s() - t0;
+
+	printf("library: %.3f us/subject, regset: %.3f us/subject (x%.1f), dfa states: %u (%lu kB), nfa runs: %llu\n",
+	       t_lib * 1e6 / loops / nb_subjects, t_set * 1e6 / loops / nb_subjects, t_lib / t_set,
+	       set->nb_dstates, (unsigned long)(set->dfa_mem >> 10), set->nfa_execs);
+
+	regset_free(set);
+	return errors != 0;
+}
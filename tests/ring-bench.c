@@ -0,0 +1,305 @@
+/*
+ * Ring buffer write benchmark. It starts 1 to <threads> threads writing
+ * messages of <size> bytes to a shared ring of <ring> bytes using ring_write()
+ * as the traces and the ring sinks do, and reports the number of messages
+ * written per second for each thread count, as well as the number of messages
+ * which could not be written. The ring contents are then checked for
+ * corruption and messages out of order for each thread.
+ *
+ * Before this, writers are forced to complete out of order, whatever the
+ * number of CPUs: a first writer is stalled in the middle of its copy by a
+ * page fault on its message, while a second one reserves, copies and returns.
+ * Once the first one resumes, both messages must be published, and old ones
+ * must still be evicted to write new ones.
+ *
+ *   usage: ring-bench [-t threads] [-n msgs per thread] [-s size] [-r ring]
+ *
+ * Build like this :
+ *    gcc -Iinclude -Iebtree -O2 -g -fno-strict-aliasing -fwrapv -DUSE_THREAD \
+ *        -o ring-bench tests/ring-bench.c src/ring.c -lpthread
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <common/buf.h>
+#include <common/chunk.h>
+#include <common/hathreads.h>
+#include <common/standard.h>
+#include <types/global.h>
+#include <proto/ring.h>
+
+#define MAX_WRITERS 64
+
+/* normally provided by haproxy.c, task.c, channel.c and standard.c, and
+ * only needed for the readers.
+ */
+struct global global;
+struct eb_root rqueue;
+THREAD_LOCAL struct task_per_thread *sched;
+THREAD_LOCAL unsigned long tid_bit;
+THREAD_LOCAL struct buffer trash;
+
+void __task_wakeup(struct task *t, struct eb_root *root)
+{
+}
+
+int ci_putblk(struct channel *chn, const char *blk, int len)
+{
+	return -1;
+}
+
+int varint_bytes(uint64_t v)
+{
+	return __varint_bytes(v);
+}
+
+static struct ring *ring;
+static volatile int go;
+static int nbthread, nbmsg, msglen;
+static unsigned int dropped;
+
+static void *writer(void *arg)
+{
+	char line[1024];
+	struct ist msg = ist2(line, msglen);
+	int thr = (long)arg;
+	int i;
+
+	memset(line, '.', sizeof(line));
+	while (!go)
+		ha_thread_relax();
+
+	for (i = 0; i < nbmsg; i++) {
+		snprintf(line, sizeof(line), "%02d %09d", thr, i);
+		line[12] = '.';
+		if (ring_write(ring, ~0, NULL, 0, &msg, 1) <= 0)
+			HA_ATOMIC_ADD(&dropped, 1);
+	}
+	return NULL;
+}
+
+/* checks that all messages are intact and in order for each thread. Returns
+ * the number of messages found, or -1 on error.
+ */
+static int check_ring()
+{
+	struct buffer *buf = &ring->buf;
+	int last[MAX_WRITERS];
+	char line[1024];
+	uint64_t msg_len;
+	size_t ofs, len;
+	int thr, seq, i, n = 0;
+
+	for (i = 0; i < MAX_WRITERS; i++)
+		last[i] = -1;
+
+	if (ring->committed != ring->reserved || ring->committed != ring->ofs + b_data(buf))
+		return -1;
+
+	ofs = 0;
+	while (ofs + 1 < b_data(buf)) {
+		if (*b_peek(buf, ofs))
+			return -1;
+		len = b_peek_varint(buf, ofs + 1, &msg_len);
+		if (!len || msg_len != msglen)
+			return -1;
+		b_getblk(buf, line, msg_len, ofs + 1 + len);
+		line[msg_len] = 0;
+		if (sscanf(line, "%d %d", &thr, &seq) != 2 ||
+		    thr < 0 || thr >= MAX_WRITERS || seq <= last[thr])
+			return -1;
+		for (i = 13; i < msg_len; i++)
+			if (line[i] != '.')
+				return -1;
+		last[thr] = seq;
+		ofs += 1 + len + msg_len;
+		n++;
+	}
+	return n;
+}
+
+/* page holding the end of the stalled writer's message */
+static char *stall_page;
+static volatile int stalled, resume;
+
+/* SIGSEGV handler for the stalled writer: waits for the main thread to let
+ * it resume, then makes the page readable so that the copy can complete.
+ */
+static void stall_handler(int sig)
+{
+	stalled = 1;
+	while (!resume)
+		ha_thread_relax();
+	mprotect(stall_page, 4096, PROT_READ | PROT_WRITE);
+}
+
+/* writes the message of sequence <seq> from thread <thr>, with its end taken
+ * from <end> which may be protected.
+ */
+static ssize_t write_msg(int thr, int seq, const char *end)
+{
+	char line[16];
+	struct ist msg[2];
+
+	snprintf(line, sizeof(line), "%02d %09d.", thr, seq);
+	msg[0] = ist2(line, 13);
+	msg[1] = ist2(end, msglen - 13);
+	return ring_write(ring, ~0, NULL, 0, msg, 2);
+}
+
+static void *stalled_writer(void *arg)
+{
+	write_msg(0, (long)arg, stall_page);
+	return NULL;
+}
+
+/* Forces two writers to complete out of order in a ring of <ringsize> bytes
+ * which already holds a few messages, and checks that both messages are
+ * published, then that they can be evicted. Returns 0 on success, otherwise
+ * -1 with an error message.
+ */
+static int check_out_of_order(size_t ringsize)
+{
+	char dots[1024];
+	pthread_t thread;
+	int i, seq;
+
+	memset(dots, '.', sizeof(dots));
+	ring = ring_new(ringsize);
+	if (!ring)
+		return -1;
+
+	for (seq = 0; seq < 3; seq++)
+		write_msg(1, seq, dots);
+
+	/* the first writer reserves its message and faults while copying it */
+	memset(stall_page, '.', 4096);
+	mprotect(stall_page, 4096, PROT_NONE);
+	stalled = resume = 0;
+	pthread_create(&thread, NULL, stalled_writer, (void *)(long)seq);
+	while (!stalled)
+		ha_thread_relax();
+
+	/* the second one reserves after it and completes first */
+	if (write_msg(1, seq, dots) <= 0) {
+		fprintf(stderr, "ring of %lu bytes: cannot write while another writer is stalled\n",
+			(unsigned long)ringsize);
+		return -1;
+	}
+
+	resume = 1;
+	pthread_join(thread, NULL);
+	if (ring->committed != ring->reserved || ring->committed != ring->ofs + b_data(&ring->buf)) {
+		fprintf(stderr, "ring of %lu bytes: %lu bytes left unpublished after out of order completion\n",
+			(unsigned long)ringsize, (unsigned long)(ring->ofs + b_data(&ring->buf) - ring->committed));
+		return -1;
+	}
+
+	/* all messages must be evicted in turn. A writer waiting forever for
+	 * an unpublished message would be killed by the alarm.
+	 */
+	alarm(3);
+	for (i = 0; i < 2 * ringsize / msglen + 2; i++) {
+		if (write_msg(1, ++seq, dots) <= 0) {
+			fprintf(stderr, "ring of %lu bytes: cannot evict old messages\n", (unsigned long)ringsize);
+			return -1;
+		}
+	}
+	alarm(0);
+
+	if (check_ring() < 0) {
+		fprintf(stderr, "ring of %lu bytes: ring is corrupted after out of order completion\n",
+			(unsigned long)ringsize);
+		return -1;
+	}
+	ring_free(ring);
+	return 0;
+}
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[MAX_WRITERS];
+	unsigned long long start, ns;
+	size_t ringsize = 1048576;
+	int maxthr = 4, opt, thr, n;
+
+	nbmsg = 1000000;
+	msglen = 100;
+	while ((opt = getopt(argc, argv, "t:n:s:r:")) != -1) {
+		switch (opt) {
+		case 't': maxthr = atoi(optarg); break;
+		case 'n': nbmsg = atoi(optarg); break;
+		case 's': msglen = atoi(optarg); break;
+		case 'r': ringsize = atol(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-n msgs per thread] [-s size] [-r ring]\n", argv[0]);
+			exit(1);
+		}
+	}
+
+	if (maxthr < 1 || maxthr > MAX_WRITERS || msglen < 14 || msglen >= 1024) {
+		fprintf(stderr, "threads must be 1..%d and size 14..1023\n", MAX_WRITERS);
+		exit(1);
+	}
+
+	/* the stalled message must end up at all offsets of the ring */
+	stall_page = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (stall_page == MAP_FAILED) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	signal(SIGSEGV, stall_handler);
+	for (n = 4 * msglen; n < 6 * msglen; n++) {
+		if (check_out_of_order(n) < 0)
+			return 1;
+	}
+	signal(SIGSEGV, SIG_DFL);
+	printf("out of order completion: OK\n");
+
+	printf("%d msgs of %d bytes per thread, ring of %lu bytes\n",
+	       nbmsg, msglen, (unsigned long)ringsize);
+
+	for (nbthread = 1; nbthread <= maxthr; nbthread++) {
+		ring = ring_new(ringsize);
+		if (!ring) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		go = dropped = 0;
+		for (thr = 0; thr < nbthread; thr++)
+			pthread_create(&threads[thr], NULL, writer, (void *)(long)thr);
+
+		start = now_ns();
+		go = 1;
+		for (thr = 0; thr < nbthread; thr++)
+			pthread_join(threads[thr], NULL);
+		ns = now_ns() - start;
+
+		n = check_ring();
+		if (n < 0) {
+			fprintf(stderr, "%d threads: ring is corrupted\n", nbthread);
+			return 1;
+		}
+
+		printf("%2d threads: %10.0f msgs/s, %10.0f msgs/s/thread, %u dropped, %d msgs in ring\n",
+		       nbthread, 1e9 * nbmsg * nbthread / ns, 1e9 * nbmsg / ns, dropped, n);
+		ring_free(ring);
+	}
+	return 0;
+}